@@ -1,7 +1,7 @@
 // Copyright 2015 Scott Swift - This program is distributed under the
 // terms of the GNU General Public License.
 
-#define DTS_VERSION "2.55"
+#define DTS_VERSION "2.56"
 
 // File:     Colorize.cpp
 // Author:   Scott Swift, dxzl@live.com
@@ -15,6 +15,7 @@
 // Date:     July 27, 2015 (Added the M_PLAY "WM_PlayCoLoRiZe" message 2.54)
 // Date:     Aug 1, 2015 (TCL_DoOneEvent() was locking up Windows Explorer
 //             plus added new search paths for Xirc.DLL 2.55)
+// Date:     Oct 19, 2026 (Threaded play, DTSP images and more, see below 2.56)
 // bad logic syntax:
 //    if (!pDTS_Color->bUseDDE && GlobalString[ii] == '"'
 //                                || GlobalString[ii] == '\x5c')
@@ -80,6 +81,33 @@
 // equivalent file-path after calling GetShortPathNameW() on a Unicode
 // file-path.
 //
+// Oct 19, 2026 - 2.56:
+//   Reader and formatter threads get lines ready ahead of the timer
+//   Follow-mode, play a file while it's written (DTS_play ... follow)
+//   Pre-formatted "DTSP" play-files (DTS_convert, tools\dtsconvert)
+//   UTF-8 play-files, text and file-paths (ColorCodePage())
+//   Stage-timing trace ring (DTS_trace)
+//   Errors go in a ring, not a MessageBox (DTS_errors, ColorGetError())
+//   Shared-memory play-buffer (ColorAllocBuffer(), ColorStartBuffer())
+//   Play-list with prefetch of the next file (DTS_play append)
+//   Cache of pre-formatted play-files (DTS_cache)
+//   Images built on all processors (Image.cpp, tools\imagebench)
+//   Record and replay sent commands (DTS_record, tools\dtsreplay)
+//   Only hInst set up when the DLL loads, the rest on first use
+//   Shared memory set up once, named per instance (DTS_INSTANCE)
+//   Play straight to an IRC server (DTS_irc, tools\ircstub)
+//   Progress and credits for YahCoLoRiZe (ColorProgress(), ColorCredits())
+//   A session per client, XiRCON and DDE play at once
+//   Pace sends by server lag (DTS_lag, Pace.cpp, tools\pacetest)
+//   Latency numbers for the one-line FIFO (DTS_ipc, tools\ipcbench)
+//   Settings you can change while it runs (DTS_config)
+//   Estimate a play before starting it (DTS_plan)
+//   gzip compressed play-files (Inflate.cpp, tools\inflatetest)
+//   Strip color codes for +c channels (DTS_strip)
+//   Play to a list of channels at once ("#one,#two")
+//   Play handles, callbacks and state events (DTS_state)
+//   Render a line in one pass (Render.cpp, tools\renderbench)
+//
 // Enjoy!
 // Mr. Swift
 
@@ -105,14 +133,31 @@
 //    __DebuggerHookData             @13  ; __DebuggerHookData
 
 #include <windows.h>
+#include <winsock.h>
 #include <condefs.h>
 #include <string.h>
 #include <stdio.h>
 #include "Colorize.h"
+#include "Render.h"
+#include "Fifo.h"
+#include "Pace.h"
+#include "Image.h"
+#include "Inflate.h"
 #pragma hdrstop
 
 USERES("Colorize.res");
 USEFILE("Colorize.h");
+USEUNIT("Render.cpp");
+USEFILE("Render.h");
+USEUNIT("Fifo.cpp");
+USEFILE("Fifo.h");
+USEUNIT("Pace.cpp");
+USEFILE("Pace.h");
+USEUNIT("Image.cpp");
+USEFILE("Image.h");
+USEUNIT("Inflate.cpp");
+USEFILE("Inflate.h");
+USEFILE("Portable.h");
 //---------------------------------------------------------------------------
 #pragma argsused
 
@@ -129,8 +174,87 @@ FARPROC lpDdeProc;  // procedure instance address
 bool bEndOfFile = false;
 bool bDataReady = false;
 bool bPaused = false;
+bool bFollowing = false;
 char* GlobalString = NULL;
 
+// Shared-memory play-buffer, the one we made (producer) and the one
+// we're playing (consumer)
+HANDLE hAllocBufMap = NULL;
+LPVOID lpAllocBuf = NULL;
+HANDLE hPlayBufMap = NULL;
+char* lpPlayBuf = NULL;
+
+// Play-list file the reader has opened ahead of time
+DTS_Source NextSource;
+LONG lPrefetched = 0; // PlayListOut+1 of the one we tried to open
+
+// Cache entry for the text play-file that's playing
+ULONGLONG CacheKey = 0;
+DWORD dwCacheSize = 0;
+bool bCacheStore = false; // missed, reader thread should add it
+
+// Compressed play-file being inflated into the heap buffer
+DTS_Inflate* pInflate = NULL;
+LONGLONG llInflateBytes = 0; // for ColorInflateRate()
+LONGLONG llInflateTicks = 0;
+
+// Mapped pre-formatted play-file
+HANDLE hImageMap = NULL;
+char* lpImage = NULL;
+DWORD dwImageSize = 0;
+DWORD dwImageLine = 0;
+
+// Play-file pipeline (reader thread -> formatter thread -> timer)
+DTS_Queue ReadQueue;
+DTS_Queue SendQueue;
+HANDLE hReaderThread = NULL;
+HANDLE hFormatThread = NULL;
+DWORD dwReaderThreadID = 0;
+DWORD dwFormatThreadID = 0;
+volatile bool bAbortPlay = false;
+bool bDetaching = false;
+DWORD dwStalls = 0; // timer ticks that found no formatted line waiting
+
+// Playback number and lines through each stage (for the trace)
+DWORD dwSession = 0;
+DWORD dwReadLine = 0;
+DWORD dwFormatLine = 0;
+DWORD dwSendLine = 0;
+DWORD dwSendTick = 0; // commands taken (each of a line's targets is one)
+
+// Targets the session's channel list is split into (see PlaySession())
+char Targets[MAXTARGETS][TARGETSIZ];
+int TargetCount = 0;
+
+// Direct IRC server connection
+SOCKET IrcSocket = INVALID_SOCKET;
+HANDLE hIrcThread = NULL;
+CRITICAL_SECTION IrcLock;
+volatile LONG IrcState = IRC_OFF;
+char IrcServer[128];
+int IrcPort = 0;
+char IrcNick[IRCNICKSIZ];
+char IrcJoined[128];
+bool bIrcDirect = false; // this play goes out over IrcSocket
+
+// Recording of sent commands
+HANDLE hRecordFile = NULL;
+LONGLONG llRecordFreq = 0;
+LONGLONG llPlayStart = 0; // when the first line went out
+DWORD dwRecorded = 0;
+
+#ifdef DTS_TRACE
+DTS_TraceEvent TraceRing[TRACESIZE];
+volatile LONG lTraceCount = 0;
+#endif
+
+// Error ring and how far each reader has got
+DTS_Error ErrorRing[ERRORSIZE];
+volatile LONG lErrorCount = 0;
+LONG lErrorEcho = 0;   // DTS_poll
+LONG lErrorExport = 0; // ColorGetError()
+LONG lErrorCleared = 0; // DTS_errors clear (the count never goes back)
+
 // Globals for DDE
 DWORD idInst = 0;
 DWORD dwResult;
@@ -142,6 +266,43 @@ HCONV hcnv;
 // Structure for shared memory space
 DTS_Color *pDTS_Color = NULL;
 
+// The session our player (the timer and pipeline threads) is playing
+DTS_Session* pPlay = NULL;
+int PlaySink = SINK_TCL;
+
+// The session and play this process last started (the other process
+// starts its own so it can't go in the shared memory)
+int StartSink = SINK_TCL;
+LONG lStartHandle = 0;
+
+// Settings - DTS_Color.Config[] is in this order
+const DTS_ConfigItem ConfigItems[CFG_COUNT] = {
+  {"playtime",      CFG_INT,  1500,                   1, 600000},
+  {"minplaytime",   CFG_INT,  100,                    0, 600000},
+  {"onelinedelay",  CFG_INT,  100,                    0, 60000},
+  {"ddetimeout",    CFG_INT,  5000,                   100, 600000},
+  {"credittimeout", CFG_INT,  CREDITTIMEOUT,          0, 600000},
+  {"primetimeout",  CFG_INT,  PRIMETIMEOUT,           0, 600000},
+  {"fifolines",     CFG_INT,  FIFOSIZE-1,             1, FIFOSIZE-1},
+  {"readqueue",     CFG_INT,  READQUEUESIZE,          2, 1024},
+  {"sendqueue",     CFG_INT,  SENDQUEUESIZE,          2, SENDQUEUESIZE},
+  {"prefetch",      CFG_BOOL, 1,                      0, 1},
+  {"prefetchkb",    CFG_INT,  PREFETCHBUDGET/1024,    0, 1024*1024},
+  {"cache",         CFG_BOOL, 1,                      0, 1},
+  {"cachekb",       CFG_INT,  CACHEBUDGET/1024,       0, 1024*1024},
+  {"workers",       CFG_INT,  MAXWORKERS,             1, MAXWORKERS},
+  {"chunkkb",       CFG_INT,  CHUNKMIN/1024,          1, 64*1024},
+  {"lagtarget",     CFG_INT,  LAGTARGET,              0, 600000},
+  {"pacemin",       CFG_INT,  PACEMIN,                1, 600000},
+  {"pacemax",       CFG_INT,  PACEMAX,                1, 600000},
+  {"pacestep",      CFG_INT,  PACESTEP,               0, 60000},
+  {"pacebackoff",   CFG_INT,  PACEBACKOFF,            8, 64},
+};
+
+// Pacing (see PaceTimer())
+int PaceTime = 0;  // our timer's interval (ms)
+LONG lLagSeen = 0; // LagSamples when we last looked
+
 // XiRC Tcl hooks
 dyn_CreateCommand Tcl_CreateCommand = NULL;
 dyn_AppendResult Tcl_AppendResult = NULL;
@@ -150,30 +311,162 @@ dyn_DoOneEvent Tcl_DoOneEvent = NULL;
 
 // pointer to shared memory
 LPVOID lpvMem = NULL;
+HANDLE hCreditEvent = NULL; // CREDIT_EVENT
+HANDLE hStateEvent[SINKS]; // STATE_EVENT for each session
+
+// DTS_play's callback scripts and how much of its play we've told them
+// about (see NotifyTcl())
+char* pOnProgress = NULL;
+char* pOnDone = NULL;
+char* pOnError = NULL;
+int NotifySink = SINK_TCL;
+LONG lNotifyHandle = 0;
+LONG lNotifySent = 0;
+LONG lNotifyState = PLAY_IDLE;
+LONG lPlayErrors = 0; // lErrorCount when our play started
+
+const char* StateNames[PLAY_STATES] = {
+  "idle", "running", "paused", "ended", "stopped", "error"};
+char InstanceName[INSTANCESIZ] = ""; // "" or ".name" (see SharedName())
+bool bInstanceSet = false; // by ColorInstance()
 
 // handle to file mapping
 HANDLE hMapObject = NULL;
 
 // Function prototypes
-bool IsPirch(void);
-bool IsVortec(void);
-bool IsPirchVortec(void);
 bool DTS_WriteLineToFile(char * FileNameBuf, char *tString);
-void ErrorHandler(LPTSTR Info, LPTSTR Extra = NULL);
+void ErrorHandler(int Code, LPTSTR Info, LPTSTR Extra = NULL);
+int ReadError(LONG* plNext, char* pBuf, int BufSize);
+void EchoErrors(Tcl_Interp* interp);
 
 int CmdPlay(void *cd, Tcl_Interp *interp, int argc, char *argv[]);
 int CmdPoll(void *cd, Tcl_Interp *interp, int argc, char *argv[]);
 int CmdVersion(void *cd, Tcl_Interp *interp, int argc, char *argv[]);
 int CmdEx(void *cd, Tcl_Interp *interp, int argc, char *argv[]);
 int CmdChan(void *cd, Tcl_Interp *interp, int argc, char *argv[]);
+int CmdQueue(void *cd, Tcl_Interp *interp, int argc, char *argv[]);
+int CmdConvert(void *cd, Tcl_Interp *interp, int argc, char *argv[]);
+int CmdTrace(void *cd, Tcl_Interp *interp, int argc, char *argv[]);
+int CmdErrors(void *cd, Tcl_Interp *interp, int argc, char *argv[]);
+int CmdCache(void *cd, Tcl_Interp *interp, int argc, char *argv[]);
+int CmdRecord(void *cd, Tcl_Interp *interp, int argc, char *argv[]);
+int CmdReplay(void *cd, Tcl_Interp *interp, int argc, char *argv[]);
+int CmdInstance(void *cd, Tcl_Interp *interp, int argc, char *argv[]);
+int CmdIrc(void *cd, Tcl_Interp *interp, int argc, char *argv[]);
+int CmdProgress(void *cd, Tcl_Interp *interp, int argc, char *argv[]);
+int CmdLag(void *cd, Tcl_Interp *interp, int argc, char *argv[]);
+int CmdIpc(void *cd, Tcl_Interp *interp, int argc, char *argv[]);
+int CmdConfig(void *cd, Tcl_Interp *interp, int argc, char *argv[]);
+int CmdPlan(void *cd, Tcl_Interp *interp, int argc, char *argv[]);
+int CmdStrip(void *cd, Tcl_Interp *interp, int argc, char *argv[]);
+int CmdState(void *cd, Tcl_Interp *interp, int argc, char *argv[]);
 void Sendtcl(Tcl_Interp *interp, char *tempstr);
-int StartLocalFilePlay(Tcl_Interp *interp);
+int StartLocalFilePlay(Tcl_Interp *interp, int Sink);
+void PlaySession(int Sink);
+bool StopSession(int Sink);
+bool PauseSession(int Sink);
+bool ResumeSession(int Sink);
+bool LoadPlayFile(char* pFilename, bool bPrefetch);
+bool LoadPlayBuffer(void);
+void UnmapPlayBuffer(void);
+bool EnqueuePlayFile(DTS_Session* pSess, char* pFilename);
+char* PeekPlayList(LONG* plOut);
+void GetPlaySource(DTS_Source* pSrc);
+void SetPlaySource(DTS_Source* pSrc);
+void FreePlaySource(void);
+void PrefetchPlayFile(void);
+bool NextPlayFile(void);
+void FreePrefetch(void);
+ULONGLONG HashPlayFile(char* lpText, DWORD dwSize);
+bool CachePath(char* pPath, char* pName);
+bool CacheOpen(char* lpText, DWORD dwSize);
+void CacheStore(void);
+int PlayFileCompression(HANDLE hPlayFile);
+bool InflatePlayBuffer(void);
+void CacheTrim(DWORD dwBudget);
+bool IrcConnect(LPTSTR Server, int Port, LPTSTR Nick);
+void IrcDisconnect(void);
+bool IrcSend(char* pLine);
+void IrcJoin(char* pChannel);
+void SendIrc(char* tempstr);
+void IrcLine(char* pLine);
+DWORD WINAPI IrcThread(LPVOID lpParam);
+bool RecordStart(LPTSTR Filename);
+void RecordStop(void);
+void RecordCommand(int Sink, char* pCmd);
+UINT RecordText(char* pCmd, char* pText);
+bool ReplayRecording(Tcl_Interp* interp, LPTSTR Filename, bool bRealTime,
+                                                          char* pResult);
 void SendToColorize(char* pRegWndMsg, char *pData);
+bool InitShared(void);
+void SharedName(char* pBuf, char* pBase);
+bool WaitForCredit(void);
+void FreeCredit(void);
+LONG CountSourceLines(void);
+void PaceTimer(void);
+void SetPlayState(DTS_Session* pSess, LONG State);
+void PauseState(DTS_Session* pSess, bool bPause);
+DTS_Session* FindPlay(LONG Handle);
+void SetCallbacks(char* pProgress, char* pDone, char* pError, int Every);
+bool HasCallbacks(void);
+void NotifyTcl(Tcl_Interp* interp);
+void RunCallback(Tcl_Interp* interp, char* pScript, char* pArgs);
+void ConfigReset(void);
+int ConfigFind(char* pName);
+bool ConfigSet(int Item, int Value);
+bool ConfigParse(int Item, char* pText, int* pValue);
+bool InitTcl(void);
+bool InitBuffers(void);
 
 void Senddde(char *tempstr);
 void QueueNextLineForTransmit(void);
-bool PrintString(int Time);
-char * stolower(char * p);
+bool PrintString(Tcl_Interp* interp, int Sink, int Time);
+char* RenderString(char* pStr, bool bImage, char* pBuf, int Dialect,
+                                                             bool bStrip);
+int SplitTargets(char* pList, char pTargets[][TARGETSIZ]);
+bool ReadNextLine(char* pStr);
+bool FrameString(char* pStr, char* tString, int Time, char* pTarget,
+                               char* pTempFile, int Dialect, bool bStrip);
+UINT TranscodeString(char* pStr, UINT length);
+HANDLE OpenPlayFile(char* pFilename, DWORD dwShare);
+
+#ifdef DTS_TRACE
+void TraceEvent(int Stage, char Phase, DWORD Line);
+#endif
+int TraceCount(void);
+void TraceClear(void);
+bool TraceDump(LPTSTR Filename);
+
+bool IsPlayImage(HANDLE hPlayFile);
+bool MapPlayImage(HANDLE hPlayFile, DWORD dwSize);
+void UnmapPlayImage(void);
+bool ReadImageLine(char* pStr);
+bool ConvertPlayFile(LPTSTR InFile, LPTSTR OutFile);
+bool PlanFile(LPTSTR Channel, LPTSTR Filename, int Time, int Dialect,
+                                                          char* pResult);
+bool PlanImage(char* lpImg, DWORD dwSize, DTS_Chunk* pChunk);
+DWORD WINAPI ChunkPlanThread(LPVOID lpParam);
+DWORD PlanOverhead(int Dialect, char* pChannel, int Time);
+DWORD PlanFlood(DTS_Chunk* pChunks, int Count, DWORD dwOverhead,
+                                                           DWORD dwTime);
+bool FillPlayBuffer(void);
+bool StartColor(LPTSTR Service, LPTSTR Channel, LPTSTR Filename,
+              int PlayTime, bool bUseFile, bool bFollow, bool bBuffer);
+bool StartPipeline(void);
+bool StopPipeline(void);
+bool IsPipelineThread(void);
+DWORD WINAPI ReaderThread(LPVOID lpParam);
+DWORD WINAPI FormatThread(LPVOID lpParam);
+
+bool QueueCreate(DTS_Queue* pQ, int Slots, int SlotSize);
+void QueueDestroy(DTS_Queue* pQ);
+int QueueDepth(DTS_Queue* pQ);
+char* QueueWriteSlot(DTS_Queue* pQ);
+void QueuePublish(DTS_Queue* pQ);
+char* QueueReadSlot(DTS_Queue* pQ, DWORD Timeout);
+void QueueRelease(DTS_Queue* pQ);
+void QueueClose(DTS_Queue* pQ);
+bool QueueDrained(DTS_Queue* pQ);
 void StopPlay(void);
 
 // Callbacks
@@ -186,17 +479,55 @@ HDDEDATA CALLBACK DdeCallback(UINT type, UINT fmt, HCONV hconv,
 extern "C" __declspec(dllexport) int Colorize_Init(Tcl_Interp *interp);
 extern "C" __declspec(dllexport) bool ColorStart(LPTSTR Service,
               LPTSTR Channel, LPTSTR Filename, int PlayTime, bool bUseFile);
-extern "C" __declspec(dllexport) bool ColorPause(void);
-extern "C" __declspec(dllexport) bool ColorResume(void);
-extern "C" __declspec(dllexport) bool ColorStop(void);
+extern "C" __declspec(dllexport) bool ColorPause(int Sink);
+extern "C" __declspec(dllexport) bool ColorResume(int Sink);
+extern "C" __declspec(dllexport) bool ColorStop(int Sink);
 extern "C" __declspec(dllexport) LPTSTR Colorize_Version(void);
+extern "C" __declspec(dllexport) int ColorQueueDepth(int Stage);
+extern "C" __declspec(dllexport) bool ColorStartFollow(LPTSTR Service,
+              LPTSTR Channel, LPTSTR Filename, int PlayTime);
+extern "C" __declspec(dllexport) bool ColorFollowEnd(void);
+extern "C" __declspec(dllexport) bool ColorConvert(LPTSTR InFile,
+                                                   LPTSTR OutFile);
+extern "C" __declspec(dllexport) bool ColorCodePage(UINT CodePage);
+extern "C" __declspec(dllexport) bool ColorTraceDump(LPTSTR Filename);
+extern "C" __declspec(dllexport) int ColorGetError(LPTSTR Buf, int BufSize);
+extern "C" __declspec(dllexport) LPTSTR ColorAllocBuffer(DWORD Size);
+extern "C" __declspec(dllexport) bool ColorFreeBuffer(void);
+extern "C" __declspec(dllexport) bool ColorStartBuffer(LPTSTR Service,
+              LPTSTR Channel, DWORD Length, int PlayTime);
+extern "C" __declspec(dllexport) bool ColorEnqueue(LONG Handle,
+                                                   LPTSTR Filename);
+extern "C" __declspec(dllexport) LONG ColorCacheStat(int Which);
+extern "C" __declspec(dllexport) LONG ColorInflateRate(void);
+extern "C" __declspec(dllexport) bool ColorRecord(LPTSTR Filename);
+extern "C" __declspec(dllexport) bool ColorInstance(LPTSTR Name);
+extern "C" __declspec(dllexport) bool ColorConnect(LPTSTR Server, int Port,
+                                                            LPTSTR Nick);
+extern "C" __declspec(dllexport) bool ColorDisconnect(void);
+extern "C" __declspec(dllexport) int ColorIrcState(void);
+extern "C" __declspec(dllexport) LONG ColorProgress(LONG Handle, int Which);
+extern "C" __declspec(dllexport) int ColorCredits(LONG Handle, int Which);
+extern "C" __declspec(dllexport) bool ColorLag(int Lag);
+extern "C" __declspec(dllexport) bool ColorPacing(int Target, int MinTime,
+                                                           int MaxTime);
+extern "C" __declspec(dllexport) LONG ColorIpcStat(int Which, int Percent);
+extern "C" __declspec(dllexport) bool ColorConfigGet(LPTSTR Name,
+                                                           int* pValue);
+extern "C" __declspec(dllexport) bool ColorConfigSet(LPTSTR Name, int Value);
+extern "C" __declspec(dllexport) bool ColorPlan(LPTSTR Channel,
+        LPTSTR Filename, int PlayTime, int Dialect, LPTSTR Buf, int BufSize);
+extern "C" __declspec(dllexport) int ColorStrip(int Sink, int Mode);
+extern "C" __declspec(dllexport) LONG ColorHandle(void);
+extern "C" __declspec(dllexport) int ColorState(LONG Handle);
+extern "C" __declspec(dllexport) int ColorWaitState(LONG Handle,
+                                                         DWORD Timeout);
+extern "C" __declspec(dllexport) bool ColorNotify(LONG Handle, int Lines);
+extern "C" __declspec(dllexport) bool ColorShutdown(void);
 
 extern BOOL WINAPI DllEntryPoint(HINSTANCE hinstDLL,
                     DWORD fdwReason, LPVOID lpvReserved);
 
-#define NULLCHAR '\0'
-#define DEFTITLE "Error:"
-
 /*********************************************************************/
 /*********************************************************************/
 /*                         Windows Functions                         */
@@ -219,95 +550,11 @@ BOOL WINAPI DllEntryPoint(HINSTANCE hinstDLL,  // DLL module handle
             // and when Xircon loads the script
       			hInst = hinstDLL;
 
-            // Look for Tcl DLL in three places...
-            // This is hard-coded - but to get the folder from the system is
-            // a pain... and may cause security level problems in Vista and up.
-            // You would need to use SHGetSpecialFolder(CSIDL_PROGRAM_FILESX86)
-            // #define CSIDL_PROGRAM_FILES 0x0026
-            // #define CSIDL_PROGRAM_FILESX86 0x002a
-     			  hXircTcl = LoadLibrary(XTCLPATH1);
-            if (hXircTcl <= (HMODULE)HINSTANCE_ERROR)
-         			hXircTcl = LoadLibrary(XTCLPATH2);
-            if (hXircTcl <= (HMODULE)HINSTANCE_ERROR)
-         			hXircTcl = LoadLibrary(XTCLPATH3);
-
-            if (hXircTcl > (HMODULE)HINSTANCE_ERROR)
-            {
-      				Tcl_CreateCommand = (dyn_CreateCommand)GetProcAddress(hXircTcl,
-                                                       "_Tcl_CreateCommand");
-
-      				Tcl_AppendResult = (dyn_AppendResult)GetProcAddress(hXircTcl,
-                                                     "_Tcl_AppendResult");
-
-      				Tcl_Eval = (dyn_Eval)GetProcAddress(hXircTcl,
-                                                       "_Tcl_Eval");
-      				Tcl_DoOneEvent = (dyn_DoOneEvent)GetProcAddress(hXircTcl,
-                                                       "_Tcl_DoOneEvent");
-              if (Tcl_CreateCommand == NULL ||
-                  Tcl_AppendResult == NULL ||
-                  Tcl_Eval == NULL ||
-                  Tcl_DoOneEvent == NULL)
-              {
-                ErrorHandler("Could not find all of the library"
-                                                "functions in XiRCON");
-                return(false);
-              }
-            }
-            // else
-            // DO NOT PUT ERROR MESSAGE HERE, ONLY XIRCON
-            // NEEDS the tcl part of this DLL!!!!!!!!!!!!
-
-            // Create a named file mapping object.
-            hMapObject = CreateFileMapping(
-                (HANDLE) 0xFFFFFFFF, // use paging file
-                NULL,                // no security attributes
-                PAGE_READWRITE,      // read/write access
-
-                0,                   // size: high 32-bits
-                sizeof(DTS_Color),   // size: low 32-bits
-                "dllmemfilemap");    // name of map object
-
-            if (hMapObject == INVALID_HANDLE_VALUE)
-            {
-              ErrorHandler("Error creating shared memory");
-              return FALSE;
-            }
-
-            // Get a pointer to the file-mapped shared memory.
-            lpvMem = MapViewOfFile(
-
-                hMapObject,     // object to map view of
-                FILE_MAP_WRITE, // read/write access
-                0,              // high offset:  map from
-                0,              // low offset:   beginning
-                0);             // default: map entire file
-
-            if (lpvMem == NULL)
-            {
-              ErrorHandler("Error getting pointer to shared memory");
-              return FALSE;
-            }
-
-            pDTS_Color = (DTS_Color*)lpvMem;
-            pDTS_Color->Filename[0] = NULLCHAR;
-            pDTS_Color->Channel[0] = NULLCHAR;
-            pDTS_Color->Service[0] = NULLCHAR;
-            pDTS_Color->PlayTime = 0; // PlayTime < 0 means "one-line" mode
-            pDTS_Color->FiFoIn = 0;
-            pDTS_Color->FiFoOut = 0;
-            pDTS_Color->bStart = pDTS_Color->bStop = false;
-            pDTS_Color->bPause = pDTS_Color->bResume = false;
-            pDTS_Color->bUseDDE = false;
-            pDTS_Color->bUseFile = false;
-
-            /* allocate memory for DDE/TCL Command string */
-            if ((GlobalString = (char*)malloc(GLOBALSTRINGSIZ)) == NULL)
-            {
-              ErrorHandler("Error allocating command buffer");
-              return FALSE;
-            }
-
-
+            // Everything else waits till it's needed (see InitShared(),
+            // InitTcl() and InitBuffers()) - we're holding the loader-lock
+            // and YahCoLoRiZe never needs the Tcl half at all. Our play
+            // threads don't need to call us on attach/detach either.
+            (void)DisableThreadLibraryCalls(hinstDLL);
             break;
 
         // The attached process creates a new thread.
@@ -323,19 +570,31 @@ BOOL WINAPI DllEntryPoint(HINSTANCE hinstDLL,  // DLL module handle
         // for either program.
         case DLL_PROCESS_DETACH:
 
-            // for mIRC, stop immediately, for XiRCON, queue a stop command
-            ColorStop();
-
-            if (pDTS_Color->bUseDDE)
+            // Never used? nothing to clean up but a play-buffer we made
+            if (pDTS_Color != NULL)
             {
-              DdeFreeStringHandle(idInst, hszService);
-              DdeFreeStringHandle(idInst, hszTopic);
-              DdeFreeStringHandle(idInst, hszItem);
-              DdeUninitialize(idInst);
-            }
+              // for mIRC, stop immediately, for XiRCON, queue a stop command
+              // (without waiting on our threads, see ColorShutdown())
+              bDetaching = true;
+              if (pPlay != NULL)
+                (void)StopSession(PlaySink);
+
+              if (idInst != 0) // we talked to mIRC, etc.
+              {
+                DdeFreeStringHandle(idInst, hszService);
+                DdeFreeStringHandle(idInst, hszTopic);
+                DdeFreeStringHandle(idInst, hszItem);
+                DdeUninitialize(idInst);
+                idInst = 0;
+              }
 
-            // Unmap shared memory from the process's address space.
-            (void)UnmapViewOfFile(lpvMem);
+              InterlockedDecrement(&pDTS_Color->Attached);
+
+              // Unmap shared memory from the process's address space.
+              (void)UnmapViewOfFile(lpvMem);
+              lpvMem = NULL;
+              pDTS_Color = NULL;
+            }
 
             // Close the process's handle to the file-mapping object.
             if (hMapObject)
@@ -351,6 +610,32 @@ BOOL WINAPI DllEntryPoint(HINSTANCE hinstDLL,  // DLL module handle
               hXircTcl = NULL;
             }
 
+            // Finished with any play-buffer we made
+            (void)ColorFreeBuffer();
+
+            // Finished with any recording
+            RecordStop();
+
+            // Finished with our IRC server
+            IrcDisconnect();
+
+            if (hCreditEvent != NULL)
+            {
+              CloseHandle(hCreditEvent);
+              hCreditEvent = NULL;
+            }
+
+            for (int ii = 0; ii < SINKS; ii++)
+            {
+              if (hStateEvent[ii] != NULL)
+              {
+                CloseHandle(hStateEvent[ii]);
+                hStateEvent[ii] = NULL;
+              }
+            }
+
+            SetCallbacks(NULL, NULL, NULL, -1);
+
             // Finished with DDE string buffer
             if (GlobalString != NULL)
             {
@@ -368,6 +653,320 @@ BOOL WINAPI DllEntryPoint(HINSTANCE hinstDLL,  // DLL module handle
     return TRUE;
 }
 /*********************************************************************/
+bool InitShared(void)
+// Purpose: Create (or open) and map the shared memory the first time
+//          anything needs it - every export calls this in place of
+//          checking pDTS_Color. Whoever creates it sets it up.
+// Globals Used: hMapObject, lpvMem, pDTS_Color, InstanceName
+{
+  char Name[64];
+  HANDLE hLock;
+
+  if (pDTS_Color != NULL)
+    return true;
+
+  // Name our instance from the environment if ColorInstance() didn't
+  if (!bInstanceSet)
+  {
+    char Env[INSTANCESIZ-1];
+    DWORD dwLen = GetEnvironmentVariable(INSTANCE_ENV, Env, sizeof(Env));
+
+    if (dwLen > 0 && dwLen < sizeof(Env))
+      sprintf(InstanceName, ".%s", Env);
+  }
+
+  // Hold the lock so no one sees it half set up
+  SharedName(Name, SHARED_LOCK);
+
+  if ((hLock = CreateMutex(NULL, FALSE, Name)) == NULL)
+  {
+    ErrorHandler(ERR_SHARED, "Error creating shared memory lock");
+    return false;
+  }
+
+  (void)WaitForSingleObject(hLock, INFINITE);
+
+  // Create a named file mapping object.
+  SharedName(Name, SHARED_NAME);
+
+  hMapObject = CreateFileMapping(
+      (HANDLE) 0xFFFFFFFF, // use paging file
+      NULL,                // no security attributes
+      PAGE_READWRITE,      // read/write access
+
+      0,                   // size: high 32-bits
+      sizeof(DTS_Color),   // size: low 32-bits
+      Name);               // name of map object
+
+  bool bFirst = GetLastError() != ERROR_ALREADY_EXISTS;
+
+  if (hMapObject == NULL)
+  {
+    ReleaseMutex(hLock);
+    CloseHandle(hLock);
+    ErrorHandler(ERR_SHARED, "Error creating shared memory");
+    return false;
+  }
+
+  // Get a pointer to the file-mapped shared memory.
+  lpvMem = MapViewOfFile(
+
+      hMapObject,     // object to map view of
+      FILE_MAP_WRITE, // read/write access
+      0,              // high offset:  map from
+      0,              // low offset:   beginning
+      0);             // default: map entire file
+
+  DTS_Color* pShared = (DTS_Color*)lpvMem;
+
+  if (pShared == NULL)
+    ErrorHandler(ERR_SHARED, "Error getting pointer to shared memory");
+  else if (bFirst)
+  {
+    memset(pShared, 0, sizeof(DTS_Color));
+
+    for (int ii = 0; ii < CFG_COUNT; ii++)
+      pShared->Config[ii] = ConfigItems[ii].Default;
+    pShared->CodePage = CP_ACP;
+    pShared->Layout = SHARED_LAYOUT;
+    pShared->Size = sizeof(DTS_Color);
+    memcpy(pShared->Magic, SHARED_MAGIC, sizeof(pShared->Magic));
+  }
+  else if (memcmp(pShared->Magic, SHARED_MAGIC, sizeof(pShared->Magic)) ||
+        pShared->Layout != SHARED_LAYOUT ||
+        pShared->Size != sizeof(DTS_Color))
+  {
+    // Another version of this DLL has it, we can't share
+    ErrorHandler(ERR_SHARED, "Shared memory is from another version!",
+                                                                   Name);
+    (void)UnmapViewOfFile(lpvMem);
+    pShared = NULL;
+  }
+
+  if (pShared != NULL)
+  {
+    InterlockedIncrement(&pShared->Attached);
+
+    // Auto-reset, the consumer sets it when it frees FIFO slots
+    SharedName(Name, CREDIT_EVENT);
+    hCreditEvent = CreateEvent(NULL, FALSE, FALSE, Name);
+
+    // Auto-reset too, whoever plays a session sets its event
+    for (int ii = 0; ii < SINKS; ii++)
+    {
+      char Base[32];
+
+      sprintf(Base, STATE_EVENT, ii);
+      SharedName(Name, Base);
+      hStateEvent[ii] = CreateEvent(NULL, FALSE, FALSE, Name);
+    }
+  }
+
+  ReleaseMutex(hLock);
+  CloseHandle(hLock);
+
+  if (pShared == NULL)
+  {
+    lpvMem = NULL;
+    (void)CloseHandle(hMapObject);
+    hMapObject = NULL;
+    return false;
+  }
+
+  // Set it last, it says we're ready
+  pDTS_Color = pShared;
+  return true;
+}
+/*********************************************************************/
+bool WaitForCredit(void)
+// Purpose: Wait up to CFG_CREDITTIMEOUT ms for the consumer to free a
+//          slot in the one-line FIFO
+// Return: false if it's still full
+{
+  DWORD dwStart = GetTickCount();
+  DWORD dwTimeout = CONFIG(CFG_CREDITTIMEOUT);
+  DWORD dwWaited;
+
+  while (FiFoCredits() == 0)
+  {
+    if ((dwWaited = GetTickCount() - dwStart) >= dwTimeout ||
+                                                    hCreditEvent == NULL)
+      return false;
+
+    (void)WaitForSingleObject(hCreditEvent, dwTimeout - dwWaited);
+  }
+
+  return true;
+}
+/*********************************************************************/
+void FreeCredit(void)
+// Purpose: Called by the consumer when it's taken lines out of the FIFO
+{
+  if (hCreditEvent != NULL)
+    SetEvent(hCreditEvent);
+}
+/*********************************************************************/
+void PaceTimer(void)
+// Purpose: Called each tick, if the client's reported the lag since we
+//          last looked, let PaceStep() change the send interval
+// Globals Used: PaceTime, lLagSeen, TimerID
+{
+  LONG lSamples = pDTS_Color->LagSamples;
+
+  if (lSamples == lLagSeen || CONFIG(CFG_LAGTARGET) <= 0)
+    return;
+
+  lLagSeen = lSamples;
+
+  int NewTime = PaceStep(PaceTime, pDTS_Color->Lag);
+
+  if (NewTime == PaceTime)
+    return;
+
+  // A recording's command times are PaceTime apart from llPlayStart,
+  // move it so the ones already sent stay where they were
+  if (hRecordFile != NULL && dwSendTick != 0)
+    llPlayStart += (LONGLONG)(dwSendTick-1) *
+                          (PaceTime - NewTime) * llRecordFreq / 1000;
+
+  PaceTime = pPlay->PaceTime = NewTime;
+
+  // Same ID, so this just changes the interval
+  TimerID = SetTimer(NULL, TimerID, PaceTime, (TIMERPROC) OnTimer1);
+}
+/*********************************************************************/
+void ConfigReset(void)
+// Purpose: Put every setting back to its default
+{
+  for (int ii = 0; ii < CFG_COUNT; ii++)
+    CONFIG(ii) = ConfigItems[ii].Default;
+}
+/*********************************************************************/
+int ConfigFind(char* pName)
+// Return: the CFG_ number of a setting's name or -1
+{
+  if (pName != NULL)
+    for (int ii = 0; ii < CFG_COUNT; ii++)
+      if (!stricmp(pName, ConfigItems[ii].Name))
+        return ii;
+
+  return -1;
+}
+/*********************************************************************/
+bool ConfigSet(int Item, int Value)
+// Purpose: Change a setting if Value is within its limits (and the pacing
+//          bounds don't cross)
+{
+  if (Item < 0 || Item >= CFG_COUNT ||
+       Value < ConfigItems[Item].Min || Value > ConfigItems[Item].Max)
+    return false;
+
+  if ((Item == CFG_PACEMIN && Value > CONFIG(CFG_PACEMAX)) ||
+                    (Item == CFG_PACEMAX && Value < CONFIG(CFG_PACEMIN)))
+    return false;
+
+  CONFIG(Item) = Value;
+  return true;
+}
+/*********************************************************************/
+bool ConfigParse(int Item, char* pText, int* pValue)
+// Purpose: Convert DTS_config's text for a setting to its value
+// Return: false if it's not a number (or on/off for a CFG_BOOL)
+{
+  if (ConfigItems[Item].Type == CFG_BOOL)
+  {
+    if (!stricmp(pText, "on") || !stricmp(pText, "true") ||
+                                                   !strcmp(pText, "1"))
+      *pValue = 1;
+    else if (!stricmp(pText, "off") || !stricmp(pText, "false") ||
+                                                   !strcmp(pText, "0"))
+      *pValue = 0;
+    else
+      return false;
+
+    return true;
+  }
+
+  char* pEnd;
+  long lValue = strtol(pText, &pEnd, 10);
+
+  if (pEnd == pText || *pEnd != NULLCHAR)
+    return false;
+
+  *pValue = (int)lValue;
+  return true;
+}
+/*********************************************************************/
+void SharedName(char* pBuf, char* pBase)
+// Purpose: Put pBase plus our instance name (if any) in pBuf (64 chars)
+{
+  sprintf(pBuf, "%s%s", pBase, InstanceName);
+}
+/*********************************************************************/
+bool InitTcl(void)
+// Purpose: Find XiRCON's Tcl library - called by Colorize_Init(), only
+//          XiRCON needs the Tcl part of this DLL
+// Globals Used: hXircTcl, Tcl_CreateCommand, etc.
+{
+  if (hXircTcl != NULL)
+    return true;
+
+  // Look for Tcl DLL in three places...
+  // This is hard-coded - but to get the folder from the system is
+  // a pain... and may cause security level problems in Vista and up.
+  // You would need to use SHGetSpecialFolder(CSIDL_PROGRAM_FILESX86)
+  // #define CSIDL_PROGRAM_FILES 0x0026
+  // #define CSIDL_PROGRAM_FILESX86 0x002a
+  hXircTcl = LoadLibrary(XTCLPATH1);
+  if (hXircTcl <= (HMODULE)HINSTANCE_ERROR)
+    hXircTcl = LoadLibrary(XTCLPATH2);
+  if (hXircTcl <= (HMODULE)HINSTANCE_ERROR)
+    hXircTcl = LoadLibrary(XTCLPATH3);
+
+  if (hXircTcl <= (HMODULE)HINSTANCE_ERROR)
+  {
+    hXircTcl = NULL;
+    return false;
+  }
+
+  Tcl_CreateCommand = (dyn_CreateCommand)GetProcAddress(hXircTcl,
+                                                 "_Tcl_CreateCommand");
+  Tcl_AppendResult = (dyn_AppendResult)GetProcAddress(hXircTcl,
+                                                  "_Tcl_AppendResult");
+  Tcl_Eval = (dyn_Eval)GetProcAddress(hXircTcl, "_Tcl_Eval");
+  Tcl_DoOneEvent = (dyn_DoOneEvent)GetProcAddress(hXircTcl,
+                                                    "_Tcl_DoOneEvent");
+
+  if (Tcl_CreateCommand == NULL ||
+      Tcl_AppendResult == NULL ||
+      Tcl_Eval == NULL ||
+      Tcl_DoOneEvent == NULL)
+  {
+    ErrorHandler(ERR_TCLLIB, "Could not find all of the library"
+                                    "functions in XiRCON");
+    return false;
+  }
+
+  return true;
+}
+/*********************************************************************/
+bool InitBuffers(void)
+// Purpose: Allocate the command string the first time we play
+// Globals Used: GlobalString
+{
+  if (GlobalString != NULL)
+    return true;
+
+  /* allocate memory for DDE/TCL Command string */
+  if ((GlobalString = (char*)malloc(GLOBALSTRINGSIZ)) == NULL)
+  {
+    ErrorHandler(ERR_MEMORY, "Error allocating command buffer");
+    return false;
+  }
+
+  return true;
+}
+/*********************************************************************/
 HDDEDATA CALLBACK DdeCallback(UINT type, UINT fmt, HCONV hconv,
       HSZ hsz1, HSZ hsz2, HDDEDATA hData, DWORD dwData1, DWORD dwData2)
 {
@@ -401,9 +1000,35 @@ VOID CALLBACK OnTimer1(
                   UINT idEvent,    // timer identifier
                   DWORD dwTime)     // current system time
 {
-  if (!bPaused)
+  TRACE_BEGIN(TR_TICK, dwSendLine);
+
+  // A DDE play another process paused or resumed (see PauseSession())
+  if (PlaySink == SINK_DDE && pPlay != NULL)
+  {
+    if (pPlay->bPause)
+    {
+      pPlay->bPause = false;
+      bPaused = true;
+      PauseState(pPlay, true);
+    }
+    else if (pPlay->bResume)
+    {
+      pPlay->bResume = false;
+      bPaused = false;
+      PauseState(pPlay, false);
+    }
+  }
+
+  // A stop still has to reach a paused play
+  if (!bPaused || (PlaySink == SINK_DDE && pPlay != NULL && pPlay->bStop))
     QueueNextLineForTransmit();
 
+  // Still playing? see if the client's told us about the lag
+  if (TimerID != NULL)
+    PaceTimer();
+
+  TRACE_END(TR_TICK, dwSendLine);
+
   UNREFERENCED_PARAMETER(hwnd);
   UNREFERENCED_PARAMETER(uMsg);
   UNREFERENCED_PARAMETER(idEvent);
@@ -423,73 +1048,100 @@ int CmdPoll(void* cd, Tcl_Interp* interp, int argc, char* argv[])
 {
   int retval = TCL_OK;
 
-  if (pDTS_Color == NULL)
+  if (!InitShared())
     return TCL_ERROR;
 
-  if (pDTS_Color->bUseDDE)
-  	return TCL_OK;
+  // Show errors from the play threads, etc.
+  if (interp != NULL && lErrorEcho != lErrorCount)
+    EchoErrors(interp);
+
+  // Run DTS_play's scripts for what its play has done
+  NotifyTcl(interp);
+
+  // Ours is the XiRCON session (mIRC's plays from YahCoLoRiZe's timer)
+  DTS_Session* pSess = &pDTS_Color->Session[SINK_TCL];
 
-  if (pDTS_Color->bPause)
+  if (pSess->bPause)
   {
-    pDTS_Color->bPause = false;
+    pSess->bPause = false;
     bPaused = true;
-    Sendtcl(interp, "echo \"Playback Paused!\" status");
+    PauseState(pSess, true);
+    if (!HasCallbacks())
+      Sendtcl(interp, "echo \"Playback Paused!\" status");
   }
-  else if (pDTS_Color->bResume)
+  else if (pSess->bResume)
   {
-    pDTS_Color->bResume = false;
+    pSess->bResume = false;
     bPaused = false;
-    Sendtcl(interp, "echo \"Playback Resumed!\" status");
+    PauseState(pSess, false);
+    if (!HasCallbacks())
+      Sendtcl(interp, "echo \"Playback Resumed!\" status");
   }
-  else if (pDTS_Color->bStart)
+  else if (pSess->bStart)
   {
-    if (pDTS_Color->bUseFile || pDTS_Color->bUseDDE)
+    if (!InitBuffers())
+      return TCL_ERROR;
+
+    if (pSess->bUseFile)
     {
-      Sendtcl(interp, "echo \"Playback Started!\" status");
-      retval = StartLocalFilePlay(interp);
+      // (if DTS_play gave us scripts they get told instead)
+      if (!HasCallbacks())
+        Sendtcl(interp, "echo \"Playback Started!\" status");
+      retval = StartLocalFilePlay(interp, SINK_TCL);
     }
     else
     {
-      if (pDTS_Color->PlayTime < 0 && interp != NULL) // one-line mode?
+      if (pSess->PlayTime < 0 && interp != NULL) // one-line mode?
       {
         // Run loop for XiRCON
         // Stay in loop or we miss data! Also, don't
         // quit until buffer clears...
+        LARGE_INTEGER Freq, Taken, Sent;
+        LONGLONG llWritten;
+
+        if (!QueryPerformanceFrequency(&Freq))
+          Freq.QuadPart = 0;
+
         while(pDTS_Color->FiFoIn != pDTS_Color->FiFoOut)
         {
+          (void)QueryPerformanceCounter(&Taken);
+
           // Unbuffer the text-line...
-          if (pDTS_Color->FiFoOut >= 0 && pDTS_Color->FiFoOut < FIFOSIZE)
+          if (FiFoTake(GlobalString, &llWritten))
           {
-            strcpy(GlobalString, pDTS_Color->FiFo[pDTS_Color->FiFoOut]);
+            IpcRecord(IPC_WAIT, Taken.QuadPart - llWritten, Freq.QuadPart);
 
-            if (++pDTS_Color->FiFoOut >= FIFOSIZE)
-              pDTS_Color->FiFoOut = 0;
+            FreeCredit();
 
-            PrintString(100);
-            Sendtcl(interp, GlobalString);
+            PrintString(interp, SINK_TCL, CONFIG(CFG_ONELINEDELAY));
+
+            (void)QueryPerformanceCounter(&Sent);
+            IpcRecord(IPC_SEND, Sent.QuadPart - Taken.QuadPart,
+                                                          Freq.QuadPart);
+            IpcSent(Sent.QuadPart);
           }
           else // error
           {
-            pDTS_Color->FiFoIn = 0;
-            pDTS_Color->FiFoOut = 0;
-            pDTS_Color->bPause = false;
-            pDTS_Color->bResume = false;
-            pDTS_Color->bStart = false;
-            pDTS_Color->bStop = false;
+            FiFoReset();
+            pSess->bPause = false;
+            pSess->bResume = false;
+            pSess->bStart = false;
+            pSess->bStop = false;
+            FreeCredit();
             break;
           }
         }
       }
     }
   }
-  else if (pDTS_Color->bStop)
+  else if (pSess->bStop)
   {
-    pDTS_Color->FiFoIn = 0;
-    pDTS_Color->FiFoOut = 0;
-    pDTS_Color->bPause = false;
-    pDTS_Color->bResume = false;
-    pDTS_Color->bStart = false;
-    pDTS_Color->bStop = false;
+    FiFoReset();
+    pSess->bPause = false;
+    pSess->bResume = false;
+    pSess->bStart = false;
+    pSess->bStop = false;
+    FreeCredit();
   }
 /*
   // This was the old method... but Tcl_DoOneEvent() was locking up
@@ -590,8 +1242,42 @@ int CmdPlay(void* cd, Tcl_Interp* interp, int argc, char* argv[])
 // Purpose: Allows XiRC script-writers to use this high-resolution
 //          play command from within XiRC.
 // Receive order for argv: channel, file, delay
+//          A play can have scripts run as it goes (see NotifyTcl()):
+//            -progress <script> -done <script> -error <script>
+//            -every <lines>
+// Result: the play's handle (for DTS_state)
 {
   int time;
+  bool bStarted;
+  char* Args[6];
+  char* pProgress = NULL;
+  char* pDone = NULL;
+  char* pError = NULL;
+  int Every = -1;
+  int Count = 0;
+
+  // Take the options out, what's left is the old positional args
+  for (int ii = 0; ii < argc; ii++)
+  {
+    if (ii > 0 && ii+1 < argc && *argv[ii] == '-')
+    {
+      if (!strcmp(argv[ii], "-progress"))
+        pProgress = argv[++ii];
+      else if (!strcmp(argv[ii], "-done"))
+        pDone = argv[++ii];
+      else if (!strcmp(argv[ii], "-error"))
+        pError = argv[++ii];
+      else if (!strcmp(argv[ii], "-every"))
+        Every = atoi(argv[++ii]);
+      else if (Count < 6)
+        Args[Count++] = argv[ii];
+    }
+    else if (Count < 6)
+      Args[Count++] = argv[ii];
+  }
+
+  argc = Count;
+  argv = Args;
 
   if (argc == 2)
   {
@@ -602,27 +1288,52 @@ int CmdPlay(void* cd, Tcl_Interp* interp, int argc, char* argv[])
     else // pause resume or stop local file playback
     {
       if (!strcmp(strlwr(argv[1]), "stop")) // Convert to lower-case
-        ColorStop();
+        ColorStop(PlaySink);
       else if (!strcmp(strlwr(argv[1]), "pause"))
-        ColorPause();
+        ColorPause(PlaySink);
       else if (!strcmp(strlwr(argv[1]), "resume"))
-        ColorResume();
+        ColorResume(PlaySink);
+      else if (!strcmp(strlwr(argv[1]), "end")) // end of a followed file
+        ColorFollowEnd();
     }
   }
-  else if (argc == 3)
-    ColorStart(NULL, argv[1], argv[2], 1500, false);
-  else if (argc == 4)
+  else if (argc == 3 && !strcmp(argv[1], "append"))
   {
-    time = atoi(argv[3]);
+    // play it after the file that's playing (or the next one started)
+    if (!ColorEnqueue(0, argv[2]))
+      (*Tcl_Eval)(interp, "echo \"Play-list is full!\" status");
+  }
+  else if (argc >= 3 && argc <= 5)
+  {
+    if (argc == 3)
+      bStarted = StartColor(NULL, argv[1], argv[2], CONFIG(CFG_PLAYTIME),
+                                                      true, false, false);
+    else
+    {
+      time = atoi(argv[3]);
 
-    if (time <= 100)
-      time = 1500;
+      if (time <= CONFIG(CFG_MINPLAYTIME))
+        time = CONFIG(CFG_PLAYTIME);
+
+      // optional 4th arg "follow" plays the file while it's being written
+      bStarted = StartColor(NULL, argv[1], argv[2], time, true,
+                  argc == 5 && !strcmp(strlwr(argv[4]), "follow"), false);
+    }
+
+    if (bStarted)
+    {
+      char Buf[20];
 
-    ColorStart(NULL, argv[1], argv[2], time, false);
+      SetCallbacks(pProgress, pDone, pError, Every);
+      sprintf(Buf, "%li", ColorHandle());
+      (*Tcl_AppendResult)(interp, Buf, NULL);
+    }
   }
   else
     (*Tcl_Eval)(interp,
-         "echo \"Usage: /play <channel> <filename> <delay in ms>\"");
+     "echo \"Usage: /play <channel> <filename> <delay in ms> [follow]"
+     " [-progress <script>] [-done <script>] [-error <script>]"
+     " [-every <lines>] or /play append <filename>\"");
 
   UNREFERENCED_PARAMETER(cd);
   UNREFERENCED_PARAMETER(argc);
@@ -640,34 +1351,476 @@ int CmdVersion(void* cd, Tcl_Interp* interp, int argc, char* argv[])
 	return TCL_OK;
 }
 /*********************************************************************/
-void SendToColorize(char* pRegWndMsg, char* pData)
+int CmdQueue(void* cd, Tcl_Interp* interp, int argc, char* argv[])
+// Purpose: Allows XiRC script-writers to see how far ahead of the timer
+//          the play-file pipeline is running.
+// Result: "read <lines> send <lines> stalls <ticks> inflate <KB/s>"
 {
-  HWND GhwndReplyTo;
-
-  // Find YahCoLoRiZe window-class
-  if ((GhwndReplyTo = FindWindow(W_CLASS, 0)) == 0)
-  	return;
+  char Buf[100];
 
-  COPYDATASTRUCT cds;
+  sprintf(Buf, "read %i send %i stalls %lu inflate %li",
+                  ColorQueueDepth(0), ColorQueueDepth(1), dwStalls,
+                                                     ColorInflateRate());
 
-  // Try to register WM_ChanCoLoRiZe window's message
-  if ((cds.dwData = RegisterWindowMessage(pRegWndMsg)) == 0)
-    return;
+  (*Tcl_AppendResult)(interp, Buf, NULL);
+  UNREFERENCED_PARAMETER(cd);
+  UNREFERENCED_PARAMETER(argc);
+  UNREFERENCED_PARAMETER(argv);
+	return TCL_OK;
+}
+/*********************************************************************/
+int CmdConvert(void* cd, Tcl_Interp* interp, int argc, char* argv[])
+// Purpose: Allows XiRC script-writers to make a pre-formatted play-file
+// Receive order for argv: text play-file, image file to write
+{
+  if (argc == 3)
+  {
+    if (!ConvertPlayFile(argv[1], argv[2]))
+    {
+      (*Tcl_AppendResult)(interp, "Could not convert ", argv[1], NULL);
+      return TCL_ERROR;
+    }
+  }
+  else
+    (*Tcl_Eval)(interp, "echo \"Usage: DTS_convert <textfile> <imagefile>\"");
 
-  cds.lpData = (void*)pData;
+  UNREFERENCED_PARAMETER(cd);
+	return TCL_OK;
+}
+/*********************************************************************/
+int CmdTrace(void* cd, Tcl_Interp* interp, int argc, char* argv[])
+// Purpose: Allows XiRC script-writers to look at per-stage timing
+//          DTS_trace               - number of events in the ring
+//          DTS_trace dump <file>   - write them as Chrome trace JSON
+//          DTS_trace clear         - empty the ring
+{
+  char Buf[32];
 
-  // the size of the string includes the terminating NULL
-  cds.cbData = strlen(pData)+1;
+  if (argc == 1)
+  {
+    sprintf(Buf, "%i", TraceCount());
+    (*Tcl_AppendResult)(interp, Buf, NULL);
+  }
+  else if (argc == 2 && !strcmp(strlwr(argv[1]), "clear"))
+    TraceClear();
+  else if (argc == 3 && !strcmp(strlwr(argv[1]), "dump"))
+  {
+    if (!TraceDump(argv[2]))
+    {
+      (*Tcl_AppendResult)(interp, "Could not write ", argv[2], NULL);
+      return TCL_ERROR;
+    }
+  }
+  else
+    (*Tcl_Eval)(interp, "echo \"Usage: DTS_trace [clear|dump <file>]\"");
 
-  SendMessage(GhwndReplyTo, WM_COPYDATA, (WPARAM)hInst, (LPARAM)&cds);
+  UNREFERENCED_PARAMETER(cd);
+	return TCL_OK;
 }
 /*********************************************************************/
+int CmdErrors(void* cd, Tcl_Interp* interp, int argc, char* argv[])
+// Purpose: Allows XiRC script-writers to see the DLL's recent errors
+//          DTS_errors        - list of {code text} (oldest first)
+//          DTS_errors clear  - forget them
+{
+  char Text[ERRORTEXTSIZ];
+  char Buf[ERRORTEXTSIZ+32];
+  LONG lNext = lErrorCleared;
+  bool bFirst = true;
+  int Code;
+
+  // Rewinding lErrorCount would throw off the ring's Seq numbers and
+  // the play's own error check (lPlayErrors), mark where we cleared
+  if (argc == 2 && !strcmp(strlwr(argv[1]), "clear"))
+    lErrorCleared = lErrorEcho = lErrorExport = lErrorCount;
+  else
+  {
+    while ((Code = ReadError(&lNext, Text, sizeof(Text))) != 0)
+    {
+      // Text can't hold braces since we make it a Tcl list
+      for (char* p = Text; *p; p++)
+        if (*p == '{' || *p == '}')
+          *p = ' ';
+
+      sprintf(Buf, "%s{%i {%s}}", bFirst ? "" : " ", Code, Text);
+      (*Tcl_AppendResult)(interp, Buf, NULL);
+      bFirst = false;
+    }
+  }
+
+  UNREFERENCED_PARAMETER(cd);
+	return TCL_OK;
+}
 /*********************************************************************/
-/*                       Colorize Functions                          */
-/*********************************************************************/
-/*********************************************************************/
+int CmdCache(void* cd, Tcl_Interp* interp, int argc, char* argv[])
+// Purpose: Allows XiRC script-writers to see how well the cache of
+//          pre-formatted play-files is doing
+//          DTS_cache        - "hits <files> misses <files>"
+//          DTS_cache clear  - delete all the cached images
+{
+  char Buf[80];
 
-bool ColorStart(LPTSTR Service, LPTSTR Channel, LPTSTR Filename,
+  if (argc == 2 && !strcmp(strlwr(argv[1]), "clear"))
+  {
+    CacheTrim(0);
+    InterlockedExchange(&pDTS_Color->CacheHits, 0);
+    InterlockedExchange(&pDTS_Color->CacheMisses, 0);
+  }
+  else
+  {
+    sprintf(Buf, "hits %li misses %li",
+                        ColorCacheStat(0), ColorCacheStat(1));
+    (*Tcl_AppendResult)(interp, Buf, NULL);
+  }
+
+  UNREFERENCED_PARAMETER(cd);
+	return TCL_OK;
+}
+/*********************************************************************/
+int CmdRecord(void* cd, Tcl_Interp* interp, int argc, char* argv[])
+// Purpose: Allows XiRC script-writers to record the commands we send
+//          DTS_record         - commands recorded so far or "off"
+//          DTS_record <file>  - start a new recording
+//          DTS_record stop    - finish it
+{
+  char Buf[32];
+
+  if (argc == 1)
+  {
+    if (hRecordFile != NULL)
+      sprintf(Buf, "%lu", dwRecorded);
+    else
+      strcpy(Buf, "off");
+
+    (*Tcl_AppendResult)(interp, Buf, NULL);
+  }
+  else if (argc == 2 && !strcmp(argv[1], "stop"))
+    RecordStop();
+  else if (argc == 2)
+  {
+    if (!RecordStart(argv[1]))
+    {
+      (*Tcl_AppendResult)(interp, "Could not write ", argv[1], NULL);
+      return TCL_ERROR;
+    }
+  }
+  else
+    (*Tcl_Eval)(interp, "echo \"Usage: DTS_record [stop|<file>]\"");
+
+  UNREFERENCED_PARAMETER(cd);
+	return TCL_OK;
+}
+/*********************************************************************/
+int CmdReplay(void* cd, Tcl_Interp* interp, int argc, char* argv[])
+// Purpose: Allows XiRC script-writers to send a recording again
+//          DTS_replay <file> [realtime]
+// Result: "commands <n> skipped <n> ms <elapsed> late <ms>"
+{
+  char Buf[128];
+
+  if (argc == 2 || (argc == 3 && !strcmp(strlwr(argv[2]), "realtime")))
+  {
+    if (!ReplayRecording(interp, argv[1], argc == 3, Buf))
+    {
+      (*Tcl_AppendResult)(interp, "Could not replay ", argv[1], NULL);
+      return TCL_ERROR;
+    }
+
+    (*Tcl_AppendResult)(interp, Buf, NULL);
+  }
+  else
+    (*Tcl_Eval)(interp, "echo \"Usage: DTS_replay <file> [realtime]\"");
+
+  UNREFERENCED_PARAMETER(cd);
+	return TCL_OK;
+}
+/*********************************************************************/
+int CmdInstance(void* cd, Tcl_Interp* interp, int argc, char* argv[])
+// Purpose: Allows XiRC script-writers to see whose shared memory we're
+//          using (set DTS_INSTANCE before starting XiRCON to pick one)
+// Result: "<instance> attached <processes>" ("" is the default instance)
+{
+  char Buf[INSTANCESIZ+32];
+
+  sprintf(Buf, "{%s} attached %li", InstanceName[0] ? InstanceName+1 : "",
+                                                  pDTS_Color->Attached);
+
+  (*Tcl_AppendResult)(interp, Buf, NULL);
+  UNREFERENCED_PARAMETER(cd);
+  UNREFERENCED_PARAMETER(argc);
+  UNREFERENCED_PARAMETER(argv);
+	return TCL_OK;
+}
+/*********************************************************************/
+int CmdIrc(void* cd, Tcl_Interp* interp, int argc, char* argv[])
+// Purpose: Allows XiRC script-writers to play straight to a server
+//          DTS_irc                                - off, connecting,
+//                                                   ready or failed
+//          DTS_irc connect <server> <port> <nick> - connect
+//          DTS_irc quit                           - disconnect
+{
+  static const char* States[] = {"off", "connecting", "ready", "failed"};
+
+  if (argc == 1)
+    (*Tcl_AppendResult)(interp, States[ColorIrcState()], NULL);
+  else if (argc == 2 && !strcmp(strlwr(argv[1]), "quit"))
+    ColorDisconnect();
+  else if (argc == 5 && !strcmp(strlwr(argv[1]), "connect"))
+  {
+    if (!ColorConnect(argv[2], atoi(argv[3]), argv[4]))
+    {
+      (*Tcl_AppendResult)(interp, "Could not connect to ", argv[2], NULL);
+      return TCL_ERROR;
+    }
+  }
+  else
+    (*Tcl_Eval)(interp,
+      "echo \"Usage: DTS_irc [quit|connect <server> <port> <nick>]\"");
+
+  UNREFERENCED_PARAMETER(cd);
+	return TCL_OK;
+}
+/*********************************************************************/
+int CmdProgress(void* cd, Tcl_Interp* interp, int argc, char* argv[])
+// Purpose: Allows XiRC script-writers to see how far along play is
+// Result: "sent <lines> of <lines> credits <fifo slots> <play-list slots>"
+//         (of 0 means we don't know yet)
+{
+  char Buf[80];
+
+  sprintf(Buf, "sent %li of %li credits %i %i", ColorProgress(0, 0),
+              ColorProgress(0, 1), ColorCredits(0, 0), ColorCredits(0, 1));
+
+  (*Tcl_AppendResult)(interp, Buf, NULL);
+  UNREFERENCED_PARAMETER(cd);
+  UNREFERENCED_PARAMETER(argc);
+  UNREFERENCED_PARAMETER(argv);
+	return TCL_OK;
+}
+/*********************************************************************/
+int CmdLag(void* cd, Tcl_Interp* interp, int argc, char* argv[])
+// Purpose: Allows XiRC script-writers to pace play by the server's lag
+//          DTS_lag <ms>                           - report a round-trip
+//          DTS_lag target <ms> <min ms> <max ms>  - lag to stay under
+//                                                   and interval bounds
+//          DTS_lag          - "lag <ms> target <ms> interval <ms>"
+{
+  char Buf[80];
+
+  if (argc == 1)
+  {
+    sprintf(Buf, "lag %li target %i interval %li", pDTS_Color->Lag,
+             CONFIG(CFG_LAGTARGET),
+             pDTS_Color->Session[StartSink].PaceTime);
+    (*Tcl_AppendResult)(interp, Buf, NULL);
+  }
+  else if (argc == 2 && isdigit(argv[1][0]))
+    ColorLag(atoi(argv[1]));
+  else if (argc == 5 && !strcmp(strlwr(argv[1]), "target"))
+  {
+    if (!ColorPacing(atoi(argv[2]), atoi(argv[3]), atoi(argv[4])))
+    {
+      (*Tcl_AppendResult)(interp, "Bad pacing bounds", NULL);
+      return TCL_ERROR;
+    }
+  }
+  else
+    (*Tcl_Eval)(interp,
+      "echo \"Usage: DTS_lag [<ms>|target <ms> <min ms> <max ms>]\"");
+
+  UNREFERENCED_PARAMETER(cd);
+	return TCL_OK;
+}
+/*********************************************************************/
+int CmdIpc(void* cd, Tcl_Interp* interp, int argc, char* argv[])
+// Purpose: Allows XiRC script-writers to see how long one-line FIFO
+//          lines from YahCoLoRiZe take to get sent
+//          DTS_ipc        - "lines <n> rate <lines/s> wait <p50> <p90>
+//                            <p99> send <p50> <p90> <p99>" (us)
+//          DTS_ipc clear  - start counting again
+{
+  char Buf[160];
+
+  if (argc == 2 && !strcmp(strlwr(argv[1]), "clear"))
+  {
+    IpcClear();
+  }
+  else
+  {
+    sprintf(Buf, "lines %li rate %li wait %li %li %li send %li %li %li",
+       ColorIpcStat(IPC_LINES, 0), ColorIpcStat(IPC_RATE, 0),
+       ColorIpcStat(IPC_WAIT, 50), ColorIpcStat(IPC_WAIT, 90),
+       ColorIpcStat(IPC_WAIT, 99), ColorIpcStat(IPC_SEND, 50),
+       ColorIpcStat(IPC_SEND, 90), ColorIpcStat(IPC_SEND, 99));
+    (*Tcl_AppendResult)(interp, Buf, NULL);
+  }
+
+  UNREFERENCED_PARAMETER(cd);
+	return TCL_OK;
+}
+/*********************************************************************/
+int CmdConfig(void* cd, Tcl_Interp* interp, int argc, char* argv[])
+// Purpose: Allows XiRC script-writers to see and change settings
+//          DTS_config                     - "<name> <value> ..." for all
+//          DTS_config get <name>          - its value
+//          DTS_config set <name> <value>  - change it (on/off for a switch)
+//          DTS_config reset               - all back to the defaults
+{
+  char Buf[40];
+  int Item = argc >= 3 ? ConfigFind(argv[2]) : -1;
+  int Value;
+
+  if (argc == 1)
+  {
+    for (int ii = 0; ii < CFG_COUNT; ii++)
+    {
+      if (ConfigItems[ii].Type == CFG_BOOL)
+        sprintf(Buf, "%s%s %s", ii ? " " : "", ConfigItems[ii].Name,
+                                              CONFIG(ii) ? "on" : "off");
+      else
+        sprintf(Buf, "%s%s %i", ii ? " " : "", ConfigItems[ii].Name,
+                                                              CONFIG(ii));
+
+      (*Tcl_AppendResult)(interp, Buf, NULL);
+    }
+  }
+  else if (argc == 2 && !strcmp(strlwr(argv[1]), "reset"))
+    ConfigReset();
+  else if (argc == 3 && !strcmp(strlwr(argv[1]), "get") && Item >= 0)
+  {
+    if (ConfigItems[Item].Type == CFG_BOOL)
+      strcpy(Buf, CONFIG(Item) ? "on" : "off");
+    else
+      sprintf(Buf, "%i", CONFIG(Item));
+
+    (*Tcl_AppendResult)(interp, Buf, NULL);
+  }
+  else if (argc == 4 && !strcmp(strlwr(argv[1]), "set") && Item >= 0)
+  {
+    if (!ConfigParse(Item, argv[3], &Value) || !ConfigSet(Item, Value))
+    {
+      sprintf(Buf, " (%i to %i)", ConfigItems[Item].Min,
+                                                   ConfigItems[Item].Max);
+      (*Tcl_AppendResult)(interp, "Bad value for ", argv[2], Buf, NULL);
+      return TCL_ERROR;
+    }
+  }
+  else if (argc >= 3 && Item < 0)
+  {
+    (*Tcl_AppendResult)(interp, "No such setting ", argv[2], NULL);
+    return TCL_ERROR;
+  }
+  else
+    (*Tcl_Eval)(interp,
+      "echo \"Usage: DTS_config [get <name>|set <name> <value>|reset]\"");
+
+  UNREFERENCED_PARAMETER(cd);
+	return TCL_OK;
+}
+/*********************************************************************/
+int CmdPlan(void* cd, Tcl_Interp* interp, int argc, char* argv[])
+// Purpose: Allows XiRC script-writers to see what playing a file will
+//          cost before playing it
+//          DTS_plan <channel> <file> [<delay>] [tcl|dde|irc]
+// Result: "lines <n> bytes <n> server <n> time <ms> flood <line> safe
+//         <ms> overlong <n> longest <line>:<bytes> ..." (flood 0 = none)
+{
+  char Result[PLANRESULTSIZ];
+  int Time = argc >= 4 ? atoi(argv[3]) : 0;
+  int Dialect = IrcState == IRC_READY ? DIALECT_IRC : DTSP_TCL;
+
+  if (argc == 5)
+  {
+    if (!strcmp(stolower(argv[4]), "dde"))
+      Dialect = DTSP_DDE;
+    else if (!strcmp(argv[4], "irc"))
+      Dialect = DIALECT_IRC;
+    else
+      Dialect = DTSP_TCL;
+  }
+
+  if (argc < 3 || argc > 5)
+    (*Tcl_Eval)(interp,
+      "echo \"Usage: DTS_plan <channel> <file> [<delay>] [tcl|dde|irc]\"");
+  else if (!ColorPlan(argv[1], argv[2], Time, Dialect, Result,
+                                                          sizeof(Result)))
+  {
+    (*Tcl_AppendResult)(interp, "Can't plan ", argv[2], NULL);
+    return TCL_ERROR;
+  }
+  else
+    (*Tcl_AppendResult)(interp, Result, NULL);
+
+  UNREFERENCED_PARAMETER(cd);
+	return TCL_OK;
+}
+/*********************************************************************/
+int CmdStrip(void* cd, Tcl_Interp* interp, int argc, char* argv[])
+// Purpose: Allows XiRC script-writers to have XiRCON's plays sent with
+//          the color codes stripped (for a +c channel)
+//          DTS_strip [on|off]
+// Result: "on" or "off"
+{
+  int Mode = -1;
+
+  if (argc == 2)
+    Mode = strcmp(stolower(argv[1]), "on") ? 0 : 1;
+
+  if (argc > 2)
+    (*Tcl_Eval)(interp, "echo \"Usage: DTS_strip [on|off]\"");
+  else if ((Mode = ColorStrip(SINK_TCL, Mode)) < 0)
+    return TCL_ERROR;
+  else
+    (*Tcl_AppendResult)(interp, Mode ? "on" : "off", NULL);
+
+  UNREFERENCED_PARAMETER(cd);
+	return TCL_OK;
+}
+/*********************************************************************/
+int CmdState(void* cd, Tcl_Interp* interp, int argc, char* argv[])
+// Purpose: Allows XiRC script-writers to ask what a play is doing
+//          DTS_state [handle]  - the last play we started if none
+// Result: idle, running, paused, ended, stopped, error or unknown
+{
+  if (!InitShared())
+    return TCL_ERROR;
+
+  int State = ColorState(argc >= 2 ? atol(argv[1]) : ColorHandle());
+
+  (*Tcl_AppendResult)(interp, State >= 0 ? StateNames[State] : "unknown",
+                                                                    NULL);
+  UNREFERENCED_PARAMETER(cd);
+	return TCL_OK;
+}
+/*********************************************************************/
+void SendToColorize(char* pRegWndMsg, char* pData)
+{
+  HWND GhwndReplyTo;
+
+  // Find YahCoLoRiZe window-class
+  if ((GhwndReplyTo = FindWindow(W_CLASS, 0)) == 0)
+  	return;
+
+  COPYDATASTRUCT cds;
+
+  // Try to register WM_ChanCoLoRiZe window's message
+  if ((cds.dwData = RegisterWindowMessage(pRegWndMsg)) == 0)
+    return;
+
+  cds.lpData = (void*)pData;
+
+  // the size of the string includes the terminating NULL
+  cds.cbData = strlen(pData)+1;
+
+  SendMessage(GhwndReplyTo, WM_COPYDATA, (WPARAM)hInst, (LPARAM)&cds);
+}
+/*********************************************************************/
+/*********************************************************************/
+/*                       Colorize Functions                          */
+/*********************************************************************/
+/*********************************************************************/
+
+bool ColorStart(LPTSTR Service, LPTSTR Channel, LPTSTR Filename,
                                       int PlayTime, bool bUseFile)
 // Purpose: Called from Colorizer.exe to initiate playback.
 // Args: Service, Channel, Filename, PlayTime (saved to shared memory)
@@ -675,781 +1828,3875 @@ bool ColorStart(LPTSTR Service, LPTSTR Channel, LPTSTR Filename,
 //
 // If PlayTime < 0, Filename holds a chat-text string!!!!!!!!!!!!!!!
 {
+  return StartColor(Service, Channel, Filename, PlayTime, bUseFile,
+                                                           false, false);
+}
+/*********************************************************************/
+bool ColorStartFollow(LPTSTR Service, LPTSTR Channel, LPTSTR Filename,
+                                                          int PlayTime)
+// Purpose: Called from Colorizer.exe to start playing Filename while
+//          it is still being written. Call ColorFollowEnd() when the
+//          file is complete.
+{
+  return StartColor(Service, Channel, Filename, PlayTime, true, true, false);
+}
+/*********************************************************************/
+bool ColorFollowEnd(void)
+// Purpose: Called from Colorizer.exe when it has finished writing a
+//          play-file started with ColorStartFollow().
+// Shared Memory: pDTS_Color structure
+{
+  if (!InitShared())
+    return(false);
+
+  // Whichever session is following it (a start clears this)
+  for (int ii = 0; ii < SINKS; ii++)
+    pDTS_Color->Session[ii].bFollowEnd = true;
+
+  return(true);
+}
+/*********************************************************************/
+LPTSTR ColorAllocBuffer(DWORD Size)
+// Purpose: Called from Colorizer.exe to get a shared-memory buffer of
+//          Size bytes to render a document into (text or a DTSP image),
+//          then play it with ColorStartBuffer(). The buffer stays until
+//          the next ColorAllocBuffer() or ColorFreeBuffer().
+// Shared Memory: pDTS_Color->BufGeneration
+// Return: the buffer or NULL
+{
+  char Name[32];
+
+  if (!InitShared() || Size == 0)
+    return(NULL);
+
+  (void)ColorFreeBuffer();
+
+  // A new name each time - the player may still have the last one mapped
+  sprintf(Name, PLAYBUF_NAME, InstanceName, ++pDTS_Color->BufGeneration);
+
+  if ((hAllocBufMap = CreateFileMapping((HANDLE)0xFFFFFFFF, NULL,
+                               PAGE_READWRITE, 0, Size, Name)) == NULL)
+    return(NULL);
+
+  if ((lpAllocBuf = MapViewOfFile(hAllocBufMap, FILE_MAP_WRITE,
+                                                     0, 0, 0)) == NULL)
+  {
+    (void)ColorFreeBuffer();
+    return(NULL);
+  }
+
+  return (LPTSTR)lpAllocBuf;
+}
+/*********************************************************************/
+bool ColorFreeBuffer(void)
+// Purpose: Called from Colorizer.exe when it's done with the buffer from
+//          ColorAllocBuffer() (the player keeps its own mapping)
+{
+  if (lpAllocBuf != NULL)
+  {
+    (void)UnmapViewOfFile(lpAllocBuf);
+    lpAllocBuf = NULL;
+  }
+
+  if (hAllocBufMap == NULL)
+    return(false);
+
+  (void)CloseHandle(hAllocBufMap);
+  hAllocBufMap = NULL;
+  return(true);
+}
+/*********************************************************************/
+bool ColorStartBuffer(LPTSTR Service, LPTSTR Channel, DWORD Length,
+                                                           int PlayTime)
+// Purpose: Called from Colorizer.exe to play the first Length bytes of
+//          the buffer from ColorAllocBuffer()
+// Shared Memory: pDTS_Color->BufLength (StartColor() copies it to the
+//                session)
+{
+  if (!InitShared() || lpAllocBuf == NULL || PlayTime < 0)
+    return(false);
+
+  pDTS_Color->BufLength = Length;
+
+  return StartColor(Service, Channel, "", PlayTime, true, false, true);
+}
+/*********************************************************************/
+bool ColorEnqueue(LONG Handle, LPTSTR Filename)
+// Purpose: Called from Colorizer.exe to play a file after the current
+//          one (or after the one the next ColorStart() plays) in a
+//          play's session
+// Args: Handle from ColorHandle(), 0 for the session this process last
+//       started (or will start)
+// Shared Memory: pDTS_Color->Session[].PlayList
+// Return: false if the play-list is full or we don't know the handle
+{
+  DTS_Session* pSess;
+
+  if (!InitShared() || Filename == NULL || *Filename == NULLCHAR)
+    return(false);
+
+  if (Handle == 0)
+    pSess = &pDTS_Color->Session[StartSink];
+  else if (Handle < 0 || (pSess = FindPlay(Handle)) == NULL)
+    return(false);
+
+  return EnqueuePlayFile(pSess, Filename);
+}
+/*********************************************************************/
+bool StartColor(LPTSTR Service, LPTSTR Channel, LPTSTR Filename,
+              int PlayTime, bool bUseFile, bool bFollow, bool bBuffer)
+// Purpose: ColorStart() and ColorStartFollow()
+{
+  if (!InitShared() || Filename == NULL)
+    return(false);
+
+  // We have our own server connection, play it from here (not to the
+  // status window though, that's still the client's)
+  bool bIrc = IrcState == IRC_READY && PlayTime >= 0 &&
+                   Channel != NULL && strcmp("status", stolower(Channel));
+
+  // Each kind of client has its own session so they can play at once
+  int Sink = (Service != NULL || bIrc) ? SINK_DDE : SINK_TCL;
+  DTS_Session* pSess = &pDTS_Color->Session[Sink];
+
   // For XiRCON, DDE Service is Null, but we may call
   // this routine several times before bStart ever gets cleared,
   // we buffer the data in a FIFO (the Tcl loop pulls data
   // out.
-  if (pDTS_Color == NULL ||
-      ((Service != NULL || (Service == NULL && bUseFile)) &&
-         (pDTS_Color->bStart || Filename == NULL)))
+  if ((Service != NULL || bUseFile) && pSess->bStart)
+    return(false);
+
+  if (!InitBuffers())
+    return(false);
+
+  // A one-line for XiRCON needs room in the FIFO
+  if (Sink == SINK_TCL && PlayTime < 0 && !WaitForCredit())
     return(false);
 
   // Truncate if the string is too long
-  if (strlen(Filename) >= sizeof(pDTS_Color->Filename))
-    Filename[sizeof(pDTS_Color->Filename)-1] = '\0';
+  if (strlen(Filename) >= sizeof(pSess->Filename))
+    Filename[sizeof(pSess->Filename)-1] = '\0';
   // Move data to shared memory structure
-  strcpy(pDTS_Color->Filename, Filename);
+  strcpy(pSess->Filename, Filename);
 
   if (Channel == NULL)
     // Move data to shared memory structure
-    strcpy(pDTS_Color->Channel, "status");
+    strcpy(pSess->Channel, "status");
   else
   {
     // Truncate if the string is too long
-    if (strlen(Channel) >= sizeof(pDTS_Color->Channel))
-      Channel[sizeof(pDTS_Color->Channel)-1] = '\0';
+    if (strlen(Channel) >= sizeof(pSess->Channel))
+      Channel[sizeof(pSess->Channel)-1] = '\0';
 
     // Move data to shared memory structure
-    strcpy(pDTS_Color->Channel, Channel);
+    strcpy(pSess->Channel, Channel);
+  }
+
+  pSess->PlayTime = PlayTime; // if < 0 we go into "one line" mode!!!!
+  pSess->bStart = true;
+
+  pSess->bStop = false; // flush any pending commands
+  pSess->bPause = false;
+  pSess->bResume = false;
+
+  pSess->bUseFile = bUseFile;
+  pSess->bFollow = bFollow;
+  pSess->bFollowEnd = false;
+  pSess->bUseBuffer = bBuffer;
+
+  if (bBuffer)
+  {
+    pSess->BufGeneration = pDTS_Color->BufGeneration;
+    pSess->BufLength = pDTS_Color->BufLength;
   }
 
-  pDTS_Color->PlayTime = PlayTime; // if < 0 we go into "one line" mode!!!!
-  pDTS_Color->bStart = true;
+  // A play (not a one-line) gets a handle to follow it by
+  if (PlayTime >= 0)
+  {
+    pSess->Handle = InterlockedIncrement(&pDTS_Color->Handles);
+    lStartHandle = pSess->Handle;
+  }
+
+  StartSink = Sink;
+
+  if (bIrc)
+    (void)StartLocalFilePlay(NULL, SINK_DDE);
+  else if (Sink == SINK_TCL)
+  {
+    // XiRCON -- use TCL to communicate
+
+    // Buffer the text-line...
+    if (PlayTime < 0)
+    {
+      LARGE_INTEGER Now;
+      (void)QueryPerformanceCounter(&Now);
+
+      FiFoPut(pSess->Filename, Now.QuadPart);
+    }
+  }
+  else // use DDE to communicate
+  {
+    if (strlen(Service) >= sizeof(pDTS_Color->Service))
+      Service[sizeof(pDTS_Color->Service)-1] = '\0';
+
+    strcpy(pDTS_Color->Service, Service);
+
+    lpDdeProc = MakeProcInstance((FARPROC) DdeCallback, hInst);
+
+    //Initialize a DDE conversation
+    if (DdeInitialize(&idInst, (PFNCALLBACK) lpDdeProc,
+        CBF_FAIL_EXECUTES|CBF_FAIL_POKES, 0) != DMLERR_NO_ERROR)
+    {
+      ErrorHandler(ERR_DDE, "Unable to initialize DDEML library!");
+      return(false);
+    }
+
+    //Set the application service and topic
+    hszService = DdeCreateStringHandle(idInst, pDTS_Color->Service, CP_WINANSI);
+    hszItem = DdeCreateStringHandle(idInst, "active", CP_WINANSI);
+
+    if (IsPirchVortec())
+      hszTopic = DdeCreateStringHandle(idInst, "IRC_COMMAND", CP_WINANSI);
+    else
+      hszTopic = DdeCreateStringHandle(idInst, "COMMAND", CP_WINANSI);
+
+    // Here we only want to call StartLocalFilePlay if we are going
+    // to be reading a master file (via our timer) that
+    // was written by YahCoLoRiZE.  If this is a "one-line"
+    // mode (text line is in the file-name string) we want to
+    // do a PrintString directly... PlayTime is < 0 to flag
+    // this special mode.
+    if (PlayTime < 0)
+    {
+      strcpy(GlobalString, Filename);
+      // Write the text to a temp-file and send the /play tempfilename
+      // string to client (for each channel) - by DDE even if a play is
+      // going straight to the server
+      PrintString(NULL, SINK_DDE, CONFIG(CFG_ONELINEDELAY));
+      pSess->bStart = false;
+    }
+    else
+    {
+//      if (IsPirchVortec())
+//        Senddde("/display \"Playback Started!\"");
+//      else
+//        Senddde("/echo -s \"Playback Started!\"");
+
+      (void)StartLocalFilePlay(NULL, SINK_DDE);  // Kick off the timer
+    }
+  }
+
+  return true;
+}
+/*********************************************************************/
+bool ColorConvert(LPTSTR InFile, LPTSTR OutFile)
+// Purpose: Called from Colorizer.exe to write a pre-formatted copy of a
+//          play-file that it (or DTS_play) can then play.
+{
+  if (!InitShared() || InFile == NULL || OutFile == NULL)
+    return(false);
+
+  return ConvertPlayFile(InFile, OutFile);
+}
+/*********************************************************************/
+bool ColorCodePage(UINT CodePage)
+// Purpose: Called from Colorizer.exe to set the code-page UTF-8 text is
+//          converted to for the client (CP_UTF8 sends it unchanged)
+// Shared Memory: pDTS_Color structure
+{
+  if (!InitShared())
+    return(false);
+
+  pDTS_Color->CodePage = CodePage;
+  return(true);
+}
+/*********************************************************************/
+bool ColorTraceDump(LPTSTR Filename)
+// Purpose: Called from Colorizer.exe to write this process's stage
+//          timing trace as Chrome trace JSON.
+{
+  if (Filename == NULL)
+    return(false);
+
+  return TraceDump(Filename);
+}
+/*********************************************************************/
+int ColorGetError(LPTSTR Buf, int BufSize)
+// Purpose: Called from Colorizer.exe (after an M_ERROR message) to get
+//          the next error it hasn't seen from this process.
+// Args: Buf gets the text (can be NULL)
+// Return: ERR_... code or 0 if there are no more errors
+{
+  return ReadError(&lErrorExport, Buf, BufSize);
+}
+/*********************************************************************/
+bool ColorStop(int Sink)
+// Purpose: Called from Colorizer.exe to stop a session's playback.
+// Args: Sink SINK_TCL (XiRCON) or SINK_DDE (mIRC or the IRC server)
+// Shared Memory: pDTS_Color structure
+{
+  if (!InitShared() || Sink < 0 || Sink >= SINKS)
+    return(false);
+
+  return StopSession(Sink);
+}
+/*********************************************************************/
+bool ColorPause(int Sink)
+// Purpose: Called from Colorizer.exe to pause a session's playback.
+// Args: Sink (see ColorStop())
+// Shared Memory: pDTS_Color structure
+{
+  if (!InitShared() || Sink < 0 || Sink >= SINKS)
+    return(false);
+
+  return PauseSession(Sink);
+}
+/*********************************************************************/
+bool ColorResume(int Sink)
+// Purpose: Called from Colorizer.exe to resume a session's playback
+// after pausing.
+// Args: Sink (see ColorStop())
+// Shared Memory: pDTS_Color structure
+{
+  if (!InitShared() || Sink < 0 || Sink >= SINKS)
+    return(false);
+
+  return ResumeSession(Sink);
+}
+/*********************************************************************/
+int Colorize_Init(Tcl_Interp *interp)
+// Called by XiRC when it loads this DLL
+{
+	if (InitTcl() && InitShared())
+  {
+		(*Tcl_CreateCommand)(interp, "DTS_play", CmdPlay, NULL, NULL);
+		(*Tcl_CreateCommand)(interp, "DTS_poll", CmdPoll, NULL, NULL);
+		(*Tcl_CreateCommand)(interp, "DTS_version", CmdVersion, NULL, NULL);
+		(*Tcl_CreateCommand)(interp, "DTS_ex", CmdEx, NULL, NULL);
+		(*Tcl_CreateCommand)(interp, "DTS_chan", CmdChan, NULL, NULL);
+		(*Tcl_CreateCommand)(interp, "DTS_queue", CmdQueue, NULL, NULL);
+		(*Tcl_CreateCommand)(interp, "DTS_convert", CmdConvert, NULL, NULL);
+		(*Tcl_CreateCommand)(interp, "DTS_trace", CmdTrace, NULL, NULL);
+		(*Tcl_CreateCommand)(interp, "DTS_errors", CmdErrors, NULL, NULL);
+		(*Tcl_CreateCommand)(interp, "DTS_cache", CmdCache, NULL, NULL);
+		(*Tcl_CreateCommand)(interp, "DTS_record", CmdRecord, NULL, NULL);
+		(*Tcl_CreateCommand)(interp, "DTS_replay", CmdReplay, NULL, NULL);
+		(*Tcl_CreateCommand)(interp, "DTS_instance", CmdInstance, NULL, NULL);
+		(*Tcl_CreateCommand)(interp, "DTS_irc", CmdIrc, NULL, NULL);
+		(*Tcl_CreateCommand)(interp, "DTS_progress", CmdProgress, NULL, NULL);
+		(*Tcl_CreateCommand)(interp, "DTS_lag", CmdLag, NULL, NULL);
+		(*Tcl_CreateCommand)(interp, "DTS_ipc", CmdIpc, NULL, NULL);
+		(*Tcl_CreateCommand)(interp, "DTS_config", CmdConfig, NULL, NULL);
+		(*Tcl_CreateCommand)(interp, "DTS_plan", CmdPlan, NULL, NULL);
+		(*Tcl_CreateCommand)(interp, "DTS_strip", CmdStrip, NULL, NULL);
+		(*Tcl_CreateCommand)(interp, "DTS_state", CmdState, NULL, NULL);
+  	return TCL_OK;
+  }
+
+	return TCL_ERROR;
+}
+/*********************************************************************/
+LPTSTR Colorize_Version(void)
+// Purpose: Called from Colorizer.exe to request version.
+{
+  return DTS_VERSION;
+}
+/*********************************************************************/
+int ColorQueueDepth(int Stage)
+// Purpose: Called from Colorizer.exe to see how many lines are waiting
+//          in this process's play-file pipeline.
+// Args: Stage 0 = read (waiting to be formatted),
+//       Stage 1 = send (waiting for the timer)
+// Return: lines waiting or -1 if bad Stage
+{
+  if (Stage == 0)
+    return QueueDepth(&ReadQueue);
+
+  if (Stage == 1)
+    return QueueDepth(&SendQueue);
+
+  return -1;
+}
+/*********************************************************************/
+LONG ColorInflateRate(void)
+// Purpose: Called from Colorizer.exe to see how fast this process's
+//          reader inflated compressed play-files (compare the lines/s
+//          ColorIpcStat() shows it sending)
+// Return: KB/s of text out of the inflater, 0 if it hasn't run
+{
+  LARGE_INTEGER Freq;
+
+  if (llInflateTicks <= 0 || !QueryPerformanceFrequency(&Freq))
+    return 0;
+
+  return (LONG)(llInflateBytes * Freq.QuadPart / 1024 / llInflateTicks);
+}
+/*********************************************************************/
+LONG ColorCacheStat(int Which)
+// Purpose: Called from Colorizer.exe to see how well the cache of
+//          pre-formatted play-files is doing
+// Args: Which 0 = hits, 1 = misses
+// Return: count or -1 if bad Which
+{
+  if (!InitShared())
+    return -1;
+
+  if (Which == 0)
+    return pDTS_Color->CacheHits;
+
+  if (Which == 1)
+    return pDTS_Color->CacheMisses;
+
+  return -1;
+}
+/*********************************************************************/
+bool ColorRecord(LPTSTR Filename)
+// Purpose: Called from Colorizer.exe to record the commands this
+//          process sends over DDE to Filename (NULL or "" stops)
+{
+  if (Filename == NULL || *Filename == NULLCHAR)
+  {
+    RecordStop();
+    return(true);
+  }
+
+  return RecordStart(Filename);
+}
+/*********************************************************************/
+bool ColorInstance(LPTSTR Name)
+// Purpose: Called from Colorizer.exe, before anything else, to use the
+//          shared memory of instance Name (overrides DTS_INSTANCE, NULL
+//          or "" is the default instance)
+// Return: false if we've already mapped an instance's shared memory
+{
+  if (pDTS_Color != NULL)
+    return(false);
+
+  if (Name == NULL || *Name == NULLCHAR)
+    InstanceName[0] = NULLCHAR;
+  else
+  {
+    InstanceName[0] = '.';
+    strncpy(InstanceName+1, Name, INSTANCESIZ-2);
+    InstanceName[INSTANCESIZ-1] = NULLCHAR;
+  }
+
+  bInstanceSet = true;
+  return(true);
+}
+/*********************************************************************/
+bool ColorConnect(LPTSTR Server, int Port, LPTSTR Nick)
+// Purpose: Called from Colorizer.exe to connect this process to an IRC
+//          server, play-files it starts then go straight to the server
+// Return: false if we couldn't start connecting (see ColorIrcState())
+{
+  return IrcConnect(Server, Port, Nick);
+}
+/*********************************************************************/
+bool ColorShutdown(void)
+// Purpose: Called from Colorizer.exe before it calls FreeLibrary() - stops
+//          our play and IRC connection and waits for their threads.
+//          DllMain() can't wait on them so anything still running at
+//          detach is abandoned.
+{
+  if (pPlay != NULL && TimerID != NULL)
+    StopPlay();
+  else
+    (void)StopPipeline();
+
+  // and IrcThread()
+  IrcDisconnect();
+
+  return(true);
+}
+/*********************************************************************/
+bool ColorDisconnect(void)
+// Purpose: Called from Colorizer.exe to drop the IRC server connection
+{
+  if (IrcSocket == INVALID_SOCKET)
+    return(false);
+
+  IrcDisconnect();
+  return(true);
+}
+/*********************************************************************/
+int ColorIrcState(void)
+// Return: IRC_OFF, IRC_CONNECTING, IRC_READY or IRC_FAILED
+{
+  return IrcState;
+}
+/*********************************************************************/
+LONG ColorProgress(LONG Handle, int Which)
+// Purpose: Called from Colorizer.exe to see how far along a play is
+// Args: Handle from ColorHandle() (0 for the last one this process
+//       started), Which 0 = lines sent, 1 = lines in the file(s) (0 if
+//       we don't know yet)
+// Return: count or -1 if bad Which (or we don't know the handle)
+{
+  DTS_Session* pSess;
+
+  if (!InitShared())
+    return -1;
+
+  if (Handle == 0)
+    pSess = &pDTS_Color->Session[StartSink];
+  else if (Handle < 0 || (pSess = FindPlay(Handle)) == NULL)
+    return -1;
+
+  if (Which == 0)
+    return pSess->LinesSent;
+
+  if (Which == 1)
+    return pSess->LinesTotal;
+
+  return -1;
+}
+/*********************************************************************/
+int ColorCredits(LONG Handle, int Which)
+// Purpose: Called from Colorizer.exe to see how far ahead it can get
+// Args: Handle (see ColorProgress(), the FIFO doesn't need one), Which
+//       0 = one-line FIFO slots free (ColorStart() with a PlayTime < 0),
+//       1 = play-list slots free (ColorEnqueue())
+// Return: credits or -1 if bad Which (or we don't know the handle)
+{
+  DTS_Session* pSess;
+
+  if (!InitShared())
+    return -1;
+
+  if (Which == 0)
+    return FiFoCredits();
+
+  if (Handle == 0)
+    pSess = &pDTS_Color->Session[StartSink];
+  else if (Handle < 0 || (pSess = FindPlay(Handle)) == NULL)
+    return -1;
+
+  if (Which == 1)
+    return PLAYLISTSIZE - (pSess->PlayListIn - pSess->PlayListOut);
+
+  return -1;
+}
+/*********************************************************************/
+bool ColorLag(int Lag)
+// Purpose: Called from Colorizer.exe with the round-trip lag (ms) it
+//          measured to the server, the player paces itself by it
+{
+  if (!InitShared() || Lag < 0)
+    return(false);
+
+  pDTS_Color->Lag = Lag;
+  InterlockedIncrement(&pDTS_Color->LagSamples);
+  return(true);
+}
+/*********************************************************************/
+bool ColorPacing(int Target, int MinTime, int MaxTime)
+// Purpose: Called from Colorizer.exe to set the lag to stay under and
+//          the fastest and slowest send interval
+// Args: Target ms (0 = don't pace), MinTime and MaxTime ms
+{
+  if (!InitShared() || MaxTime < MinTime ||
+      MinTime < ConfigItems[CFG_PACEMIN].Min ||
+      MaxTime > ConfigItems[CFG_PACEMAX].Max ||
+      Target < ConfigItems[CFG_LAGTARGET].Min ||
+      Target > ConfigItems[CFG_LAGTARGET].Max)
+    return(false);
+
+  // All three at once, one at a time the bounds could cross
+  CONFIG(CFG_PACEMIN) = MinTime;
+  CONFIG(CFG_PACEMAX) = MaxTime;
+  CONFIG(CFG_LAGTARGET) = Target;
+  return(true);
+}
+/*********************************************************************/
+LONG ColorIpcStat(int Which, int Percent)
+// Purpose: Called from Colorizer.exe to see how long one-line FIFO
+//          lines take to get from ColorStart() to XiRCON
+// Args: Which IPC_WAIT or IPC_SEND (Percent-ile in us), IPC_LINES or
+//       IPC_RATE (lines/s between the first and last line)
+// Return: -1 if bad args
+{
+  if (!InitShared())
+    return -1;
+
+  if ((Which == IPC_WAIT || Which == IPC_SEND) &&
+                                         Percent > 0 && Percent <= 100)
+    return IpcPercentile(Which, Percent);
+
+  if (Which == IPC_LINES)
+    return pDTS_Color->IpcLines;
+
+  if (Which == IPC_RATE)
+  {
+    LARGE_INTEGER Freq;
+
+    if (!QueryPerformanceFrequency(&Freq))
+      return 0;
+
+    return IpcRate(Freq.QuadPart);
+  }
+
+  return -1;
+}
+/*********************************************************************/
+bool ColorConfigGet(LPTSTR Name, int* pValue)
+// Purpose: Called from Colorizer.exe to read a setting (see DTS_config,
+//          a switch is 1 or 0)
+// Return: false if there's no such setting
+{
+  int Item;
+
+  if (!InitShared() || pValue == NULL || (Item = ConfigFind(Name)) < 0)
+    return(false);
+
+  *pValue = CONFIG(Item);
+  return(true);
+}
+/*********************************************************************/
+bool ColorConfigSet(LPTSTR Name, int Value)
+// Purpose: Called from Colorizer.exe to change a setting, it applies from
+//          the next line sent (queue sizes from the next play)
+// Return: false if there's no such setting or Value is out of range
+{
+  if (!InitShared())
+    return(false);
+
+  return ConfigSet(ConfigFind(Name), Value);
+}
+/*********************************************************************/
+bool ColorPlan(LPTSTR Channel, LPTSTR Filename, int PlayTime, int Dialect,
+                                                  LPTSTR Buf, int BufSize)
+// Purpose: Called from Colorizer.exe to estimate a play before starting
+//          it (see DTS_plan for what goes in Buf)
+// Args: PlayTime delay in ms (0 = CFG_PLAYTIME), Dialect DTSP_TCL,
+//       DTSP_DDE or DIALECT_IRC
+// Return: false if the file can't be read
+{
+  char Result[PLANRESULTSIZ];
+
+  if (!InitShared() || Channel == NULL || Filename == NULL ||
+                                          Buf == NULL || BufSize <= 0)
+    return(false);
+
+  if (PlayTime <= 0)
+    PlayTime = CONFIG(CFG_PLAYTIME);
+
+  if (!PlanFile(Channel, Filename, PlayTime, Dialect, Result))
+    return(false);
+
+  strncpy(Buf, Result, BufSize-1);
+  Buf[BufSize-1] = NULLCHAR;
+  return(true);
+}
+/*********************************************************************/
+int ColorStrip(int Sink, int Mode)
+// Purpose: Called from Colorizer.exe to have a session's lines sent with
+//          the color codes stripped (for a +c channel), from the next line
+// Args: Sink SINK_TCL (XiRCON) or SINK_DDE (mIRC or the IRC server),
+//       Mode 1 = strip, 0 = don't, -1 = just ask
+// Return: 1 if it strips, 0 if not, -1 if bad Sink
+{
+  if (!InitShared() || Sink < 0 || Sink >= SINKS)
+    return -1;
+
+  DTS_Session* pSess = &pDTS_Color->Session[Sink];
+
+  if (Mode >= 0)
+    pSess->bStrip = Mode != 0;
+
+  return pSess->bStrip ? 1 : 0;
+}
+/*********************************************************************/
+LONG ColorHandle(void)
+// Purpose: Called from Colorizer.exe right after ColorStart...() to get
+//          the new play's handle
+// Return: the handle of the last play this process started (0 if none
+//         yet) - a DTS_play in XiRCON in between doesn't change it
+{
+  if (!InitShared())
+    return 0;
+
+  return lStartHandle;
+}
+/*********************************************************************/
+int ColorState(LONG Handle)
+// Purpose: Called from Colorizer.exe to see what a play is doing
+// Return: PLAY_... (PLAY_IDLE if it hasn't started yet), -1 if we don't
+//         know the handle (another play has taken its session)
+{
+  DTS_Session* pSess;
+
+  if (!InitShared() || Handle <= 0 || (pSess = FindPlay(Handle)) == NULL)
+    return -1;
+
+  if (pSess->PlayHandle == Handle)
+    return pSess->State;
+
+  return PLAY_IDLE;
+}
+/*********************************************************************/
+int ColorWaitState(LONG Handle, DWORD Timeout)
+// Purpose: Called from Colorizer.exe (on a thread of its own) to wait
+//          for a play's next change of state, or its next -every lines
+//          (ColorNotify()), instead of polling
+// Args: Handle, Timeout in ms (INFINITE is ok)
+// Return: ColorState() after the wait (or the timeout)
+{
+  DTS_Session* pSess;
+
+  if (!InitShared() || Handle <= 0 || (pSess = FindPlay(Handle)) == NULL)
+    return -1;
+
+  HANDLE hEvent = hStateEvent[pSess - pDTS_Color->Session];
+
+  if (hEvent == NULL)
+    return -1;
+
+  // Already over, don't wait for a change that won't come
+  if (pSess->PlayHandle == Handle && pSess->State != PLAY_RUNNING &&
+                                            pSess->State != PLAY_PAUSED)
+    return pSess->State;
+
+  (void)WaitForSingleObject(hEvent, Timeout);
+
+  return ColorState(Handle);
+}
+/*********************************************************************/
+bool ColorNotify(LONG Handle, int Lines)
+// Purpose: Called from Colorizer.exe to have a play (by its handle from
+//          ColorHandle()) set its STATE_EVENT every so many lines sent
+//          (0 = don't)
+// Return: false if we don't know the handle
+{
+  DTS_Session* pSess;
+
+  if (!InitShared() || Lines < 0 || Handle <= 0 ||
+                                   (pSess = FindPlay(Handle)) == NULL)
+    return(false);
+
+  pSess->Notify = Lines;
+  return(true);
+}
+/*********************************************************************/
+/*********************************************************************/
+/*                         General Functions                         */
+/*********************************************************************/
+/*********************************************************************/
+
+int StartLocalFilePlay(Tcl_Interp *interp, int Sink)
+// Purpose: Play a session's file from this process - SINK_TCL from
+//          XiRCON's DTS_poll (interp), SINK_DDE from our own timer
+{
+  DTS_Session* pSess = &pDTS_Color->Session[Sink];
+
+  pSess->bStart = false; // Do this to prevent reentrant call
+                         // from DoOneEvent
+  bPaused = false;
+
+  if (pSess->Filename != NULL && pSess->Channel != NULL)
+  {
+    StopPlay(); // Stop any play in-progress
+
+    PlaySession(Sink);
+    bFollowing = pPlay->bFollow;
+
+    // From here on the session's State is about this play
+    lPlayErrors = lErrorCount;
+    pPlay->PlayHandle = pPlay->Handle;
+    SetPlayState(pPlay, PLAY_RUNNING);
+
+    // Straight to the server if we're connected (not for status though)
+    bIrcDirect = Sink == SINK_DDE && IrcState == IRC_READY &&
+                       strcmp("status", stolower(pPlay->Channel));
+    if (bIrcDirect)
+      for (int ii = 0; ii < TargetCount; ii++)
+        IrcJoin(Targets[ii]);
+
+    if (pPlay->bUseBuffer ? !LoadPlayBuffer() :
+                          !LoadPlayFile(pPlay->Filename, false))
+    {
+      StopPlay();
+    	return TCL_ERROR;
+    }
+
+    // Initialize vars and flags
+    bDataReady = bEndOfFile = bPaused = false;
+    dwByteCount = 0; // Counts total bytes processed from heap buffer
+    dwSession++;
+    dwReadLine = dwFormatLine = dwSendLine = dwSendTick = 0;
+    pPlay->LinesSent = 0;
+    pPlay->LinesTotal = CountSourceLines();
+
+    // Start at the user's rate, lag we heard about before doesn't count
+    PaceTime = pPlay->PaceTime = pPlay->PlayTime;
+    lLagSeen = pDTS_Color->LagSamples;
+
+    // Start the reader and formatter threads, they run ahead of the
+    // timer so all that's left to do on a tick is the send
+    if (!StartPipeline())
+    {
+      ErrorHandler(ERR_THREAD, "Cannot start play threads!");
+      StopPlay();
+    	return TCL_ERROR;
+    }
+
+    // Go ahead and queue first line as soon as it's formatted
+    (void)QueueReadSlot(&SendQueue, CONFIG(CFG_PRIMETIMEOUT));
+
+    LARGE_INTEGER Now;
+    (void)QueryPerformanceCounter(&Now);
+    llPlayStart = Now.QuadPart;
+
+    QueueNextLineForTransmit();
+
+    // Begin timer thread
+    TimerID = SetTimer(NULL,      // no main window handle in a DLL
+          0,                      // timer identifier
+          PaceTime,               // delay in ms
+          (TIMERPROC) OnTimer1);  // timer callback
+
+    // Fetch and send text lines on timer event, yielding to XiRC
+    // XiRC only calls our polling routine once per second,
+    // but we can send data to a chat window much faster, so this
+    // code gates data to XiRC at a programmable rate set in Colorizer.exe
+    // while still allowing other XiRC scripts to run.
+    if (Sink == SINK_TCL && interp != NULL)
+    {
+      // Run loop for XiRCON
+      while((!bEndOfFile || bDataReady) && !pPlay->bStop)
+      {
+        if (bDataReady) // bDataDeady triggered by timer callback event
+        {
+          Sendtcl(interp, GlobalString);
+          bDataReady = false;
+        }
+        else if (lErrorEcho != lErrorCount)
+          EchoErrors(interp);
+        else // Yield to other TCL processes
+        {
+          NotifyTcl(interp);
+          (void)Tcl_DoOneEvent(TCL_DONT_WAIT);
+        }
+      }
+
+      // (if DTS_play gave us scripts they get told instead)
+      if (!HasCallbacks())
+      {
+        if (pPlay->bStop)
+          Sendtcl(interp, "echo \"Playback Stopped!\" status");
+        else
+          Sendtcl(interp, "echo \"Playback Ended!\" status");
+      }
+
+      StopPlay();
+      NotifyTcl(interp);
+    }
+  }
+
+  return TCL_OK;
+}
+/*********************************************************************/
+void PlaySession(int Sink)
+// Purpose: Point our player (and the formatting) at a session
+// Globals Used: pPlay, PlaySink, Targets
+{
+  pPlay = &pDTS_Color->Session[Sink];
+  PlaySink = Sink;
+  TargetCount = SplitTargets(pPlay->Channel, Targets);
+}
+/*********************************************************************/
+int SplitTargets(char* pList, char pTargets[][TARGETSIZ])
+// Purpose: Split a session's channel list ("#one,#two") into pTargets
+//          (MAXTARGETS of them)
+// Return: targets (at least one, if pList is empty it's "")
+{
+  char List[TARGETSIZ];
+  char* pTok;
+  int Count = 0;
+
+  strncpy(List, pList, sizeof(List)-1);
+  List[sizeof(List)-1] = NULLCHAR;
+
+  for (pTok = strtok(List, TARGETSEPS); pTok != NULL && Count < MAXTARGETS;
+                                          pTok = strtok(NULL, TARGETSEPS))
+    strcpy(pTargets[Count++], stolower(pTok));
+
+  if (Count == 0)
+    pTargets[Count++][0] = NULLCHAR;
+
+  return Count;
+}
+/*********************************************************************/
+bool StopSession(int Sink)
+// Purpose: Stop a session - a DDE one we're playing stops now, XiRCON's
+//          gets a stop command for its DTS_poll, and one another process
+//          is playing (XiRCON's direct IRC play) gets one for its timer
+// Return: false if there was nothing for us to stop
+{
+  DTS_Session* pSess = &pDTS_Color->Session[Sink];
+  bool bOurs = Sink == SINK_DDE && pPlay == pSess;
+
+  if (pSess->bStop || (Sink == SINK_DDE && !bOurs &&
+           pSess->State != PLAY_RUNNING && pSess->State != PLAY_PAUSED))
+    return(false);
+
+// DON'T CLEAR bStart!!!!  Tcl polling delay means
+// a pending start could be (and was being) aborted...
+//  pSess->bStart = false; // flush any pending commands
+
+  pSess->bPause = false;
+  pSess->bResume = false;
+
+  // Forget the rest of the play-list
+  InterlockedExchange(&pSess->PlayListOut, pSess->PlayListIn);
+
+  if (bOurs)
+  {
+    if  (TimerID != NULL)
+    {
+      StopPlay();
+
+//      if (IsPirchVortec())
+//        Senddde("/display \"Playback Stopped!\"");
+//      else
+//        Senddde("/echo -s \"Playback Stopped!\"");
+    }
+  }
+  else
+    pSess->bStop = true;
+
+  return(true);
+}
+/*********************************************************************/
+bool PauseSession(int Sink)
+// Purpose: Pause a session (see StopSession()) - another process's DDE
+//          play is paused by its OnTimer1()
+{
+  DTS_Session* pSess = &pDTS_Color->Session[Sink];
+
+  // Nothing playing, or already told to
+  if (pSess->bPause || pSess->bStop || pSess->State != PLAY_RUNNING)
+    return(false);
+
+  // Not bStart - a start XiRCON hasn't polled yet still has to run
+  pSess->bResume = false;
+
+  if (Sink == SINK_DDE && pPlay == pSess)
+  {
+    // Not to a play going straight to the server, there may be no DDE
+    // client to tell (and a failed Senddde() would stop the play)
+    if (!bIrcDirect && idInst != 0)
+    {
+      if (IsPirchVortec())
+        Senddde("/display \"Playback Paused!\"");
+      else
+        Senddde("/echo -s \"Playback Paused!\"");
+    }
+
+    bPaused = true;
+    PauseState(pSess, true);
+  }
+  else
+    pSess->bPause = true;
+
+  return(true);
+}
+/*********************************************************************/
+bool ResumeSession(int Sink)
+// Purpose: Resume a paused session (see StopSession())
+{
+  DTS_Session* pSess = &pDTS_Color->Session[Sink];
+
+  // Nothing paused, or already told to
+  if (pSess->bResume || pSess->bStop || pSess->State != PLAY_PAUSED)
+    return(false);
+
+  // Not bStart - a start XiRCON hasn't polled yet still has to run
+  pSess->bPause = false;
+
+  if (Sink == SINK_DDE && pPlay == pSess)
+  {
+    // Not to a play going straight to the server, there may be no DDE
+    // client to tell (and a failed Senddde() would stop the play)
+    if (!bIrcDirect && idInst != 0)
+    {
+      if (IsPirchVortec())
+        Senddde("/display \"Playback Resumed!\"");
+      else
+        Senddde("/echo -s \"Playback Resumed!\"");
+    }
+
+    bPaused = false;
+    PauseState(pSess, false);
+  }
+  else
+    pSess->bResume = true;
+
+  return(true);
+}
+/*********************************************************************/
+void SetPlayState(DTS_Session* pSess, LONG State)
+// Purpose: Say what a session's play is doing and wake anyone waiting
+//          on its STATE_EVENT (ColorWaitState())
+{
+  if (InterlockedExchange(&pSess->State, State) == State)
+    return;
+
+  int Sink = (int)(pSess - pDTS_Color->Session);
+
+  if (hStateEvent[Sink] != NULL)
+    SetEvent(hStateEvent[Sink]);
+}
+/*********************************************************************/
+void PauseState(DTS_Session* pSess, bool bPause)
+// Purpose: SetPlayState() for a pause or resume - only a play that's
+//          going can be paused
+{
+  if (pSess->State == PLAY_RUNNING || pSess->State == PLAY_PAUSED)
+    SetPlayState(pSess, bPause ? PLAY_PAUSED : PLAY_RUNNING);
+}
+/*********************************************************************/
+DTS_Session* FindPlay(LONG Handle)
+// Purpose: The session a play handle was given out for
+// Return: NULL if neither session has it (it's too old)
+{
+  for (int ii = 0; ii < SINKS; ii++)
+  {
+    DTS_Session* pSess = &pDTS_Color->Session[ii];
+
+    if (pSess->Handle == Handle || pSess->PlayHandle == Handle)
+      return pSess;
+  }
+
+  return NULL;
+}
+/*********************************************************************/
+void SetCallbacks(char* pProgress, char* pDone, char* pError, int Every)
+// Purpose: Set DTS_play's scripts for the play it just started (they're
+//          all cleared by a DTS_play without them)
+// Args: Scripts (NULL for none), Every - progress every so many lines
+//       (< 0 leaves the session's Notify alone)
+// Globals Used: pOnProgress, pOnDone, pOnError, lNotify...
+{
+  char** pScript[3] = {&pOnProgress, &pOnDone, &pOnError};
+  char* pNew[3] = {pProgress, pDone, pError};
+
+  for (int ii = 0; ii < 3; ii++)
+  {
+    if (*pScript[ii] != NULL)
+      free(*pScript[ii]);
+
+    *pScript[ii] = (pNew[ii] != NULL && *pNew[ii] != NULLCHAR) ?
+                                                   strdup(pNew[ii]) : NULL;
+  }
+
+  lNotifyHandle = 0;
+
+  if (pDTS_Color == NULL)
+    return;
+
+  // Our DTS_play's, not whatever YahCoLoRiZe started since
+  DTS_Session* pSess = &pDTS_Color->Session[StartSink];
+
+  if (Every >= 0)
+    pSess->Notify = Every;
+
+  NotifySink = StartSink;
+  lNotifyHandle = (pOnProgress != NULL || pOnDone != NULL ||
+                           pOnError != NULL) ? lStartHandle : 0;
+  lNotifySent = 0;
+  lNotifyState = PLAY_IDLE;
+}
+/*********************************************************************/
+bool HasCallbacks(void)
+// Return: true if DTS_play's scripts are still following a play (once
+//         it's over, later plays get the status echoes again)
+{
+  return lNotifyHandle != 0 &&
+           (pOnProgress != NULL || pOnDone != NULL || pOnError != NULL);
+}
+/*********************************************************************/
+void NotifyTcl(Tcl_Interp* interp)
+// Purpose: Run DTS_play's scripts for anything that's happened to its
+//          play since we last looked - called from XiRCON's Tcl loop
+//          (DTS_poll and the play loop), never from the timer or a
+//          pipeline thread. The scripts get these args added:
+//            -progress  <handle> <state> <lines sent> <lines total>
+//            -done      <handle> ended|stopped <lines sent>
+//            -error     <handle> "<last error>"
+// Globals Used: pOnProgress, pOnDone, pOnError, lNotify...
+{
+  if (interp == NULL || lNotifyHandle == 0)
+    return;
+
+  DTS_Session* pSess = &pDTS_Color->Session[NotifySink];
+  LONG Handle = lNotifyHandle;
+
+  // Not started yet (the start is waiting for DTS_poll)
+  if (pSess->PlayHandle < Handle)
+    return;
+
+  // Another play took over the session, ours was stopped
+  LONG State = pSess->PlayHandle == Handle ? pSess->State : PLAY_STOPPED;
+  LONG Sent = pSess->LinesSent;
+  char Args[2*ERRORTEXTSIZ+64];
+
+  if (State == PLAY_RUNNING && pOnProgress != NULL && pSess->Notify > 0 &&
+                                      Sent - lNotifySent >= pSess->Notify)
+  {
+    lNotifySent = Sent;
+    sprintf(Args, " %li %s %li %li", Handle, StateNames[State], Sent,
+                                                       pSess->LinesTotal);
+    RunCallback(interp, pOnProgress, Args);
+  }
+
+  if (State == lNotifyState)
+    return;
+
+  lNotifyState = State;
+
+  if (State == PLAY_RUNNING || State == PLAY_PAUSED)
+  {
+    sprintf(Args, " %li %s %li %li", Handle, StateNames[State], Sent,
+                                                       pSess->LinesTotal);
+    RunCallback(interp, pOnProgress, Args);
+  }
+  else if (State == PLAY_ERROR)
+  {
+    char Text[ERRORTEXTSIZ];
+    char Esc[2*ERRORTEXTSIZ];
+    LONG lNext = lErrorCount-1;
+
+    if (!ReadError(&lNext, Text, sizeof(Text)))
+      strcpy(Text, "Colorize.dll:Play failed");
+
+    (void)EscapeString(Text, strlen(Text), Esc, DTSP_TCL);
+    sprintf(Args, " %li \"%s\"", Handle, Esc);
+
+    // It's over, a script that starts another play gets new callbacks
+    lNotifyHandle = 0;
+    RunCallback(interp, pOnError, Args);
+  }
+  else if (State == PLAY_ENDED || State == PLAY_STOPPED)
+  {
+    sprintf(Args, " %li %s %li", Handle, StateNames[State], Sent);
+
+    lNotifyHandle = 0;
+    RunCallback(interp, pOnDone, Args);
+  }
+}
+/*********************************************************************/
+void RunCallback(Tcl_Interp* interp, char* pScript, char* pArgs)
+// Purpose: Eval a callback script with args on the end (a copy, the
+//          script can start a play that replaces it)
+{
+  if (pScript == NULL)
+    return;
+
+  char* pCmd = (char*)malloc(strlen(pScript)+strlen(pArgs)+1);
+
+  if (pCmd == NULL)
+    return;
+
+  strcpy(pCmd, pScript);
+  strcat(pCmd, pArgs);
+
+  // A script's error is its own business, it doesn't stop the play
+  (void)(*Tcl_Eval)(interp, pCmd);
+
+  free(pCmd);
+}
+/*********************************************************************/
+bool LoadPlayFile(char* pFilename, bool bPrefetch)
+// Purpose: Open a play-file and get it ready for the reader thread, a
+//          text file is read into a heap (or a piece at a time in
+//          follow-mode) and a pre-formatted file is mapped
+// Args: bPrefetch - for PrefetchPlayFile(), don't report errors (we'll
+//                   try again when it's time to play it) and don't read
+//                   a text file bigger than CFG_PREFETCHKB
+// Globals Used: hFile, hHeap, lpHeap, dwBytesRead, bFollowing
+{
+  DWORD dwFileSizeHigh;
+  DWORD dwFileSize;
+
+  // Open file (in follow-mode YahCoLoRiZe still has it open to write)
+  if ((hFile = OpenPlayFile(pFilename, bFollowing ?
+     FILE_SHARE_READ|FILE_SHARE_WRITE : FILE_SHARE_READ)) == INVALID_HANDLE_VALUE)
+  {
+    if (!bPrefetch)
+      ErrorHandler(ERR_OPEN, "Could not open file.",pFilename);
+    return false;
+  }
+
+  dwBytesRead = 0;
+
+  if (bFollowing)
+    // Read a piece at a time as it grows (see FillPlayBuffer())
+    dwFileSize = FOLLOWBUFSIZE;
+  else
+  {
+    // Determine file's size
+    dwFileSize = GetFileSize(hFile,&dwFileSizeHigh);
+    if (dwFileSizeHigh)
+    {
+      if (!bPrefetch)
+        ErrorHandler(ERR_FILESIZE, "File is too big!");
+      return false;
+    }
+
+    if (dwFileSize == 0)
+    {
+      if (!bPrefetch)
+        ErrorHandler(ERR_FILESIZE, "Play file is empty!");
+      return false;
+    }
+
+    // A pre-formatted file just gets mapped - no heap, no reading
+    if (IsPlayImage(hFile))
+    {
+      if (!MapPlayImage(hFile, dwFileSize))
+      {
+        if (!bPrefetch)
+          ErrorHandler(ERR_IMAGE, "Bad pre-formatted play file!",pFilename);
+        return false;
+      }
+
+      return true;
+    }
+
+    switch (PlayFileCompression(hFile))
+    {
+      case COMP_ZSTD:
+        if (!bPrefetch)
+          ErrorHandler(ERR_COMPRESSED, "Can't play zstd files, use gzip!",
+                                                                 pFilename);
+        return false;
+
+      case COMP_GZIP:
+        // Inflated a piece at a time, like follow-mode (see
+        // FillPlayBuffer())
+        if ((pInflate = InflateOpen()) == NULL)
+        {
+          if (!bPrefetch)
+            ErrorHandler(ERR_MEMORY, "Cannot allocate inflate buffers!");
+          return false;
+        }
+
+        dwFileSize = FOLLOWBUFSIZE;
+        break;
+    }
+  }
+
+  if (bPrefetch && dwFileSize > (DWORD)CONFIG(CFG_PREFETCHKB)*1024)
+    return false;
+
+  // Create a heap in virtual memory
+  if ((hHeap = HeapCreate(0,dwFileSize,0)) == NULL)
+  {
+    if (!bPrefetch)
+      ErrorHandler(ERR_MEMORY, "Cannot create heap!");
+    return false;
+  }
+
+  // Allocate space for the file
+  if ((lpHeap = HeapAlloc(hHeap,0,dwFileSize)) == NULL)
+  {
+    if (!bPrefetch)
+      ErrorHandler(ERR_MEMORY, "Insufficient heap space!");
+    return false;
+  }
+
+  // In follow-mode (or compressed) the reader thread fills it
+  if (!bFollowing && pInflate == NULL)
+  {
+    // Read the entire file into virtual memory
+    (void)ReadFile(hFile, lpHeap, dwFileSize, &dwBytesRead, NULL);
+    if (dwBytesRead != dwFileSize)
+    {
+      if (!bPrefetch)
+        ErrorHandler(ERR_READ, "Could not read entire file!");
+      return false;
+    }
+
+    // Finished with the file
+    CloseHandle(hFile);
+    hFile = NULL;
+
+    // Play it pre-formatted if we've played it before
+    if (CacheOpen((char*)lpHeap, dwBytesRead))
+    {
+      HeapDestroy(hHeap);
+      hHeap = NULL;
+      lpHeap = NULL;
+      dwBytesRead = 0;
+    }
+  }
+
+  return true;
+}
+/*********************************************************************/
+bool LoadPlayBuffer(void)
+// Purpose: Map the play-buffer YahCoLoRiZe rendered into with
+//          ColorAllocBuffer() - the reader thread plays it right out of
+//          the view, nothing is read or copied
+// Shared Memory Vars: pPlay->BufGeneration, pPlay->BufLength
+// Globals Used: hPlayBufMap, lpPlayBuf, lpHeap, dwBytesRead
+{
+  char Name[32];
+  HANDLE hMap;
+  char* lpView;
+  DWORD dwLength = pPlay->BufLength;
+
+  sprintf(Name, PLAYBUF_NAME, InstanceName, pPlay->BufGeneration);
+
+  if ((hMap = OpenFileMapping(FILE_MAP_READ, FALSE, Name)) == NULL)
+  {
+    ErrorHandler(ERR_OPEN, "Could not open play buffer.", Name);
+    return false;
+  }
+
+  if ((lpView = (char*)MapViewOfFile(hMap, FILE_MAP_READ, 0, 0, 0)) == NULL)
+  {
+    CloseHandle(hMap);
+    ErrorHandler(ERR_SHARED, "Could not map play buffer.", Name);
+    return false;
+  }
+
+  if (dwLength == 0)
+  {
+    UnmapViewOfFile(lpView);
+    CloseHandle(hMap);
+    ErrorHandler(ERR_FILESIZE, "Play buffer is empty!");
+    return false;
+  }
+
+  // It can hold a pre-formatted image too
+  if (dwLength >= sizeof(DTSP_Header) &&
+                !memcmp(lpView, DTSP_MAGIC, sizeof(DTSP_MAGIC)-1))
+  {
+    hImageMap = hMap;
+    lpImage = lpView;
+    dwImageSize = dwLength;
+    dwImageLine = 0;
+
+    if (!CheckPlayImage(lpImage, dwImageSize))
+    {
+      ErrorHandler(ERR_IMAGE, "Bad pre-formatted play buffer!", Name);
+      return false;
+    }
+
+    return true;
+  }
+
+  hPlayBufMap = hMap;
+  lpPlayBuf = lpView;
+
+  // ReadNextLine() treats it just like a file read into the heap
+  lpHeap = lpPlayBuf;
+  dwBytesRead = dwLength;
+
+  return true;
+}
+/*********************************************************************/
+void UnmapPlayBuffer(void)
+{
+  if (lpPlayBuf != NULL)
+  {
+    (void)UnmapViewOfFile(lpPlayBuf);
+    lpPlayBuf = NULL;
+  }
+
+  if (hPlayBufMap != NULL)
+  {
+    (void)CloseHandle(hPlayBufMap);
+    hPlayBufMap = NULL;
+  }
+}
+/*********************************************************************/
+/*********************************************************************/
+/*                        Play-List Functions                        */
+/*********************************************************************/
+/*********************************************************************/
+
+bool EnqueuePlayFile(DTS_Session* pSess, char* pFilename)
+// Purpose: Add a play-file to the end of a session's play-list
+// Shared Memory: pSess->PlayList, PlayListIn, PlayListOut
+// Return: false if the list is full
+{
+  LONG lIn = pSess->PlayListIn;
+
+  if (lIn - pSess->PlayListOut >= PLAYLISTSIZE)
+    return false;
+
+  char* pEntry = pSess->PlayList[lIn % PLAYLISTSIZE];
+
+  strncpy(pEntry, pFilename, MAX_PATH-1);
+  pEntry[MAX_PATH-1] = NULLCHAR;
+
+  // Publish it after it's written
+  InterlockedIncrement(&pSess->PlayListIn);
+  return true;
+}
+/*********************************************************************/
+char* PeekPlayList(LONG* plOut)
+// Args: plOut gets the PlayListOut it was peeked at (NULL if not wanted)
+// Return: next play-file on our session's list or NULL if it's empty
+{
+  LONG lOut = pPlay->PlayListOut;
+
+  if (plOut != NULL)
+    *plOut = lOut;
+
+  if (lOut == pPlay->PlayListIn)
+    return NULL;
+
+  return pPlay->PlayList[lOut % PLAYLISTSIZE];
+}
+/*********************************************************************/
+void GetPlaySource(DTS_Source* pSrc)
+// Purpose: Save the play-file state the reader thread works on
+{
+  pSrc->hFile = hFile;
+  pSrc->hHeap = hHeap;
+  pSrc->lpHeap = lpHeap;
+  pSrc->dwBytesRead = dwBytesRead;
+  pSrc->hImageMap = hImageMap;
+  pSrc->lpImage = lpImage;
+  pSrc->dwImageSize = dwImageSize;
+  pSrc->CacheKey = CacheKey;
+  pSrc->dwCacheSize = dwCacheSize;
+  pSrc->bCacheStore = bCacheStore;
+  pSrc->pInflate = pInflate;
+}
+/*********************************************************************/
+void SetPlaySource(DTS_Source* pSrc)
+// Purpose: Make a saved (or cleared) play-file the one the reader thread
+//          works on, from its first line
+{
+  hFile = pSrc->hFile;
+  hHeap = pSrc->hHeap;
+  lpHeap = pSrc->lpHeap;
+  dwBytesRead = pSrc->dwBytesRead;
+  dwByteCount = 0;
+  hImageMap = pSrc->hImageMap;
+  lpImage = pSrc->lpImage;
+  dwImageSize = pSrc->dwImageSize;
+  dwImageLine = 0;
+  CacheKey = pSrc->CacheKey;
+  dwCacheSize = pSrc->dwCacheSize;
+  bCacheStore = pSrc->bCacheStore;
+  pInflate = pSrc->pInflate;
+}
+/*********************************************************************/
+void FreePlaySource(void)
+// Purpose: Done with the current play-file (or play-buffer)
+// Globals Used: hFile, hHeap, lpImage, lpPlayBuf
+{
+  // Finished with a pre-formatted file or a play-buffer
+  UnmapPlayImage();
+  UnmapPlayBuffer();
+
+  // Finished with the heap
+  if (hHeap != NULL)
+  {
+    HeapDestroy(hHeap);
+    hHeap = NULL;
+  }
+  lpHeap = NULL;
+
+  if (pInflate != NULL)
+  {
+    free(pInflate);
+    pInflate = NULL;
+  }
+
+  // Finished with the file
+  if (hFile != NULL)
+  {
+    CloseHandle(hFile);
+    hFile = NULL;
+  }
+}
+/*********************************************************************/
+void PrefetchPlayFile(void)
+// Purpose: Called by the reader thread - open, read or map the next file
+//          on the play-list while the current one is still playing so
+//          NextPlayFile() only has to swap it in. A text file bigger
+//          than CFG_PREFETCHKB is left for NextPlayFile() to load.
+// Globals Used: NextSource, lPrefetched, bFollowing
+{
+  char* pFilename;
+  DTS_Source Current;
+  DTS_Source Cleared;
+
+  // Already done this one (or tried to), and we don't know when a
+  // followed file will end...
+  if (!CONFIG(CFG_PREFETCH) || bFollowing || lPrefetched == pPlay->PlayListOut + 1 ||
+                                (pFilename = PeekPlayList(NULL)) == NULL)
+    return;
+
+  lPrefetched = pPlay->PlayListOut + 1;
+
+  GetPlaySource(&Current);
+  memset(&Cleared, 0, sizeof(Cleared));
+  SetPlaySource(&Cleared);
+
+  NextSource.bReady = LoadPlayFile(pFilename, true);
+  GetPlaySource(&NextSource);
+
+  if (!NextSource.bReady)
+    FreePlaySource();
+
+  SetPlaySource(&Current);
+}
+/*********************************************************************/
+bool NextPlayFile(void)
+// Purpose: Called by the reader thread at the end of a play-file to
+//          move on to the next one on the play-list
+// Globals Used: NextSource, lPrefetched, bFollowing
+// Return: false if the list is empty (or the file can't be played)
+{
+  char* pFilename;
+  LONG lOut;
+
+  if (bAbortPlay || (pFilename = PeekPlayList(&lOut)) == NULL)
+    return false;
+
+  FreePlaySource();
+  bFollowing = false;
+
+  if (NextSource.bReady && lPrefetched == pPlay->PlayListOut + 1)
+  {
+    SetPlaySource(&NextSource);
+    NextSource.bReady = false;
+  }
+  else
+  {
+    FreePrefetch(); // for a file that's since been taken off the list
+
+    if (!LoadPlayFile(pFilename, false))
+      return false;
+
+    dwByteCount = 0;
+  }
+
+  // Claim it - unless StopSession() emptied the list since we peeked,
+  // then it isn't ours to play (and Out mustn't go past In)
+  if ((LONG)InterlockedCompareExchange((PVOID*)&pPlay->PlayListOut,
+                               (PVOID)(lOut+1), (PVOID)lOut) != lOut)
+  {
+    FreePlaySource();
+    return false;
+  }
+
+  // Still 0 if we were following, we never did know how many (and
+  // now we don't if this one's compressed)
+  if (pPlay->LinesTotal != 0)
+  {
+    LONG lLines = CountSourceLines();
+    pPlay->LinesTotal = lLines != 0 ? pPlay->LinesTotal + lLines : 0;
+  }
+
+  return true;
+}
+/*********************************************************************/
+LONG CountSourceLines(void)
+// Purpose: Count the lines in the play-file the reader is about to read
+// Return: lines or 0 if we don't know (a followed or compressed file)
+{
+  if (lpImage != NULL)
+    return ((DTSP_Header*)lpImage)->Lines;
+
+  if (bFollowing || pInflate != NULL || lpHeap == NULL)
+    return 0;
+
+  char* lpText = (char*)lpHeap;
+  LONG lLines = 0;
+
+  for (DWORD ii = 0; ii < dwBytesRead; ii++)
+    if (lpText[ii] == '\n')
+      lLines++;
+
+  // Last line has no line-feed
+  if (dwBytesRead && lpText[dwBytesRead-1] != '\n')
+    lLines++;
+
+  return lLines;
+}
+/*********************************************************************/
+void FreePrefetch(void)
+// Purpose: Throw away a prefetched play-file that never got played
+// Globals Used: NextSource, lPrefetched
+{
+  if (NextSource.bReady)
+  {
+    DTS_Source Current;
+
+    GetPlaySource(&Current);
+    SetPlaySource(&NextSource);
+    FreePlaySource();
+    SetPlaySource(&Current);
+
+    NextSource.bReady = false;
+  }
+
+  lPrefetched = 0;
+}
+/*********************************************************************/
+/*********************************************************************/
+/*                    Compressed Play-File Functions                 */
+/*********************************************************************/
+/*********************************************************************/
+
+int PlayFileCompression(HANDLE hPlayFile)
+// Purpose: See if an open play-file is compressed (leaves the
+//          file-pointer at the start)
+// Return: COMP_NONE, COMP_GZIP or COMP_ZSTD
+{
+  char Magic[sizeof(ZSTD_MAGIC)-1];
+  DWORD dwRead;
+  int Ret = COMP_NONE;
+
+  if (ReadFile(hPlayFile, Magic, sizeof(Magic), &dwRead, NULL))
+  {
+    if (dwRead >= sizeof(GZIP_MAGIC)-1 &&
+                          !memcmp(Magic, GZIP_MAGIC, sizeof(GZIP_MAGIC)-1))
+      Ret = COMP_GZIP;
+    else if (dwRead == sizeof(Magic) && !memcmp(Magic, ZSTD_MAGIC,
+                                                            sizeof(Magic)))
+      Ret = COMP_ZSTD;
+  }
+
+  (void)SetFilePointer(hPlayFile, 0, NULL, FILE_BEGIN);
+  return Ret;
+}
+/*********************************************************************/
+bool InflatePlayBuffer(void)
+// Purpose: FillPlayBuffer() for a compressed play-file - inflate the
+//          next FOLLOWBUFSIZE bytes of text into the heap buffer
+// Globals Used: pInflate, lpHeap, dwByteCount, dwBytesRead
+// Return: false at the end of the file (or on bad data)
+{
+  LARGE_INTEGER Start, End;
+
+  if (bAbortPlay)
+    return false;
+
+  (void)QueryPerformanceCounter(&Start);
+  DWORD dwOut = Inflate(pInflate, (BYTE*)lpHeap, FOLLOWBUFSIZE);
+  (void)QueryPerformanceCounter(&End);
+
+  llInflateBytes += dwOut;
+  llInflateTicks += End.QuadPart - Start.QuadPart;
+
+  if (pInflate->bError)
+  {
+    ErrorHandler(ERR_COMPRESSED, "Bad gzip play file!");
+    return false;
+  }
+
+  dwByteCount = 0;
+  dwBytesRead = dwOut;
+  return dwOut != 0;
+}
+/*********************************************************************/
+bool InflateRead(BYTE* pBuf, DWORD dwSize, DWORD* pdwRead)
+// Purpose: Inflate.cpp's input - the next piece of the gzip play-file
+//          hFile is open on
+{
+  return ReadFile(hFile, pBuf, dwSize, pdwRead, NULL) != 0;
+}
+/*********************************************************************/
+/*********************************************************************/
+/*********************************************************************/
+/*                          Cache Functions                          */
+/*********************************************************************/
+/*********************************************************************/
+
+ULONGLONG HashPlayFile(char* lpText, DWORD dwSize)
+// Purpose: FNV-1a 64-bit hash of a text play-file plus everything else
+//          that goes into its pre-formatted image (see BuildPlayImage())
+{
+  ULONGLONG Hash = ((ULONGLONG)0xCBF29CE4 << 32) | 0x84222325;
+  ULONGLONG Prime = ((ULONGLONG)0x00000100 << 32) | 0x000001B3;
+  DWORD ii;
+
+  for (ii = 0; ii < dwSize; ii++)
+  {
+    Hash ^= (BYTE)lpText[ii];
+    Hash *= Prime;
+  }
+
+  // Same text in another code-page or image version is another entry
+  Hash ^= pDTS_Color->CodePage;
+  Hash *= Prime;
+  Hash ^= DTSP_VERSION;
+  Hash *= Prime;
+
+  return Hash;
+}
+/*********************************************************************/
+bool CachePath(char* pPath, char* pName)
+// Purpose: Put the cache directory (made if need be) and pName (or the
+//          current CacheKey's file-name if NULL) in pPath (MAX_PATH chars)
+// Globals Used: CacheKey, dwCacheSize
+{
+  DWORD dwLen = GetTempPath(MAX_PATH, pPath);
+
+  if (dwLen == 0 || dwLen + strlen(CACHEDIR) + 32 >= MAX_PATH)
+    return false;
+
+  strcat(pPath, CACHEDIR);
+  (void)CreateDirectory(pPath, NULL);
+
+  if (pName != NULL)
+  {
+    if (strlen(pPath) + strlen(pName) + 2 >= MAX_PATH)
+      return false;
+    sprintf(pPath+strlen(pPath), "\\%s", pName);
+  }
+  else
+    sprintf(pPath+strlen(pPath), CACHE_FMT, (DWORD)(CacheKey >> 32),
+                                             (DWORD)CacheKey, dwCacheSize);
+  return true;
+}
+/*********************************************************************/
+bool CacheOpen(char* lpText, DWORD dwSize)
+// Purpose: Look for a pre-formatted image of a text play-file we've
+//          played before and map it in place of the text
+// Globals Used: CacheKey, dwCacheSize, bCacheStore, hFile
+// Shared Memory: pDTS_Color->CacheHits, pDTS_Color->CacheMisses
+// Return: true if it's mapped (a hit), false and bCacheStore set to
+//         have the reader thread add it (a miss)
+{
+  char Path[MAX_PATH];
+  HANDLE hCache;
+  DWORD dwSizeHigh;
+
+  bCacheStore = false;
+
+  // A big file would push everything else out
+  if (!CONFIG(CFG_CACHE) || dwSize > (DWORD)CONFIG(CFG_CACHEKB)*1024/4)
+    return false;
+
+  CacheKey = HashPlayFile(lpText, dwSize);
+  dwCacheSize = dwSize;
+
+  if (!CachePath(Path, NULL))
+    return false;
+
+  if ((hCache = CreateFile(Path, GENERIC_READ|GENERIC_WRITE,
+            FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                                          NULL)) != INVALID_HANDLE_VALUE)
+  {
+    DWORD dwImgSize = GetFileSize(hCache, &dwSizeHigh);
+
+    if (!dwSizeHigh && MapPlayImage(hCache, dwImgSize))
+    {
+      FILETIME Now;
+
+      // Most recently used...
+      GetSystemTimeAsFileTime(&Now);
+      (void)SetFileTime(hCache, NULL, NULL, &Now);
+
+      hFile = hCache;
+      InterlockedIncrement(&pDTS_Color->CacheHits);
+      return true;
+    }
+
+    // Bad entry, make a new one
+    UnmapPlayImage();
+    CloseHandle(hCache);
+    (void)DeleteFile(Path);
+  }
+
+  InterlockedIncrement(&pDTS_Color->CacheMisses);
+  bCacheStore = true;
+  return false;
+}
+/*********************************************************************/
+void CacheStore(void)
+// Purpose: Called by the reader thread when it's done reading a text
+//          play-file that missed the cache - build its image and add
+//          it, the timer is still busy sending the last lines
+// Globals Used: CacheKey, dwCacheSize, bCacheStore, lpHeap, dwBytesRead
+{
+  char Path[MAX_PATH];
+  char TmpPath[MAX_PATH];
+  char TmpName[32];
+  char* lpImg;
+  DWORD dwImageSize, dwWritten;
+  HANDLE hOut;
+
+  if (!bCacheStore || hHeap == NULL || dwBytesRead != dwCacheSize)
+    return;
+
+  bCacheStore = false;
+
+  // Another process could be adding one too
+  sprintf(TmpName, CACHE_TMPFMT, GetCurrentProcessId());
+
+  if (!CachePath(Path, NULL) || !CachePath(TmpPath, TmpName))
+    return;
+
+  if (!BuildPlayImage((char*)lpHeap, dwBytesRead, &lpImg, &dwImageSize))
+    return;
+
+  // Write it under a temp name so no one ever maps half an image
+  if ((hOut = CreateFile(TmpPath, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                    FILE_ATTRIBUTE_NORMAL, NULL)) != INVALID_HANDLE_VALUE)
+  {
+    bool bRet = WriteFile(hOut, lpImg, dwImageSize, &dwWritten, NULL) &&
+                                                dwWritten == dwImageSize;
+    CloseHandle(hOut);
+
+    if (!bRet || !MoveFile(TmpPath, Path))
+      (void)DeleteFile(TmpPath);
+  }
+
+  free(lpImg);
+
+  CacheTrim((DWORD)CONFIG(CFG_CACHEKB)*1024);
+}
+/*********************************************************************/
+void CacheTrim(DWORD dwBudget)
+// Purpose: Delete the least recently played images until the cache
+//          takes up no more than dwBudget bytes
+{
+  char Path[MAX_PATH];
+  char Oldest[MAX_PATH];
+  char Victim[MAX_PATH];
+  WIN32_FIND_DATA fd;
+  FILETIME ftOldest;
+  HANDLE hFind;
+  DWORD dwTotal;
+
+  if (!CachePath(Path, CACHE_WILDCARD))
+    return;
+
+  for (;;)
+  {
+    if ((hFind = FindFirstFile(Path, &fd)) == INVALID_HANDLE_VALUE)
+      return;
+
+    dwTotal = 0;
+    Oldest[0] = NULLCHAR;
+
+    do
+    {
+      if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)
+        continue;
+
+      dwTotal += fd.nFileSizeLow;
+
+      if (Oldest[0] == NULLCHAR ||
+                 CompareFileTime(&fd.ftLastWriteTime, &ftOldest) < 0)
+      {
+        ftOldest = fd.ftLastWriteTime;
+        strcpy(Oldest, fd.cFileName);
+      }
+    } while (FindNextFile(hFind, &fd));
+
+    FindClose(hFind);
+
+    if (dwTotal <= dwBudget || Oldest[0] == NULLCHAR ||
+                  !CachePath(Victim, Oldest) || !DeleteFile(Victim))
+      return;
+  }
+}
+/*********************************************************************/
+void StopPlay(void)
+{
+  // A pipeline thread can't wait on itself, let the timer clean up
+  if (IsPipelineThread())
+  {
+    bAbortPlay = true;
+    return;
+  }
+
+  if (pPlay != NULL)
+  {
+    // Say how it finished (an error stops a play too)
+    if (pPlay->State == PLAY_RUNNING || pPlay->State == PLAY_PAUSED)
+      SetPlayState(pPlay, lErrorCount != lPlayErrors ? PLAY_ERROR :
+                          bEndOfFile && !pPlay->bStop ? PLAY_ENDED :
+                                                        PLAY_STOPPED);
+    pPlay->bStop = false;
+  }
+
+  // Finished with the timer
+  if (TimerID)
+  {
+    KillTimer(NULL, TimerID);
+    TimerID = NULL;
+  }
+
+  // Finished with the reader and formatter threads, and if they've
+  // gone, with the play-file and any we opened ahead of it
+  if (StopPipeline())
+  {
+    FreePrefetch();
+    FreePlaySource();
+  }
+
+  bPaused = false;
+  bIrcDirect = false;
+
+// Nice idea to delete the temp files BUT - we will call stop
+// when the chat-client is still reading files :) so - nice try but
+// no cigar...
+/*
+  // Delete files
+  char *FileNameBuf;
+
+  // Allocate file-name buffer
+  if ((FileNameBuf = (char *)malloc(MAX_PATH)) == NULL)
+  {
+    ErrorHandler(ERR_MEMORY, "Error creating filename buffer");
+    return;
+  }
+
+  GetTempPath(MAX_PATH, FileNameBuf);
+  strcat(FileNameBuf, TEMPFILE_0);
+  DeleteFile(FileNameBuf);
+  GetTempPath(MAX_PATH, FileNameBuf);
+  strcat(FileNameBuf, TEMPFILE_1);
+  DeleteFile(FileNameBuf);
+  GetTempPath(MAX_PATH, FileNameBuf);
+  strcat(FileNameBuf, TEMPFILE_2);
+  DeleteFile(FileNameBuf);
+  GetTempPath(MAX_PATH, FileNameBuf);
+  strcat(FileNameBuf, TEMPFILE_3);
+  DeleteFile(FileNameBuf);
+
+  free(FileNameBuf);
+*/
+}
+/*********************************************************************/
+void Senddde(char* tempstr)
+{
+  RecordCommand(DTSP_DDE, tempstr);
+
+  try
+  {
+    //Connect to the service and request the topic
+    TRACE_BEGIN(TR_DDECONNECT, dwSendLine);
+    hcnv = DdeConnect(idInst, hszService, hszTopic, NULL);
+    TRACE_END(TR_DDECONNECT, dwSendLine);
+
+    if (hcnv == 0)
+    {
+      StopSession(SINK_DDE);
+      return;
+    }
+
+    //Start a DDE transaction
+    TRACE_BEGIN(TR_DDEPOKE, dwSendLine);
+    HDDEDATA hRet = DdeClientTransaction((LPBYTE)tempstr, strlen(tempstr)+1,
+          hcnv, hszItem, CF_TEXT, XTYP_POKE, CONFIG(CFG_DDETIMEOUT),
+                                                             &dwResult);
+    TRACE_END(TR_DDEPOKE, dwSendLine);
+
+    if (hRet == 0)
+    {
+      UINT result = DdeGetLastError(idInst);
+      switch (result)
+      {
+        case DMLERR_ADVACKTIMEOUT:
+        case DMLERR_BUSY:
+        case DMLERR_DATAACKTIMEOUT:
+        case DMLERR_DLL_NOT_INITIALIZED:
+        case DMLERR_EXECACKTIMEOUT:
+        case DMLERR_INVALIDPARAMETER:
+        case DMLERR_MEMORY_ERROR:
+        case DMLERR_NO_CONV_ESTABLISHED:
+        case DMLERR_NO_ERROR:
+        case DMLERR_NOTPROCESSED:
+        case DMLERR_POKEACKTIMEOUT:
+        case DMLERR_POSTMSG_FAILED:
+        case DMLERR_REENTRANCY:
+        case DMLERR_SERVER_DIED:
+        case DMLERR_UNADVACKTIMEOUT:
+        default:
+          StopSession(SINK_DDE);
+      }
+    }
+
+    //Free DDE
+    DdeDisconnect(hcnv);
+  }
+  catch(...)
+  {
+    ErrorHandler(ERR_EXCEPTION, "Exception thrown in Senddde()!");
+  }
+}
+/*********************************************************************/
+void Sendtcl(Tcl_Interp *interp, char *tempstr)
+{
+  RecordCommand(DTSP_TCL, tempstr);
+
+  try
+  {
+    TRACE_BEGIN(TR_TCLEVAL, dwSendLine);
+    (*Tcl_Eval)(interp, tempstr);
+    TRACE_END(TR_TCLEVAL, dwSendLine);
+  }
+  catch(...)
+  {
+    ErrorHandler(ERR_EXCEPTION, "Exception thrown in Sendtcl()!");
+  }
+}
+/*********************************************************************/
+void ErrorHandler(int Code, LPTSTR Info, LPTSTR Extra)
+// Purpose: Record an error without blocking (this can be the timer, the
+//          middle of XiRCON's Tcl loop, a pipeline thread or the DLL
+//          entry-point) and ask any playback to stop. The error is
+//          echoed to XiRCON's status window by DTS_poll, listed by
+//          DTS_errors, and YahCoLoRiZe gets an M_ERROR message telling
+//          it to call ColorGetError().
+// Args: Code (ERR_...), String with information, optional extra info
+{
+  DTS_Error* pErr;
+  LONG lIndex = InterlockedIncrement(&lErrorCount)-1;
+
+  pErr = &ErrorRing[(DWORD)lIndex % ERRORSIZE];
+
+  // Readers skip an entry until its Seq says it's complete
+  InterlockedExchange(&pErr->Seq, 0);
+  pErr->Code = Code;
+  pErr->Time = GetTickCount();
+  strcpy(pErr->Text, "Colorize.dll:");
+  strncat(pErr->Text, Info, sizeof(pErr->Text)-strlen(pErr->Text)-1);
+  if (Extra != NULL)
+  {
+    strncat(pErr->Text, " ", sizeof(pErr->Text)-strlen(pErr->Text)-1);
+    strncat(pErr->Text, Extra, sizeof(pErr->Text)-strlen(pErr->Text)-1);
+  }
+  InterlockedExchange(&pErr->Seq, lIndex+1);
+
+  // The timer (or the XiRCON loop) does the actual clean-up
+  bAbortPlay = true;
+
+  // Tell YahCoLoRiZe without waiting for it
+  HWND hwnd;
+  UINT Msg;
+
+  if ((hwnd = FindWindow(W_CLASS, 0)) != 0 &&
+                          (Msg = RegisterWindowMessage(M_ERROR)) != 0)
+    PostMessage(hwnd, Msg, (WPARAM)Code, (LPARAM)GetCurrentProcessId());
+}
+/*********************************************************************/
+int ReadError(LONG* plNext, char* pBuf, int BufSize)
+// Purpose: Copy the next error after *plNext to pBuf (skipping any that
+//          have been written over) and advance *plNext
+// Return: ERR_... code or 0 if there are no more errors
+{
+  LONG lCount = lErrorCount;
+
+  if (lCount - *plNext > ERRORSIZE)
+    *plNext = lCount - ERRORSIZE;
+
+  while (*plNext < lCount)
+  {
+    DTS_Error* pErr = &ErrorRing[(DWORD)*plNext % ERRORSIZE];
+    LONG lIndex = (*plNext)++;
+
+    if (pErr->Seq != lIndex+1)
+      continue; // being written or already written over
+
+    if (pBuf != NULL && BufSize > 0)
+    {
+      strncpy(pBuf, pErr->Text, BufSize-1);
+      pBuf[BufSize-1] = NULLCHAR;
+    }
+
+    return pErr->Code;
+  }
+
+  return 0;
+}
+/*********************************************************************/
+void EchoErrors(Tcl_Interp* interp)
+// Purpose: Show any new errors in XiRCON's status window
+{
+  char Text[ERRORTEXTSIZ];
+  char Esc[2*ERRORTEXTSIZ];
+  char Cmd[2*ERRORTEXTSIZ+32];
+
+  while (ReadError(&lErrorEcho, Text, sizeof(Text)))
+  {
+    (void)EscapeString(Text, strlen(Text), Esc, DTSP_TCL);
+    sprintf(Cmd, "echo \"%s\" status", Esc);
+    Sendtcl(interp, Cmd);
+  }
+}
+/*********************************************************************/
+void QueueNextLineForTransmit(void)
+// Purpose: Move the next formatted line from the pipeline's send queue
+//          into GlobalString
+// Globals Used: bEndOfFile, bDataReady, dwBytesRead, GlobalString, SendQueue
+{
+  if (SendQueue.pBuf == NULL) // nothing playing
+  {
+    StopPlay();
+    return;
+  }
+
+  // immediate stop-play for mIRC if detaching or user-stop
+  if (PlaySink == SINK_DDE && pPlay->bStop)
+  {
+    StopPlay();
+
+//    if (IsPirchVortec())
+//      Senddde("/display \"Playback Stopped!\"");
+//    else
+//      Senddde("/echo -s \"Playback Stopped!\"");
+
+    return;
+  }
+
+  char* lpSlot;
+
+  // Queue data for Eval
+  if (!bEndOfFile && !bDataReady)
+  {
+    // The formatter thread has already done the work, just don't wait
+    // on it here...
+    if ((lpSlot = QueueReadSlot(&SendQueue, 0)) != NULL)
+    {
+      // A line's other targets don't count as lines
+      if (lpSlot[SLOTTAG] == SLOT_LINE)
+      {
+        dwSendLine++;
+        pPlay->LinesSent = dwSendLine;
+
+        // Anyone following the play asked to hear every so many lines
+        if (pPlay->Notify > 0 && dwSendLine % pPlay->Notify == 0 &&
+                                          hStateEvent[PlaySink] != NULL)
+          SetEvent(hStateEvent[PlaySink]);
+      }
+
+      strcpy(GlobalString, lpSlot);
+      QueueRelease(&SendQueue);
+      bDataReady = true;
+      dwSendTick++;
+    }
+    else if (!QueueDrained(&SendQueue))
+      dwStalls++; // formatter fell behind the timer
+
+    // Finished reading the file?
+    if (QueueDrained(&SendQueue) || bAbortPlay)
+      bEndOfFile = true;
+  }
+
+  // pump data directly via DDE if this is mIRC (or to our IRC server)
+  if (PlaySink == SINK_DDE)
+  {
+    //Start a DDE transaction
+    if (bDataReady)
+    {
+      if (bIrcDirect)
+        SendIrc(GlobalString);
+      else
+        Senddde(GlobalString);
+      bDataReady = false;
+    }
+
+    if (bEndOfFile)
+    {
+      StopPlay();
+
+//      if (IsPirchVortec())
+//        Senddde("/display \"Playback Ended!\"");
+//      else
+//        Senddde("/echo -s \"Playback Ended!\"");
+    }
+  }
+}
+/*********************************************************************/
+bool ReadNextLine(char* pStr)
+// Purpose: Copy the next line of the play-file (in virtual memory) into
+//          pStr (GLOBALSTRINGSIZ chars) - called by the reader thread
+// Globals Used: lpHeap, dwByteCount, dwBytesRead
+// Return: false at end of file
+{
+  DWORD dwStringCount = 0;
+
+  // In follow-mode a line can span a refill of the buffer
+  do
+  {
+    if (ScanLine((char*)lpHeap, dwBytesRead, &dwByteCount,
+                                           pStr, &dwStringCount))
+    {
+      (void)EndLine(pStr, dwStringCount);
+      return true;
+    }
+  } while (FillPlayBuffer());
+
+  // Last line has no line-feed
+  return EndLine(pStr, dwStringCount) != 0;
+}
+/*********************************************************************/
+bool FillPlayBuffer(void)
+// Purpose: Follow-mode - wait for the next piece of a play-file that's
+//          still being written and read it into the heap buffer
+// Globals Used: hFile, lpHeap, dwByteCount, dwBytesRead, bFollowing
+// Return: false at the real end of the file
+{
+  DWORD dwRead;
+  bool bLast;
+
+  if (pInflate != NULL)
+    return InflatePlayBuffer();
+
+  if (!bFollowing)
+    return false;
+
+  for(;;)
+  {
+    // Check this before we read so nothing written just before
+    // ColorFollowEnd() gets lost
+    bLast = pPlay->bFollowEnd;
+
+    if (!ReadFile(hFile, lpHeap, FOLLOWBUFSIZE, &dwRead, NULL))
+      return false;
+
+    if (dwRead)
+    {
+      dwByteCount = 0;
+      dwBytesRead = dwRead;
+      return true;
+    }
+
+    if (bLast || bAbortPlay)
+      return false;
+
+    Sleep(FOLLOWPOLL);
+  }
+}
+/*********************************************************************/
+DWORD WINAPI ReaderThread(LPVOID lpParam)
+// Purpose: First pipeline stage, splits the play-file into lines
+{
+  char* lpSlot;
+
+  while (!bAbortPlay && (lpSlot = QueueWriteSlot(&ReadQueue)) != NULL)
+  {
+    bool bMore;
+
+    // Get the next file on the play-list ready while this one plays
+    PrefetchPlayFile();
+
+    TRACE_BEGIN(TR_SCAN, dwReadLine+1);
+    do
+    {
+      bMore = lpImage != NULL ? ReadImageLine(lpSlot) :
+                                                    ReadNextLine(lpSlot);
+
+      // Done with a new text file? cache its image for next time
+      if (!bMore)
+        CacheStore();
+    } while (!bMore && NextPlayFile());
+    TRACE_END(TR_SCAN, dwReadLine+1);
+
+    if (!bMore)
+      break;
+
+    lpSlot[SLOTTAG] = lpImage != NULL ? SLOT_IMAGE : SLOT_TEXT;
+
+    dwReadLine++;
+
+    QueuePublish(&ReadQueue);
+  }
+
+  QueueClose(&ReadQueue);
+
+  UNREFERENCED_PARAMETER(lpParam);
+  return 0;
+}
+/*********************************************************************/
+DWORD WINAPI FormatThread(LPVOID lpParam)
+// Purpose: Second pipeline stage, turns lines into client commands
+//          (and writes the DDE temp-files) ahead of the timer
+{
+  char* lpIn;
+  char* lpOut;
+  char Render[RENDERSIZ];
+
+  while (!bAbortPlay)
+  {
+    if ((lpIn = QueueReadSlot(&ReadQueue, 50)) == NULL)
+    {
+      if (QueueDrained(&ReadQueue))
+        break;
+      continue;
+    }
+
+    bool bOk = true;
+    char TempFile[MAX_PATH];
+    char Tag = SLOT_LINE;
+
+    dwFormatLine++;
+    TRACE_BEGIN(TR_FORMAT, dwFormatLine);
+
+    // What's the same for every target, once (a pre-formatted line is
+    // already escaped for our client, see RenderText() for stripping it)...
+    int Dialect = bIrcDirect ? DIALECT_IRC :
+                           PlaySink == SINK_DDE ? DTSP_DDE : DTSP_TCL;
+    bool bStrip = pPlay->bStrip;
+    char* tString = RenderString(lpIn, lpIn[SLOTTAG] == SLOT_IMAGE, Render,
+                                                          Dialect, bStrip);
+
+    // ...then a command for each
+    TempFile[0] = NULLCHAR;
+
+    for (int ii = 0; ii < TargetCount && bOk; ii++)
+    {
+      // The server has no status window
+      if (bIrcDirect && !strcmp(Targets[ii], "status"))
+        continue;
+
+      if ((lpOut = QueueWriteSlot(&SendQueue)) == NULL)
+        bOk = false;
+      // play file with no delay!
+      else if ((bOk = FrameString(lpOut, tString, 0, Targets[ii],
+                                     TempFile, Dialect, bStrip)) == true)
+      {
+        lpOut[SLOTTAG] = Tag;
+        Tag = SLOT_MORE;
+        QueuePublish(&SendQueue);
+      }
+    }
+
+    TRACE_END(TR_FORMAT, dwFormatLine);
+
+    QueueRelease(&ReadQueue);
+
+    if (!bOk)
+      break;
+  }
+
+  QueueClose(&SendQueue);
+
+  UNREFERENCED_PARAMETER(lpParam);
+  return 0;
+}
+/*********************************************************************/
+bool StartPipeline(void)
+// Purpose: Create the queues and start the reader and formatter threads
+// Globals Used: ReadQueue, SendQueue, hReaderThread, hFormatThread
+{
+  bAbortPlay = false;
+  dwStalls = 0;
+  llInflateBytes = llInflateTicks = 0;
+
+  if (!QueueCreate(&ReadQueue, CONFIG(CFG_READQUEUE), GLOBALSTRINGSIZ+1) ||
+      !QueueCreate(&SendQueue, CONFIG(CFG_SENDQUEUE), GLOBALSTRINGSIZ+1))
+    return false;
+
+  hReaderThread = CreateThread(NULL, 0, ReaderThread, NULL, 0,
+                                                    &dwReaderThreadID);
+  hFormatThread = CreateThread(NULL, 0, FormatThread, NULL, 0,
+                                                    &dwFormatThreadID);
+
+  return hReaderThread != NULL && hFormatThread != NULL;
+}
+/*********************************************************************/
+bool StopPipeline(void)
+// Purpose: Stop the reader and formatter threads and free the queues
+// Return: false if a thread is still running - it keeps its queues
+{
+  bAbortPlay = true;
+
+  // Wake anything waiting on a queue
+  if (ReadQueue.pBuf != NULL)
+  {
+    SetEvent(ReadQueue.hNotEmpty);
+    SetEvent(ReadQueue.hNotFull);
+  }
+  if (SendQueue.pBuf != NULL)
+  {
+    SetEvent(SendQueue.hNotEmpty);
+    SetEvent(SendQueue.hNotFull);
+  }
+
+  // Never wait while detaching, we hold the loader-lock so a thread
+  // can't finish exiting (ColorShutdown() is where they get stopped)
+  DWORD dwWait = bDetaching ? 0 : INFINITE;
+  bool bGone = true;
+
+  if (hReaderThread != NULL)
+  {
+    if (WaitForSingleObject(hReaderThread, dwWait) != WAIT_OBJECT_0)
+      bGone = false;
+    CloseHandle(hReaderThread);
+    hReaderThread = NULL;
+    dwReaderThreadID = 0;
+  }
+
+  if (hFormatThread != NULL)
+  {
+    if (WaitForSingleObject(hFormatThread, dwWait) != WAIT_OBJECT_0)
+      bGone = false;
+    CloseHandle(hFormatThread);
+    hFormatThread = NULL;
+    dwFormatThreadID = 0;
+  }
+
+  // A thread that may still be in here gets to keep its buffers
+  if (!bGone)
+    return(false);
+
+  QueueDestroy(&ReadQueue);
+  QueueDestroy(&SendQueue);
+  return(true);
+}
+/*********************************************************************/
+bool IsPipelineThread(void)
+{
+  DWORD dwID = GetCurrentThreadId();
+
+  return (dwReaderThreadID != 0 && dwID == dwReaderThreadID) ||
+         (dwFormatThreadID != 0 && dwID == dwFormatThreadID);
+}
+/*********************************************************************/
+bool PrintString(Tcl_Interp* interp, int Sink, int Time)
+// Purpose: One-line mode - format the line in GlobalString for each of
+//          the session's targets and send it, to XiRCON through interp
+//          (SINK_TCL) or by DDE. A play may be going on, so this leaves
+//          its session, targets and transport alone.
+{
+  DTS_Session* pSess = &pDTS_Color->Session[Sink];
+  char OneTargets[MAXTARGETS][TARGETSIZ];
+  char TempFile[MAX_PATH];
+  char Render[RENDERSIZ];
+  int Dialect = Sink == SINK_DDE ? DTSP_DDE : DTSP_TCL;
+  int Count = SplitTargets(pSess->Channel, OneTargets);
+  char* tString = RenderString(GlobalString, false, Render, Dialect,
+                                                            pSess->bStrip);
+  bool bRet = true;
+
+  TempFile[0] = NULLCHAR;
+
+  for (int ii = 0; ii < Count && bRet; ii++)
+  {
+    if ((bRet = FrameString(GlobalString, tString, Time, OneTargets[ii],
+                              TempFile, Dialect, pSess->bStrip)) == true)
+    {
+      if (Sink == SINK_TCL)
+        Sendtcl(interp, GlobalString);
+      else
+        Senddde(GlobalString);
+    }
+  }
+
+  return bRet;
+}
+/*********************************************************************/
+char* RenderString(char* pStr, bool bImage, char* pBuf, int Dialect,
+                                                              bool bStrip)
+// Purpose: The part of turning a line in pStr (GLOBALSTRINGSIZ chars)
+//          into a command that's the same for every target - transcode
+//          it in-place (not an image line, that was done when it was
+//          built), then strip and escape it (see RenderText())
+// Args: pBuf (RENDERSIZ chars) to render it in, Dialect, bStrip
+// Return: the rendered text in pBuf
+{
+  UINT length = strlen(pStr);
+
+  if (!bImage)
+    length = TranscodeString(pStr, length);
+
+  return RenderText(pStr, length, bImage, pBuf, Dialect, bStrip);
+}
+/*********************************************************************/
+bool FrameString(char* pStr, char* tString, int Time, char* pTarget,
+                                char* pTempFile, int Dialect, bool bStrip)
+// Purpose: Wrap the escaped text in tString in the command that sends
+//          it to pTarget (writing the DDE temp-file) and put that
+//          command in pStr (GLOBALSTRINGSIZ chars). tString is from
+//          RenderString(), with a char free before it.
+// Args: pTempFile (MAX_PATH chars) is the temp-file a line's other
+//       targets already wrote, or "" and we write it, Dialect and
+//       bStrip as tString was rendered with
+{
+  // Only mIRC and friends get the line through a temp-file
+  if (Dialect != DTSP_DDE)
+  {
+    FrameCommand(pStr, tString, Time, pTarget, NULL, Dialect, bStrip);
+    return true;
+  }
+
+  char* FileNameBuf;
+
+  // Allocate file-name buffer
+  if ((FileNameBuf = (char*)malloc(MAX_PATH)) == NULL)
+  {
+    ErrorHandler(ERR_MEMORY, "Error creating filename buffer");
+    return false;
+  }
+
+  char* pFile = FileNameBuf;
+
+  if (!strcmp("status", stolower(pTarget)))
+  {
+    // Writing one line to a file and using the /play command
+    // eliminates the mIRC bug of stripping out spaces...
+    //
+    // ORIGINALLY, setting UseFile triggered mode of writing to a
+    // temp-file... but NOW, YahCoLoRiZe can locally do /msg driven
+    // playback or send just the /play file command when UseDll is
+    // unchecked.  When UseDll is checked, we want to have two modes
+    // in the dll.  If UseFile is checked, we want to play data
+    // from the file written by YahCoLoRiZe (a full file), one line
+    // at a time via /play and through a temp-file here.
+    //
+    // If UseFile us NOT checked, YahCoLoRiZe does not write a
+    // big file for us to play here, instead it used a "one-line"
+    // mode (via setting PlayTime < 0)... but HERE, we still
+    // want to buffer that text through a temp-file to keep
+    // mIRC/PIRCH from stripping spaces out...
+    //if (pPlay->bUseFile)
+
+    bool bWrote;
+
+    if (IsPirchVortec())
+    {
+      // Pirch bug seems to require a leading CTRL_K or else the first
+      // color-sequence CTRL_K is skipped... (in the char RenderString()
+      // left free, other targets don't want it)
+      tString[-1] = CTRL_K;
+      bWrote = DTS_WriteLineToFile(FileNameBuf, tString-1);
+    }
+    else
+      bWrote = DTS_WriteLineToFile(FileNameBuf, tString);
+
+    if (!bWrote)
+    {
+      ErrorHandler(ERR_TEMPFILE, "Error writing main temp file");
+      free(FileNameBuf);
+      return false;
+    }
+  }
+  else
+  {
+    // Writing one to a temp file and using the /play command
+    // eliminates the mIRC bug of stripping out spaces... (once,
+    // every channel can play the same one)
+    if (pTempFile[0] == NULLCHAR &&
+                        DTS_WriteLineToFile(pTempFile, tString) == false)
+    {
+      pTempFile[0] = NULLCHAR;
+      ErrorHandler(ERR_TEMPFILE, "Error writing mIRC temp file");
+      free(FileNameBuf);
+      return false;
+    }
+
+    pFile = pTempFile;
+  }
+
+  FrameCommand(pStr, tString, Time, pTarget, pFile, Dialect, bStrip);
+
+  free(FileNameBuf);
+  return true;
+}
+/*********************************************************************/
+UINT TranscodeString(char* pStr, UINT length)
+// Purpose: Convert a UTF-8 line (GLOBALSTRINGSIZ chars) in-place to the
+//          client's code-page. ASCII lines, lines that aren't UTF-8 (plain
+//          ANSI) and UTF-8 clients are left alone.
+// Shared Memory Vars: pDTS_Color->CodePage
+// Return: new length
+{
+  WCHAR wBuf[GLOBALSTRINGSIZ];
+  UINT CodePage = pDTS_Color->CodePage;
+
+  // Drop a byte-order-mark (first line of a UTF-8 file)
+  if (length >= 3 && !memcmp(pStr, "\xef\xbb\xbf", 3))
+  {
+    memmove(pStr, pStr+3, length-2);
+    length -= 3;
+  }
+
+  if (CodePage == CP_UTF8 || IsAscii(pStr, length) || !IsUtf8(pStr, length))
+    return length;
+
+  int wLen = MultiByteToWideChar(CP_UTF8, 0, pStr, length,
+                                                   wBuf, GLOBALSTRINGSIZ);
+  if (wLen <= 0)
+    return length;
+
+  // Make sure it fits before we write over pStr
+  int aLen = WideCharToMultiByte(CodePage, 0, wBuf, wLen, NULL, 0,
+                                                             NULL, NULL);
+  if (aLen <= 0 || (UINT)aLen > length)
+    return length;
+
+  (void)WideCharToMultiByte(CodePage, 0, wBuf, wLen, pStr, aLen, NULL, NULL);
+  pStr[aLen] = NULLCHAR;
+  return aLen;
+}
+/*********************************************************************/
+HANDLE OpenPlayFile(char* pFilename, DWORD dwShare)
+// Purpose: Open a play-file for reading, the path may be UTF-8 so
+//          YahCoLoRiZe Unicode no longer needs to pass the short path
+{
+  UINT length = strlen(pFilename);
+
+  if (!IsAscii(pFilename, length) && IsUtf8(pFilename, length))
+  {
+    WCHAR wPath[sizeof(pPlay->Filename)];
+
+    if (MultiByteToWideChar(CP_UTF8, 0, pFilename, -1, wPath,
+                                  sizeof(pPlay->Filename)) > 0)
+      return CreateFileW(wPath, GENERIC_READ, dwShare, NULL,
+                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  }
+
+  return CreateFile(pFilename, GENERIC_READ, dwShare, NULL,
+                          OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+}
+/*********************************************************************/
+bool DTS_WriteLineToFile(char* FileNameBuf, char* tString)
+// We write one line at a time to a file then play that file
+// via a DDE command "/playfile" for PIRCH, "/play" for mIRC.
+// We do this because sending using /msg will strip spaces...
+// playing a file sends the line as-is (good for ascii-art,
+// lyrics, etc)
+{
+  static LONG Unique = 0;
+
+  HANDLE hWriteFile;
+  unsigned long BytesWritten;
+
+  GetTempPath(MAX_PATH, FileNameBuf);
+
+  // Create set of TEMPFILE_COUNT temp files (the formatter thread calls
+  // this while the timer may be doing a one-line send)
+  int n = (int)((DWORD)InterlockedIncrement(&Unique) % TEMPFILE_COUNT);
+
+  sprintf(FileNameBuf+strlen(FileNameBuf), TEMPFILE_FMT, TEMPFILE_BASE+n);
+
+  TRACE_BEGIN(TR_TEMPFILE, dwFormatLine);
+
+  // Try to create in virtual memory... FILE_ATTRIBUTE_TEMPORARY
+  if ((hWriteFile = CreateFile(FileNameBuf,
+        GENERIC_WRITE,FILE_SHARE_READ,NULL,CREATE_ALWAYS,
+            FILE_ATTRIBUTE_TEMPORARY,NULL)) == INVALID_HANDLE_VALUE)
+  {
+    TRACE_END(TR_TEMPFILE, dwFormatLine);
+    return(false);
+  }
+
+  bool bRet = WriteFile(hWriteFile, tString,
+            strlen(tString)+1, &BytesWritten, NULL) != 0;
+
+  CloseHandle(hWriteFile);
+  TRACE_END(TR_TEMPFILE, dwFormatLine);
+  return bRet;
+}
+/*********************************************************************/
+/*********************************************************************/
+/*                        Play-Image Functions                       */
+/*********************************************************************/
+/*********************************************************************/
+
+bool IsPlayImage(HANDLE hPlayFile)
+// Purpose: See if an open play-file starts with DTSP_MAGIC (leaves the
+//          file-pointer at the start)
+{
+  char Magic[sizeof(DTSP_MAGIC)-1];
+  DWORD dwRead;
+
+  bool bRet = ReadFile(hPlayFile, Magic, sizeof(Magic), &dwRead, NULL) &&
+       dwRead == sizeof(Magic) && !memcmp(Magic, DTSP_MAGIC, sizeof(Magic));
+
+  (void)SetFilePointer(hPlayFile, 0, NULL, FILE_BEGIN);
+  return bRet;
+}
+/*********************************************************************/
+bool MapPlayImage(HANDLE hPlayFile, DWORD dwSize)
+// Purpose: Map a pre-formatted play-file read-only
+// Globals Used: hImageMap, lpImage, dwImageSize, dwImageLine
+{
+  if ((hImageMap = CreateFileMapping(hPlayFile, NULL, PAGE_READONLY,
+                                                 0, 0, NULL)) == NULL)
+    return false;
+
+  if ((lpImage = (char*)MapViewOfFile(hImageMap, FILE_MAP_READ,
+                                                   0, 0, 0)) == NULL)
+    return false;
+
+  dwImageSize = dwSize;
+  dwImageLine = 0;
+
+  return CheckPlayImage(lpImage, dwImageSize);
+}
+/*********************************************************************/
+void UnmapPlayImage(void)
+{
+  if (lpImage != NULL)
+  {
+    (void)UnmapViewOfFile(lpImage);
+    lpImage = NULL;
+  }
+
+  if (hImageMap != NULL)
+  {
+    (void)CloseHandle(hImageMap);
+    hImageMap = NULL;
+  }
+}
+/*********************************************************************/
+bool ReadImageLine(char* pStr)
+// Purpose: Copy the next line's payload for our client from the mapped
+//          image to pStr (GLOBALSTRINGSIZ chars) - called by the reader
+//          thread in place of ReadNextLine()
+// Return: false at end of file
+{
+  if (!ImageLine(lpImage, dwImageSize, dwImageLine,
+         PlaySink == SINK_DDE && !bIrcDirect ? DTSP_DDE : DTSP_TCL, pStr))
+    return false;
+
+  dwImageLine++;
+  return true;
+}
+/*********************************************************************/
+int CountProcessors(void)
+// Return: processors SplitChunks() can give a chunk to
+{
+  SYSTEM_INFO si;
+
+  GetSystemInfo(&si);
+  return si.dwNumberOfProcessors;
+}
+/*********************************************************************/
+bool RunChunks(DTS_Chunk* pChunks, int Count,
+                                        LPTHREAD_START_ROUTINE lpWork)
+// Purpose: Run lpWork on every chunk, one thread each (the first one
+//          on this thread) and wait for them all
+// Return: false if any of them failed
+{
+  HANDLE hThreads[MAXWORKERS];
+  DWORD dwID;
+  int ii;
+
+  for (ii = 1; ii < Count; ii++)
+    hThreads[ii] = CreateThread(NULL, 0, lpWork, &pChunks[ii], 0, &dwID);
+
+  (void)lpWork(&pChunks[0]);
+
+  bool bRet = pChunks[0].bOk;
+
+  for (ii = 1; ii < Count; ii++)
+  {
+    if (hThreads[ii] == NULL)
+      // Couldn't start it, do it here
+      (void)lpWork(&pChunks[ii]);
+    else
+    {
+      WaitForSingleObject(hThreads[ii], INFINITE);
+      CloseHandle(hThreads[ii]);
+    }
+
+    if (!pChunks[ii].bOk)
+      bRet = false;
+  }
+
+  return bRet;
+}
+/*********************************************************************/
+bool ConvertPlayFile(LPTSTR InFile, LPTSTR OutFile)
+// Purpose: Write a pre-formatted copy of text play-file InFile to
+//          OutFile (which can then be played like any other play-file)
+{
+  HANDLE hIn, hOut;
+  DWORD dwSize, dwSizeHigh, dwRead, dwWritten, dwImageSize;
+  char* lpText;
+  char* lpImg;
+
+  if ((hIn = OpenPlayFile(InFile, FILE_SHARE_READ)) == INVALID_HANDLE_VALUE)
+    return false;
+
+  dwSize = GetFileSize(hIn, &dwSizeHigh);
+
+  if (dwSizeHigh || dwSize == 0 || dwSize == INVALID_FILE_SIZE ||
+                           (lpText = (char*)malloc(dwSize)) == NULL)
+  {
+    CloseHandle(hIn);
+    return false;
+  }
+
+  bool bRet = ReadFile(hIn, lpText, dwSize, &dwRead, NULL) &&
+                                                   dwRead == dwSize;
+  CloseHandle(hIn);
+
+  if (bRet)
+    bRet = BuildPlayImage(lpText, dwSize, &lpImg, &dwImageSize);
+
+  free(lpText);
+
+  if (!bRet)
+    return false;
+
+  if ((hOut = CreateFile(OutFile, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                    FILE_ATTRIBUTE_NORMAL, NULL)) == INVALID_HANDLE_VALUE)
+  {
+    free(lpImg);
+    return false;
+  }
+
+  bRet = WriteFile(hOut, lpImg, dwImageSize, &dwWritten, NULL) &&
+                                              dwWritten == dwImageSize;
+  CloseHandle(hOut);
+  free(lpImg);
+
+  return bRet;
+}
+/*********************************************************************/
+/*********************************************************************/
+/*                         Planner Functions                         */
+/*********************************************************************/
+/*********************************************************************/
+
+bool PlanFile(LPTSTR Channel, LPTSTR Filename, int Time, int Dialect,
+                                                           char* pResult)
+// Purpose: Count what playing Filename to Channel every Time ms would
+//          send, into pResult (PLANRESULTSIZ chars, see CmdPlan())
+{
+  HANDLE hIn;
+  DWORD dwSize, dwSizeHigh, dwRead;
+  char* lpText;
+  char Chan[128];
+  DTS_Chunk Chunks[MAXWORKERS];
+  int Count, ii;
+
+  strncpy(Chan, Channel, sizeof(Chan)-1);
+  Chan[sizeof(Chan)-1] = NULLCHAR;
+  (void)stolower(Chan);
+
+  if ((hIn = OpenPlayFile(Filename, FILE_SHARE_READ|FILE_SHARE_WRITE)) ==
+                                                     INVALID_HANDLE_VALUE)
+    return false;
+
+  dwSize = GetFileSize(hIn, &dwSizeHigh);
 
-  pDTS_Color->bStop = false; // flush any pending commands
-  pDTS_Color->bPause = false;
-  pDTS_Color->bResume = false;
+  if (dwSizeHigh || dwSize == 0 || dwSize == INVALID_FILE_SIZE ||
+                           (lpText = (char*)malloc(dwSize)) == NULL)
+  {
+    CloseHandle(hIn);
+    return false;
+  }
 
-  pDTS_Color->bUseFile = bUseFile;
+  bool bRet = ReadFile(hIn, lpText, dwSize, &dwRead, NULL) &&
+                                                   dwRead == dwSize;
+  CloseHandle(hIn);
 
-  if (Service == NULL)
+  // Count each line, pre-formatted or not
+  if (bRet && CheckPlayImage(lpText, dwSize))
   {
-    // XiRCON -- use TCL to communicate
-    pDTS_Color->bUseDDE = false;
+    memset(&Chunks[0], 0, sizeof(DTS_Chunk));
+    Chunks[0].Dialect = Dialect;
+    Count = 1;
+    bRet = PlanImage(lpText, dwSize, &Chunks[0]);
+  }
+  else if (bRet)
+  {
+    Count = SplitChunks(lpText, dwSize, Chunks);
 
-    // Buffer the text-line...
-    if (PlayTime < 0)
+    for (ii = 0; ii < Count; ii++)
     {
-      strcpy(pDTS_Color->FiFo[pDTS_Color->FiFoIn], pDTS_Color->Filename);
-
-      if (++pDTS_Color->FiFoIn >= FIFOSIZE)
-        pDTS_Color->FiFoIn = 0;
+      Chunks[ii].Dialect = Dialect;
+      Chunks[ii].pwServer = NULL;
     }
+
+    bRet = RunChunks(Chunks, Count, ChunkPlanThread);
   }
-  else // use DDE to communicate
-  {
-    pDTS_Color->bUseDDE = true;
+  else
+    Count = 0;
 
-    if (strlen(Service) >= sizeof(pDTS_Color->Service))
-      Service[sizeof(pDTS_Color->Service)-1] = '\0';
+  if (bRet)
+  {
+    DWORD dwLines = 0, dwWire = 0, dwServer = 0, dwOverlong = 0;
+    DWORD Longest[PLANLONGEST], LongestBytes[PLANLONGEST];
+    DWORD dwFlood = 0, dwSafe = 0;
+    bool bStatus = !strcmp("status", Chan);
 
-    strcpy(pDTS_Color->Service, Service);
+    // "PRIVMSG <channel> :<text>\r\n" at the server, nothing if it's
+    // the status window
+    DWORD dwPrivmsg = bStatus ? 0 : PlanOverhead(DIALECT_IRC, Chan, Time);
 
-    lpDdeProc = MakeProcInstance((FARPROC) DdeCallback, hInst);
+    memset(Longest, 0, sizeof(Longest));
+    memset(LongestBytes, 0, sizeof(LongestBytes));
 
-    //Initialize a DDE conversation
-    if (DdeInitialize(&idInst, (PFNCALLBACK) lpDdeProc,
-        CBF_FAIL_EXECUTES|CBF_FAIL_POKES, 0) != DMLERR_NO_ERROR)
+    for (ii = 0; ii < Count; ii++)
     {
-      ErrorHandler("Unable to initialize DDEML library!");
-      return(false);
-    }
+      for (DWORD jj = 0; jj < Chunks[ii].dwLines; jj++)
+      {
+        DWORD dwBytes = bStatus ? 0 : dwPrivmsg + Chunks[ii].pwServer[jj];
 
-    //Set the application service and topic
-    hszService = DdeCreateStringHandle(idInst, pDTS_Color->Service, CP_WINANSI);
-    hszItem = DdeCreateStringHandle(idInst, "active", CP_WINANSI);
+        dwLines++;
 
-    if (IsPirchVortec())
-      hszTopic = DdeCreateStringHandle(idInst, "IRC_COMMAND", CP_WINANSI);
-    else
-      hszTopic = DdeCreateStringHandle(idInst, "COMMAND", CP_WINANSI);
+        if (dwBytes > IRCLINESIZ)
+        {
+          dwOverlong++;
+          dwBytes = IRCLINESIZ;
+        }
 
-    // Here we only want to call StartLocalFilePlay if we are going
-    // to be reading a master file (via our timer) that
-    // was written by YahCoLoRiZE.  If this is a "one-line"
-    // mode (text line is in the file-name string) we want to
-    // do a PrintString directly... PlayTime is < 0 to flag
-    // this special mode.
-    if (PlayTime < 0)
-    {
-      strcpy(GlobalString, Filename);
-      PrintString(100); // Write the text to a temp-file and format GlobalString
+        dwServer += dwBytes;
+
+        // Keep the longest, longest first
+        for (int kk = 0; kk < PLANLONGEST; kk++)
+        {
+          if (dwBytes > LongestBytes[kk])
+          {
+            for (int mm = PLANLONGEST-1; mm > kk; mm--)
+            {
+              Longest[mm] = Longest[mm-1];
+              LongestBytes[mm] = LongestBytes[mm-1];
+            }
+
+            Longest[kk] = dwLines;
+            LongestBytes[kk] = dwBytes;
+            break;
+          }
+        }
+      }
 
-      // Send the /play tempfilename string to client
-      Senddde(GlobalString);
-      pDTS_Color->bStart = false;
+      dwWire += Chunks[ii].dwWire;
     }
-    else
+
+    dwWire += dwLines * PlanOverhead(Dialect, Chan, Time);
+
+    if (!bStatus)
     {
-//      if (IsPirchVortec())
-//        Senddde("/display \"Playback Started!\"");
-//      else
-//        Senddde("/echo -s \"Playback Started!\"");
+      dwFlood = PlanFlood(Chunks, Count, dwPrivmsg, Time);
+
+      // Shortest delay the server takes without flooding (0 = none is
+      // long enough)
+      if (PlanFlood(Chunks, Count, dwPrivmsg, FLOODSEARCHMAX) == 0)
+      {
+        DWORD dwLo = 0, dwHi = FLOODSEARCHMAX;
+
+        while (dwLo < dwHi)
+        {
+          DWORD dwMid = (dwLo + dwHi) / 2;
+
+          if (PlanFlood(Chunks, Count, dwPrivmsg, dwMid) == 0)
+            dwHi = dwMid;
+          else
+            dwLo = dwMid + 1;
+        }
 
-      (void)StartLocalFilePlay(NULL);  // Kick off the timer
+        dwSafe = dwLo;
+      }
     }
+
+    int Len = sprintf(pResult,
+      "lines %lu bytes %lu server %lu time %lu flood %lu safe %lu "
+      "overlong %lu longest", dwLines, dwWire, dwServer,
+                     dwLines ? (dwLines-1) * Time : 0, dwFlood, dwSafe,
+                                                            dwOverlong);
+
+    for (ii = 0; ii < PLANLONGEST && Longest[ii] != 0; ii++)
+      Len += sprintf(pResult + Len, " %lu:%lu", Longest[ii],
+                                                       LongestBytes[ii]);
   }
 
-  return true;
+  for (ii = 0; ii < Count; ii++)
+    if (Chunks[ii].pwServer != NULL)
+      free(Chunks[ii].pwServer);
+
+  free(lpText);
+  return bRet;
 }
 /*********************************************************************/
-bool ColorStop(void)
-// Purpose: Called from Colorizer.exe to stop playback.
-// Shared Memory: pDTS_Color structure
+bool PlanImage(char* lpImg, DWORD dwSize, DTS_Chunk* pChunk)
+// Purpose: PlanFile() for a pre-formatted play-file - it's already
+//          escaped, just measure the payloads
 {
-  if (pDTS_Color == NULL || pDTS_Color->bStop)
-    return(false);
+  DTSP_Header* pHdr = (DTSP_Header*)lpImg;
+  DWORD* pOffsets = (DWORD*)(lpImg + pHdr->OffsetTable);
 
-// DON'T CLEAR bStart!!!!  Tcl polling delay means
-// a pending start could be (and was being) aborted...
-//  pDTS_Color->bStart = false; // flush any pending commands
+  if ((pChunk->pwServer = (WORD*)malloc((pHdr->Lines+1)*sizeof(WORD)))
+                                                                   == NULL)
+    return false;
+
+  // Same payload ReadImageLine() plays, mIRC's is the text as it is
+  // (what the server sees)
+  int Payload = pChunk->Dialect == DTSP_DDE ? DTSP_DDE : DTSP_TCL;
 
-  pDTS_Color->bPause = false;
-  pDTS_Color->bResume = false;
+  pChunk->dwLines = pHdr->Lines;
+  pChunk->dwWire = 0;
 
-  if (pDTS_Color->bUseDDE)
+  for (DWORD ii = 0; ii < pHdr->Lines; ii++)
   {
-    if  (TimerID != NULL)
+    DWORD dwWire = 0, dwServer = 0;
+    DWORD dwOffset;
+    char* pEnd;
+
+    if ((dwOffset = pOffsets[ii*DTSP_DIALECTS + Payload]) < dwSize)
     {
-      StopPlay();
+      pEnd = (char*)memchr(lpImg + dwOffset, NULLCHAR, dwSize - dwOffset);
+      dwWire = pEnd != NULL ? (DWORD)(pEnd - (lpImg + dwOffset)) :
+                                                        dwSize - dwOffset;
+    }
 
-//      if (IsPirchVortec())
-//        Senddde("/display \"Playback Stopped!\"");
-//      else
-//        Senddde("/echo -s \"Playback Stopped!\"");
+    if ((dwOffset = pOffsets[ii*DTSP_DIALECTS + DTSP_DDE]) < dwSize)
+    {
+      pEnd = (char*)memchr(lpImg + dwOffset, NULLCHAR, dwSize - dwOffset);
+      dwServer = pEnd != NULL ? (DWORD)(pEnd - (lpImg + dwOffset)) :
+                                                        dwSize - dwOffset;
     }
+
+    // Blank line, the server gets a lone CTRL_K
+    if (dwServer == 2 && !memcmp(lpImg + dwOffset, "\r\n", 2))
+      dwServer = 1;
+
+    pChunk->dwWire += dwWire;
+    pChunk->pwServer[ii] = (WORD)(dwServer > 0xFFFF ? 0xFFFF : dwServer);
   }
-  else
-    pDTS_Color->bStop = true;
 
-  return(true);
+  return true;
 }
 /*********************************************************************/
-bool ColorPause(void)
-// Purpose: Called from Colorizer.exe to pause playback.
-// Shared Memory: pDTS_Color structure
+DWORD WINAPI ChunkPlanThread(LPVOID lpParam)
+// Purpose: PlanFile() for one chunk of a text play-file - the same
+//          line and code-page passes as ChunkCountThread() but only
+//          counting what the escaping would add
 {
-  if (pDTS_Color == NULL || pDTS_Color->bPause)
-    return(false);
+  DTS_Chunk* pChunk = (DTS_Chunk*)lpParam;
+  char* pLine;
+  DWORD dwPos, dwLen, dwMax;
+
+  pChunk->bOk = false;
+
+  // Room for a line-count per line-feed, plus one without
+  for (dwPos = 0, dwMax = 1; dwPos < pChunk->dwSize; dwPos++)
+    if (pChunk->lpText[dwPos] == '\n')
+      dwMax++;
+
+  if ((pChunk->pwServer = (WORD*)malloc(dwMax*sizeof(WORD))) == NULL)
+    return 0;
+
+  if ((pLine = (char*)malloc(GLOBALSTRINGSIZ)) == NULL)
+    return 0;
 
-  pDTS_Color->bStop = false; // flush any pending commands
-  pDTS_Color->bResume = false;
-  pDTS_Color->bStart = false;
+  dwPos = pChunk->dwLines = pChunk->dwWire = 0;
 
-  if (pDTS_Color->bUseDDE)
+  while (pChunk->dwLines < dwMax &&
+               NextTextLine(pChunk->lpText, pChunk->dwSize, &dwPos, pLine))
   {
-    if (IsPirchVortec())
-      Senddde("/display \"Playback Paused!\"");
-    else
-      Senddde("/echo -s \"Playback Paused!\"");
+    // A blank line goes as "\r\n" (a lone CTRL_K to the server)
+    if ((dwLen = TranscodeString(pLine, strlen(pLine))) == 0)
+    {
+      pChunk->dwWire += 2;
+      pChunk->pwServer[pChunk->dwLines++] = 1;
+      continue;
+    }
 
-    bPaused = true;
+    pChunk->dwWire += EscapedLength(pLine, dwLen, pChunk->Dialect);
+    pChunk->pwServer[pChunk->dwLines++] =
+                              (WORD)(dwLen > 0xFFFF ? 0xFFFF : dwLen);
   }
-  else
-    pDTS_Color->bPause = true;
 
-  return(true);
+  free(pLine);
+
+  pChunk->bOk = true;
+  return 0;
 }
 /*********************************************************************/
-bool ColorResume(void)
-// Purpose: Called from Colorizer.exe to resume playback
-// after pausing.
-// Shared Memory: pDTS_Color structure
+DWORD PlanOverhead(int Dialect, char* pChannel, int Time)
+// Purpose: Bytes FrameString() wraps around each line's text for the
+//          client (for mIRC the /play of the temp-file)
 {
-  if (pDTS_Color == NULL || pDTS_Color->bResume)
-    return(false);
+  char Buf[MAX_PATH+300];
+  char Path[MAX_PATH+32];
+  bool bStatus = !strcmp("status", pChannel);
 
-  pDTS_Color->bStop = false; // flush any pending commands
-  pDTS_Color->bPause = false;
-  pDTS_Color->bStart = false;
+  if (Dialect == DIALECT_IRC)
+    return sprintf(Buf, "PRIVMSG %s :\r\n", pChannel);
 
-  if (pDTS_Color->bUseDDE)
-  {
-    if (IsPirchVortec())
-      Senddde("/display \"Playback Resumed!\"");
-    else
-      Senddde("/echo -s \"Playback Resumed!\"");
+  if (Dialect == DTSP_TCL)
+    return bStatus ? sprintf(Buf, "echo \"\" status") :
+                     sprintf(Buf, "/msg %s \"\"", pChannel);
 
-    bPaused = false;
-  }
-  else
-    pDTS_Color->bResume = true;
+  DWORD dwLen = GetTempPath(MAX_PATH, Path);
 
-  return(true);
+  if (dwLen == 0 || dwLen >= MAX_PATH)
+    dwLen = 0;
+
+  sprintf(Path + dwLen, TEMPFILE_FMT, TEMPFILE_BASE);
+
+  return bStatus ? sprintf(Buf, "/play -s %s %i", Path, Time) :
+                   sprintf(Buf, "/play %s %s %i", pChannel, Path, Time);
 }
 /*********************************************************************/
-int Colorize_Init(Tcl_Interp *interp)
-// Called by XiRC when it loads this DLL
+DWORD PlanFlood(DTS_Chunk* pChunks, int Count, DWORD dwOverhead,
+                                                            DWORD dwTime)
+// Purpose: Play the lines' server bytes against the ircd flood rule
+//          (see FLOODLINE) a line every dwTime ms
+// Return: first line (from 1) the server would hold back, 0 if none
 {
-	if (Tcl_CreateCommand && Tcl_AppendResult && Tcl_Eval)
+  LONGLONG llNow = 0, llClock = 0;
+  DWORD dwLine = 0;
+
+  for (int ii = 0; ii < Count; ii++)
   {
-		(*Tcl_CreateCommand)(interp, "DTS_play", CmdPlay, NULL, NULL);
-		(*Tcl_CreateCommand)(interp, "DTS_poll", CmdPoll, NULL, NULL);
-		(*Tcl_CreateCommand)(interp, "DTS_version", CmdVersion, NULL, NULL);
-		(*Tcl_CreateCommand)(interp, "DTS_ex", CmdEx, NULL, NULL);
-		(*Tcl_CreateCommand)(interp, "DTS_chan", CmdChan, NULL, NULL);
-  	return TCL_OK;
+    for (DWORD jj = 0; jj < pChunks[ii].dwLines; jj++)
+    {
+      DWORD dwBytes = dwOverhead + pChunks[ii].pwServer[jj];
+
+      if (dwBytes > IRCLINESIZ)
+        dwBytes = IRCLINESIZ;
+
+      dwLine++;
+
+      if (llClock < llNow)
+        llClock = llNow;
+
+      llClock += FLOODLINE + (LONGLONG)dwBytes * 1000 / FLOODBYTES;
+
+      if (llClock - llNow > FLOODLIMIT)
+        return dwLine;
+
+      llNow += dwTime;
+    }
   }
 
-	return TCL_ERROR;
-}
-/*********************************************************************/
-LPTSTR Colorize_Version(void)
-// Purpose: Called from Colorizer.exe to request version.
-{
-  return DTS_VERSION;
+  return 0;
 }
 /*********************************************************************/
 /*********************************************************************/
-/*                         General Functions                         */
+/*                           IRC Functions                           */
 /*********************************************************************/
 /*********************************************************************/
 
-int StartLocalFilePlay(Tcl_Interp *interp)
+bool IrcConnect(LPTSTR Server, int Port, LPTSTR Nick)
+// Purpose: Start connecting to an IRC server (IrcThread() registers
+//          and answers PINGs), drops any connection we already have
+// Globals Used: IrcSocket, hIrcThread, IrcState, IrcServer, etc.
 {
-  DWORD dwFileSizeHigh;
-  DWORD dwFileSize;
+  WSADATA wsa;
+  DWORD dwID;
 
-  pDTS_Color->bStart = false; // Do this to prevent reentrant call
-                              // from DoOneEvent
-  bPaused = false;
+  IrcDisconnect();
 
-  if (pDTS_Color->Filename != NULL && pDTS_Color->Channel != NULL)
+  if (Server == NULL || Nick == NULL || *Server == NULLCHAR ||
+                                      *Nick == NULLCHAR || Port <= 0)
+    return false;
+
+  if (WSAStartup(MAKEWORD(1,1), &wsa) != 0)
+    return false;
+
+  if ((IrcSocket = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP)) ==
+                                                         INVALID_SOCKET)
   {
-    StopPlay(); // Stop any play in-progress
+    WSACleanup();
+    return false;
+  }
 
-    // Open file
-    if ((hFile = CreateFile(pDTS_Color->Filename,
-            GENERIC_READ,FILE_SHARE_READ,NULL,OPEN_EXISTING,
-                FILE_ATTRIBUTE_NORMAL,NULL)) == INVALID_HANDLE_VALUE)
-    {
-      ErrorHandler("Could not open file.",pDTS_Color->Filename);
-    	return TCL_ERROR;
-    }
+  strncpy(IrcServer, Server, sizeof(IrcServer)-1);
+  IrcServer[sizeof(IrcServer)-1] = NULLCHAR;
+  strncpy(IrcNick, Nick, sizeof(IrcNick)-2); // room for a '_'
+  IrcNick[sizeof(IrcNick)-2] = NULLCHAR;
+  IrcPort = Port;
+  IrcJoined[0] = NULLCHAR;
 
-    // Determine file's size
-    dwFileSize = GetFileSize(hFile,&dwFileSizeHigh);
-    if (dwFileSizeHigh)
-    {
-      ErrorHandler("File is too big!");
-    	return TCL_ERROR;
-    }
+  InitializeCriticalSection(&IrcLock);
+  IrcState = IRC_CONNECTING;
 
-    if (dwFileSize == 0)
-    {
-      ErrorHandler("Play file is empty!");
-    	return TCL_ERROR;
-    }
+  if ((hIrcThread = CreateThread(NULL, 0, IrcThread, NULL, 0, &dwID)) == NULL)
+  {
+    IrcDisconnect();
+    return false;
+  }
 
-    // Create a heap in virtual memory
-    if ((hHeap = HeapCreate(0,dwFileSize,0)) == INVALID_HANDLE_VALUE)
-    {
-      ErrorHandler("Cannot create heap!");
-    	return TCL_ERROR;
-    }
+  return true;
+}
+/*********************************************************************/
+void IrcDisconnect(void)
+// Purpose: Say goodbye to the IRC server (if we're connected) and clean
+//          up the socket and its thread
+{
+  if (IrcSocket == INVALID_SOCKET)
+    return;
 
-    // Allocate space for the file
-    if ((lpHeap = HeapAlloc(hHeap,0,dwFileSize)) == NULL)
-    {
-      ErrorHandler("Insufficient heap space!");
-    	return TCL_ERROR;
-    }
+  // Tell IrcThread() it's on purpose
+  bool bReady = IrcState == IRC_READY;
+  IrcState = IRC_OFF;
 
-    // Read the entire file into virtual memory
-    (void)ReadFile(hFile, lpHeap, dwFileSize, &dwBytesRead, NULL);
-    if (dwBytesRead != dwFileSize)
-    {
-      ErrorHandler("Could not read entire file!");
-    	return TCL_ERROR;
-    }
+  if (bReady)
+    (void)IrcSend("QUIT :YahCoLoRiZe");
 
-    // Finished with the file
-    CloseHandle(hFile);
+  // Wakes IrcThread() out of recv()
+  (void)closesocket(IrcSocket);
+  IrcSocket = INVALID_SOCKET;
 
-    // Initialize vars and flags
-    bDataReady = bEndOfFile = bPaused = false;
-    dwByteCount = 0; // Counts total bytes processed from heap buffer
+  // Never wait while detaching (see StopPipeline())
+  bool bGone = true;
 
-    // Go ahead and queue first line
-    QueueNextLineForTransmit();
+  if (hIrcThread != NULL)
+  {
+    if (WaitForSingleObject(hIrcThread, bDetaching ? 0 : INFINITE) !=
+                                                          WAIT_OBJECT_0)
+      bGone = false;
+    CloseHandle(hIrcThread);
+    hIrcThread = NULL;
+  }
 
-    // Begin timer thread
-    TimerID = SetTimer(NULL,      // no main window handle in a DLL
-          0,                      // timer identifier
-          pDTS_Color->PlayTime,   // delay in ms
-          (TIMERPROC) OnTimer1);  // timer callback
+  // IrcThread() may still be in IrcSend(), leave it the lock and winsock
+  if (!bGone)
+    return;
 
-    // Fetch and send text lines on timer event, yielding to XiRC
-    // XiRC only calls our polling routine once per second,
-    // but we can send data to a chat window much faster, so this
-    // code gates data to XiRC at a programmable rate set in Colorizer.exe
-    // while still allowing other XiRC scripts to run.
-    if (!pDTS_Color->bUseDDE && interp != NULL)
-    {
-      // Run loop for XiRCON
-      while((!bEndOfFile || bDataReady) && !pDTS_Color->bStop)
-      {
-        if (bDataReady) // bDataDeady triggered by timer callback event
-        {
-          Sendtcl(interp, GlobalString);
-          bDataReady = false;
-        }
-        else if (!pDTS_Color->bUseDDE) // Yield to other TCL processes
-          (void)Tcl_DoOneEvent(TCL_DONT_WAIT);
-      }
+  DeleteCriticalSection(&IrcLock);
+  WSACleanup();
+}
+/*********************************************************************/
+bool IrcSend(char* pLine)
+// Purpose: Send one line (IRCLINESIZ-2 chars at most) to the server,
+//          the timer and IrcThread() both call this
+{
+  char Buf[IRCLINESIZ];
+  int Len = strlen(pLine);
 
-      if (pDTS_Color->bStop)
-        Sendtcl(interp, "echo \"Playback Stopped!\" status");
-      else
-        Sendtcl(interp, "echo \"Playback Ended!\" status");
+  if (IrcSocket == INVALID_SOCKET)
+    return false;
 
-      StopPlay();
-    }
-  }
+  // The server would cut it off anyway
+  if (Len > IRCLINESIZ-2)
+    Len = IRCLINESIZ-2;
 
-  return TCL_OK;
+  memcpy(Buf, pLine, Len);
+  Buf[Len++] = '\r';
+  Buf[Len++] = '\n';
+
+  EnterCriticalSection(&IrcLock);
+
+  int Sent = 0, Ret = 0;
+
+  while (Sent < Len &&
+           (Ret = send(IrcSocket, Buf+Sent, Len-Sent, 0)) != SOCKET_ERROR)
+    Sent += Ret;
+
+  LeaveCriticalSection(&IrcLock);
+
+  return Sent == Len;
 }
 /*********************************************************************/
-void StopPlay(void)
+void IrcJoin(char* pChannel)
+// Purpose: Join a channel we're about to play to (we can't send to
+//          most channels from outside)
+// Globals Used: IrcJoined
 {
-  pDTS_Color->bStop = false;
+  char Buf[IRCLINESIZ];
 
-  // Finished with the timer
-  if (TimerID)
-  {
-    KillTimer(NULL, TimerID);
-    TimerID = NULL;
-  }
+  if ((pChannel[0] != '#' && pChannel[0] != '&') ||
+                                           !strcmp(IrcJoined, pChannel))
+    return;
 
-  // Finished with the heap
-  if (hHeap != NULL)
-  {
-    HeapDestroy(hHeap);
-    hHeap = NULL;
-  }
+  sprintf(Buf, "JOIN %.*s", (int)sizeof(IrcJoined)-1, pChannel);
 
-  // Finished with the file
-  if (hFile != NULL)
-  {
-    CloseHandle(hFile);
-    hFile = NULL;
-  }
+  if (IrcSend(Buf))
+    strcpy(IrcJoined, Buf+5);
+}
+/*********************************************************************/
+void SendIrc(char* tempstr)
+// Purpose: Send a PRIVMSG from FrameString() straight to the server
+{
+  RecordCommand(DIALECT_IRC, tempstr);
 
-  bPaused = false;
+  TRACE_BEGIN(TR_IRCSEND, dwSendLine);
+  bool bOk = IrcSend(tempstr);
+  TRACE_END(TR_IRCSEND, dwSendLine);
 
-// Nice idea to delete the temp files BUT - we will call stop
-// when the chat-client is still reading files :) so - nice try but
-// no cigar...
-/*
-  // Delete files
-  char *FileNameBuf;
+  if (!bOk)
+    ErrorHandler(ERR_IRC, "Could not send to the IRC server!");
+}
+/*********************************************************************/
+void IrcLine(char* pLine)
+// Purpose: Handle a line from the server - all we care about is being
+//          registered and keeping the connection alive
+// Globals Used: IrcState, IrcNick
+{
+  char Buf[IRCLINESIZ];
 
-  // Allocate file-name buffer
-  if ((FileNameBuf = (char *)malloc(MAX_PATH)) == NULL)
+  // Skip the prefix
+  if (*pLine == ':')
   {
-    ErrorHandler("Error creating filename buffer");
-    return;
+    if ((pLine = strchr(pLine, ' ')) == NULL)
+      return;
+    while (*pLine == ' ')
+      pLine++;
   }
 
-  GetTempPath(MAX_PATH, FileNameBuf);
-  strcat(FileNameBuf, TEMPFILE_0);
-  DeleteFile(FileNameBuf);
-  GetTempPath(MAX_PATH, FileNameBuf);
-  strcat(FileNameBuf, TEMPFILE_1);
-  DeleteFile(FileNameBuf);
-  GetTempPath(MAX_PATH, FileNameBuf);
-  strcat(FileNameBuf, TEMPFILE_2);
-  DeleteFile(FileNameBuf);
-  GetTempPath(MAX_PATH, FileNameBuf);
-  strcat(FileNameBuf, TEMPFILE_3);
-  DeleteFile(FileNameBuf);
+  if (!strncmp(pLine, "PING", 4))
+  {
+    sprintf(Buf, "PONG%.*s", IRCLINESIZ-8, pLine+4);
+    (void)IrcSend(Buf);
+  }
+  else if (!strncmp(pLine, "001 ", 4)) // RPL_WELCOME
+    IrcState = IRC_READY;
+  else if (!strncmp(pLine, "433 ", 4) && IrcState == IRC_CONNECTING)
+  {
+    // Nick in use, try it with a '_' on the end
+    int Len = strlen(IrcNick);
 
-  free(FileNameBuf);
-*/
+    if (Len < (int)sizeof(IrcNick)-1)
+    {
+      IrcNick[Len] = '_';
+      IrcNick[Len+1] = NULLCHAR;
+    }
+
+    sprintf(Buf, "NICK %s", IrcNick);
+    (void)IrcSend(Buf);
+  }
 }
 /*********************************************************************/
-void Senddde(char* tempstr)
+DWORD WINAPI IrcThread(LPVOID lpParam)
+// Purpose: Connect to IrcServer, register as IrcNick and then read the
+//          server's lines till the connection closes
 {
-  try
+  char Buf[2*IRCLINESIZ];
+  sockaddr_in Addr;
+  hostent* pHost;
+  int Len = 0, Got;
+
+  memset(&Addr, 0, sizeof(Addr));
+  Addr.sin_family = AF_INET;
+  Addr.sin_port = htons((unsigned short)IrcPort);
+
+  if ((Addr.sin_addr.s_addr = inet_addr(IrcServer)) == INADDR_NONE)
   {
-    //Connect to the service and request the topic
-    if ((hcnv = DdeConnect(idInst, hszService, hszTopic, NULL)) == 0)
+    if ((pHost = gethostbyname(IrcServer)) == NULL)
     {
-      ColorStop();
-      return;
+      IrcState = IRC_FAILED;
+      return 0;
     }
 
-    //Start a DDE transaction
-    if (DdeClientTransaction((LPBYTE)tempstr, strlen(tempstr)+1,
-          hcnv, hszItem, CF_TEXT, XTYP_POKE, 5000, &dwResult) == 0)
+    memcpy(&Addr.sin_addr, pHost->h_addr, pHost->h_length);
+  }
+
+  if (connect(IrcSocket, (sockaddr*)&Addr, sizeof(Addr)) == SOCKET_ERROR)
+  {
+    IrcState = IRC_FAILED;
+    return 0;
+  }
+
+  sprintf(Buf, "NICK %s", IrcNick);
+  (void)IrcSend(Buf);
+  sprintf(Buf, "USER %s 0 * :YahCoLoRiZe", IrcNick);
+  (void)IrcSend(Buf);
+
+  while ((Got = recv(IrcSocket, Buf+Len, sizeof(Buf)-1-Len, 0)) > 0)
+  {
+    char* pLine = Buf;
+    char* pEnd;
+
+    Len += Got;
+    Buf[Len] = NULLCHAR;
+
+    while ((pEnd = strchr(pLine, '\n')) != NULL)
     {
-      UINT result = DdeGetLastError(idInst);
-      switch (result)
-      {
-        case DMLERR_ADVACKTIMEOUT:
-        case DMLERR_BUSY:
-        case DMLERR_DATAACKTIMEOUT:
-        case DMLERR_DLL_NOT_INITIALIZED:
-        case DMLERR_EXECACKTIMEOUT:
-        case DMLERR_INVALIDPARAMETER:
-        case DMLERR_MEMORY_ERROR:
-        case DMLERR_NO_CONV_ESTABLISHED:
-        case DMLERR_NO_ERROR:
-        case DMLERR_NOTPROCESSED:
-        case DMLERR_POKEACKTIMEOUT:
-        case DMLERR_POSTMSG_FAILED:
-        case DMLERR_REENTRANCY:
-        case DMLERR_SERVER_DIED:
-        case DMLERR_UNADVACKTIMEOUT:
-        default:
-          ColorStop();
-      }
+      *pEnd = NULLCHAR;
+      if (pEnd > pLine && pEnd[-1] == '\r')
+        pEnd[-1] = NULLCHAR;
+
+      IrcLine(pLine);
+      pLine = pEnd+1;
     }
 
-    //Free DDE
-    DdeDisconnect(hcnv);
+    // Keep a partial line for next time (drop one that's too long)
+    Len = strlen(pLine);
+    if (Len >= (int)sizeof(Buf)-1)
+      Len = 0;
+    memmove(Buf, pLine, Len);
   }
-  catch(...)
+
+  // The server hung up (not IrcDisconnect())
+  if (IrcState != IRC_OFF)
   {
-    ErrorHandler("Exception thrown in Senddde()!");
+    IrcState = IRC_FAILED;
+
+    if (bIrcDirect)
+      ErrorHandler(ERR_IRC, "Lost the connection to the IRC server!",
+                                                              IrcServer);
   }
+
+  UNREFERENCED_PARAMETER(lpParam);
+  return 0;
 }
 /*********************************************************************/
-void Sendtcl(Tcl_Interp *interp, char *tempstr)
+/*********************************************************************/
+/*                         Record Functions                          */
+/*********************************************************************/
+/*********************************************************************/
+
+bool RecordStart(LPTSTR Filename)
+// Purpose: Start appending every command we send to a client to
+//          Filename (see DTSR_Record), stops any recording first
+// Globals Used: hRecordFile, llRecordFreq, dwRecorded
 {
-  try
+  DTSR_Header Hdr;
+  LARGE_INTEGER Freq, Now;
+  DWORD dwWritten;
+
+  RecordStop();
+
+  if (!QueryPerformanceFrequency(&Freq) || Freq.QuadPart == 0)
+    return false;
+
+  if ((hRecordFile = CreateFile(Filename, GENERIC_WRITE, FILE_SHARE_READ,
+                           NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                                          NULL)) == INVALID_HANDLE_VALUE)
   {
-    (*Tcl_Eval)(interp, tempstr);
+    hRecordFile = NULL;
+    return false;
   }
-  catch(...)
+
+  (void)QueryPerformanceCounter(&Now);
+
+  memcpy(Hdr.Magic, DTSR_MAGIC, sizeof(Hdr.Magic));
+  Hdr.Version = DTSR_VERSION;
+  Hdr.Freq = Freq.QuadPart;
+  Hdr.Start = Now.QuadPart;
+
+  if (!WriteFile(hRecordFile, &Hdr, sizeof(Hdr), &dwWritten, NULL) ||
+                                              dwWritten != sizeof(Hdr))
   {
-    ErrorHandler("Exception thrown in Sendtcl()!");
+    RecordStop();
+    return false;
   }
+
+  llRecordFreq = Freq.QuadPart;
+  dwRecorded = 0;
+  return true;
 }
 /*********************************************************************/
-void ErrorHandler(LPTSTR Info, LPTSTR Extra)
-// Purpose: Close open handles and display message box for error
-// Args: String with information to display in message box
-// Globals Used: hHeap, TimerID, hFile
+void RecordStop(void)
 {
-  char TempString[300];
-
-  StopPlay();
-  strcpy(TempString,"Colorize.dll:");
-  strcat(TempString,Info);
-  if (Extra != NULL)
+  if (hRecordFile != NULL)
   {
-    strcat(TempString,"\r\n");
-    strcat(TempString,Extra);
+    CloseHandle(hRecordFile);
+    hRecordFile = NULL;
   }
-  MessageBox(NULL,TempString,DEFTITLE,MB_OK|MB_SETFOREGROUND);
 }
 /*********************************************************************/
-void QueueNextLineForTransmit(void)
-// Purpose: Format data from virtual memory buffer into GlobalString
-// Globals Used: bEndOfFile, bDataReady, lpHeap, dwByteCount, dwBytesRead,
-//               GlobalString
-// Custom Functions Called: PrintString()
+void RecordCommand(int Sink, char* pCmd)
+// Purpose: Called by Sendtcl() and Senddde() to add pCmd to the
+//          recording (if there is one). A play-file line's scheduled
+//          time is when the timer should have sent it, anything else
+//          is scheduled for right now.
+// Globals Used: hRecordFile, llPlayStart, dwSession, dwSendLine,
+//               dwSendTick
 {
-  if (dwBytesRead == 0)
-  {
-    StopPlay();
-    return;
-  }
+  DTSR_Record Rec;
+  LARGE_INTEGER Now;
+  DWORD dwWritten;
 
-  // immediate stop-play for mIRC if detaching or user-stop
-  if (pDTS_Color->bUseDDE && pDTS_Color->bStop)
-  {
-    StopPlay();
+  if (hRecordFile == NULL)
+    return;
 
-//    if (IsPirchVortec())
-//      Senddde("/display \"Playback Stopped!\"");
-//    else
-//      Senddde("/echo -s \"Playback Stopped!\"");
+  (void)QueryPerformanceCounter(&Now);
 
-    return;
-  }
+  Rec.Actual = Now.QuadPart;
 
-  DWORD dwStringCount;
-  char* lpBuf;
+  if (TimerID != NULL && dwSendTick != 0)
+    Rec.Scheduled = llPlayStart + (LONGLONG)(dwSendTick-1) *
+                                        PaceTime * llRecordFreq / 1000;
+  else
+    Rec.Scheduled = Rec.Actual;
 
-  // Queue data for Eval
-  if (!bEndOfFile && !bDataReady)
-  {
-    // Read through the file (now in virtual memory)
-    lpBuf = (char*)lpHeap; // Point to start of heap
+  Rec.Session = dwSession;
+  Rec.Line = TimerID != NULL ? dwSendLine : 0;
+  Rec.Sink = (BYTE)Sink;
 
-    dwStringCount = 0;
+  // Nothing's played here yet? (XiRCON's pause, etc.)
+  char* pTarget = pPlay != NULL ? pPlay->Channel : "";
 
-    for(; dwByteCount < dwBytesRead ; dwByteCount++)
-    {
-      if (lpBuf[dwByteCount] != '\r' && lpBuf[dwByteCount] != '\n' &&
-                   dwStringCount < GLOBALSTRINGSIZ-1)
-        GlobalString[dwStringCount++] = lpBuf[dwByteCount];
-      else if (lpBuf[dwByteCount] == '\n')
-      {
-        // Add a terminating CTRL_K if space(s) at end of line to prevent
-        // them from being trimmed off by some clients
-        if (dwStringCount && GlobalString[dwStringCount-1] == ' ')
-          GlobalString[dwStringCount++] = CTRL_K;
-        GlobalString[dwStringCount] = NULLCHAR;
-//        PrintString(pDTS_Color->PlayTime);
-        PrintString(0); // play file with no delay!
-        bDataReady = true;
-        dwByteCount++;
-        break;
-      }
-    }
+  UINT TargetLen = strlen(pTarget);
+  UINT CmdLen = strlen(pCmd);
 
-    // Finished reading the file?
-    if (dwByteCount >= dwBytesRead)
-    {
-      if (!bDataReady)
-      {
-        // Add a terminating CTRL_K if space(s) at end of line to prevent
-        // them from being trimmed off by some clients
-        if (dwStringCount && GlobalString[dwStringCount-1] == ' ')
-          GlobalString[dwStringCount++] = CTRL_K;
-        GlobalString[dwStringCount] = NULLCHAR;
+  Rec.TargetLen = (BYTE)(TargetLen > 255 ? 255 : TargetLen);
+  Rec.CommandLen = (WORD)(CmdLen > 0xFFFF ? 0xFFFF : CmdLen);
 
-        if (dwStringCount)
-        {
-//          PrintString(pDTS_Color->PlayTime);
-          PrintString(0); // play file with no delay!
-          bDataReady = true;
-        }
-      }
+  // A DDE command only names the temp-file, keep what it plays
+  char* pText = Sink == DTSP_DDE ? (char*)malloc(RENDERSIZ) : NULL;
 
-      bEndOfFile = true;
-    }
-  }
+  Rec.TextLen = (WORD)(pText != NULL ? RecordText(pCmd, pText) : 0);
 
-  // pump data directly via DDE if this is mIRC
-  if (pDTS_Color->bUseDDE)
-  {
-    //Start a DDE transaction
-    if (bDataReady)
-    {
-      Senddde(GlobalString);
-      bDataReady = false;
-    }
+  bool bOk = WriteFile(hRecordFile, &Rec, sizeof(Rec), &dwWritten, NULL) &&
+       WriteFile(hRecordFile, pTarget, Rec.TargetLen,
+                                                   &dwWritten, NULL) &&
+       WriteFile(hRecordFile, pCmd, Rec.CommandLen, &dwWritten, NULL) &&
+       (Rec.TextLen == 0 ||
+          WriteFile(hRecordFile, pText, Rec.TextLen, &dwWritten, NULL));
 
-    if (bEndOfFile)
-    {
-      StopPlay();
+  if (pText != NULL)
+    free(pText);
 
-//      if (IsPirchVortec())
-//        Senddde("/display \"Playback Ended!\"");
-//      else
-//        Senddde("/echo -s \"Playback Ended!\"");
-    }
-  }
+  // Out of disk? just stop recording, it's no reason to stop playing
+  if (bOk)
+    dwRecorded++;
+  else
+    RecordStop();
 }
 /*********************************************************************/
-bool PrintString(int Time)
-// Purpose: Convert data from GlobalString into
-//    a file-play command-string to send to
-//    client via ether DDE or Tcl.
-// Globals Used: GlobalString, String
-// Shared Memory Vars: pDTS_Color->Channel
+UINT RecordText(char* pCmd, char* pText)
+// Purpose: Read the text of the temp-file (see DTS_WriteLineToFile())
+//          a DDE command plays into pText (RENDERSIZ chars)
+// Return: its length, 0 if pCmd doesn't play one of ours
 {
-  UINT length = strlen(GlobalString);
+  char Path[MAX_PATH];
+  HANDLE hIn;
+  DWORD dwRead;
+  char* p;
+  int n, End = 0;
 
-  if (length == 0)
-    length = sprintf(GlobalString, "\r\n");
+  DWORD dwLen = GetTempPath(MAX_PATH, Path);
 
-  char *tString;
+  if (dwLen == 0 || dwLen + 16 > MAX_PATH ||
+      (p = strstr(pCmd, Path)) == NULL ||
+      sscanf(p + dwLen, TEMPFILE_FMT "%n", &n, &End) != 1 || End == 0)
+    return 0;
 
-  // Allocate a buffer large enough to handle a case where every
-  // char was a " or a \ (requiring insertion of \ escape chars
-  // plus a NULL
-  if ((tString = (char*)malloc(2*length+1)) == NULL)
-  {
-    ErrorHandler("Error allocating command buffer");
+  sprintf(Path + dwLen, TEMPFILE_FMT, n);
+
+  if ((hIn = CreateFile(Path, GENERIC_READ, FILE_SHARE_READ |
+            FILE_SHARE_WRITE, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL,
+                                          NULL)) == INVALID_HANDLE_VALUE)
+    return 0;
+
+  if (!ReadFile(hIn, pText, RENDERSIZ-1, &dwRead, NULL))
+    dwRead = 0;
+
+  CloseHandle(hIn);
+
+  // It was written with its null
+  pText[dwRead] = NULLCHAR;
+  return strlen(pText);
+}
+/*********************************************************************/
+bool ReplayRecording(Tcl_Interp* interp, LPTSTR Filename, bool bRealTime,
+                                                           char* pResult)
+// Purpose: Send the XiRCON commands in a recording to interp again, as
+//          fast as we can or with their recorded spacing, and put
+//          "commands <n> skipped <n> ms <elapsed> late <ms>" in pResult
+//          (late is the furthest any command got behind its spacing)
+{
+  HANDLE hIn;
+  DTSR_Header Hdr;
+  DTSR_Record Rec;
+  LARGE_INTEGER Freq, Begin, Now;
+  LONGLONG llFirst = 0, llLate = 0;
+  DWORD dwRead, dwCommands = 0, dwSkipped = 0;
+  char* pCmd;
+
+  if (!QueryPerformanceFrequency(&Freq) || Freq.QuadPart == 0)
     return false;
-   }
 
-  char* FileNameBuf;
+  if ((hIn = CreateFile(Filename, GENERIC_READ, FILE_SHARE_READ, NULL,
+      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL)) == INVALID_HANDLE_VALUE)
+    return false;
 
-  // Allocate file-name buffer
-  if ((FileNameBuf = (char*)malloc(MAX_PATH)) == NULL)
+  if (!ReadFile(hIn, &Hdr, sizeof(Hdr), &dwRead, NULL) ||
+      dwRead != sizeof(Hdr) ||
+      memcmp(Hdr.Magic, DTSR_MAGIC, sizeof(Hdr.Magic)) ||
+      Hdr.Version < 1 || Hdr.Version > DTSR_VERSION || Hdr.Freq == 0 ||
+      (pCmd = (char*)malloc(0xFFFF+1)) == NULL)
   {
-    ErrorHandler("Error creating filename buffer");
+    CloseHandle(hIn);
     return false;
   }
 
-  UINT ii,jj;
+  (void)QueryPerformanceCounter(&Begin);
 
-  // Scan string for " characters or \ characters
-  // \\ and \" are needed for text between quotes in C
-  for (ii = 0, jj = 0 ; ii < length ; ii++, jj++)
+  while (ReadFile(hIn, &Rec, sizeof(Rec), &dwRead, NULL) &&
+                                                   dwRead == sizeof(Rec))
   {
-    if (!pDTS_Color->bUseDDE)
-    {
-      if (GlobalString[ii] == '"' || GlobalString[ii] == '\x5c')
-        // allow " and \ chars
-        tString[jj++] = '\x5c';
-
-      tString[jj] = GlobalString[ii];
-    }
-    else // mIRC will interpret $# as a parameter! (replace with ' ')
+    // Version 1 has no text
+    if (Hdr.Version < 2)
+      Rec.TextLen = 0;
+
+    // Skip the target, the command already has it (and the text, we
+    // don't send DDE commands)
+    if (SetFilePointer(hIn, Rec.TargetLen, NULL, FILE_CURRENT) ==
+                                                              0xFFFFFFFF ||
+        !ReadFile(hIn, pCmd, Rec.CommandLen, &dwRead, NULL) ||
+                                                dwRead != Rec.CommandLen ||
+        SetFilePointer(hIn, Rec.TextLen, NULL, FILE_CURRENT) == 0xFFFFFFFF)
+      break;
+
+    pCmd[Rec.CommandLen] = NULLCHAR;
+
+    // DDE commands need a DDE conversation...
+    if (Rec.Sink != DTSP_TCL)
     {
-      if (ii+1 < length && GlobalString[ii] == '$' &&
-                                            isdigit(GlobalString[ii+1]))
-        tString[jj] = ' ';
-      else
-        tString[jj] = GlobalString[ii];
+      dwSkipped++;
+      continue;
     }
-  }
 
-  tString[jj] = NULLCHAR;
+    if (dwCommands == 0)
+      llFirst = Rec.Actual;
 
-  if (!strcmp("status", stolower(pDTS_Color->Channel)))
-  {
-    if (pDTS_Color->bUseDDE) // echo to mIRC
-    {
-      // Writing one line to a file and using the /play command
-      // eliminates the mIRC bug of stripping out spaces...
-      //
-      // ORIGINALLY, setting UseFile triggered mode of writing to a
-      // temp-file... but NOW, YahCoLoRiZe can locally do /msg driven
-      // playback or send just the /play file command when UseDll is
-      // unchecked.  When UseDll is checked, we want to have two modes
-      // in the dll.  If UseFile is checked, we want to play data
-      // from the file written by YahCoLoRiZe (a full file), one line
-      // at a time via /play and through a temp-file here.
-      //
-      // If UseFile us NOT checked, YahCoLoRiZe does not write a
-      // big file for us to play here, instead it used a "one-line"
-      // mode (via setting PlayTime < 0)... but HERE, we still
-      // want to buffer that text through a temp-file to keep
-      // mIRC/PIRCH from stripping spaces out...
-      //if (pDTS_Color->bUseFile)
+    // When it went out in the recording, in our counts
+    LONGLONG llDue = Begin.QuadPart +
+               (Rec.Actual - llFirst) * Freq.QuadPart / Hdr.Freq;
 
-      if (IsPirchVortec())
-      {
-        // Pirch bug seems to require a leading CTRL_K or else the first
-        // color-sequence CTRL_K is skipped...
-        for (int ii = strlen(tString) ; ii >= 0  ; ii--)
-          tString[ii+1] = tString[ii];
-        tString[0] = '\003'; // leading CTRL_K
-      }
+    (void)QueryPerformanceCounter(&Now);
 
-      if (DTS_WriteLineToFile(FileNameBuf, tString) == false)
+    if (bRealTime)
+    {
+      // Yield to other TCL processes till it's due, sleeping between
+      // their events (in slices, so they aren't held up long)
+      while (Now.QuadPart < llDue)
       {
-        ErrorHandler("Error writing main temp file");
-        free(FileNameBuf);
-        return false;
+        DWORD dwLeft = (DWORD)((llDue - Now.QuadPart) * 1000 /
+                                                          Freq.QuadPart);
+        if (dwLeft == 0)
+          break;
+
+        (void)Tcl_DoOneEvent(TCL_DONT_WAIT);
+        Sleep(dwLeft < REPLAYSLICE ? dwLeft : REPLAYSLICE);
+        (void)QueryPerformanceCounter(&Now);
       }
+    }
 
-      // send to status window
-      if (IsPirchVortec())
-        // this won't work - pirch has no switch for status...
-        sprintf(GlobalString, "/playfile -s %s", FileNameBuf);
-      else // we only play a one-line file, NOTE: DO NOT USE -p!
-        sprintf(GlobalString, "/play -s %s %i", FileNameBuf, Time);
+    if (Now.QuadPart - llDue > llLate)
+      llLate = Now.QuadPart - llDue;
 
-//      if (IsPirchVortec())
-        // Pirch bug seems to require a leading CTRL_K
-        // or else the first color-sequence CTRL_K is skipped
-//        sprintf(GlobalString, "/display %c%s",'\003',tString);
-//      else
-//        sprintf(GlobalString, "/echo -s %s",tString);
-    }
-    else // echo to XiRCON
-      sprintf(GlobalString, "echo \"%s\" status",tString);
+    Sendtcl(interp, pCmd);
+    dwCommands++;
   }
-  else // not to status window
-  {
-    if (pDTS_Color->bUseDDE) // msg to mIRC via file
-    {
-      // Writing one to a temp file and using the /play command
-      // eliminates the mIRC bug of stripping out spaces...
-      if (DTS_WriteLineToFile(FileNameBuf, tString) == false)
-      {
-        ErrorHandler("Error writing mIRC temp file");
-        free(FileNameBuf);
-        return false;
-      }
 
-      if (IsPirchVortec())
-        sprintf(GlobalString, "/playfile %s %s", pDTS_Color->Channel,
-                                                          FileNameBuf);
-      else // we only play a one-line file, NOTE: DO NOT USE -p!
-        sprintf(GlobalString, "/play %s %s %i", pDTS_Color->Channel,
-                                                   FileNameBuf, Time);
-    }
-    else // msg to XiRCON
-      sprintf(GlobalString, "/msg %s \"%s\"",pDTS_Color->Channel,tString);
-  }
+  (void)QueryPerformanceCounter(&Now);
 
-  free(tString);
-  free(FileNameBuf);
+  free(pCmd);
+  CloseHandle(hIn);
+
+  sprintf(pResult, "commands %lu skipped %lu ms %lu late %lu", dwCommands,
+          dwSkipped,
+          (DWORD)((Now.QuadPart - Begin.QuadPart) * 1000 / Freq.QuadPart),
+          (DWORD)(llLate * 1000 / Freq.QuadPart));
   return true;
 }
 /*********************************************************************/
-char* stolower(char* p)
+/*********************************************************************/
+/*                          Trace Functions                          */
+/*********************************************************************/
+/*********************************************************************/
+
+#ifdef DTS_TRACE
+void TraceEvent(int Stage, char Phase, DWORD Line)
+// Purpose: Add a begin ('B') or end ('E') event to the trace ring, any
+//          thread can call this. The oldest events get written over.
+{
+  LARGE_INTEGER Now;
+  DTS_TraceEvent* pEv;
+
+  (void)QueryPerformanceCounter(&Now);
+
+  pEv = &TraceRing[(DWORD)(InterlockedIncrement(&lTraceCount)-1) &
+                                                          (TRACESIZE-1)];
+  pEv->Time = Now.QuadPart;
+  pEv->ThreadID = GetCurrentThreadId();
+  pEv->Session = dwSession;
+  pEv->Line = Line;
+  pEv->Stage = (BYTE)Stage;
+  pEv->Phase = Phase;
+}
+#endif
+/*********************************************************************/
+int TraceCount(void)
+// Purpose: Events in the trace ring
+{
+#ifdef DTS_TRACE
+  return lTraceCount < TRACESIZE ? (int)lTraceCount : TRACESIZE;
+#else
+  return 0;
+#endif
+}
+/*********************************************************************/
+void TraceClear(void)
 {
-  char* savep = p;
+#ifdef DTS_TRACE
+  InterlockedExchange(&lTraceCount, 0);
+#endif
+}
+/*********************************************************************/
+bool TraceDump(LPTSTR Filename)
+// Purpose: Write the trace ring as Chrome trace-event JSON, load it in
+//          chrome://tracing (or any viewer that reads that format)
+{
+#ifdef DTS_TRACE
+  static const char* StageNames[TR_STAGES] = {"tick", "scan", "format",
+                      "tempfile", "ddeconnect", "ddepoke", "tcleval",
+                      "build", "ircsend"};
+  LARGE_INTEGER Freq;
+  HANDLE hOut;
+  DWORD dwWritten;
+  char Buf[256];
+  int Len;
+
+  if (!QueryPerformanceFrequency(&Freq) || Freq.QuadPart == 0)
+    return false;
 
-  int limit = GLOBALSTRINGSIZ;
+  if ((hOut = CreateFile(Filename, GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+                    FILE_ATTRIBUTE_NORMAL, NULL)) == INVALID_HANDLE_VALUE)
+    return false;
+
+  LONG lCount = lTraceCount;
+  LONG lFirst = lCount > TRACESIZE ? lCount - TRACESIZE : 0;
+  bool bRet = WriteFile(hOut, "{\"traceEvents\":[\n", 17, &dwWritten, NULL);
 
-  while(limit--)
+  for (LONG ii = lFirst; ii < lCount && bRet; ii++)
   {
-    char c = *p;
+    DTS_TraceEvent* pEv = &TraceRing[(DWORD)ii & (TRACESIZE-1)];
 
-    if (c == NULLCHAR)
-      return savep;
+    if (pEv->Stage >= TR_STAGES)
+      continue;
 
-    *p++ = (char)tolower(c);
+    // Timestamps are in microseconds
+    Len = sprintf(Buf, "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.1f,"
+          "\"pid\":%lu,\"tid\":%lu,\"args\":{\"session\":%lu,\"line\":%lu}}",
+          ii == lFirst ? "" : ",\n", StageNames[pEv->Stage], pEv->Phase,
+          (double)pEv->Time * 1000000.0 / (double)Freq.QuadPart,
+          GetCurrentProcessId(), pEv->ThreadID, pEv->Session, pEv->Line);
+
+    bRet = WriteFile(hOut, Buf, Len, &dwWritten, NULL);
   }
 
-  return savep;
+  if (bRet)
+    bRet = WriteFile(hOut, "\n]}\n", 4, &dwWritten, NULL);
+
+  CloseHandle(hOut);
+  return bRet;
+#else
+  UNREFERENCED_PARAMETER(Filename);
+  return false;
+#endif
 }
 /*********************************************************************/
-bool DTS_WriteLineToFile(char* FileNameBuf, char* tString)
-// We write one line at a time to a file then play that file
-// via a DDE command "/playfile" for PIRCH, "/play" for mIRC.
-// We do this because sending using /msg will strip spaces...
-// playing a file sends the line as-is (good for ascii-art,
-// lyrics, etc)
+/*********************************************************************/
+/*                          Queue Functions                          */
+/*********************************************************************/
+/*********************************************************************/
+
+bool QueueCreate(DTS_Queue* pQ, int Slots, int SlotSize)
+// Purpose: Allocate a queue of Slots lines of SlotSize chars each
 {
-  static int Unique = 0;
+  pQ->In = pQ->Out = 0;
+  pQ->bClosed = 0;
+  pQ->Slots = Slots;
+  pQ->SlotSize = SlotSize;
+  pQ->hNotEmpty = CreateEvent(NULL, FALSE, FALSE, NULL);
+  pQ->hNotFull = CreateEvent(NULL, FALSE, FALSE, NULL);
+
+  if ((pQ->pBuf = (char*)malloc(Slots*SlotSize)) == NULL ||
+                         pQ->hNotEmpty == NULL || pQ->hNotFull == NULL)
+  {
+    QueueDestroy(pQ);
+    return false;
+  }
 
-  HANDLE hWriteFile;
-  unsigned long BytesWritten;
+  return true;
+}
+/*********************************************************************/
+void QueueDestroy(DTS_Queue* pQ)
+{
+  if (pQ->pBuf != NULL)
+  {
+    free(pQ->pBuf);
+    pQ->pBuf = NULL;
+  }
 
-  GetTempPath(MAX_PATH, FileNameBuf);
+  if (pQ->hNotEmpty != NULL)
+  {
+    CloseHandle(pQ->hNotEmpty);
+    pQ->hNotEmpty = NULL;
+  }
 
-  // Create set of 4 temp files
-  int n = ++Unique % 4;
+  if (pQ->hNotFull != NULL)
+  {
+    CloseHandle(pQ->hNotFull);
+    pQ->hNotFull = NULL;
+  }
 
-  if (n == 0)
-    strcat(FileNameBuf, TEMPFILE_0);
-  else if (n == 1)
-    strcat(FileNameBuf, TEMPFILE_1);
-  else if (n == 2)
-    strcat(FileNameBuf, TEMPFILE_2);
-  else
-    strcat(FileNameBuf, TEMPFILE_3);
+  pQ->In = pQ->Out = 0;
+}
+/*********************************************************************/
+int QueueDepth(DTS_Queue* pQ)
+// Purpose: Lines waiting (safe to call from any thread)
+{
+  if (pQ->pBuf == NULL)
+    return 0;
 
-  // Try to create in virtual memory... FILE_ATTRIBUTE_TEMPORARY
-  if ((hWriteFile = CreateFile(FileNameBuf,
-        GENERIC_WRITE,FILE_SHARE_READ,NULL,CREATE_ALWAYS,
-            FILE_ATTRIBUTE_TEMPORARY,NULL)) == INVALID_HANDLE_VALUE)
-    return(false);
+  return (int)(pQ->In - pQ->Out);
+}
+/*********************************************************************/
+char* QueueWriteSlot(DTS_Queue* pQ)
+// Purpose: Producer - wait for a free slot
+// Return: the slot to write, or NULL if play was aborted
+{
+  while (pQ->In - pQ->Out >= pQ->Slots)
+  {
+    if (bAbortPlay)
+      return NULL;
 
-  if (WriteFile(hWriteFile, tString,
-            strlen(tString)+1, &BytesWritten, NULL) == 0)
-    return(false);
+    WaitForSingleObject(pQ->hNotFull, 50);
+  }
 
-  CloseHandle(hWriteFile);
-  return true;
+  return pQ->pBuf + (pQ->In % pQ->Slots) * pQ->SlotSize;
+}
+/*********************************************************************/
+void QueuePublish(DTS_Queue* pQ)
+// Purpose: Producer - hand the slot from QueueWriteSlot() to the consumer
+{
+  InterlockedIncrement(&pQ->In);
+  SetEvent(pQ->hNotEmpty);
+}
+/*********************************************************************/
+char* QueueReadSlot(DTS_Queue* pQ, DWORD Timeout)
+// Purpose: Consumer - wait up to Timeout ms for a line
+// Return: the oldest line, or NULL if none arrived
+{
+  DWORD dwStart = GetTickCount();
+
+  if (pQ->pBuf == NULL)
+    return NULL;
+
+  while (pQ->In == pQ->Out)
+  {
+    DWORD dwElapsed = GetTickCount() - dwStart;
+
+    if (pQ->bClosed || bAbortPlay || dwElapsed >= Timeout)
+      return NULL;
+
+    WaitForSingleObject(pQ->hNotEmpty, Timeout - dwElapsed);
+  }
+
+  return pQ->pBuf + (pQ->Out % pQ->Slots) * pQ->SlotSize;
 }
 /*********************************************************************/
-bool IsPirchVortec(void)
+void QueueRelease(DTS_Queue* pQ)
+// Purpose: Consumer - done with the slot from QueueReadSlot()
 {
-  return IsPirch() || IsVortec();
+  InterlockedIncrement(&pQ->Out);
+  SetEvent(pQ->hNotFull);
 }
 /*********************************************************************/
-bool IsPirch(void)
+void QueueClose(DTS_Queue* pQ)
+// Purpose: Producer - no more lines are coming
 {
-  return !strcmp("pirch", stolower(pDTS_Color->Service));
+  InterlockedExchange(&pQ->bClosed, 1);
+  SetEvent(pQ->hNotEmpty);
 }
 /*********************************************************************/
-bool IsVortec(void)
+bool QueueDrained(DTS_Queue* pQ)
+// Purpose: Consumer - true if the producer is finished and we have read
+//          every line
 {
-  return !strcmp("vortec", stolower(pDTS_Color->Service));
+  return pQ->pBuf == NULL || (pQ->bClosed && pQ->In == pQ->Out);
 }
 /*********************************************************************/
 /*********************************************************************/
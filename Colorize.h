@@ -7,15 +7,195 @@
 #define TCL_OK 0
 #define TCL_ERROR 1
 
-#define FIFOSIZE 4
+#define FIFOSIZE 4 // holds FIFOSIZE-1 lines (see FiFoCredits())
+// How long ColorStart() waits for a one-line FIFO slot (ms)
+#define CREDITTIMEOUT 1500
+
+// One-line FIFO latency histograms (DTS_ipc, ColorIpcStat()), bucket N
+// counts lines that took under 2^(N+1) microseconds
+#define IPCBUCKETS 32
+#define IPC_WAIT 0  // ColorStart() to DTS_poll taking it out
+#define IPC_SEND 1  // to Sendtcl() returning
+#define IPC_LINES 2
+#define IPC_RATE 3  // lines/s
 #define GLOBALSTRINGSIZ 5000
 
+// Play-file pipeline: lines read from the play-file wait in READQUEUESIZE
+// slots for the formatter thread, formatted commands wait in SENDQUEUESIZE
+// slots for the timer to send them
+#define READQUEUESIZE 16
+#define SENDQUEUESIZE 16
+// Time to wait for the pipeline to produce the first line (ms)
+#define PRIMETIMEOUT 2000
+
+// Follow-mode: a play-file still being written is read FOLLOWBUFSIZE bytes
+// at a time, checking for more every FOLLOWPOLL ms until the producer
+// calls ColorFollowEnd()
+#define FOLLOWBUFSIZE 65536
+#define FOLLOWPOLL 20
+
+// Compressed play-files, told apart by their first bytes: gzip is
+// inflated into the follow-mode buffer a piece at a time, reading the
+// file INFLATEINSIZ bytes at a time (zstd we only recognize)
+#define GZIP_MAGIC "\x1f\x8b\x08"
+#define ZSTD_MAGIC "\x28\xb5\x2f\xfd"
+#define COMP_NONE 0
+#define COMP_GZIP 1
+#define COMP_ZSTD 2
+#define INFLATEINSIZ 16384
+#define INFLATEWINDOW 32768 // deflate's largest distance (power of 2)
+#define INFLATEMAXBITS 15
+
+// Inflate states (DTS_Inflate.State)
+#define INF_HEADER 0  // gzip member header
+#define INF_BLOCK 1   // deflate block header
+#define INF_STORED 2  // copying a stored block
+#define INF_CODES 3   // decoding a fixed or dynamic block
+#define INF_TRAILER 4 // gzip CRC and size
+#define INF_DONE 5
+
+// Named shared-memory play-buffer (ColorAllocBuffer()), one per
+// generation so a new buffer never disturbs the one playing
+#define PLAYBUF_NAME "dllplaybuf%s%lu"
+
+// Shared memory segment - the first process to map it sets it up (under
+// SHARED_LOCK), the rest check SHARED_MAGIC and SHARED_LAYOUT match. An
+// instance name (ColorInstance() or the DTS_INSTANCE environment var)
+// goes on the end of these names so pairs of client and YahCoLoRiZe
+// can each have their own.
+#define SHARED_NAME "dllmemfilemap"
+#define SHARED_LOCK "dllmemfilelock"
+#define CREDIT_EVENT "dllmemfilecredit" // set when the FIFO drains
+#define STATE_EVENT "dllmemfilestate%d" // a session's play changed state
+#define SHARED_MAGIC "DTSC"
+#define SHARED_LAYOUT 9 // bump when DTS_Color changes
+#define INSTANCE_ENV "DTS_INSTANCE"
+#define INSTANCESIZ 32
+
+// Sessions, one per kind of client so XiRCON and mIRC/PIRCH can each be
+// playing at once (DTS_Color.Session[])
+#define SINK_TCL 0 // played by XiRCON's DTS_poll
+#define SINK_DDE 1 // played by the caller's own timer (so is direct IRC)
+#define SINKS 2
+
+// Play-list (DTS_play append, ColorEnqueue()) - the reader thread opens
+// the next file while the current one plays, reading a text file into
+// memory only if it's no bigger than PREFETCHBUDGET
+#define PLAYLISTSIZE 8
+#define PREFETCHBUDGET (4L*1024L*1024L)
+
+// Extra byte at the end of a ReadQueue slot that says where the line
+// came from (the reader can move on to the next file ahead of the
+// formatter)
+#define SLOTTAG GLOBALSTRINGSIZ
+#define SLOT_TEXT 0
+#define SLOT_IMAGE 1
+
+// ...and at the end of a SendQueue slot, whether it's a line's first
+// command or one for the line's other targets
+#define SLOT_MORE 0
+#define SLOT_LINE 1
+
+// What a session's play is doing (DTS_state, ColorState()) - each
+// change sets the session's STATE_EVENT
+#define PLAY_IDLE 0
+#define PLAY_RUNNING 1
+#define PLAY_PAUSED 2
+#define PLAY_ENDED 3
+#define PLAY_STOPPED 4
+#define PLAY_ERROR 5
+#define PLAY_STATES 6
+
+// A session's channel can be a list ("#one,#two") - each line is
+// rendered once and framed for each of up to MAXTARGETS targets
+#define MAXTARGETS 8
+#define TARGETSEPS ", "
+#define TARGETSIZ 128 // as long as a session's Channel
+
+// Cache of pre-formatted images of text play-files we've played, in
+// the temp directory and named for a hash of the text (see CacheOpen())
+#define CACHEDIR "DtsCache"
+#define CACHE_FMT "\\%08lX%08lX%08lX.dtp"
+#define CACHE_WILDCARD "*.dtp"
+#define CACHE_TMPFMT "dts%lu.tmp"
+#define CACHEBUDGET (16L*1024L*1024L)
+
+// Direct IRC server connection (DTS_irc, ColorConnect())
+#define IRC_OFF 0
+#define IRC_CONNECTING 1
+#define IRC_READY 2     // registered, we can play to it
+#define IRC_FAILED 3
+#define IRCLINESIZ 512  // longest line, CR-LF and all (RFC 1459)
+#define IRCNICKSIZ 32
+
+// Pacing by the server lag the client reports (DTS_lag, ColorLag()). Lag
+// over the target stretches the send interval by PACEBACKOFF eighths, lag
+// under it takes PACESTEP ms off, within CFG_PACEMIN and CFG_PACEMAX
+#define LAGTARGET 2000 // ms (0 = don't pace)
+#define PACEMIN 250
+#define PACEMAX 10000
+#define PACESTEP 50
+#define PACEBACKOFF 12 // x1.5
+
+// Recording of the commands sent to the client (DTS_record) - a
+// DTSR_Header then a DTSR_Record, target, command and the text of the
+// temp-file a DDE command plays for each one (version 1 has no text)
+#define DTSR_MAGIC "DTSR"
+#define DTSR_VERSION 2
+#define REPLAYSLICE 10 // ms DTS_replay sleeps at most between events
+
+// BuildPlayImage() splits a text play-file into a chunk per processor,
+// up to MAXWORKERS chunks of at least CHUNKMIN bytes
+#define MAXWORKERS 8
+#define CHUNKMIN (64L*1024L)
+
+// DTS_plan's flood check, the classic ircd rule: each line puts the
+// server's clock for us FLOODLINE ms (and a second per FLOODBYTES bytes)
+// ahead, more than FLOODLIMIT ms ahead of real time and we're flooding
+#define FLOODLINE 2000
+#define FLOODBYTES 120
+#define FLOODLIMIT 10000
+#define FLOODSEARCHMAX 60000 // longest delay DTS_plan will look for
+#define PLANLONGEST 3
+#define PLANRESULTSIZ 256
+
+// Settings anyone can change while we run (DTS_config, ColorConfigSet()),
+// kept in DTS_Color.Config[] (see ConfigItems[] for names and limits).
+// The defines above are their defaults, array sizes stay compile-time.
+#define CFG_INT 0
+#define CFG_BOOL 1  // on/off
+#define CFG_PLAYTIME 0      // DTS_play's delay if none (or too short)
+#define CFG_MINPLAYTIME 1
+#define CFG_ONELINEDELAY 2  // mIRC /play delay for a one-line
+#define CFG_DDETIMEOUT 3
+#define CFG_CREDITTIMEOUT 4
+#define CFG_PRIMETIMEOUT 5
+#define CFG_FIFOLINES 6     // one-line FIFO lines in use (< FIFOSIZE)
+#define CFG_READQUEUE 7     // next play's queues
+#define CFG_SENDQUEUE 8     // (<= SENDQUEUESIZE, see TEMPFILE_COUNT)
+#define CFG_PREFETCH 9
+#define CFG_PREFETCHKB 10
+#define CFG_CACHE 11
+#define CFG_CACHEKB 12
+#define CFG_WORKERS 13      // <= MAXWORKERS
+#define CFG_CHUNKKB 14
+#define CFG_LAGTARGET 15
+#define CFG_PACEMIN 16
+#define CFG_PACEMAX 17
+#define CFG_PACESTEP 18
+#define CFG_PACEBACKOFF 19
+#define CFG_COUNT 20
+#define CONFIG(Item) (pDTS_Color->Config[Item])
+
 // YahCoLoRiZe class-name
 #define W_CLASS "TDTSColor"
 // Custom message strings
 #define M_CHAN "WM_ChanCoLoRiZe"
 #define M_DATA "WM_DataCoLoRiZe"
 #define M_PLAY "WM_PlayCoLoRiZe"
+// Posted to YahCoLoRiZe when the DLL records an error, WPARAM is the
+// ERR_... code and LPARAM the process-ID (call ColorGetError())
+#define M_ERROR "WM_ErrorCoLoRiZe"
 
 // Places to look (in this order) for Xtcl.dll
 #define XTCLPATH1 "Xtcl.dll"
@@ -68,16 +248,122 @@ typedef void (Tcl_FreeProc) (char *blockPtr);
 #define TCL_VOLATILE    ((Tcl_FreeProc *) 1)
 #define TCL_DYNAMIC     ((Tcl_FreeProc *) 3)
 
+// Error codes (ColorGetError(), DTS_errors)
+#define ERR_TCLLIB 1    // Xtcl.dll is missing functions
+#define ERR_SHARED 2    // shared memory
+#define ERR_MEMORY 3    // out of memory
+#define ERR_DDE 4       // DDEML
+#define ERR_THREAD 5    // could not start the play threads
+#define ERR_OPEN 6      // could not open the play-file
+#define ERR_FILESIZE 7  // play-file is empty or too big
+#define ERR_IMAGE 8     // bad pre-formatted play-file
+#define ERR_READ 9      // could not read the play-file
+#define ERR_EXCEPTION 10
+#define ERR_TEMPFILE 11 // could not write a DDE temp-file
+#define ERR_IRC 12      // lost (or couldn't write to) the IRC server
+#define ERR_COMPRESSED 13 // bad or unsupported compressed play-file
+
+// Error ring size (errors) and the most text kept for each
+#define ERRORSIZE 32
+#define ERRORTEXTSIZ 300
+
+// Comment this out to compile the stage-timing trace out of the DLL
+#define DTS_TRACE
+
+// Trace ring size in events (must be a power of two)
+#define TRACESIZE 8192
+
+// Traced stages (see TraceDump() for the names)
+#define TR_TICK 0       // OnTimer1()
+#define TR_SCAN 1       // reader splitting out a line
+#define TR_FORMAT 2     // FormatString()/FrameString()
+#define TR_TEMPFILE 3   // DTS_WriteLineToFile()
+#define TR_DDECONNECT 4 // DdeConnect()
+#define TR_DDEPOKE 5    // DdeClientTransaction()
+#define TR_TCLEVAL 6    // Tcl_Eval()
+#define TR_BUILD 7      // BuildPlayImage() chunk (Line is the chunk)
+#define TR_IRCSEND 8    // send() to the IRC server
+#define TR_STAGES 9
+
+#ifdef DTS_TRACE
+#define TRACE_BEGIN(Stage, Line) TraceEvent(Stage, 'B', Line)
+#define TRACE_END(Stage, Line) TraceEvent(Stage, 'E', Line)
+#else
+#define TRACE_BEGIN(Stage, Line)
+#define TRACE_END(Stage, Line)
+#endif
+
 // Temp file names (delete on Stop())
 #define TEMPFILE_0 "mrc5290.tmp"
 #define TEMPFILE_1 "mrc5291.tmp"
 #define TEMPFILE_2 "mrc5292.tmp"
 #define TEMPFILE_3 "mrc5293.tmp"
 
+// The formatter runs up to SENDQUEUESIZE lines ahead of the client, so we
+// need that many more temp files than the 4 the client may still be reading
+// (mrc5290.tmp, mrc5291.tmp, ...)
+#define TEMPFILE_FMT "mrc%d.tmp"
+#define TEMPFILE_BASE 5290
+#define TEMPFILE_COUNT (SENDQUEUESIZE+4)
+
+#define NULLCHAR '\0'
+
 // Terminate outgoing lines with this to prevent some clients from
 // trimming off trailing spaces...
 #define CTRL_K 0x03
 
+// The other mIRC formatting codes (see StripAll)
+#define CTRL_B 0x02 // bold
+#define CTRL_O 0x0f // plain
+#define CTRL_R 0x16 // reverse
+#define CTRL_I 0x1d // italic
+#define CTRL_U 0x1f // underline
+
+// With the codes stripped (a +c channel) a no-break space keeps trailing
+// spaces instead of CTRL_K - in the client's ANSI code-page or UTF-8
+#define STRIPPAD "\xa0"
+#define STRIPPAD_UTF8 "\xc2\xa0"
+
+// Pre-formatted play-file (written by ColorConvert()). Every line is
+// stored already split, padded and escaped for each kind of client so it
+// can be mapped and played without looking at the text:
+//
+//   DTSP_Header
+//   DWORD Offsets[Lines][DTSP_DIALECTS] (file-offset of each payload)
+//   BYTE Flags[Lines]
+//   null-terminated payloads
+#define DTSP_MAGIC "DTSP"
+#define DTSP_VERSION 1
+
+// Dialects
+#define DTSP_TCL 0 // XiRCON (" and \ escaped)
+#define DTSP_DDE 1 // mIRC, PIRCH and Vortec ($<digit> blanked)
+#define DTSP_DIALECTS 2
+#define DIALECT_IRC 2 // straight to an IRC server, as is (not in images)
+
+// RenderString() renders a line in one pass (FuseLine()) into RENDERSIZ
+// chars - every char escaped, PIRCH's leading CTRL_K, a pad and the NULL.
+// Its escape stage is the line's dialect, or for an image line (already
+// escaped) DIALECT_IRC to leave it as is or RENDER_UNESCAPE to undo
+// DTSP_TCL's escapes for the server.
+#define RENDERSIZ (2*GLOBALSTRINGSIZ+4)
+#define RENDER_UNESCAPE 3
+#define RENDER_ESCAPES 4
+
+// Line flags
+#define DTSP_PADDED 0x01 // CTRL_K added to keep trailing spaces
+#define DTSP_EMPTY 0x02  // blank line (payload is "\r\n")
+
+typedef struct {
+  char Magic[4];
+  DWORD Version;
+  DWORD Lines;
+  DWORD Dialects;
+  DWORD OffsetTable;
+  DWORD FlagTable;
+  DWORD Size; // of the whole file
+} DTSP_Header;
+
 typedef struct {
 	char * result;
 	void (*freeProc)(char *blockPtr);
@@ -85,16 +371,171 @@ typedef struct {
 } Tcl_Interp;
 
 typedef struct {
-  bool bStart, bStop, bPause, bResume, bUseDDE, bUseFile;
+  char* Name;
+  BYTE Type; // CFG_INT or CFG_BOOL
+  int Default;
+  int Min;
+  int Max;
+} DTS_ConfigItem;
+
+// One client's play, set by the ColorXxx() calls and read by the process
+// that plays it
+typedef struct {
+  bool bStart, bStop, bPause, bResume, bUseFile;
+  bool bFollow, bFollowEnd; // play-file is still being written
+  bool bUseBuffer;    // play from the PLAYBUF_NAME buffer, not Filename
+  DWORD BufGeneration;
+  DWORD BufLength;
 	int PlayTime;
-	int FiFoIn;
-	int FiFoOut;
-  char Service[64];
   char Channel[128];
   char Filename[2048]; // big enough for a chat-text line...
-  char FiFo[FIFOSIZE][2048]; // fifo buffer...
+  volatile LONG PlayListIn;  // files added
+  volatile LONG PlayListOut; // files the reader has moved on to
+  char PlayList[PLAYLISTSIZE][MAX_PATH];
+  volatile LONG LinesSent;   // play-file lines the consumer has sent
+  volatile LONG LinesTotal;  // in the files it's read so far (0 = following)
+  volatile LONG PaceTime;    // send interval in effect (ms)
+  bool bStrip;               // strip color codes (the channel is +c)
+  volatile LONG Handle;      // last play started (StartColor())
+  volatile LONG PlayHandle;  // the play State is about
+  volatile LONG State;       // PLAY_IDLE, etc.
+  volatile LONG Notify;      // set STATE_EVENT every Notify lines too
+} DTS_Session;
+
+typedef struct {
+  char Magic[4];          // SHARED_MAGIC once it's set up
+  DWORD Layout;           // SHARED_LAYOUT
+  DWORD Size;             // sizeof(DTS_Color)
+  volatile LONG Attached; // processes using it
+  UINT CodePage; // client's code-page for UTF-8 text (CP_ACP by default)
+  DWORD BufGeneration; // last ColorAllocBuffer()
+  DWORD BufLength;     // and ColorStartBuffer()
+  volatile LONG FiFoIn;  // see FiFoPut() and FiFoTake()
+  volatile LONG FiFoOut;
+  char Service[64];
+  char FiFo[FIFOSIZE][2048]; // fifo buffer (XiRCON's one-line mode)...
+  LONGLONG FiFoTime[FIFOSIZE]; // QueryPerformanceCounter() when written
+  volatile LONG IpcHist[2][IPCBUCKETS]; // IPC_WAIT and IPC_SEND
+  volatile LONG IpcLines;
+  LONGLONG IpcFirst; // first and last line's Sendtcl() returning
+  LONGLONG IpcLast;
+  volatile LONG CacheHits;   // text play-files found in the cache
+  volatile LONG CacheMisses; // and not found
+  volatile LONG Lag;         // last round-trip the client reported (ms)
+  volatile LONG LagSamples;  // reports so far
+  volatile LONG Handles;     // last play handle given out
+  int Config[CFG_COUNT];     // CFG_PLAYTIME, etc.
+  DTS_Session Session[SINKS];
 } DTS_Color;
 
+// Canonical Huffman code (see InflateCode())
+typedef struct {
+  short Count[INFLATEMAXBITS+1]; // codes of each length
+  short Symbol[288];             // symbols, shortest codes first
+} DTS_Huffman;
+
+// A gzip play-file being inflated by the reader thread (see Inflate())
+typedef struct {
+  BYTE In[INFLATEINSIZ];
+  DWORD dwInPos;
+  DWORD dwInLen;
+  DWORD dwBitBuf;
+  int BitCount;
+  BYTE Window[INFLATEWINDOW]; // last 32K out, for back-references
+  DWORD dwWinPos;
+  DWORD dwWinFill;
+  int State;
+  bool bFinal;          // this block is the member's last
+  DWORD dwStored;       // stored block bytes left
+  int CopyLen;          // back-reference bytes left
+  DWORD dwCopyDist;
+  DTS_Huffman Lengths;  // literal/length code
+  DTS_Huffman Dists;    // distance code
+  DWORD dwCrc;          // of what we've put out, for the trailer
+  DWORD dwSize;
+  bool bError;
+} DTS_Inflate;
+
+// A play-file the reader thread has opened (see GetPlaySource())
+typedef struct {
+  HANDLE hFile;
+  HANDLE hHeap;
+  LPVOID lpHeap;
+  DWORD dwBytesRead;
+  HANDLE hImageMap;
+  char* lpImage;
+  DWORD dwImageSize;
+  ULONGLONG CacheKey;
+  DWORD dwCacheSize;
+  bool bCacheStore;
+  DTS_Inflate* pInflate;
+  bool bReady;
+} DTS_Source;
+
+typedef struct {
+  char Magic[4];
+  DWORD Version;
+  LONGLONG Freq;  // QueryPerformanceFrequency()
+  LONGLONG Start; // QueryPerformanceCounter() when recording started
+} DTSR_Header;
+
+typedef struct {
+  LONGLONG Scheduled; // when the timer should have sent it
+  LONGLONG Actual;    // when it was sent
+  DWORD Session;
+  DWORD Line;         // play-file line or 0
+  BYTE Sink;          // DTSP_TCL, DTSP_DDE or DIALECT_IRC
+  BYTE TargetLen;     // channel's length (follows this)
+  WORD CommandLen;    // command's length (follows the channel)
+  WORD TextLen;       // temp-file text's length (follows the command)
+} DTSR_Record;
+
+// Piece of a text play-file for BuildPlayImage() (see SplitChunks())
+typedef struct {
+  char* lpText;       // whole lines
+  DWORD dwSize;
+  int Index;
+  DWORD dwLines;      // pass 1 - counted
+  DWORD dwPayload;
+  char* lpImg;        // pass 2 - where its lines go in the image
+  DWORD dwFirstLine;
+  DWORD dwOut;
+  int Dialect;        // DTS_plan - count only, for this client
+  DWORD dwWire;       // escaped bytes
+  WORD* pwServer;     // each line's bytes as the server sees them
+  bool bOk;
+} DTS_Chunk;
+
+// Bounded single-producer/single-consumer queue of text-lines. In and Out
+// only ever count up, In is written only by the producer thread and Out
+// only by the consumer thread...
+typedef struct {
+  char* pBuf;             // Slots * SlotSize bytes
+  int Slots;
+  int SlotSize;
+  volatile LONG In;       // lines written
+  volatile LONG Out;      // lines read
+  volatile LONG bClosed;  // producer is finished
+  HANDLE hNotEmpty;       // auto-reset, set by producer
+  HANDLE hNotFull;        // auto-reset, set by consumer
+} DTS_Queue;
+
+typedef struct {
+  LONGLONG Time;  // QueryPerformanceCounter()
+  DWORD ThreadID;
+  DWORD Session;  // counts playbacks
+  DWORD Line;     // line number in the session
+  BYTE Stage;     // TR_TICK, etc.
+  char Phase;     // 'B'egin or 'E'nd
+} DTS_TraceEvent;
+
+typedef struct {
+  volatile LONG Seq; // position in the ring + 1 once it's complete
+  int Code;          // ERR_...
+  DWORD Time;        // GetTickCount()
+  char Text[ERRORTEXTSIZ];
+} DTS_Error;
+
 typedef int Tcl_CmdProc(void *cd, Tcl_Interp *interp, int argc, char *argv[]);
 
 /* Typedefed Tcl functions */
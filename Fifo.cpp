@@ -0,0 +1,149 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// File:     Fifo.cpp
+// Author:   Scott Swift, dxzl@live.com
+//
+// XiRCON's one-line FIFO in the shared memory - ColorStart() puts a line
+// in, DTS_poll takes them out - and the latency histograms DTS_ipc shows.
+// Nothing in it needs Windows, tools\ipcbench runs it between two Linux
+// processes. Waiting for a free slot (WaitForCredit(), FreeCredit()) is
+// Colorize.cpp's, it takes an event.
+
+#include "Portable.h"
+#include <string.h>
+#include "Colorize.h"
+#include "Fifo.h"
+#pragma hdrstop
+
+// In Colorize.cpp (or the tool's own)
+extern DTS_Color* pDTS_Color;
+
+/*********************************************************************/
+int FiFoCredits(void)
+// Return: one-line FIFO slots free (one is always kept empty so a full
+//         FIFO doesn't look like an empty one, CFG_FIFOLINES can hold
+//         back more)
+{
+  int Used = pDTS_Color->FiFoIn - pDTS_Color->FiFoOut;
+
+  if (Used < 0)
+    Used += FIFOSIZE;
+
+  int Credits = CONFIG(CFG_FIFOLINES) - Used;
+
+  return Credits > 0 ? Credits : 0;
+}
+/*********************************************************************/
+void FiFoPut(char* pLine, LONGLONG llNow)
+// Purpose: Put a line in the one-line FIFO (the producer, after a
+//          credit)
+// Args: llNow the clock IpcRecord() gets the ticks of
+{
+  LONG lIn = pDTS_Color->FiFoIn;
+
+  strncpy(pDTS_Color->FiFo[lIn], pLine, sizeof(pDTS_Color->FiFo[0])-1);
+  pDTS_Color->FiFo[lIn][sizeof(pDTS_Color->FiFo[0])-1] = NULLCHAR;
+  pDTS_Color->FiFoTime[lIn] = llNow;
+
+  // The line's in before the consumer can see it (a full barrier)
+  (void)InterlockedExchange(&pDTS_Color->FiFoIn,
+                                            lIn+1 >= FIFOSIZE ? 0 : lIn+1);
+}
+/*********************************************************************/
+bool FiFoTake(char* pBuf, LONGLONG* pllWritten)
+// Purpose: Take the oldest line out of the one-line FIFO (the consumer,
+//          while FiFoIn != FiFoOut) into pBuf (GLOBALSTRINGSIZ chars)
+// Return: false if FiFoOut's gone bad (FiFoReset() it)
+{
+  LONG lOut = pDTS_Color->FiFoOut;
+
+  if (lOut < 0 || lOut >= FIFOSIZE)
+    return false;
+
+  strcpy(pBuf, pDTS_Color->FiFo[lOut]);
+  *pllWritten = pDTS_Color->FiFoTime[lOut];
+
+  // Done with the slot before the producer can have it
+  (void)InterlockedExchange(&pDTS_Color->FiFoOut,
+                                          lOut+1 >= FIFOSIZE ? 0 : lOut+1);
+  return true;
+}
+/*********************************************************************/
+void FiFoReset(void)
+{
+  pDTS_Color->FiFoIn = 0;
+  pDTS_Color->FiFoOut = 0;
+}
+/*********************************************************************/
+/*********************************************************************/
+void IpcRecord(int Which, LONGLONG llTicks, LONGLONG llFreq)
+// Purpose: Count a one-line FIFO line's time in an IPC_WAIT or IPC_SEND
+//          histogram
+// Args: llTicks clock ticks, llFreq ticks a second
+{
+  if (llFreq <= 0)
+    return;
+
+  ULONGLONG ullMicro = llTicks > 0 ?
+                 (ULONGLONG)llTicks * 1000000 / llFreq : 0;
+
+  // Bucket N is under 2^(N+1) us
+  int Bucket = 0;
+  while (Bucket < IPCBUCKETS-1 && (ullMicro >> (Bucket+1)) != 0)
+    Bucket++;
+
+  InterlockedIncrement(&pDTS_Color->IpcHist[Which][Bucket]);
+}
+/*********************************************************************/
+LONG IpcPercentile(int Which, int Percent)
+// Return: microseconds Percent of the lines in the IPC_WAIT or IPC_SEND
+//         histogram took less than (to the next power of 2), 0 if
+//         there are none
+{
+  volatile LONG* pHist = pDTS_Color->IpcHist[Which];
+  LONGLONG llTotal = 0;
+  int ii;
+
+  for (ii = 0; ii < IPCBUCKETS; ii++)
+    llTotal += pHist[ii];
+
+  if (llTotal == 0)
+    return 0;
+
+  LONGLONG llWant = (llTotal * Percent + 99) / 100;
+  LONGLONG llSoFar = 0;
+
+  for (ii = 0; ii < IPCBUCKETS-1; ii++)
+    if ((llSoFar += pHist[ii]) >= llWant)
+      break;
+
+  return ii >= 30 ? 0x7FFFFFFF : 2L << ii;
+}
+/*********************************************************************/
+void IpcSent(LONGLONG llNow)
+// Purpose: Count a one-line FIFO line as sent, for IpcRate()
+{
+  if (InterlockedIncrement(&pDTS_Color->IpcLines) == 1)
+    pDTS_Color->IpcFirst = llNow;
+  pDTS_Color->IpcLast = llNow;
+}
+/*********************************************************************/
+LONG IpcRate(LONGLONG llFreq)
+// Return: lines/s between the first and last line sent, 0 if we can't
+//         tell yet
+{
+  LONGLONG llSpan = pDTS_Color->IpcLast - pDTS_Color->IpcFirst;
+
+  if (pDTS_Color->IpcLines < 2 || llSpan <= 0 || llFreq <= 0)
+    return 0;
+
+  return (LONG)((LONGLONG)(pDTS_Color->IpcLines-1) * llFreq / llSpan);
+}
+/*********************************************************************/
+void IpcClear(void)
+{
+  pDTS_Color->IpcLines = 0;
+  memset((void*)pDTS_Color->IpcHist, 0, sizeof(pDTS_Color->IpcHist));
+}
+/*********************************************************************/
@@ -0,0 +1,20 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// One-line FIFO in the shared memory (Fifo.cpp) - include Portable.h (or
+// windows.h) and Colorize.h first
+
+#ifndef __fifo_h
+#define __fifo_h
+
+int FiFoCredits(void);
+void FiFoPut(char* pLine, LONGLONG llNow);
+bool FiFoTake(char* pBuf, LONGLONG* pllWritten);
+void FiFoReset(void);
+void IpcRecord(int Which, LONGLONG llTicks, LONGLONG llFreq);
+void IpcSent(LONGLONG llNow);
+LONG IpcPercentile(int Which, int Percent);
+LONG IpcRate(LONGLONG llFreq);
+void IpcClear(void);
+
+#endif
@@ -0,0 +1,346 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// File:     Image.cpp
+// Author:   Scott Swift, dxzl@live.com
+//
+// Splitting a text play-file into lines and building its pre-formatted
+// image (see DTSP_Header), a chunk per processor. Nothing in it needs
+// Windows - the threads, the count of processors and the code-page
+// conversion are the caller's (see Image.h), so tools\imagebench and
+// tools\dtsconvert build it with g++ (tools\ImageHost.cpp has the calls).
+
+#include "Portable.h"
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include "Colorize.h"
+#include "Render.h"
+#include "Image.h"
+#pragma hdrstop
+
+// In Colorize.cpp (or the tool's own)
+extern DTS_Color* pDTS_Color;
+
+/*********************************************************************/
+bool ScanLine(char* lpBuf, DWORD dwSize, DWORD* pdwPos,
+                                        char* pStr, DWORD* pdwCount)
+// Purpose: Copy chars from lpBuf[*pdwPos] to pStr[*pdwCount] up to the
+//          next line-feed (dropping carriage-returns and anything past
+//          GLOBALSTRINGSIZ-2 chars)
+// Return: true if we hit the line-feed, false if we ran out of buffer
+{
+  DWORD dwPos = *pdwPos;
+  DWORD dwCount = *pdwCount;
+  bool bLineFeed = false;
+
+  for(; dwPos < dwSize ; dwPos++)
+  {
+    if (lpBuf[dwPos] != '\r' && lpBuf[dwPos] != '\n' &&
+                 dwCount < GLOBALSTRINGSIZ-2)
+      pStr[dwCount++] = lpBuf[dwPos];
+    else if (lpBuf[dwPos] == '\n')
+    {
+      dwPos++;
+      bLineFeed = true;
+      break;
+    }
+  }
+
+  *pdwPos = dwPos;
+  *pdwCount = dwCount;
+  return bLineFeed;
+}
+/*********************************************************************/
+DWORD EndLine(char* pStr, DWORD dwCount)
+// Purpose: Terminate a line from ScanLine()
+// Return: length of pStr
+{
+  // Add a terminating CTRL_K if space(s) at end of line to prevent
+  // them from being trimmed off by some clients
+  if (dwCount && pStr[dwCount-1] == ' ')
+    pStr[dwCount++] = CTRL_K;
+  pStr[dwCount] = NULLCHAR;
+
+  return dwCount;
+}
+/*********************************************************************/
+bool NextTextLine(char* lpBuf, DWORD dwSize, DWORD* pdwPos, char* pStr)
+// Purpose: Copy the next line of a whole text file in lpBuf to pStr
+//          (GLOBALSTRINGSIZ chars) the same way ReadNextLine() does
+// Return: false at end of file
+{
+  DWORD dwCount = 0;
+
+  if (ScanLine(lpBuf, dwSize, pdwPos, pStr, &dwCount))
+  {
+    (void)EndLine(pStr, dwCount);
+    return true;
+  }
+
+  // Last line has no line-feed
+  return EndLine(pStr, dwCount) != 0;
+}
+/*********************************************************************/
+bool CheckPlayImage(char* lpImg, DWORD dwSize)
+// Purpose: Make sure an image's tables fit inside it
+{
+  DTSP_Header* pHdr = (DTSP_Header*)lpImg;
+
+  if (dwSize < sizeof(DTSP_Header) ||
+      memcmp(pHdr->Magic, DTSP_MAGIC, sizeof(pHdr->Magic)) ||
+      pHdr->Version != DTSP_VERSION ||
+      pHdr->Dialects != DTSP_DIALECTS ||
+      pHdr->Size != dwSize ||
+      pHdr->Lines > dwSize / (DTSP_DIALECTS*sizeof(DWORD)+1) ||
+      pHdr->OffsetTable > dwSize ||
+      pHdr->Lines*DTSP_DIALECTS*sizeof(DWORD) > dwSize-pHdr->OffsetTable ||
+      pHdr->FlagTable > dwSize ||
+      pHdr->Lines > dwSize-pHdr->FlagTable)
+    return false;
+
+  return true;
+}
+/*********************************************************************/
+bool ImageLine(char* lpImg, DWORD dwSize, DWORD dwLine, int Dialect,
+                                                             char* pStr)
+// Purpose: Copy line dwLine's payload for Dialect from a checked image
+//          (see CheckPlayImage()) to pStr (GLOBALSTRINGSIZ chars)
+// Return: false past the last line
+{
+  DTSP_Header* pHdr = (DTSP_Header*)lpImg;
+  DWORD* pOffsets = (DWORD*)(lpImg + pHdr->OffsetTable);
+
+  if (dwLine >= pHdr->Lines)
+    return false;
+
+  DWORD dwOffset = pOffsets[dwLine*DTSP_DIALECTS + Dialect];
+
+  if (dwOffset >= dwSize)
+  {
+    pStr[0] = NULLCHAR;
+    return true;
+  }
+
+  // Leave room for PIRCH's leading CTRL_K (see FrameString())
+  DWORD dwMax = dwSize - dwOffset;
+  if (dwMax > GLOBALSTRINGSIZ-2)
+    dwMax = GLOBALSTRINGSIZ-2;
+
+  char* pPayload = lpImg + dwOffset;
+  char* pEnd = (char*)memchr(pPayload, NULLCHAR, dwMax);
+  DWORD dwLen = pEnd != NULL ? (DWORD)(pEnd - pPayload) : dwMax;
+
+  memcpy(pStr, pPayload, dwLen);
+  pStr[dwLen] = NULLCHAR;
+  return true;
+}
+/*********************************************************************/
+bool BuildPlayImage(char* lpText, DWORD dwSize,
+                                     char** ppImage, DWORD* pdwImageSize)
+// Purpose: Split, pad and escape a whole text play-file into a
+//          pre-formatted image (free() it when done). UTF-8 lines are
+//          stored in the code-page set when the image is built. A big
+//          file gets split at line boundaries into a chunk per
+//          processor, the chunks are done in parallel and laid out in
+//          order.
+{
+  DTS_Chunk Chunks[MAXWORKERS];
+  int Count, ii;
+
+  Count = SplitChunks(lpText, dwSize, Chunks);
+
+  // Pass 1 - count lines and payload bytes to lay out the image
+  if (!RunChunks(Chunks, Count, ChunkCountThread))
+    return false;
+
+  DWORD dwLines = 0;
+  DWORD dwPayload = 0;
+
+  for (ii = 0; ii < Count; ii++)
+  {
+    dwLines += Chunks[ii].dwLines;
+    dwPayload += Chunks[ii].dwPayload;
+  }
+
+  DWORD dwOffsetTable = sizeof(DTSP_Header);
+  DWORD dwFlagTable = dwOffsetTable + dwLines*DTSP_DIALECTS*sizeof(DWORD);
+  DWORD dwImageSize = dwFlagTable + dwLines + dwPayload;
+  char* lpImg;
+
+  if ((lpImg = (char*)malloc(dwImageSize)) == NULL)
+    return false;
+
+  DTSP_Header* pHdr = (DTSP_Header*)lpImg;
+
+  memcpy(pHdr->Magic, DTSP_MAGIC, sizeof(pHdr->Magic));
+  pHdr->Version = DTSP_VERSION;
+  pHdr->Lines = dwLines;
+  pHdr->Dialects = DTSP_DIALECTS;
+  pHdr->OffsetTable = dwOffsetTable;
+  pHdr->FlagTable = dwFlagTable;
+  pHdr->Size = dwImageSize;
+
+  // Each chunk's lines and payloads follow the one before it's
+  DWORD dwLine = 0;
+  DWORD dwOut = dwFlagTable + dwLines;
+
+  for (ii = 0; ii < Count; ii++)
+  {
+    Chunks[ii].lpImg = lpImg;
+    Chunks[ii].dwFirstLine = dwLine;
+    Chunks[ii].dwOut = dwOut;
+
+    dwLine += Chunks[ii].dwLines;
+    dwOut += Chunks[ii].dwPayload;
+  }
+
+  // Pass 2 - fill in the tables and payloads
+  if (!RunChunks(Chunks, Count, ChunkFillThread))
+  {
+    free(lpImg);
+    return false;
+  }
+
+  *ppImage = lpImg;
+  *pdwImageSize = dwImageSize;
+  return true;
+}
+/*********************************************************************/
+int SplitChunks(char* lpText, DWORD dwSize, DTS_Chunk* pChunks)
+// Purpose: Split a text play-file at line-feeds into a chunk for each
+//          processor (up to CFG_WORKERS), none smaller than CFG_CHUNKKB
+// Return: number of chunks
+{
+  int Count, ii;
+  DWORD dwPos, dwEnd;
+
+  Count = CountProcessors();
+  if (Count > CONFIG(CFG_WORKERS))
+    Count = CONFIG(CFG_WORKERS);
+  if ((DWORD)Count > dwSize / ((DWORD)CONFIG(CFG_CHUNKKB)*1024))
+    Count = dwSize / ((DWORD)CONFIG(CFG_CHUNKKB)*1024);
+  if (Count < 1)
+    Count = 1;
+
+  for (ii = 0, dwPos = 0; ii < Count; ii++)
+  {
+    // An even share of what's left, out to the end of its last line
+    dwEnd = dwPos + (dwSize - dwPos) / (Count - ii);
+
+    if (ii == Count-1)
+      dwEnd = dwSize;
+    else
+    {
+      while (dwEnd < dwSize && lpText[dwEnd-1] != '\n')
+        dwEnd++;
+    }
+
+    memset(&pChunks[ii], 0, sizeof(DTS_Chunk));
+    pChunks[ii].lpText = lpText + dwPos;
+    pChunks[ii].dwSize = dwEnd - dwPos;
+    pChunks[ii].Index = ii;
+
+    dwPos = dwEnd;
+  }
+
+  return Count;
+}
+/*********************************************************************/
+DWORD WINAPI ChunkCountThread(LPVOID lpParam)
+// Purpose: BuildPlayImage() pass 1 for one chunk - count its lines and
+//          escaped payload bytes
+{
+  DTS_Chunk* pChunk = (DTS_Chunk*)lpParam;
+  char* pLine;
+  char* pEsc;
+  DWORD dwPos, dwLen;
+  int Dialect;
+
+  pChunk->bOk = false;
+
+  if ((pLine = (char*)malloc(GLOBALSTRINGSIZ)) == NULL)
+    return 0;
+
+  if ((pEsc = (char*)malloc(2*GLOBALSTRINGSIZ+1)) == NULL)
+  {
+    free(pLine);
+    return 0;
+  }
+
+  TRACE_BEGIN(TR_BUILD, pChunk->Index);
+
+  dwPos = pChunk->dwLines = pChunk->dwPayload = 0;
+
+  while (NextTextLine(pChunk->lpText, pChunk->dwSize, &dwPos, pLine))
+  {
+    if ((dwLen = TranscodeString(pLine, strlen(pLine))) == 0)
+      dwLen = sprintf(pLine, "\r\n");
+
+    for (Dialect = 0; Dialect < DTSP_DIALECTS; Dialect++)
+      pChunk->dwPayload += EscapeString(pLine, dwLen, pEsc, Dialect) + 1;
+
+    pChunk->dwLines++;
+  }
+
+  TRACE_END(TR_BUILD, pChunk->Index);
+
+  free(pLine);
+  free(pEsc);
+
+  pChunk->bOk = true;
+  return 0;
+}
+/*********************************************************************/
+DWORD WINAPI ChunkFillThread(LPVOID lpParam)
+// Purpose: BuildPlayImage() pass 2 for one chunk - fill in its lines'
+//          offsets, flags and payloads
+{
+  DTS_Chunk* pChunk = (DTS_Chunk*)lpParam;
+  DTSP_Header* pHdr = (DTSP_Header*)pChunk->lpImg;
+  DWORD* pOffsets = (DWORD*)(pChunk->lpImg + pHdr->OffsetTable);
+  BYTE* pFlags = (BYTE*)(pChunk->lpImg + pHdr->FlagTable);
+  DWORD dwOut = pChunk->dwOut;
+  DWORD dwPos, dwLen, dwLine;
+  char* pLine;
+  int Dialect;
+
+  pChunk->bOk = false;
+
+  if ((pLine = (char*)malloc(GLOBALSTRINGSIZ)) == NULL)
+    return 0;
+
+  TRACE_BEGIN(TR_BUILD, pChunk->Index);
+
+  dwPos = 0;
+
+  for (DWORD ii = 0; ii < pChunk->dwLines; ii++)
+  {
+    (void)NextTextLine(pChunk->lpText, pChunk->dwSize, &dwPos, pLine);
+
+    dwLine = pChunk->dwFirstLine + ii;
+    pFlags[dwLine] = 0;
+
+    if ((dwLen = TranscodeString(pLine, strlen(pLine))) == 0)
+    {
+      dwLen = sprintf(pLine, "\r\n");
+      pFlags[dwLine] |= DTSP_EMPTY;
+    }
+    else if (pLine[dwLen-1] == CTRL_K)
+      pFlags[dwLine] |= DTSP_PADDED;
+
+    for (Dialect = 0; Dialect < DTSP_DIALECTS; Dialect++)
+    {
+      pOffsets[dwLine*DTSP_DIALECTS + Dialect] = dwOut;
+      dwOut += EscapeString(pLine, dwLen, pChunk->lpImg+dwOut, Dialect) + 1;
+    }
+  }
+
+  TRACE_END(TR_BUILD, pChunk->Index);
+
+  free(pLine);
+
+  pChunk->bOk = true;
+  return 0;
+}
+/*********************************************************************/
@@ -0,0 +1,32 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// Lines and pre-formatted play-file images (Image.cpp) - include
+// Portable.h (or windows.h) and Colorize.h first
+
+#ifndef __image_h
+#define __image_h
+
+bool ScanLine(char* lpBuf, DWORD dwSize, DWORD* pdwPos,
+                                        char* pStr, DWORD* pdwCount);
+DWORD EndLine(char* pStr, DWORD dwCount);
+bool NextTextLine(char* lpBuf, DWORD dwSize, DWORD* pdwPos, char* pStr);
+bool CheckPlayImage(char* lpImg, DWORD dwSize);
+bool ImageLine(char* lpImg, DWORD dwSize, DWORD dwLine, int Dialect,
+                                                            char* pStr);
+bool BuildPlayImage(char* lpText, DWORD dwSize,
+                                     char** ppImage, DWORD* pdwImageSize);
+int SplitChunks(char* lpText, DWORD dwSize, DTS_Chunk* pChunks);
+DWORD WINAPI ChunkCountThread(LPVOID lpParam);
+DWORD WINAPI ChunkFillThread(LPVOID lpParam);
+
+// Colorize.cpp's (a tool has its own)
+int CountProcessors(void);
+bool RunChunks(DTS_Chunk* pChunks, int Count,
+                                       LPTHREAD_START_ROUTINE lpWork);
+UINT TranscodeString(char* pStr, UINT length);
+#ifdef DTS_TRACE
+void TraceEvent(int Stage, char Phase, DWORD Line);
+#endif
+
+#endif
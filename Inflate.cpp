@@ -0,0 +1,529 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// File:     Inflate.cpp
+// Author:   Scott Swift, dxzl@live.com
+//
+// A small resumable gzip (RFC 1952) inflater for compressed play-files -
+// stored, fixed and dynamic deflate blocks (RFC 1951), concatenated
+// members and the CRC and size check. Inflate() stops wherever its output
+// fills and picks up there next time. The compressed bytes come from
+// InflateRead() (the caller's, see Inflate.h) so tools\inflatetest builds
+// it with g++.
+
+#include "Portable.h"
+#include <string.h>
+#include <stdlib.h>
+#include "Colorize.h"
+#include "Inflate.h"
+#pragma hdrstop
+
+DWORD CrcTable[256];
+bool bCrcTable = false;
+
+// Deflate's length and distance bases and extra bits (RFC 1951)
+const short LengthBase[29] = {
+  3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+  35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+const short LengthExtra[29] = {
+  0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+  3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+const short DistBase[30] = {
+  1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+  257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145,
+  8193, 12289, 16385, 24577};
+const short DistExtra[30] = {
+  0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+  7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+// Order the code-length code's lengths come in
+const BYTE CodeOrder[19] = {
+  16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+DTS_Inflate* InflateOpen(void)
+// Purpose: Start inflating a gzip file (what InflateRead() gives us)
+// Return: NULL if out of memory
+{
+  DTS_Inflate* pInf;
+
+  if (!bCrcTable)
+  {
+    for (DWORD ii = 0; ii < 256; ii++)
+    {
+      DWORD dwCrc = ii;
+
+      for (int jj = 0; jj < 8; jj++)
+        dwCrc = (dwCrc & 1) ? 0xEDB88320L ^ (dwCrc >> 1) : dwCrc >> 1;
+
+      CrcTable[ii] = dwCrc;
+    }
+
+    bCrcTable = true;
+  }
+
+  if ((pInf = (DTS_Inflate*)malloc(sizeof(DTS_Inflate))) == NULL)
+    return NULL;
+
+  memset(pInf, 0, sizeof(DTS_Inflate));
+  pInf->State = INF_HEADER;
+  return pInf;
+}
+/*********************************************************************/
+DWORD Inflate(DTS_Inflate* pInf, BYTE* pOut, DWORD dwRoom)
+// Purpose: Inflate up to dwRoom bytes, picking up where we left off
+// Return: bytes in pOut, less than dwRoom only at the end (or if
+//         pInf->bError)
+{
+  DWORD dwOut = 0;
+
+  while (dwOut < dwRoom && !pInf->bError)
+  {
+    switch (pInf->State)
+    {
+      case INF_HEADER:
+        if (!InflateHeader(pInf))
+          pInf->bError = true;
+        break;
+
+      case INF_BLOCK:
+        if (!InflateBlock(pInf))
+          pInf->bError = true;
+        break;
+
+      case INF_STORED:
+        while (pInf->dwStored && dwOut < dwRoom && !pInf->bError)
+        {
+          int c = InflateByte(pInf);
+
+          if (c < 0)
+            pInf->bError = true;
+          else
+          {
+            InflatePut(pInf, (BYTE)c);
+            pOut[dwOut++] = (BYTE)c;
+            pInf->dwStored--;
+          }
+        }
+
+        if (pInf->dwStored == 0)
+          pInf->State = pInf->bFinal ? INF_TRAILER : INF_BLOCK;
+        break;
+
+      case INF_CODES:
+        dwOut += InflateCodes(pInf, pOut + dwOut, dwRoom - dwOut);
+        break;
+
+      case INF_TRAILER:
+        if (!InflateTrailer(pInf))
+          pInf->bError = true;
+        break;
+
+      default: // INF_DONE
+        return dwOut;
+    }
+  }
+
+  return dwOut;
+}
+/*********************************************************************/
+int InflateByte(DTS_Inflate* pInf)
+// Purpose: Next byte of the compressed file, reading more when we run
+//          out (InflateRead())
+// Return: byte or -1 at the end of the file
+{
+  if (pInf->dwInPos >= pInf->dwInLen)
+  {
+    if (!InflateRead(pInf->In, INFLATEINSIZ, &pInf->dwInLen) ||
+                                                        pInf->dwInLen == 0)
+    {
+      pInf->dwInLen = 0;
+      return -1;
+    }
+
+    pInf->dwInPos = 0;
+  }
+
+  return pInf->In[pInf->dwInPos++];
+}
+/*********************************************************************/
+DWORD InflateBits(DTS_Inflate* pInf, int Need)
+// Purpose: Next Need (up to 16) bits, least significant first
+// Return: bits (pInf->bError set if the file ends)
+{
+  while (pInf->BitCount < Need)
+  {
+    int c = InflateByte(pInf);
+
+    if (c < 0)
+    {
+      pInf->bError = true;
+      return 0;
+    }
+
+    pInf->dwBitBuf |= (DWORD)c << pInf->BitCount;
+    pInf->BitCount += 8;
+  }
+
+  DWORD dwBits = pInf->dwBitBuf & ((1L << Need) - 1);
+  pInf->dwBitBuf >>= Need;
+  pInf->BitCount -= Need;
+  return dwBits;
+}
+/*********************************************************************/
+int InflateCode(DTS_Inflate* pInf, DTS_Huffman* pHuff)
+// Purpose: Decode one symbol a bit at a time - canonical codes of each
+//          length follow the shorter ones, so we only need the counts
+// Return: symbol or -1 if the code isn't in the table
+{
+  int Code = 0;  // bits so far
+  int First = 0; // first code of this length
+  int Index = 0; // its symbol
+
+  for (int Len = 1; Len <= INFLATEMAXBITS; Len++)
+  {
+    Code |= (int)InflateBits(pInf, 1);
+
+    if (pInf->bError)
+      return -1;
+
+    int Count = pHuff->Count[Len];
+
+    if (Code - Count < First)
+      return pHuff->Symbol[Index + (Code - First)];
+
+    Index += Count;
+    First = (First + Count) << 1;
+    Code <<= 1;
+  }
+
+  return -1;
+}
+/*********************************************************************/
+int InflateBuild(DTS_Huffman* pHuff, short* pLengths, int Count)
+// Purpose: Make a canonical code from each symbol's code length
+// Return: 0 if complete, > 0 if incomplete, < 0 if over-subscribed
+{
+  short Offsets[INFLATEMAXBITS+1];
+  int Len, Sym;
+
+  memset(pHuff->Count, 0, sizeof(pHuff->Count));
+
+  for (Sym = 0; Sym < Count; Sym++)
+    pHuff->Count[pLengths[Sym]]++;
+
+  if (pHuff->Count[0] == Count)
+    return 0; // no codes at all (a block with only literals is ok)
+
+  int Left = 1;
+
+  for (Len = 1; Len <= INFLATEMAXBITS; Len++)
+  {
+    Left <<= 1;
+    Left -= pHuff->Count[Len];
+
+    if (Left < 0)
+      return Left;
+  }
+
+  Offsets[1] = 0;
+
+  for (Len = 1; Len < INFLATEMAXBITS; Len++)
+    Offsets[Len+1] = (short)(Offsets[Len] + pHuff->Count[Len]);
+
+  for (Sym = 0; Sym < Count; Sym++)
+    if (pLengths[Sym] != 0)
+      pHuff->Symbol[Offsets[pLengths[Sym]]++] = (short)Sym;
+
+  return Left;
+}
+/*********************************************************************/
+bool InflateHeader(DTS_Inflate* pInf)
+// Purpose: Skip a gzip member's header (RFC 1952)
+// Return: false if it isn't one we can inflate
+{
+  int ii;
+
+  if (InflateBits(pInf, 8) != 0x1f || InflateBits(pInf, 8) != 0x8b ||
+                                           InflateBits(pInf, 8) != 8)
+    return false;
+
+  DWORD dwFlags = InflateBits(pInf, 8);
+
+  // Time, extra flags and OS
+  for (ii = 0; ii < 6; ii++)
+    (void)InflateBits(pInf, 8);
+
+  if (dwFlags & 4) // FEXTRA
+  {
+    DWORD dwLen = InflateBits(pInf, 16);
+
+    while (dwLen-- && !pInf->bError)
+      (void)InflateBits(pInf, 8);
+  }
+
+  if (dwFlags & 8) // FNAME
+    while (InflateBits(pInf, 8) != 0 && !pInf->bError);
+
+  if (dwFlags & 16) // FCOMMENT
+    while (InflateBits(pInf, 8) != 0 && !pInf->bError);
+
+  if (dwFlags & 2) // FHCRC
+    (void)InflateBits(pInf, 16);
+
+  pInf->dwCrc = 0xFFFFFFFFL;
+  pInf->dwSize = 0;
+  pInf->State = INF_BLOCK;
+  return !pInf->bError && (dwFlags & 0xE0) == 0;
+}
+/*********************************************************************/
+bool InflateBlock(DTS_Inflate* pInf)
+// Purpose: Read a deflate block's header and get ready to inflate it
+// Return: false on bad data
+{
+  short Lengths[288];
+  int Sym;
+
+  pInf->bFinal = InflateBits(pInf, 1) != 0;
+
+  switch (InflateBits(pInf, 2))
+  {
+    case 0: // stored
+    {
+      // Starts on a byte
+      pInf->dwBitBuf = 0;
+      pInf->BitCount = 0;
+
+      DWORD dwLen = InflateBits(pInf, 16);
+
+      if (InflateBits(pInf, 16) != (~dwLen & 0xFFFF))
+        return false;
+
+      pInf->dwStored = dwLen;
+      pInf->State = INF_STORED;
+      break;
+    }
+
+    case 1: // fixed codes
+      for (Sym = 0; Sym < 144; Sym++)
+        Lengths[Sym] = 8;
+      for (; Sym < 256; Sym++)
+        Lengths[Sym] = 9;
+      for (; Sym < 280; Sym++)
+        Lengths[Sym] = 7;
+      for (; Sym < 288; Sym++)
+        Lengths[Sym] = 8;
+      (void)InflateBuild(&pInf->Lengths, Lengths, 288);
+
+      for (Sym = 0; Sym < 30; Sym++)
+        Lengths[Sym] = 5;
+      (void)InflateBuild(&pInf->Dists, Lengths, 30);
+
+      pInf->CopyLen = 0;
+      pInf->State = INF_CODES;
+      break;
+
+    case 2: // dynamic codes
+      if (!InflateTables(pInf))
+        return false;
+
+      pInf->CopyLen = 0;
+      pInf->State = INF_CODES;
+      break;
+
+    default:
+      return false;
+  }
+
+  return !pInf->bError;
+}
+/*********************************************************************/
+bool InflateTables(DTS_Inflate* pInf)
+// Purpose: Read a dynamic block's literal/length and distance codes
+// Return: false on bad data
+{
+  short Lengths[320];
+  DTS_Huffman CodeLen;
+  int Index, Sym, Err;
+
+  int nLen = (int)InflateBits(pInf, 5) + 257;
+  int nDist = (int)InflateBits(pInf, 5) + 1;
+  int nCode = (int)InflateBits(pInf, 4) + 4;
+
+  if (pInf->bError || nLen > 286 || nDist > 30)
+    return false;
+
+  // Code-length code first
+  for (Index = 0; Index < 19; Index++)
+    Lengths[CodeOrder[Index]] =
+                         Index < nCode ? (short)InflateBits(pInf, 3) : 0;
+
+  if (InflateBuild(&CodeLen, Lengths, 19) != 0)
+    return false;
+
+  // Then the lengths of both codes with it
+  for (Index = 0; Index < nLen + nDist;)
+  {
+    if ((Sym = InflateCode(pInf, &CodeLen)) < 0)
+      return false;
+
+    if (Sym < 16)
+      Lengths[Index++] = (short)Sym;
+    else
+    {
+      short Len = 0;
+      int Repeat;
+
+      if (Sym == 16)
+      {
+        if (Index == 0)
+          return false;
+
+        Len = Lengths[Index-1];
+        Repeat = 3 + (int)InflateBits(pInf, 2);
+      }
+      else if (Sym == 17)
+        Repeat = 3 + (int)InflateBits(pInf, 3);
+      else
+        Repeat = 11 + (int)InflateBits(pInf, 7);
+
+      if (pInf->bError || Index + Repeat > nLen + nDist)
+        return false;
+
+      while (Repeat--)
+        Lengths[Index++] = Len;
+    }
+  }
+
+  // Has to have an end-of-block code
+  if (Lengths[256] == 0)
+    return false;
+
+  // Incomplete codes are only ok with a single code
+  Err = InflateBuild(&pInf->Lengths, Lengths, nLen);
+  if (Err < 0 || (Err > 0 && nLen - pInf->Lengths.Count[0] != 1))
+    return false;
+
+  Err = InflateBuild(&pInf->Dists, Lengths + nLen, nDist);
+  if (Err < 0 || (Err > 0 && nDist - pInf->Dists.Count[0] != 1))
+    return false;
+
+  return true;
+}
+/*********************************************************************/
+DWORD InflateCodes(DTS_Inflate* pInf, BYTE* pOut, DWORD dwRoom)
+// Purpose: Inflate a fixed or dynamic block until it ends or pOut is
+//          full (a back-reference can be left half copied)
+// Return: bytes in pOut
+{
+  DWORD dwOut = 0;
+
+  while (dwOut < dwRoom)
+  {
+    if (pInf->CopyLen > 0)
+    {
+      BYTE c = pInf->Window[(pInf->dwWinPos - pInf->dwCopyDist) &
+                                                       (INFLATEWINDOW-1)];
+      InflatePut(pInf, c);
+      pOut[dwOut++] = c;
+      pInf->CopyLen--;
+      continue;
+    }
+
+    int Sym = InflateCode(pInf, &pInf->Lengths);
+
+    if (Sym < 0)
+    {
+      pInf->bError = true;
+      break;
+    }
+
+    if (Sym < 256) // literal
+    {
+      InflatePut(pInf, (BYTE)Sym);
+      pOut[dwOut++] = (BYTE)Sym;
+    }
+    else if (Sym == 256) // end of block
+    {
+      pInf->State = pInf->bFinal ? INF_TRAILER : INF_BLOCK;
+      break;
+    }
+    else // length and distance back into what we've put out
+    {
+      if ((Sym -= 257) >= 29)
+      {
+        pInf->bError = true;
+        break;
+      }
+
+      int Len = LengthBase[Sym] + (int)InflateBits(pInf, LengthExtra[Sym]);
+
+      if ((Sym = InflateCode(pInf, &pInf->Dists)) < 0 || Sym >= 30)
+      {
+        pInf->bError = true;
+        break;
+      }
+
+      DWORD dwDist = DistBase[Sym] + InflateBits(pInf, DistExtra[Sym]);
+
+      if (pInf->bError || dwDist > pInf->dwWinFill)
+      {
+        pInf->bError = true;
+        break;
+      }
+
+      pInf->CopyLen = Len;
+      pInf->dwCopyDist = dwDist;
+    }
+  }
+
+  return dwOut;
+}
+/*********************************************************************/
+bool InflateTrailer(DTS_Inflate* pInf)
+// Purpose: Check a gzip member's CRC and size, and see if another
+//          member follows (concatenated .gz files)
+// Return: false if the text doesn't match
+{
+  DWORD dwCrc, dwSize;
+
+  // Trailer starts on a byte
+  pInf->dwBitBuf >>= pInf->BitCount & 7;
+  pInf->BitCount &= ~7;
+
+  dwCrc = InflateBits(pInf, 16);
+  dwCrc |= InflateBits(pInf, 16) << 16;
+  dwSize = InflateBits(pInf, 16);
+  dwSize |= InflateBits(pInf, 16) << 16;
+
+  if (pInf->bError || dwCrc != ~pInf->dwCrc || dwSize != pInf->dwSize)
+    return false;
+
+  // Anything left in the bit buffer, then the file
+  int c = pInf->BitCount ? (int)InflateBits(pInf, 8) : InflateByte(pInf);
+
+  if (c == 0x1f)
+  {
+    // Put it back for InflateHeader()
+    pInf->dwBitBuf = (pInf->dwBitBuf << 8) | (DWORD)c;
+    pInf->BitCount += 8;
+    pInf->State = INF_HEADER;
+  }
+  else
+    pInf->State = INF_DONE; // anything else (padding) is ignored
+
+  return true;
+}
+/*********************************************************************/
+void InflatePut(DTS_Inflate* pInf, BYTE c)
+// Purpose: Keep a byte we've put out for back-references and the CRC
+{
+  pInf->Window[pInf->dwWinPos++ & (INFLATEWINDOW-1)] = c;
+  pInf->dwWinPos &= INFLATEWINDOW-1;
+
+  if (pInf->dwWinFill < INFLATEWINDOW)
+    pInf->dwWinFill++;
+
+  pInf->dwCrc = CrcTable[(pInf->dwCrc ^ c) & 0xFF] ^ (pInf->dwCrc >> 8);
+  pInf->dwSize++;
+}
+/*********************************************************************/
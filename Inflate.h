@@ -0,0 +1,26 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// gzip inflater (Inflate.cpp) - include Portable.h (or windows.h) and
+// Colorize.h first
+
+#ifndef __inflate_h
+#define __inflate_h
+
+DTS_Inflate* InflateOpen(void);
+DWORD Inflate(DTS_Inflate* pInf, BYTE* pOut, DWORD dwRoom);
+int InflateByte(DTS_Inflate* pInf);
+DWORD InflateBits(DTS_Inflate* pInf, int Need);
+int InflateCode(DTS_Inflate* pInf, DTS_Huffman* pHuff);
+int InflateBuild(DTS_Huffman* pHuff, short* pLengths, int Count);
+bool InflateHeader(DTS_Inflate* pInf);
+bool InflateBlock(DTS_Inflate* pInf);
+bool InflateTables(DTS_Inflate* pInf);
+DWORD InflateCodes(DTS_Inflate* pInf, BYTE* pOut, DWORD dwRoom);
+bool InflateTrailer(DTS_Inflate* pInf);
+void InflatePut(DTS_Inflate* pInf, BYTE c);
+
+// Colorize.cpp's (a tool has its own)
+bool InflateRead(BYTE* pBuf, DWORD dwSize, DWORD* pdwRead);
+
+#endif
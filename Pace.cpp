@@ -0,0 +1,45 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// File:     Pace.cpp
+// Author:   Scott Swift, dxzl@live.com
+//
+// The send-interval controller behind DTS_lag - the arithmetic only,
+// PaceTimer() in Colorize.cpp feeds it the client's reports and moves
+// the timer. tools\pacetest runs it against a simulated server.
+
+#include "Portable.h"
+#include "Colorize.h"
+#include "Pace.h"
+#pragma hdrstop
+
+// In Colorize.cpp (or the tool's own)
+extern DTS_Color* pDTS_Color;
+
+/*********************************************************************/
+int PaceStep(int PaceTime, LONG Lag)
+// Purpose: Slow down (multiplicative) when a lag report is over
+//          CFG_LAGTARGET or speed up (additive) when it's under
+// Args: PaceTime the send interval now (ms), Lag the round-trip the
+//       client just reported (ms)
+// Return: the new send interval, within CFG_PACEMIN and CFG_PACEMAX
+//         (PaceTime if we aren't pacing)
+{
+  if (CONFIG(CFG_LAGTARGET) <= 0)
+    return PaceTime;
+
+  int NewTime;
+
+  if (Lag > CONFIG(CFG_LAGTARGET))
+    NewTime = PaceTime * CONFIG(CFG_PACEBACKOFF) / 8 + 1;
+  else
+    NewTime = PaceTime - CONFIG(CFG_PACESTEP);
+
+  if (NewTime < CONFIG(CFG_PACEMIN))
+    NewTime = CONFIG(CFG_PACEMIN);
+  if (NewTime > CONFIG(CFG_PACEMAX))
+    NewTime = CONFIG(CFG_PACEMAX);
+
+  return NewTime;
+}
+/*********************************************************************/
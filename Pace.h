@@ -0,0 +1,12 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// Pacing by the server's lag (Pace.cpp) - include Portable.h (or
+// windows.h) and Colorize.h first
+
+#ifndef __pace_h
+#define __pace_h
+
+int PaceStep(int PaceTime, LONG Lag);
+
+#endif
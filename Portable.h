@@ -0,0 +1,48 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// The Win32 types and the few calls the Windows-free parts of the DLL
+// (Render.cpp and the like) use, so the programs in tools\ can build
+// them with g++ on Linux. Under C++ Builder this is just windows.h.
+
+#ifndef __portable_h
+#define __portable_h
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <stdint.h>
+#include <stddef.h>
+
+typedef uint8_t BYTE;
+typedef uint16_t WORD;
+typedef uint32_t DWORD;
+typedef int32_t LONG;
+typedef unsigned int UINT;
+typedef int BOOL;
+typedef int64_t LONGLONG;
+typedef uint64_t ULONGLONG;
+typedef void* HANDLE;
+typedef void* LPVOID;
+typedef char* LPTSTR;
+typedef DWORD (*LPTHREAD_START_ROUTINE)(LPVOID);
+
+#define WINAPI
+#define MAX_PATH 260
+#define CP_ACP 0
+#define CP_UTF8 65001
+
+inline LONG InterlockedIncrement(volatile LONG* p)
+{ return __sync_add_and_fetch(p, 1); }
+
+inline LONG InterlockedDecrement(volatile LONG* p)
+{ return __sync_sub_and_fetch(p, 1); }
+
+inline LONG InterlockedExchange(volatile LONG* p, LONG v)
+{ return __sync_lock_test_and_set(p, v); }
+
+inline LONG InterlockedExchangeAdd(volatile LONG* p, LONG v)
+{ return __sync_fetch_and_add(p, v); }
+#endif
+
+#endif
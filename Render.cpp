@@ -0,0 +1,489 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// File:     Render.cpp
+// Author:   Scott Swift, dxzl@live.com
+//
+// Turning a line into the text of a client command, with nothing in it
+// that needs Windows (the tools in tools\ build it with g++). Colorize.cpp
+// transcodes the line and writes the DDE temp-file, FrameCommand() wraps
+// the result for each target.
+
+#include "Portable.h"
+#include <string.h>
+#include <stdio.h>
+#include <ctype.h>
+#include "Colorize.h"
+#include "Render.h"
+#pragma hdrstop
+
+// In Colorize.cpp (or the tool's own)
+extern DTS_Color* pDTS_Color;
+
+/*********************************************************************/
+// A line is rendered by FuseLine<Strip, Escape>() in one pass, each
+// char going through a strip stage and then an escape stage. The stages
+// are small structs the compiler inlines into the loop, and every pair
+// RenderString() can ask for is compiled as its own function
+// (RenderStages). A stage's Plain(dw) says none of the four chars in dw
+// need it, so most of a line is moved a DWORD at a time.
+struct Stage
+{
+  // true if any byte of dw is below n (n <= 0x80)
+  static bool Below(DWORD dw, DWORD n)
+  { return ((dw - 0x01010101L*n) & ~dw & 0x80808080L) != 0; }
+
+  // true if any byte of dw is c
+  static bool Has(DWORD dw, BYTE c)
+  { return Below(dw ^ (0x01010101L*c), 1); }
+};
+
+// Strip stages - Skip() says how many chars at ii to leave out
+struct StripNone : Stage
+{
+  enum { bPad = false };
+  static bool Plain(DWORD) { return true; }
+  static UINT Skip(BYTE*, UINT, UINT) { return 0; }
+};
+
+struct StripAll : Stage // a +c channel, take the codes out
+{
+  enum { bPad = true }; // it takes EndLine()'s CTRL_K too
+
+  static bool Plain(DWORD dw) { return !Below(dw, 0x20); }
+
+  static UINT Skip(BYTE* p, UINT ii, UINT length)
+  {
+    BYTE c = p[ii];
+
+    if (c != CTRL_K)
+      return (c == CTRL_B || c == CTRL_O || c == CTRL_R ||
+                                     c == CTRL_I || c == CTRL_U) ? 1 : 0;
+
+    // Up to two digits of foreground, then a comma and up to two
+    // of background (a comma with no digit after it is text)
+    UINT jj = ii+1;
+
+    if (jj < length && isdigit(p[jj]))
+    {
+      jj++;
+      if (jj < length && isdigit(p[jj]))
+        jj++;
+
+      if (jj+1 < length && p[jj] == ',' && isdigit(p[jj+1]))
+      {
+        jj += 2;
+        if (jj < length && isdigit(p[jj]))
+          jj++;
+      }
+    }
+
+    return jj - ii;
+  }
+};
+
+// Escape stages - Put() moves the char at ii (and ii past it) to t
+// Return: chars put
+struct EscapeNone : Stage // DIALECT_IRC, or an image line as it is
+{
+  bool Plain(DWORD) { return true; }
+
+  UINT Put(BYTE* p, UINT& ii, UINT, BYTE* t)
+  { *t = p[ii++]; return 1; }
+};
+
+struct EscapeTcl : Stage // DTSP_TCL, " and \ in XiRCON's "..."
+{
+  bool Plain(DWORD dw) { return !Has(dw, '"') && !Has(dw, '\x5c'); }
+
+  UINT Put(BYTE* p, UINT& ii, UINT, BYTE* t)
+  {
+    BYTE c = p[ii++];
+
+    if (c != '"' && c != '\x5c')
+    {
+      *t = c;
+      return 1;
+    }
+
+    t[0] = '\x5c';
+    t[1] = c;
+    return 2;
+  }
+};
+
+struct EscapeDde : Stage // DTSP_DDE, mIRC takes $<digit> for a parameter
+{
+  BYTE* pDollar; // the '$' we just put, blanked if a digit comes next
+
+  EscapeDde() : pDollar(NULL) {}
+
+  bool Plain(DWORD dw) { return pDollar == NULL && !Has(dw, '$'); }
+
+  UINT Put(BYTE* p, UINT& ii, UINT, BYTE* t)
+  {
+    BYTE c = p[ii++];
+
+    if (pDollar != NULL && isdigit(c))
+      *pDollar = ' ';
+
+    pDollar = c == '$' ? t : NULL;
+    *t = c;
+    return 1;
+  }
+};
+
+struct UnescapeTcl : Stage // RENDER_UNESCAPE, a DTSP_TCL payload
+{
+  bool Plain(DWORD dw) { return !Has(dw, '\x5c'); }
+
+  UINT Put(BYTE* p, UINT& ii, UINT length, BYTE* t)
+  {
+    if (p[ii] == '\x5c' && ii+1 < length)
+      ii++;
+
+    *t = p[ii++];
+    return 1;
+  }
+};
+/*********************************************************************/
+template <class Strip, class Escape>
+UINT FuseLine(char* pStr, UINT length, char* tString)
+// Purpose: Strip and escape length chars of pStr into tString
+//          (RENDERSIZ-1 chars) in one pass, padding a trailing space
+//          with a no-break space if Strip took EndLine()'s CTRL_K
+// Shared Memory Vars: pDTS_Color->CodePage
+// Return: length of tString
+{
+  BYTE* p = (BYTE*)pStr;
+  BYTE* t = (BYTE*)tString;
+  Escape Esc;
+  UINT ii = 0, jj = 0;
+
+  while (ii < length)
+  {
+    UINT Stop = length;
+
+    // Nothing for either stage in these four, move them as they are
+    // (x86 doesn't mind the unaligned DWORDs), else a char at a time
+    if (length - ii >= 4)
+    {
+      DWORD dw = *(DWORD*)(p + ii);
+
+      if (Strip::Plain(dw) && Esc.Plain(dw))
+      {
+        *(DWORD*)(t + jj) = dw;
+        ii += 4;
+        jj += 4;
+        continue;
+      }
+
+      Stop = ii + 4;
+    }
+
+    while (ii < Stop)
+    {
+      UINT Skip = Strip::Skip(p, ii, length);
+
+      if (Skip)
+        ii += Skip;
+      else
+        jj += Esc.Put(p, ii, length, t + jj);
+    }
+  }
+
+  t[jj] = NULLCHAR;
+
+  // (escapes only add ASCII, the text is UTF-8 or not the same)
+  if (Strip::bPad && jj && t[jj-1] == ' ' && jj + 2 < GLOBALSTRINGSIZ)
+  {
+    const char* pPad = pDTS_Color->CodePage == CP_UTF8 ||
+        (!IsAscii(tString, jj) && IsUtf8(tString, jj)) ?
+                                               STRIPPAD_UTF8 : STRIPPAD;
+    strcpy(tString + jj, pPad);
+    jj += strlen(pPad);
+  }
+
+  return jj;
+}
+/*********************************************************************/
+typedef UINT (*RENDERFN)(char* pStr, UINT length, char* tString);
+
+// [bStrip][escape] (see RENDER_ESCAPES)
+RENDERFN RenderStages[2][RENDER_ESCAPES] = {
+  {&FuseLine<StripNone, EscapeTcl>, &FuseLine<StripNone, EscapeDde>,
+   &FuseLine<StripNone, EscapeNone>, &FuseLine<StripNone, UnescapeTcl>},
+  {&FuseLine<StripAll, EscapeTcl>, &FuseLine<StripAll, EscapeDde>,
+   &FuseLine<StripAll, EscapeNone>, &FuseLine<StripAll, UnescapeTcl>}};
+/*********************************************************************/
+char* RenderText(char* pStr, UINT length, bool bImage, char* pBuf,
+                                                int Dialect, bool bStrip)
+// Purpose: Strip and escape length chars of pStr for our client in one
+//          pass. An image line is already escaped, it's only unescaped
+//          for the server - but a DDE one that's stripped is escaped
+//          again, taking the codes out of "$^B5" leaves mIRC a "$5".
+// Args: pBuf (RENDERSIZ chars) to render it in, Dialect DTSP_TCL,
+//       DTSP_DDE or DIALECT_IRC (straight to the server), bStrip
+//       take the codes out
+// Return: the rendered text in pBuf, with a char free before it for
+//         PIRCH's leading CTRL_K (see FrameString()), "\r\n" for a line
+//         with nothing left in it
+{
+  int Escape;
+
+  if (!bImage)
+    Escape = Dialect;
+  else if (Dialect == DIALECT_IRC)
+    Escape = RENDER_UNESCAPE;
+  else if (Dialect == DTSP_DDE && bStrip)
+    Escape = DTSP_DDE;
+  else
+    Escape = DIALECT_IRC;
+
+  char* tString = pBuf + 1;
+
+  if ((*RenderStages[bStrip ? 1 : 0][Escape])(pStr, length, tString) == 0)
+    strcpy(tString, "\r\n");
+
+  return tString;
+}
+/*********************************************************************/
+UINT EscapeString(char* pStr, UINT length, char* tString, int Dialect)
+// Purpose: Copy length chars of pStr to tString (2*length+1 chars)
+//          escaping them for the client
+// Args: Dialect DTSP_TCL (XiRCON), DTSP_DDE (mIRC, PIRCH, Vortec) or
+//       DIALECT_IRC
+// Return: length of tString
+{
+  UINT ii,jj;
+
+  // Scan string for " characters or \ characters
+  // \\ and \" are needed for text between quotes in C
+  for (ii = 0, jj = 0 ; ii < length ; ii++, jj++)
+  {
+    if (Dialect == DTSP_TCL)
+    {
+      if (pStr[ii] == '"' || pStr[ii] == '\x5c')
+        // allow " and \ chars
+        tString[jj++] = '\x5c';
+
+      tString[jj] = pStr[ii];
+    }
+    else if (Dialect == DTSP_DDE)
+    {
+      // mIRC will interpret $# as a parameter! (replace with ' ')
+      if (ii+1 < length && pStr[ii] == '$' &&
+                                            isdigit(pStr[ii+1]))
+        tString[jj] = ' ';
+      else
+        tString[jj] = pStr[ii];
+    }
+    else // DIALECT_IRC goes as it is
+      tString[jj] = pStr[ii];
+  }
+
+  tString[jj] = NULLCHAR;
+  return jj;
+}
+/*********************************************************************/
+UINT EscapedLength(char* pStr, UINT length, int Dialect)
+// Return: length EscapeString() would give length chars of pStr
+{
+  UINT jj = length;
+
+  if (Dialect == DTSP_TCL)
+    for (UINT ii = 0 ; ii < length ; ii++)
+      if (pStr[ii] == '"' || pStr[ii] == '\x5c')
+        jj++;
+
+  return jj;
+}
+/*********************************************************************/
+int FitText(char* tString, int Room)
+// Purpose: How much of the escaped text in tString fits in Room chars
+//          of a command - a line escaped for XiRCON can be twice as long
+//          as the GLOBALSTRINGSIZ slot it's framed into. Doesn't split
+//          a \" or \\ escape.
+// Return: chars of tString to use
+{
+  int Len = strlen(tString);
+
+  if (Len <= Room)
+    return Len;
+
+  Len = Room > 0 ? Room : 0;
+
+  // An odd run of backslashes at the end is half an escape
+  int Slashes = 0;
+
+  while (Slashes < Len && tString[Len-1-Slashes] == '\x5c')
+    Slashes++;
+
+  return (Slashes & 1) ? Len-1 : Len;
+}
+/*********************************************************************/
+bool IsAscii(char* pStr, UINT length)
+// Purpose: true if no char in pStr is above 0x7f. Checks a DWORD (four
+//          chars) at a time since nearly every line we send is ASCII.
+{
+  BYTE* p = (BYTE*)pStr;
+  BYTE* pEnd = p + length;
+
+  // Get to a DWORD boundary
+  while (p < pEnd && ((size_t)p & 3))
+    if (*p++ & 0x80)
+      return false;
+
+  // Four DWORDs per pass, the high bit of any byte means non-ASCII
+  for (; pEnd - p >= 16; p += 16)
+    if ((((DWORD*)p)[0] | ((DWORD*)p)[1] |
+         ((DWORD*)p)[2] | ((DWORD*)p)[3]) & 0x80808080)
+      return false;
+
+  for (; pEnd - p >= 4; p += 4)
+    if (*(DWORD*)p & 0x80808080)
+      return false;
+
+  while (p < pEnd)
+    if (*p++ & 0x80)
+      return false;
+
+  return true;
+}
+/*********************************************************************/
+bool IsUtf8(char* pStr, UINT length)
+// Purpose: true if pStr is well-formed UTF-8 (no overlong forms,
+//          surrogates or code-points past U+10FFFF)
+{
+  BYTE* p = (BYTE*)pStr;
+  BYTE* pEnd = p + length;
+
+  while (p < pEnd)
+  {
+    BYTE c = *p++;
+
+    if (c < 0x80)
+      continue;
+
+    int nTrail;
+    BYTE Min = 0x80, Max = 0xbf; // allowed range of the 1st trail byte
+
+    if (c >= 0xc2 && c <= 0xdf)
+      nTrail = 1;
+    else if (c >= 0xe0 && c <= 0xef)
+    {
+      nTrail = 2;
+      if (c == 0xe0)
+        Min = 0xa0; // overlong
+      else if (c == 0xed)
+        Max = 0x9f; // surrogate
+    }
+    else if (c >= 0xf0 && c <= 0xf4)
+    {
+      nTrail = 3;
+      if (c == 0xf0)
+        Min = 0x90; // overlong
+      else if (c == 0xf4)
+        Max = 0x8f; // past U+10FFFF
+    }
+    else
+      return false;
+
+    if (pEnd - p < nTrail || *p < Min || *p > Max)
+      return false;
+
+    for (p++; --nTrail; p++)
+      if ((*p & 0xc0) != 0x80)
+        return false;
+  }
+
+  return true;
+}
+/*********************************************************************/
+void FrameCommand(char* pStr, char* tString, int Time, char* pTarget,
+                                   char* pFile, int Dialect, bool bStrip)
+// Purpose: Wrap the escaped text in tString (from RenderText()) in the
+//          command that sends it to pTarget and put that command in
+//          pStr (GLOBALSTRINGSIZ chars)
+// Args: pFile is the temp-file FrameString() wrote tString to (DTSP_DDE
+//       only, unused otherwise), Dialect and bStrip as tString was
+//       rendered with
+{
+  // Straight to the IRC server - an empty PRIVMSG is an error, a lone
+  // CTRL_K shows as a blank line (a no-break space if stripping)
+  if (Dialect == DIALECT_IRC)
+  {
+    if (tString[0] == NULLCHAR || !strcmp(tString, "\r\n"))
+    {
+      if (bStrip)
+        strcpy(tString, pDTS_Color->CodePage == CP_UTF8 ?
+                                              STRIPPAD_UTF8 : STRIPPAD);
+      else
+        sprintf(tString, "%c", CTRL_K);
+    }
+
+    sprintf(pStr, "PRIVMSG %s :%.*s", pTarget, IRCLINESIZ, tString);
+  }
+  else if (!strcmp("status", stolower(pTarget)))
+  {
+    if (Dialect == DTSP_DDE) // echo to mIRC
+    {
+      // send to status window
+      if (IsPirchVortec())
+        // this won't work - pirch has no switch for status...
+        sprintf(pStr, "/playfile -s %s", pFile);
+      else // we only play a one-line file, NOTE: DO NOT USE -p!
+        sprintf(pStr, "/play -s %s %i", pFile, Time);
+    }
+    else // echo to XiRCON
+      sprintf(pStr, "echo \"%.*s\" status",
+               FitText(tString, GLOBALSTRINGSIZ-1-14), tString);
+  }
+  else // not to status window
+  {
+    if (Dialect == DTSP_DDE) // msg to mIRC via file
+    {
+      if (IsPirchVortec())
+        sprintf(pStr, "/playfile %s %s", pTarget, pFile);
+      else // we only play a one-line file, NOTE: DO NOT USE -p!
+        sprintf(pStr, "/play %s %s %i", pTarget, pFile, Time);
+    }
+    else // msg to XiRCON
+      sprintf(pStr, "/msg %s \"%.*s\"", pTarget,
+      FitText(tString, GLOBALSTRINGSIZ-1-8-(int)strlen(pTarget)), tString);
+  }
+}
+char* stolower(char* p)
+{
+  char* savep = p;
+
+  int limit = GLOBALSTRINGSIZ;
+
+  while(limit--)
+  {
+    char c = *p;
+
+    if (c == NULLCHAR)
+      return savep;
+
+    *p++ = (char)tolower(c);
+  }
+
+  return savep;
+}
+/*********************************************************************/
+bool IsPirchVortec(void)
+{
+  return IsPirch() || IsVortec();
+}
+/*********************************************************************/
+bool IsPirch(void)
+{
+  return !strcmp("pirch", stolower(pDTS_Color->Service));
+}
+/*********************************************************************/
+bool IsVortec(void)
+{
+  return !strcmp("vortec", stolower(pDTS_Color->Service));
+}
+/*********************************************************************/
@@ -0,0 +1,24 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// Line rendering (Render.cpp) - include Portable.h (or windows.h) and
+// Colorize.h first
+
+#ifndef __render_h
+#define __render_h
+
+char* RenderText(char* pStr, UINT length, bool bImage, char* pBuf,
+                                               int Dialect, bool bStrip);
+UINT EscapeString(char* pStr, UINT length, char* tString, int Dialect);
+UINT EscapedLength(char* pStr, UINT length, int Dialect);
+int FitText(char* tString, int Room);
+void FrameCommand(char* pStr, char* tString, int Time, char* pTarget,
+                                   char* pFile, int Dialect, bool bStrip);
+bool IsAscii(char* pStr, UINT length);
+bool IsUtf8(char* pStr, UINT length);
+char* stolower(char* p);
+bool IsPirch(void);
+bool IsVortec(void);
+bool IsPirchVortec(void);
+
+#endif
@@ -0,0 +1,124 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// File:     ImageHost.cpp
+// Author:   Scott Swift, dxzl@live.com
+//
+// The calls Image.cpp leaves to Colorize.cpp, done with POSIX threads for
+// the tools. TranscodeString() only knows Latin-1 (code-page 28591) - the
+// DLL has all of Windows' code-pages - which is all a benchmark needs.
+
+#include "../Portable.h"
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "../Colorize.h"
+#include "../Render.h"
+#include "../Image.h"
+#include "ImageHost.h"
+
+extern DTS_Color* pDTS_Color;
+
+int HostWorkers = 0;
+
+/*********************************************************************/
+int CountProcessors(void)
+{
+  if (HostWorkers > 0)
+    return HostWorkers;
+
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+
+  return n > 0 ? (int)n : 1;
+}
+/*********************************************************************/
+static void* ChunkThread(void* pArg)
+{
+  void** ppArgs = (void**)pArg;
+
+  (void)((LPTHREAD_START_ROUTINE)ppArgs[0])(ppArgs[1]);
+  return NULL;
+}
+/*********************************************************************/
+bool RunChunks(DTS_Chunk* pChunks, int Count,
+                                        LPTHREAD_START_ROUTINE lpWork)
+// Purpose: Colorize.cpp's, a pthread for every chunk but the first
+{
+  pthread_t Threads[MAXWORKERS];
+  bool bStarted[MAXWORKERS];
+  void* Args[MAXWORKERS][2];
+  int ii;
+
+  for (ii = 1; ii < Count; ii++)
+  {
+    Args[ii][0] = (void*)lpWork;
+    Args[ii][1] = &pChunks[ii];
+    bStarted[ii] = pthread_create(&Threads[ii], NULL, ChunkThread,
+                                                        Args[ii]) == 0;
+  }
+
+  (void)lpWork(&pChunks[0]);
+
+  bool bRet = pChunks[0].bOk;
+
+  for (ii = 1; ii < Count; ii++)
+  {
+    if (!bStarted[ii])
+      (void)lpWork(&pChunks[ii]);
+    else
+      pthread_join(Threads[ii], NULL);
+
+    if (!pChunks[ii].bOk)
+      bRet = false;
+  }
+
+  return bRet;
+}
+/*********************************************************************/
+UINT TranscodeString(char* pStr, UINT length)
+// Purpose: Colorize.cpp's, UTF-8 to Latin-1 ('?' for what it hasn't)
+{
+  // Drop a byte-order-mark (first line of a UTF-8 file)
+  if (length >= 3 && !memcmp(pStr, "\xef\xbb\xbf", 3))
+  {
+    memmove(pStr, pStr+3, length-2);
+    length -= 3;
+  }
+
+  if (pDTS_Color->CodePage == CP_UTF8 || IsAscii(pStr, length) ||
+                                                   !IsUtf8(pStr, length))
+    return length;
+
+  BYTE* p = (BYTE*)pStr;
+  UINT ii = 0, jj = 0;
+
+  while (ii < length)
+  {
+    BYTE c = p[ii];
+
+    if (c < 0x80)
+    {
+      p[jj++] = c;
+      ii++;
+    }
+    else
+    {
+      int n = c >= 0xf0 ? 4 : c >= 0xe0 ? 3 : 2;
+
+      p[jj++] = (n == 2 && c <= 0xc3) ?
+                       (BYTE)(((c & 0x1f) << 6) | (p[ii+1] & 0x3f)) : '?';
+      ii += n;
+    }
+  }
+
+  pStr[jj] = NULLCHAR;
+  return jj;
+}
+/*********************************************************************/
+#ifdef DTS_TRACE
+void TraceEvent(int, char, DWORD)
+{
+}
+#endif
+/*********************************************************************/
@@ -0,0 +1,12 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// What Colorize.cpp gives Image.cpp, for the tools (ImageHost.cpp)
+
+#ifndef __imagehost_h
+#define __imagehost_h
+
+// CountProcessors() says this many (0 = what the machine has)
+extern int HostWorkers;
+
+#endif
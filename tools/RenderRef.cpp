@@ -0,0 +1,236 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// File:     RenderRef.cpp
+// Author:   Scott Swift, dxzl@live.com
+//
+// What RenderText() has to match, done the plain way a byte at a time:
+// strip the codes in-place, pad a trailing space, then escape the
+// result into a new buffer - the order the formatter did it in before
+// FuseLine(). striptest checks Render.cpp against it. RenderMulti() is
+// that old formatter pass for pass, malloc and PIRCH shifts and all, for
+// renderbench to time RenderText() against.
+
+#include "../Portable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include "../Colorize.h"
+#include "../Render.h"
+#include "RenderRef.h"
+
+/*********************************************************************/
+UINT StripRef(char* pStr, UINT length, UINT CodePage)
+// Purpose: Take the color (CTRL_K fg[,bg]), bold, underline, reverse,
+//          italic and plain codes out of pStr in-place and pad a
+//          trailing space with a no-break space
+// Return: new length
+{
+  BYTE* p = (BYTE*)pStr;
+  UINT ii = 0, jj = 0;
+
+  while (ii < length)
+  {
+    BYTE c = p[ii++];
+
+    if (c == CTRL_K)
+    {
+      // Up to two digits of foreground, then a comma and up to two
+      // of background (a comma with no digit after it is text)
+      if (ii < length && isdigit(p[ii]))
+      {
+        ii++;
+        if (ii < length && isdigit(p[ii]))
+          ii++;
+
+        if (ii+1 < length && p[ii] == ',' && isdigit(p[ii+1]))
+        {
+          ii += 2;
+          if (ii < length && isdigit(p[ii]))
+            ii++;
+        }
+      }
+    }
+    else if (c != CTRL_B && c != CTRL_O && c != CTRL_R &&
+                                           c != CTRL_I && c != CTRL_U)
+      p[jj++] = c;
+  }
+
+  pStr[jj] = NULLCHAR;
+
+  if (jj && pStr[jj-1] == ' ')
+  {
+    bool bAscii = true;
+
+    for (ii = 0; ii < jj; ii++)
+      if (p[ii] & 0x80)
+        bAscii = false;
+
+    const char* pPad = CodePage == CP_UTF8 ||
+      (!bAscii && IsUtf8(pStr, jj)) ? STRIPPAD_UTF8 : STRIPPAD;
+
+    strcpy(pStr + jj, pPad);
+    jj += strlen(pPad);
+  }
+
+  return jj;
+}
+/*********************************************************************/
+UINT EscapeRef(char* pStr, UINT length, char* tString, int Dialect)
+// Purpose: Escape length chars of pStr into tString for the client
+// Return: length of tString
+{
+  UINT jj = 0;
+
+  for (UINT ii = 0; ii < length; ii++)
+  {
+    char c = pStr[ii];
+
+    // XiRCON's "..." wants \" and \\, mIRC takes $<digit> for a
+    // parameter (it gets a space), the server takes it as it is
+    if (Dialect == DTSP_TCL && (c == '"' || c == '\x5c'))
+      tString[jj++] = '\x5c';
+    else if (Dialect == DTSP_DDE && c == '$' && ii+1 < length &&
+                                                isdigit(pStr[ii+1]))
+      c = ' ';
+
+    tString[jj++] = c;
+  }
+
+  tString[jj] = NULLCHAR;
+  return jj;
+}
+/*********************************************************************/
+char* RenderRef(char* pStr, UINT length, char* pBuf, int Dialect,
+                                             bool bStrip, UINT CodePage)
+// Purpose: What RenderText() should make of length chars of the line
+//          in pStr (already transcoded), whether it was played as text
+//          or from an image
+// Args: pBuf (RENDERSIZ chars)
+// Return: the rendered text in pBuf
+{
+  char Line[GLOBALSTRINGSIZ+4];
+
+  memcpy(Line, pStr, length);
+  Line[length] = NULLCHAR;
+
+  if (bStrip)
+    length = StripRef(Line, length, CodePage);
+
+  if (length == 0)
+  {
+    strcpy(pBuf, "\r\n");
+    return pBuf;
+  }
+
+  (void)EscapeRef(Line, length, pBuf, Dialect);
+  return pBuf;
+}
+/*********************************************************************/
+UINT StripMulti(char* pStr, UINT length, UINT CodePage)
+// Purpose: The old StripString() - StripCodes() a DWORD at a time
+//          in-place, then pad a trailing space
+// Return: new length
+{
+  BYTE* p = (BYTE*)pStr;
+  UINT ii = 0, jj = 0;
+
+  while (ii < length)
+  {
+    // No char below 0x20 in these four, move them down as they are
+    if (length - ii >= 4)
+    {
+      DWORD dw;
+
+      memcpy(&dw, p + ii, sizeof(dw));
+
+      if (!((dw - 0x20202020L) & ~dw & 0x80808080L))
+      {
+        if (jj != ii)
+          memcpy(p + jj, &dw, sizeof(dw));
+
+        ii += 4;
+        jj += 4;
+        continue;
+      }
+    }
+
+    BYTE c = p[ii++];
+
+    if (c == CTRL_K)
+    {
+      if (ii < length && isdigit(p[ii]))
+      {
+        ii++;
+        if (ii < length && isdigit(p[ii]))
+          ii++;
+
+        if (ii+1 < length && p[ii] == ',' && isdigit(p[ii+1]))
+        {
+          ii += 2;
+          if (ii < length && isdigit(p[ii]))
+            ii++;
+        }
+      }
+    }
+    else if (c != CTRL_B && c != CTRL_O && c != CTRL_R &&
+                                           c != CTRL_I && c != CTRL_U)
+      p[jj++] = c;
+  }
+
+  p[jj] = NULLCHAR;
+
+  if (jj && pStr[jj-1] == ' ')
+  {
+    const char* pPad = CodePage == CP_UTF8 ||
+        (!IsAscii(pStr, jj) && IsUtf8(pStr, jj)) ? STRIPPAD_UTF8 : STRIPPAD;
+    UINT PadLen = strlen(pPad);
+
+    if (jj + PadLen < GLOBALSTRINGSIZ)
+    {
+      strcpy(pStr + jj, pPad);
+      jj += PadLen;
+    }
+  }
+
+  return jj;
+}
+/*********************************************************************/
+char* RenderMulti(char* pStr, int Dialect, bool bStrip, bool bPirch,
+                                                            UINT CodePage)
+// Purpose: The old RenderString() and FrameString() passes over a text
+//          line in pStr (GLOBALSTRINGSIZ chars, already transcoded):
+//          strip it in-place, malloc a buffer and escape into it, and
+//          for PIRCH shift it right for the leading CTRL_K and back
+// Return: the rendered text (free it) or NULL if out of memory
+{
+  UINT length = strlen(pStr);
+
+  if (bStrip)
+    length = StripMulti(pStr, length, CodePage);
+
+  if (length == 0)
+    length = sprintf(pStr, "\r\n");
+
+  char* tString;
+
+  if ((tString = (char*)malloc(2*length+2)) == NULL)
+    return NULL;
+
+  (void)EscapeRef(pStr, length, tString, Dialect);
+
+  if (bPirch)
+  {
+    for (int ii = strlen(tString); ii >= 0; ii--)
+      tString[ii+1] = tString[ii];
+    tString[0] = CTRL_K;
+
+    // (the temp-file was written here)
+
+    memmove(tString, tString+1, strlen(tString));
+  }
+
+  return tString;
+}
+/*********************************************************************/
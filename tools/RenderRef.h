@@ -0,0 +1,17 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// Scalar reference for Render.cpp (RenderRef.cpp)
+
+#ifndef __renderref_h
+#define __renderref_h
+
+UINT StripRef(char* pStr, UINT length, UINT CodePage);
+UINT EscapeRef(char* pStr, UINT length, char* tString, int Dialect);
+char* RenderRef(char* pStr, UINT length, char* pBuf, int Dialect,
+                                            bool bStrip, UINT CodePage);
+UINT StripMulti(char* pStr, UINT length, UINT CodePage);
+char* RenderMulti(char* pStr, int Dialect, bool bStrip, bool bPirch,
+                                                           UINT CodePage);
+
+#endif
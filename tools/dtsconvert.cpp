@@ -0,0 +1,405 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// File:     dtsconvert.cpp
+// Author:   Scott Swift, dxzl@live.com
+//
+// ColorConvert() (DTS_convert) without Windows - writes the pre-formatted
+// image (DTSP_Header) of a text play-file with the DLL's own
+// BuildPlayImage() (Image.cpp), so YahCoLoRiZe's files can be converted
+// ahead of time on any machine. With -b it times loading and rendering
+// every line both ways instead:
+//
+//   text  - read the file, split lines (NextTextLine()), transcode and
+//           escape each (what ReadNextLine() and RenderString() do)
+//   image - map the image, CheckPlayImage(), copy each payload
+//           (ImageLine(), what ReadImageLine() does) and render it
+//
+// and checks that both give every line byte-for-byte the same. Both files
+// are read through the page cache, run it twice for a warm cache.
+//
+// Build and run (from tools/):
+//   g++ -O2 -o dtsconvert dtsconvert.cpp ImageHost.cpp ../Image.cpp
+//                                              ../Render.cpp -lpthread
+//   ./dtsconvert [-u] [-w workers] in.txt out.dtsp
+//   ./dtsconvert -b [-u] [-d tcl|dde|irc] [-s] [-r runs] in.txt [out.dtsp]
+//
+// -u keeps UTF-8 (CP_UTF8), by default it goes to Latin-1 (ImageHost.cpp)
+// the way the DLL's CP_ACP would. -d and -s are the client and the strip
+// setting rendered for. Without out.dtsp -b uses a temp-file.
+
+#include "../Portable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "../Colorize.h"
+#include "../Render.h"
+#include "../Image.h"
+#include "ImageHost.h"
+
+DTS_Color Shared;
+DTS_Color* pDTS_Color = &Shared;
+
+typedef struct {
+  double Load;    // ms to the first line rendered
+  double All;     // ms for every line
+  DWORD dwLines;
+} LOAD_Result;
+
+/*********************************************************************/
+static double NowMs(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+/*********************************************************************/
+static char* ReadWhole(const char* pName, DWORD* pdwSize)
+// Purpose: The whole file, malloc'd (what StartLocalFilePlay() reads)
+{
+  int fd = open(pName, O_RDONLY);
+  struct stat st;
+  char* p = NULL;
+
+  if (fd < 0)
+    return NULL;
+
+  if (fstat(fd, &st) == 0 && st.st_size > 0 &&
+                        (p = (char*)malloc(st.st_size + 1)) != NULL)
+  {
+    if (read(fd, p, st.st_size) == st.st_size)
+    {
+      p[st.st_size] = NULLCHAR;
+      *pdwSize = (DWORD)st.st_size;
+    }
+    else
+    {
+      free(p);
+      p = NULL;
+    }
+  }
+
+  close(fd);
+  return p;
+}
+/*********************************************************************/
+static bool WriteWhole(const char* pName, char* p, DWORD dwSize)
+{
+  FILE* f = fopen(pName, "wb");
+
+  if (f == NULL)
+    return false;
+
+  bool bRet = fwrite(p, 1, dwSize, f) == dwSize;
+
+  return fclose(f) == 0 && bRet;
+}
+/*********************************************************************/
+static bool Convert(const char* pIn, const char* pOut)
+// Purpose: ConvertPlayFile()
+{
+  DWORD dwSize, dwImageSize;
+  char* lpText;
+  char* lpImg;
+
+  if ((lpText = ReadWhole(pIn, &dwSize)) == NULL)
+  {
+    fprintf(stderr, "dtsconvert: can't read %s\n", pIn);
+    return false;
+  }
+
+  bool bRet = BuildPlayImage(lpText, dwSize, &lpImg, &dwImageSize);
+  free(lpText);
+
+  if (!bRet)
+  {
+    fprintf(stderr, "dtsconvert: can't convert %s\n", pIn);
+    return false;
+  }
+
+  if (!WriteWhole(pOut, lpImg, dwImageSize))
+  {
+    fprintf(stderr, "dtsconvert: can't write %s\n", pOut);
+    free(lpImg);
+    return false;
+  }
+
+  printf("%s: %lu bytes, %lu lines -> %s: %lu bytes\n", pIn,
+         (unsigned long)dwSize,
+         (unsigned long)((DTSP_Header*)lpImg)->Lines, pOut,
+                                               (unsigned long)dwImageSize);
+  free(lpImg);
+  return true;
+}
+/*********************************************************************/
+static bool LoadText(const char* pName, int Dialect, bool bStrip,
+                                 FILE* fLines, LOAD_Result* pRes)
+// Purpose: Play a text file's lines through the renderer, writing each
+//          rendered line to fLines if it's not NULL
+{
+  static char Line[GLOBALSTRINGSIZ];
+  static char Buf[RENDERSIZ];
+  double t0 = NowMs();
+  DWORD dwSize, dwPos = 0;
+  char* lpText;
+
+  if ((lpText = ReadWhole(pName, &dwSize)) == NULL)
+    return false;
+
+  pRes->dwLines = 0;
+
+  while (NextTextLine(lpText, dwSize, &dwPos, Line))
+  {
+    // RenderString()
+    UINT length = TranscodeString(Line, strlen(Line));
+    char* pOut = RenderText(Line, length, false, Buf, Dialect, bStrip);
+
+    if (pRes->dwLines++ == 0)
+      pRes->Load = NowMs() - t0;
+
+    if (fLines != NULL)
+      fprintf(fLines, "%s\n", pOut);
+  }
+
+  pRes->All = NowMs() - t0;
+  free(lpText);
+  return true;
+}
+/*********************************************************************/
+static bool LoadImage(const char* pName, int Dialect, bool bStrip,
+                                 FILE* fLines, LOAD_Result* pRes)
+// Purpose: LoadText() for an image (mapped, the way MapPlayImage() does)
+{
+  static char Line[GLOBALSTRINGSIZ];
+  static char Buf[RENDERSIZ];
+  double t0 = NowMs();
+  struct stat st;
+  int fd;
+
+  if ((fd = open(pName, O_RDONLY)) < 0)
+    return false;
+
+  if (fstat(fd, &st) != 0 || st.st_size == 0)
+  {
+    close(fd);
+    return false;
+  }
+
+  DWORD dwSize = (DWORD)st.st_size;
+  char* lpImg = (char*)mmap(NULL, dwSize, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  close(fd);
+
+  if (lpImg == (char*)MAP_FAILED)
+    return false;
+
+  if (!CheckPlayImage(lpImg, dwSize))
+  {
+    munmap(lpImg, dwSize);
+    return false;
+  }
+
+  // ReadImageLine() - IRC gets the XiRCON payload, unescaped
+  int Payload = Dialect == DTSP_DDE ? DTSP_DDE : DTSP_TCL;
+
+  pRes->dwLines = 0;
+
+  while (ImageLine(lpImg, dwSize, pRes->dwLines, Payload, Line))
+  {
+    char* pOut = RenderText(Line, strlen(Line), true, Buf, Dialect, bStrip);
+
+    if (pRes->dwLines++ == 0)
+      pRes->Load = NowMs() - t0;
+
+    if (fLines != NULL)
+      fprintf(fLines, "%s\n", pOut);
+  }
+
+  pRes->All = NowMs() - t0;
+  munmap(lpImg, dwSize);
+  return true;
+}
+/*********************************************************************/
+static bool SameFiles(FILE* fA, FILE* fB, DWORD* pdwLine)
+// Purpose: Compare two files of rendered lines, *pdwLine is the first
+//          line that differs
+{
+  static char a[RENDERSIZ+2], b[RENDERSIZ+2];
+
+  rewind(fA);
+  rewind(fB);
+
+  for (*pdwLine = 1;; (*pdwLine)++)
+  {
+    char* pA = fgets(a, sizeof(a), fA);
+    char* pB = fgets(b, sizeof(b), fB);
+
+    if (pA == NULL || pB == NULL)
+      return pA == pB;
+
+    if (strcmp(a, b))
+      return false;
+  }
+}
+/*********************************************************************/
+static void Show(const char* pName, LOAD_Result* pRes, double Base)
+{
+  printf("  %-6s first line %8.3f ms  all %8.1f ms  %9.0f lines/s  %5.2fx\n",
+         pName, pRes->Load, pRes->All,
+         pRes->All > 0 ? pRes->dwLines * 1000.0 / pRes->All : 0,
+                                      pRes->All > 0 ? Base / pRes->All : 0);
+}
+/*********************************************************************/
+static int Bench(const char* pIn, const char* pOut, int Dialect,
+                                                   bool bStrip, int Runs)
+{
+  char Temp[] = "/tmp/dtsconvertXXXXXX";
+  LOAD_Result Text, Image, Res;
+  int ii;
+
+  if (pOut == NULL)
+  {
+    int fd = mkstemp(Temp);
+
+    if (fd < 0)
+      return 2;
+
+    close(fd);
+    pOut = Temp;
+  }
+
+  double t0 = NowMs();
+
+  if (!Convert(pIn, pOut))
+    return 2;
+
+  printf("  converted in %.1f ms (once, ahead of play)\n", NowMs() - t0);
+
+  // Each way's rendered lines, to check they agree
+  FILE* fText = tmpfile();
+  FILE* fImage = tmpfile();
+  bool bOk = fText != NULL && fImage != NULL &&
+             LoadText(pIn, Dialect, bStrip, fText, &Res) &&
+             LoadImage(pOut, Dialect, bStrip, fImage, &Res);
+
+  if (!bOk)
+  {
+    fprintf(stderr, "dtsconvert: can't play %s or %s\n", pIn, pOut);
+    return 2;
+  }
+
+  DWORD dwLine;
+  bool bSame = SameFiles(fText, fImage, &dwLine);
+
+  fclose(fText);
+  fclose(fImage);
+
+  // Best of Runs, taking turns
+  for (ii = 0; ii < Runs; ii++)
+  {
+    (void)LoadText(pIn, Dialect, bStrip, NULL, &Res);
+    if (ii == 0 || Res.All < Text.All)
+      Text = Res;
+
+    (void)LoadImage(pOut, Dialect, bStrip, NULL, &Res);
+    if (ii == 0 || Res.All < Image.All)
+      Image = Res;
+  }
+
+  printf("  %lu lines, best of %d:\n", (unsigned long)Text.dwLines, Runs);
+  Show("text", &Text, Text.All);
+  Show("image", &Image, Text.All);
+
+  if (pOut == Temp)
+    unlink(Temp);
+
+  if (!bSame || Text.dwLines != Image.dwLines)
+  {
+    printf("FAIL rendered line %lu differs\n", (unsigned long)dwLine);
+    return 1;
+  }
+
+  printf("every rendered line identical\n");
+  return 0;
+}
+/*********************************************************************/
+static void Usage(void)
+{
+  fprintf(stderr,
+     "usage: dtsconvert [-u] [-w workers] in.txt out.dtsp\n"
+     "       dtsconvert -b [-u] [-d tcl|dde|irc] [-s] [-r runs] in.txt "
+                                                         "[out.dtsp]\n");
+}
+/*********************************************************************/
+int main(int argc, char** argv)
+{
+  bool bBench = false, bStrip = false;
+  int Dialect = DTSP_TCL, Runs = 5, c;
+
+  pDTS_Color->CodePage = CP_ACP;
+  CONFIG(CFG_WORKERS) = MAXWORKERS;
+  CONFIG(CFG_CHUNKKB) = CHUNKMIN/1024;
+
+  while ((c = getopt(argc, argv, "bud:sr:w:")) != -1)
+  {
+    switch (c)
+    {
+      case 'b': bBench = true; break;
+      case 'u': pDTS_Color->CodePage = CP_UTF8; break;
+      case 's': bStrip = true; break;
+      case 'r': Runs = atoi(optarg); break;
+      case 'w':
+        if ((CONFIG(CFG_WORKERS) = atoi(optarg)) < 1 ||
+                                         CONFIG(CFG_WORKERS) > MAXWORKERS)
+        {
+          Usage();
+          return 2;
+        }
+        HostWorkers = CONFIG(CFG_WORKERS);
+        break;
+      case 'd':
+        if (!strcmp(optarg, "tcl"))
+          Dialect = DTSP_TCL;
+        else if (!strcmp(optarg, "dde"))
+          Dialect = DTSP_DDE;
+        else if (!strcmp(optarg, "irc"))
+          Dialect = DIALECT_IRC;
+        else
+        {
+          Usage();
+          return 2;
+        }
+        break;
+      default:
+        Usage();
+        return 2;
+    }
+  }
+
+  if (bBench)
+  {
+    if (optind >= argc || argc - optind > 2 || Runs < 1)
+    {
+      Usage();
+      return 2;
+    }
+
+    return Bench(argv[optind], optind+1 < argc ? argv[optind+1] : NULL,
+                                                   Dialect, bStrip, Runs);
+  }
+
+  if (argc - optind != 2)
+  {
+    Usage();
+    return 2;
+  }
+
+  return Convert(argv[optind], argv[optind+1]) ? 0 : 1;
+}
+/*********************************************************************/
@@ -0,0 +1,552 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// File:     dtsreplay.cpp
+// Author:   Scott Swift, dxzl@live.com
+//
+// Reads a DTS_record recording (see DTSR_Record in Colorize.h) without
+// the DLL. It lists the records with how late each went out, or takes
+// each line's text back out of its command (the temp-file's text for a
+// DDE one), renders and frames it again with Render.cpp for any client
+// and sends the commands - flat out or with their recorded spacing - to
+// a file or straight to an IRC server.
+//
+// Build (from tools/):
+//   g++ -O2 -o dtsreplay dtsreplay.cpp ../Render.cpp
+//
+// Run:
+//   ./dtsreplay -l file.dtsr              list the records
+//   ./dtsreplay [options] file.dtsr       replay them
+//     -r            with their recorded spacing (else flat out)
+//     -d tcl|dde|irc  client to render for (default the recorded one)
+//     -s            strip the codes (a +c channel)
+//     -u            the client's code-page is UTF-8
+//     -p service    DDE service, "pirch" frames for PIRCH (default mirc)
+//     -t dir        where -d dde writes its temp-files (default /tmp)
+//     -o file       write the commands there (default stdout)
+//     -c host:port  send them to an IRC server instead (implies -d irc,
+//                   ircstub is a local one), -n nick
+//
+// Ends with "commands <n> skipped <n> differ <n> ms <elapsed> late <ms>
+// lines/s <n>" on stderr. Differ counts commands that came out unlike the
+// recorded ones, when rendering for the recorded client.
+
+#include "../Portable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include "../Colorize.h"
+#include "../Render.h"
+
+DTS_Color Shared;
+DTS_Color* pDTS_Color = &Shared;
+
+static const char* SinkNames[] = {"tcl", "dde", "irc"};
+
+static FILE* pOut = stdout;
+static int Sock = -1;
+static char TempDir[MAX_PATH] = "/tmp/";
+static int TempNext = 0;
+
+/*********************************************************************/
+static LONGLONG NowNs(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (LONGLONG)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+/*********************************************************************/
+static void SleepUntil(LONGLONG llDue)
+{
+  struct timespec ts;
+
+  ts.tv_sec = (time_t)(llDue / 1000000000LL);
+  ts.tv_nsec = (long)(llDue % 1000000000LL);
+
+  while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) ==
+                                                                  EINTR)
+    ;
+}
+/*********************************************************************/
+static bool ReadRecord(FILE* pIn, DWORD Version, DTSR_Record* pRec,
+                               char* pTarget, char* pCmd, char* pText)
+// Purpose: Read the next record and the strings after it (each gets a
+//          null), pCmd and pText 0xFFFF+1 chars
+// Return: false at the end (or a record cut short)
+{
+  if (fread(pRec, sizeof(*pRec), 1, pIn) != 1)
+    return false;
+
+  // Version 1 has no text
+  if (Version < 2)
+    pRec->TextLen = 0;
+
+  if (fread(pTarget, 1, pRec->TargetLen, pIn) != pRec->TargetLen ||
+      fread(pCmd, 1, pRec->CommandLen, pIn) != pRec->CommandLen ||
+      fread(pText, 1, pRec->TextLen, pIn) != pRec->TextLen)
+    return false;
+
+  pTarget[pRec->TargetLen] = NULLCHAR;
+  pCmd[pRec->CommandLen] = NULLCHAR;
+  pText[pRec->TextLen] = NULLCHAR;
+  return true;
+}
+/*********************************************************************/
+static int RecoverLine(DTSR_Record* pRec, char* pCmd, char* pText,
+                               char* pTarget, char* pLine, int* pTime)
+// Purpose: Take the line's text back out of a recorded command, undoing
+//          its client's escapes, the target it went to and mIRC's /play
+//          delay (0 if none)
+// Args: pTarget (256 chars) and pLine (RENDERSIZ chars) to put them in
+// Return: the line's length, -1 for a command that isn't a line's
+{
+  char Buf[RENDERSIZ];
+  char* pStart;
+  char* pEnd;
+  int length;
+
+  *pTime = 0;
+
+  if (pRec->Sink == DTSP_TCL)
+  {
+    // /msg <target> "<text>" or echo "<text>" status
+    if (!strncmp(pCmd, "echo \"", 6))
+      strcpy(pTarget, "status");
+    else if (sscanf(pCmd, "/msg %255s \"", pTarget) != 1)
+      return -1;
+
+    if ((pStart = strchr(pCmd, '"')) == NULL ||
+                      (pEnd = strrchr(pCmd, '"')) == pStart)
+      return -1;
+
+    pStart++;
+    length = pEnd - pStart;
+
+    if (length > GLOBALSTRINGSIZ)
+      length = GLOBALSTRINGSIZ;
+
+    // The server's unescape undoes XiRCON's
+    pStart = RenderText(pStart, length, true, Buf, DIALECT_IRC, false);
+  }
+  else if (pRec->Sink == DTSP_DDE)
+  {
+    // /play[file] -s <file> or /play[file] <target> <file>, the line
+    // is in the temp-file (there's none for a whole play-file)
+    if (pRec->TextLen == 0 || strncmp(pCmd, "/play", 5))
+      return -1;
+
+    pStart = strchr(pCmd, ' ');
+
+    if (pStart == NULL || sscanf(pStart, " %255s", pTarget) != 1)
+      return -1;
+
+    if (!strcmp(pTarget, "-s"))
+      strcpy(pTarget, "status");
+
+    if (!strncmp(pCmd, "/play ", 6))
+      *pTime = atoi(strrchr(pCmd, ' ')+1);
+
+    pStart = pText;
+
+    // PIRCH's leading CTRL_K (see FrameString())
+    if (!strncmp(pCmd, "/playfile -s", 12) && *pStart == CTRL_K)
+      pStart++;
+  }
+  else if (pRec->Sink == DIALECT_IRC)
+  {
+    // PRIVMSG <target> :<text>
+    if (sscanf(pCmd, "PRIVMSG %255s :", pTarget) != 1 ||
+                               (pStart = strstr(pCmd, " :")) == NULL)
+      return -1;
+
+    pStart += 2;
+
+    // FrameCommand()'s blank line
+    if (pStart[0] == CTRL_K && pStart[1] == NULLCHAR)
+      pStart++;
+  }
+  else
+    return -1;
+
+  // RenderText()'s blank line
+  if (!strcmp(pStart, "\r\n"))
+    pStart += 2;
+
+  length = strlen(pStart);
+
+  if (length > GLOBALSTRINGSIZ)
+    length = GLOBALSTRINGSIZ;
+
+  memcpy(pLine, pStart, length);
+  pLine[length] = NULLCHAR;
+  return length;
+}
+/*********************************************************************/
+static bool WriteTemp(char* pFile, char* tString)
+// Purpose: Write a line to the next of our TEMPFILE_COUNT temp-files,
+//          the way DTS_WriteLineToFile() does
+{
+  sprintf(pFile, "%s" TEMPFILE_FMT, TempDir,
+                                TEMPFILE_BASE + TempNext++ % TEMPFILE_COUNT);
+
+  FILE* pF = fopen(pFile, "wb");
+
+  if (pF == NULL)
+    return false;
+
+  bool bOk = fwrite(tString, strlen(tString)+1, 1, pF) == 1;
+
+  return fclose(pF) == 0 && bOk;
+}
+/*********************************************************************/
+static bool IrcLine(const char* pLine)
+{
+  char Buf[IRCLINESIZ+3];
+  int len = snprintf(Buf, sizeof(Buf)-2, "%s", pLine);
+
+  if (len > IRCLINESIZ-2)
+    len = IRCLINESIZ-2;
+
+  Buf[len++] = '\r';
+  Buf[len++] = '\n';
+  return send(Sock, Buf, len, MSG_NOSIGNAL) == len;
+}
+/*********************************************************************/
+static int IrcPoll(int Timeout)
+// Purpose: Read what the server sent, answering its PINGs
+// Args: Timeout ms to wait for something
+// Return: 1 if it welcomed us (001), 0 if not, -1 if it closed
+{
+  static char In[4096];
+  static int InLen = 0;
+  struct pollfd pfd;
+  int Ret = 0;
+
+  pfd.fd = Sock;
+  pfd.events = POLLIN;
+
+  while (poll(&pfd, 1, Timeout) > 0)
+  {
+    int n = recv(Sock, In + InLen, sizeof(In)-1 - InLen, 0);
+
+    if (n <= 0)
+      return -1;
+
+    InLen += n;
+    In[InLen] = NULLCHAR;
+
+    char* p = In;
+    char* pEol;
+
+    while ((pEol = strstr(p, "\r\n")) != NULL)
+    {
+      *pEol = NULLCHAR;
+
+      if (!strncmp(p, "PING ", 5))
+      {
+        p[1] = 'O';
+        IrcLine(p);
+      }
+      else if (strstr(p, " 001 ") != NULL)
+        Ret = 1;
+
+      p = pEol+2;
+    }
+
+    InLen -= p - In;
+    memmove(In, p, InLen);
+
+    if (InLen == sizeof(In)-1) // a line too long for us
+      InLen = 0;
+
+    Timeout = 0;
+  }
+
+  return Ret;
+}
+/*********************************************************************/
+static bool IrcConnect(char* pHost, const char* pNick)
+// Purpose: Connect to pHost ("host:port") and register as pNick
+{
+  struct addrinfo Hints, *pAi;
+  char Buf[IRCLINESIZ];
+  char* pPort = strrchr(pHost, ':');
+
+  if (pPort == NULL)
+    return false;
+
+  *pPort++ = NULLCHAR;
+
+  memset(&Hints, 0, sizeof(Hints));
+  Hints.ai_socktype = SOCK_STREAM;
+
+  if (getaddrinfo(pHost, pPort, &Hints, &pAi) != 0)
+    return false;
+
+  Sock = socket(pAi->ai_family, pAi->ai_socktype, pAi->ai_protocol);
+
+  bool bOk = Sock >= 0 && connect(Sock, pAi->ai_addr, pAi->ai_addrlen) == 0;
+
+  freeaddrinfo(pAi);
+
+  if (!bOk)
+    return false;
+
+  sprintf(Buf, "NICK %.30s", pNick);
+  IrcLine(Buf);
+  sprintf(Buf, "USER %.30s 0 * :dtsreplay", pNick);
+  IrcLine(Buf);
+
+  // Ten seconds to get its welcome
+  for (int ii = 0; ii < 100; ii++)
+  {
+    int Ret = IrcPoll(100);
+
+    if (Ret)
+      return Ret > 0;
+  }
+
+  return false;
+}
+/*********************************************************************/
+static bool Emit(char* pCmd, char* pTarget)
+// Purpose: Send a framed command to the server or the output file
+{
+  static char Joined[256] = "";
+
+  if (Sock < 0)
+    return fprintf(pOut, "%s\n", pCmd) > 0;
+
+  // Join a channel the first time we send to it
+  if (pTarget[0] == '#' && strcmp(pTarget, Joined))
+  {
+    char Buf[300];
+
+    sprintf(Buf, "JOIN %s", pTarget);
+    IrcLine(Buf);
+    strcpy(Joined, pTarget);
+  }
+
+  return IrcPoll(0) >= 0 && IrcLine(pCmd);
+}
+/*********************************************************************/
+static void ListRecord(DTSR_Header* pHdr, DTSR_Record* pRec,
+                                         char* pTarget, char* pCmd)
+{
+  double Ms = 1000.0 / (double)pHdr->Freq;
+
+  printf("%5u %6u %-3s %10.3f %10.3f %8.3f %-12s %s\n",
+         pRec->Session, pRec->Line,
+         pRec->Sink < 3 ? SinkNames[pRec->Sink] : "?",
+         (double)(pRec->Scheduled - pHdr->Start) * Ms,
+         (double)(pRec->Actual - pHdr->Start) * Ms,
+         (double)(pRec->Actual - pRec->Scheduled) * Ms, pTarget, pCmd);
+}
+/*********************************************************************/
+static void Usage(void)
+{
+  fprintf(stderr, "Usage: dtsreplay [-l] [-r] [-d tcl|dde|irc] [-s] [-u] "
+    "[-p service] [-t dir] [-o file] [-c host:port [-n nick]] file\n");
+  exit(2);
+}
+/*********************************************************************/
+int main(int argc, char* argv[])
+{
+  bool bList = false, bRealTime = false, bStrip = false;
+  int Dialect = -1;
+  char* pHost = NULL;
+  const char* pNick = "dtsreplay";
+  int opt;
+
+  strcpy(Shared.Service, "mirc");
+  Shared.CodePage = CP_ACP;
+
+  while ((opt = getopt(argc, argv, "lrd:sup:t:o:c:n:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'l': bList = true; break;
+      case 'r': bRealTime = true; break;
+      case 's': bStrip = true; break;
+      case 'u': Shared.CodePage = CP_UTF8; break;
+      case 'p': snprintf(Shared.Service, sizeof(Shared.Service), "%s",
+                                                         optarg); break;
+      case 't': snprintf(TempDir, sizeof(TempDir), "%s/", optarg); break;
+      case 'c': pHost = optarg; break;
+      case 'n': pNick = optarg; break;
+      case 'o':
+        if ((pOut = fopen(optarg, "w")) == NULL)
+        {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      case 'd':
+        for (Dialect = 2; Dialect >= 0; Dialect--)
+          if (!strcmp(optarg, SinkNames[Dialect]))
+            break;
+        if (Dialect < 0)
+          Usage();
+        break;
+      default:
+        Usage();
+    }
+  }
+
+  if (optind != argc-1)
+    Usage();
+
+  FILE* pIn = fopen(argv[optind], "rb");
+  DTSR_Header Hdr;
+
+  if (pIn == NULL)
+  {
+    perror(argv[optind]);
+    return 1;
+  }
+
+  if (fread(&Hdr, sizeof(Hdr), 1, pIn) != 1 ||
+      memcmp(Hdr.Magic, DTSR_MAGIC, sizeof(Hdr.Magic)) ||
+      Hdr.Version < 1 || Hdr.Version > DTSR_VERSION || Hdr.Freq == 0)
+  {
+    fprintf(stderr, "%s: not a DTSR recording we know\n", argv[optind]);
+    return 1;
+  }
+
+  if (pHost != NULL)
+  {
+    Dialect = DIALECT_IRC;
+
+    if (!IrcConnect(pHost, pNick))
+    {
+      fprintf(stderr, "can't connect to %s\n", pHost);
+      return 1;
+    }
+  }
+
+  DTSR_Record Rec;
+  char Target[256], NewTarget[256];
+  char* pCmd = (char*)malloc(0xFFFF+1);
+  char* pText = (char*)malloc(0xFFFF+1);
+  char Line[RENDERSIZ], Buf[RENDERSIZ], Cmd[GLOBALSTRINGSIZ];
+  char File[MAX_PATH+32];
+  LONGLONG llFirst = 0, llLate = 0;
+  long Commands = 0, Skipped = 0, Differ = 0;
+
+  if (bList)
+    printf("%5s %6s %-3s %10s %10s %8s %-12s %s\n", "sess", "line",
+           "via", "due ms", "sent ms", "late ms", "target", "command");
+
+  LONGLONG llBegin = NowNs();
+
+  while (ReadRecord(pIn, Hdr.Version, &Rec, Target, pCmd, pText))
+  {
+    if (bList)
+    {
+      ListRecord(&Hdr, &Rec, Target, pCmd);
+
+      if (Rec.Actual - Rec.Scheduled > llLate)
+        llLate = Rec.Actual - Rec.Scheduled;
+
+      Commands++;
+      continue;
+    }
+
+    int Time;
+    int length = RecoverLine(&Rec, pCmd, pText, NewTarget, Line, &Time);
+    int Out = Dialect < 0 ? Rec.Sink : Dialect;
+
+    if (length < 0 || Out > DIALECT_IRC)
+    {
+      Skipped++;
+      continue;
+    }
+
+    // Render and frame it as FormatThread() and FrameString() would
+    char* tString = RenderText(Line, length, false, Buf, Out, bStrip);
+    char* pFile = NULL;
+
+    if (Out == DTSP_DDE)
+    {
+      char* pWrite = tString;
+
+      if (IsPirchVortec() && !strcmp("status", stolower(NewTarget)))
+      {
+        tString[-1] = CTRL_K;
+        pWrite--;
+      }
+
+      if (!WriteTemp(File, pWrite))
+      {
+        perror(File);
+        return 1;
+      }
+
+      pFile = File;
+
+      if (Out == Rec.Sink && strcmp(pWrite, pText))
+        Differ++;
+    }
+
+    FrameCommand(Cmd, tString, Time, NewTarget, pFile, Out, bStrip);
+
+    if (Out == Rec.Sink && Out != DTSP_DDE && strcmp(Cmd, pCmd))
+      Differ++;
+
+    // When it went out in the recording, in our clock
+    if (Commands == 0)
+      llFirst = Rec.Actual;
+
+    LONGLONG llDue = llBegin + (LONGLONG)((double)(Rec.Actual - llFirst) *
+                                            1e9 / (double)Hdr.Freq);
+    if (bRealTime)
+      SleepUntil(llDue);
+
+    LONGLONG llNow = NowNs();
+
+    if (bRealTime && llNow - llDue > llLate)
+      llLate = llNow - llDue;
+
+    if (!Emit(Cmd, NewTarget))
+    {
+      fprintf(stderr, "lost the server\n");
+      return 1;
+    }
+
+    Commands++;
+  }
+
+  LONGLONG llElapsed = NowNs() - llBegin;
+
+  if (Sock >= 0)
+  {
+    IrcLine("QUIT :done");
+    close(Sock);
+  }
+
+  if (pOut != stdout)
+    fclose(pOut);
+
+  fclose(pIn);
+  free(pCmd);
+  free(pText);
+
+  // (listing, late is the recording's own)
+  double LateMs = bList ? (double)llLate * 1000.0 / (double)Hdr.Freq :
+                                                   (double)llLate / 1e6;
+
+  fprintf(stderr, "commands %ld skipped %ld differ %ld ms %.0f late %.3f "
+          "lines/s %.0f\n", Commands, Skipped, Differ,
+          (double)llElapsed / 1e6, LateMs,
+          llElapsed > 0 ? (double)Commands * 1e9 / (double)llElapsed : 0.0);
+
+  return 0;
+}
+/*********************************************************************/
@@ -0,0 +1,66 @@
+#!/bin/sh
+# Makes inflatetest's vectors (run from tools/gz, needs gzip and python3).
+# They're committed, this is only how they were made.
+set -e
+
+# ~120K of chat-like play-file text, the same every time
+python3 - <<'PY'
+import random
+random.seed(46)
+w = ["hello", "the", "channel", "quiet", "tonight", "lol", "brb", "script",
+     "\"quoted\"", "back\\slash", "$1", "café", "€5", "[x]", "{y}"]
+with open("play.txt", "w", encoding="utf-8", newline="") as f:
+  for i in range(2500):
+    if random.random() < 0.05:
+      f.write("\r\n")
+      continue
+    s = " ".join(random.choice(w) if random.random() > 0.2 else
+                 "\x03%d,%d" % (random.randint(0, 15), random.randint(0, 15))
+                 for _ in range(random.randint(1, 16)))
+    f.write(s + ("   " if random.random() < 0.3 else "") + "\r\n")
+with open("short.txt", "w", newline="") as f:
+  f.write("hello hello hello\r\n")
+PY
+
+# gzip's own levels, -6 keeps the name (FNAME)
+gzip -n -1 -c play.txt > play-1.gz
+gzip -N -6 -c play.txt > play-6.gz
+gzip -n -9 -c play.txt > play-9.gz
+
+# Two members, concatenated
+head -c 50000 play.txt | gzip -n -6 > multi.gz
+tail -c +50001 play.txt | gzip -n -6 >> multi.gz
+
+# Short text gets a fixed-code block
+gzip -n -9 -c short.txt > fixed.gz
+
+# Stored blocks, and every optional header field (FEXTRA, FNAME,
+# FCOMMENT, FHCRC)
+python3 - <<'PY'
+import struct, zlib
+text = open("play.txt", "rb").read()
+def member(data, level, flags=0, extra=b"", name=b"", comment=b""):
+  c = zlib.compressobj(level, zlib.DEFLATED, -15)
+  body = c.compress(data) + c.flush()
+  hdr = b"\x1f\x8b\x08" + bytes([flags]) + b"\0\0\0\0\0\xff"
+  if flags & 4:
+    hdr += struct.pack("<H", len(extra)) + extra
+  if flags & 8:
+    hdr += name + b"\0"
+  if flags & 16:
+    hdr += comment + b"\0"
+  if flags & 2:
+    hdr += struct.pack("<H", zlib.crc32(hdr) & 0xffff)
+  return hdr + body + struct.pack("<II", zlib.crc32(data), len(data))
+open("stored.gz", "wb").write(member(text, 0))
+open("header.gz", "wb").write(member(open("short.txt", "rb").read(), 6,
+       4|8|16|2, b"XY\2\0hi", b"short.txt", b"a comment"))
+PY
+
+# Bad ones: cut short, CRC wrong, and zeros after the end (ignored)
+head -c 20000 play-6.gz > trunc.gz
+python3 -c "
+d = bytearray(open('play-9.gz','rb').read()); d[-8] ^= 1
+open('badcrc.gz','wb').write(d)"
+cp play-1.gz padded.gz
+head -c 100 /dev/zero >> padded.gz
@@ -0,0 +1,236 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// File:     imagebench.cpp
+// Author:   Scott Swift, dxzl@live.com
+//
+// Speedup of BuildPlayImage() (Image.cpp) against the number of worker
+// threads. Builds the same text at 1, 2, 4... up to MAXWORKERS threads
+// (CFG_WORKERS, CFG_CHUNKKB at its default), best of -r runs each, and
+// checks every image is byte-for-byte the one-thread image. The threads
+// are pthreads here (ImageHost.cpp), the split and both passes are the
+// DLL's own code.
+//
+// Build and run (from tools/):
+//   g++ -O2 -o imagebench imagebench.cpp ImageHost.cpp ../Image.cpp
+//                                              ../Render.cpp -lpthread
+//   ./imagebench [-m MB] [-r runs] [-k chunkKB] [file]
+//
+// With no file it makes -m MB (default 64) of chat-like text - colors,
+// bold, trailing spaces, blank lines and some UTF-8. Exits 1 if an image
+// differs or fails CheckPlayImage().
+
+#include "../Portable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "../Colorize.h"
+#include "../Image.h"
+#include "ImageHost.h"
+
+DTS_Color Shared;
+DTS_Color* pDTS_Color = &Shared;
+
+/*********************************************************************/
+static double NowMs(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+/*********************************************************************/
+static char* MakeText(DWORD dwSize)
+// Purpose: dwSize bytes of whole chat-like lines (malloc'd)
+{
+  static const char* Words[] = {
+    "hello", "the", "channel", "is", "quiet", "tonight", "anyone",
+    "seen", "the", "new", "script", "colors", "look", "great", "lol",
+    "caf\xc3\xa9", "na\xc3\xafve", "\xe2\x82\xac" "5", "brb", "ok"
+  };
+  const int nWords = sizeof(Words)/sizeof(Words[0]);
+  char* p = (char*)malloc(dwSize + 1);
+  DWORD dwPos = 0;
+  unsigned Seed = 12345;
+
+  if (p == NULL)
+    return NULL;
+
+  while (dwPos < dwSize)
+  {
+    char Line[512];
+    int n = 0;
+
+    Seed = Seed * 1103515245 + 12345;
+
+    if ((Seed >> 16) % 20 == 0)
+      n = 0; // blank line
+    else
+    {
+      int nLine = 3 + (Seed >> 8) % 25;
+
+      for (int ii = 0; ii < nLine && n < 400; ii++)
+      {
+        Seed = Seed * 1103515245 + 12345;
+        unsigned r = Seed >> 16;
+
+        if (r % 7 == 0)
+          n += sprintf(Line+n, "%c%d,%d", CTRL_K, r % 16, (r >> 4) % 16);
+        else if (r % 11 == 0)
+          Line[n++] = CTRL_B;
+
+        n += sprintf(Line+n, "%s ", Words[(r >> 5) % nWords]);
+      }
+
+      if (Seed & 0x100)
+        n += sprintf(Line+n, "   ");
+    }
+
+    Line[n++] = '\n';
+
+    if (dwPos + n > dwSize)
+      break;
+
+    memcpy(p + dwPos, Line, n);
+    dwPos += n;
+  }
+
+  memset(p + dwPos, '\n', dwSize - dwPos);
+  p[dwSize] = NULLCHAR;
+  return p;
+}
+/*********************************************************************/
+static char* ReadFile(const char* pName, DWORD* pdwSize)
+{
+  FILE* f = fopen(pName, "rb");
+
+  if (f == NULL)
+    return NULL;
+
+  fseek(f, 0, SEEK_END);
+  long Len = ftell(f);
+  fseek(f, 0, SEEK_SET);
+
+  char* p = (char*)malloc(Len + 1);
+
+  if (p == NULL || fread(p, 1, Len, f) != (size_t)Len)
+  {
+    free(p);
+    fclose(f);
+    return NULL;
+  }
+
+  fclose(f);
+  p[Len] = NULLCHAR;
+  *pdwSize = (DWORD)Len;
+  return p;
+}
+/*********************************************************************/
+int main(int argc, char** argv)
+{
+  DWORD dwMB = 64, dwSize = 0;
+  int Runs = 3, ChunkKB = CHUNKMIN/1024, c;
+  char* lpText;
+
+  while ((c = getopt(argc, argv, "m:r:k:")) != -1)
+  {
+    switch (c)
+    {
+      case 'm': dwMB = atoi(optarg); break;
+      case 'r': Runs = atoi(optarg); break;
+      case 'k': ChunkKB = atoi(optarg); break;
+      default:
+        fprintf(stderr, "usage: imagebench [-m MB] [-r runs] [-k chunkKB] "
+                                                               "[file]\n");
+        return 2;
+    }
+  }
+
+  if (optind < argc)
+    lpText = ReadFile(argv[optind], &dwSize);
+  else
+    lpText = MakeText(dwSize = dwMB*1024*1024);
+
+  if (lpText == NULL || Runs < 1 || ChunkKB < 1)
+  {
+    fprintf(stderr, "imagebench: no text\n");
+    return 2;
+  }
+
+  pDTS_Color->CodePage = 28591; // Latin-1 (ImageHost.cpp)
+  CONFIG(CFG_CHUNKKB) = ChunkKB;
+
+  printf("%.1f MB of text, %ld processors online, chunks >= %d KB\n",
+         dwSize / 1048576.0, sysconf(_SC_NPROCESSORS_ONLN), ChunkKB);
+  printf("threads  chunks      ms    MB/s  speedup  image\n");
+
+  char* lpFirst = NULL;
+  DWORD dwFirst = 0;
+  double msFirst = 0;
+  int Failed = 0;
+
+  for (int Threads = 1; Threads <= MAXWORKERS; Threads *= 2)
+  {
+    DTS_Chunk Chunks[MAXWORKERS];
+    double msBest = 0;
+    char* lpImg = NULL;
+    DWORD dwImg = 0;
+
+    HostWorkers = Threads;
+    CONFIG(CFG_WORKERS) = Threads;
+
+    for (int ii = 0; ii < Runs; ii++)
+    {
+      free(lpImg);
+      lpImg = NULL;
+
+      double t0 = NowMs();
+
+      if (!BuildPlayImage(lpText, dwSize, &lpImg, &dwImg))
+      {
+        fprintf(stderr, "imagebench: BuildPlayImage() failed\n");
+        return 1;
+      }
+
+      double ms = NowMs() - t0;
+
+      if (ii == 0 || ms < msBest)
+        msBest = ms;
+    }
+
+    const char* pResult = "ok";
+
+    if (!CheckPlayImage(lpImg, dwImg))
+      pResult = "FAIL CheckPlayImage()";
+    else if (lpFirst != NULL && (dwImg != dwFirst ||
+                                        memcmp(lpImg, lpFirst, dwImg)))
+      pResult = "FAIL differs from 1 thread";
+
+    if (pResult[0] == 'F')
+      Failed++;
+
+    if (lpFirst == NULL)
+    {
+      lpFirst = lpImg;
+      dwFirst = dwImg;
+      msFirst = msBest;
+    }
+
+    printf("%7d  %6d  %6.0f  %6.1f  %7.2f  %s\n", Threads,
+           SplitChunks(lpText, dwSize, Chunks), msBest,
+           dwSize / 1048576.0 / (msBest / 1000.0), msFirst / msBest,
+                                                                 pResult);
+
+    if (lpImg != lpFirst)
+      free(lpImg);
+  }
+
+  free(lpFirst);
+  free(lpText);
+
+  printf("%s\n", Failed ? "FAILED" : "all images identical");
+  return Failed ? 1 : 0;
+}
+/*********************************************************************/
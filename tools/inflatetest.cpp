@@ -0,0 +1,251 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// File:     inflatetest.cpp
+// Author:   Scott Swift, dxzl@live.com
+//
+// Checks Inflate() (Inflate.cpp) against gzip's own output and times it
+// against the send rate. The vectors in tools/gz (made by gz/make.sh)
+// are gzip -1, -6 (with FNAME) and -9, two concatenated members, stored
+// blocks, a fixed-code block, every optional header field, zeros after
+// the end - each must inflate to its text - and a file cut short and one
+// with a wrong CRC, which must fail having put out no more than is right.
+// Each is inflated with output room of 1, 7, 4096 and FOLLOWBUFSIZE bytes
+// a call, so every block type gets stopped and picked up again.
+//
+// Build and run (from tools/):
+//   g++ -O2 -o inflatetest inflatetest.cpp ../Inflate.cpp
+//   ./inflatetest [-d dir] [-t secs] [file.gz]
+//
+// Then it inflates gz/play-9.gz (or file.gz) over and over for -t secs
+// (default 1) and prints MB/s, the lines/s that is at the text's mean
+// line length, and how many times faster than sending a line every
+// PACEMIN ms that is. Exits 1 if any check fails.
+
+#include "../Portable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "../Colorize.h"
+#include "../Inflate.h"
+
+#define MAXTEXT (1024*1024)
+
+typedef struct {
+  const char* pName;
+  const char* pText; // what it inflates to, NULL if it has to fail
+} GZ_Vector;
+
+static const GZ_Vector Vectors[] = {
+  {"play-1.gz",  "play.txt"},
+  {"play-6.gz",  "play.txt"},
+  {"play-9.gz",  "play.txt"},
+  {"multi.gz",   "play.txt"},
+  {"stored.gz",  "play.txt"},
+  {"padded.gz",  "play.txt"},
+  {"fixed.gz",   "short.txt"},
+  {"header.gz",  "short.txt"},
+  {"trunc.gz",   NULL},
+  {"badcrc.gz",  NULL},
+};
+
+static const DWORD Rooms[] = {1, 7, 4096, FOLLOWBUFSIZE};
+
+static FILE* fIn; // InflateRead()'s
+static int Failed = 0;
+
+/*********************************************************************/
+bool InflateRead(BYTE* pBuf, DWORD dwSize, DWORD* pdwRead)
+// Purpose: Colorize.cpp's, from fIn
+{
+  *pdwRead = (DWORD)fread(pBuf, 1, dwSize, fIn);
+  return !ferror(fIn);
+}
+/*********************************************************************/
+static double NowMs(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000.0 + ts.tv_nsec / 1e6;
+}
+/*********************************************************************/
+static BYTE* ReadWhole(const char* pName, DWORD* pdwSize)
+{
+  FILE* f = fopen(pName, "rb");
+  BYTE* p = (BYTE*)malloc(MAXTEXT);
+
+  if (f == NULL || p == NULL)
+  {
+    if (f != NULL)
+      fclose(f);
+    free(p);
+    return NULL;
+  }
+
+  *pdwSize = (DWORD)fread(p, 1, MAXTEXT, f);
+  fclose(f);
+  return p;
+}
+/*********************************************************************/
+static DWORD InflateFile(const char* pName, DWORD dwRoom, BYTE* pOut,
+                                          DWORD dwMax, bool* pbError)
+// Purpose: Inflate a whole .gz into pOut, dwRoom bytes a call (the way
+//          InflatePlayBuffer() does FOLLOWBUFSIZE)
+// Return: bytes put out
+{
+  DTS_Inflate* pInf;
+  DWORD dwOut = 0, dwGot;
+
+  *pbError = true;
+
+  if ((fIn = fopen(pName, "rb")) == NULL)
+    return 0;
+
+  if ((pInf = InflateOpen()) == NULL)
+  {
+    fclose(fIn);
+    return 0;
+  }
+
+  do
+  {
+    DWORD dwAsk = dwRoom < dwMax - dwOut ? dwRoom : dwMax - dwOut;
+
+    dwGot = Inflate(pInf, pOut + dwOut, dwAsk);
+    dwOut += dwGot;
+  } while (dwGot != 0 && !pInf->bError && dwOut < dwMax);
+
+  *pbError = pInf->bError;
+  free(pInf);
+  fclose(fIn);
+  return dwOut;
+}
+/*********************************************************************/
+static void Check(bool bOk, const char* pWhat, const char* pName,
+                                                             DWORD dwRoom)
+{
+  printf("%s %s %s (%lu a call)\n", bOk ? "PASS" : "FAIL", pName, pWhat,
+                                                    (unsigned long)dwRoom);
+  if (!bOk)
+    Failed++;
+}
+/*********************************************************************/
+static void Bench(const char* pName, double Secs)
+{
+  BYTE* pOut = (BYTE*)malloc(MAXTEXT);
+  DWORD dwOut = 0, dwLines = 0, ii;
+  double Bytes = 0, t0 = NowMs(), ms;
+  bool bError;
+
+  if (pOut == NULL)
+    return;
+
+  do
+  {
+    dwOut = InflateFile(pName, FOLLOWBUFSIZE, pOut, MAXTEXT, &bError);
+    Bytes += dwOut;
+  } while (!bError && (ms = NowMs() - t0) < Secs * 1000);
+
+  if (bError || dwOut == 0)
+  {
+    printf("FAIL %s won't inflate\n", pName);
+    Failed++;
+    free(pOut);
+    return;
+  }
+
+  for (ii = 0; ii < dwOut; ii++)
+    if (pOut[ii] == '\n')
+      dwLines++;
+
+  if (dwLines == 0)
+    dwLines = 1;
+
+  double MBs = Bytes / 1048576.0 / (ms / 1000);
+  double Lines = Bytes / ((double)dwOut / dwLines) / (ms / 1000);
+  double Send = 1000.0 / PACEMIN;
+
+  printf("%s: %.1f MB/s inflated, %.0f lines/s at %.0f bytes a line\n",
+                   pName, MBs, Lines, (double)dwOut / dwLines);
+  printf("sending a line every %d ms is %.0f lines/s, inflating is %.0fx "
+                              "faster\n", PACEMIN, Send, Lines / Send);
+  free(pOut);
+}
+/*********************************************************************/
+int main(int argc, char** argv)
+{
+  const char* pDir = "gz";
+  const char* pBench = NULL;
+  double Secs = 1;
+  char Path[MAX_PATH];
+  int ii, jj;
+
+  for (ii = 1; ii < argc; ii++)
+  {
+    if (!strcmp(argv[ii], "-d") && ii+1 < argc)
+      pDir = argv[++ii];
+    else if (!strcmp(argv[ii], "-t") && ii+1 < argc)
+      Secs = atof(argv[++ii]);
+    else if (argv[ii][0] != '-')
+      pBench = argv[ii];
+    else
+    {
+      fprintf(stderr, "usage: inflatetest [-d dir] [-t secs] [file.gz]\n");
+      return 2;
+    }
+  }
+
+  BYTE* pOut = (BYTE*)malloc(MAXTEXT);
+
+  if (pOut == NULL)
+    return 2;
+
+  for (ii = 0; ii < (int)(sizeof(Vectors)/sizeof(Vectors[0])); ii++)
+  {
+    const GZ_Vector* pVec = &Vectors[ii];
+    DWORD dwText = 0;
+    BYTE* pText;
+
+    // Fails have to match play-6/play-9's text as far as they get
+    sprintf(Path, "%s/%s", pDir, pVec->pText ? pVec->pText : "play.txt");
+
+    if ((pText = ReadWhole(Path, &dwText)) == NULL)
+    {
+      fprintf(stderr, "inflatetest: can't read %s (-d?)\n", Path);
+      return 2;
+    }
+
+    sprintf(Path, "%s/%s", pDir, pVec->pName);
+
+    for (jj = 0; jj < (int)(sizeof(Rooms)/sizeof(Rooms[0])); jj++)
+    {
+      bool bError;
+      DWORD dwOut = InflateFile(Path, Rooms[jj], pOut, MAXTEXT, &bError);
+
+      if (pVec->pText != NULL)
+        Check(!bError && dwOut == dwText && !memcmp(pOut, pText, dwText),
+                              "inflates to its text", pVec->pName, Rooms[jj]);
+      else
+        Check(bError && dwOut <= dwText && !memcmp(pOut, pText, dwOut),
+                          "fails, no wrong bytes", pVec->pName, Rooms[jj]);
+    }
+
+    free(pText);
+  }
+
+  free(pOut);
+
+  if (pBench == NULL)
+  {
+    sprintf(Path, "%s/play-9.gz", pDir);
+    pBench = Path;
+  }
+
+  Bench(pBench, Secs);
+
+  printf("%s\n", Failed ? "FAILED" : "all passed");
+  return Failed ? 1 : 0;
+}
+/*********************************************************************/
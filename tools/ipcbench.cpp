@@ -0,0 +1,429 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// File:     ipcbench.cpp
+// Author:   Scott Swift, dxzl@live.com
+//
+// Times XiRCON's one-line path between two Linux processes: the producer
+// does what ColorStart() does (wait for a credit, FiFoPut()), the
+// consumer what DTS_poll does (FiFoTake(), FreeCredit(), render and frame
+// the /msg and hand it on), both running Fifo.cpp and Render.cpp on a
+// DTS_Color in POSIX shared memory. The credit event is a semaphore.
+//
+// The baseline is the DLL as it is - FiFo[FIFOSIZE][2048] with the
+// consumer polling (XiRCON's ON TIMER calls DTS_poll, about once a
+// second). "wake" has the producer post the consumer instead, to see
+// what the polling costs; "spin" polls flat out.
+//
+// Build (from tools/):
+//   g++ -O2 -o ipcbench ipcbench.cpp ../Fifo.cpp ../Render.cpp -lpthread
+//
+// Run:
+//   ./ipcbench [-n lines] [-s sizes] [-i polls] [-b bursts] [-l lines]
+//              [-c cpu,cpu]
+//     -n lines    a run's lines (default 500)
+//     -s sizes    line lengths (default 32,400,2000)
+//     -i polls    consumer's poll period in us, 0 spins, -1 is "wake"
+//                 (default -1,0,1000,10000)
+//     -b bursts   <lines>/<gap us> the producer sends them in, 1/0 is
+//                 flat out (default 1/0,3/20000)
+//     -l lines    FIFO lines in use, CFG_FIFOLINES (default FIFOSIZE-1)
+//     -c p,c      pin the producer and consumer to these cores
+//
+// A line per run: lines/s, lines ColorStart() would have dropped (no
+// credit in CREDITTIMEOUT ms), the write-to-take wait's percentiles and
+// the log2 histogram's (what DTS_ipc says), and the take-to-sent time.
+
+#include "../Portable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include "../Colorize.h"
+#include "../Render.h"
+#include "../Fifo.h"
+
+#define MAXRUNVALS 8
+#define POLLWAKE (-1)
+
+typedef struct {
+  DTS_Color Color;
+  sem_t Credit;          // hCreditEvent
+  sem_t Data;            // "wake" - posted with each line
+  volatile LONG Done;    // producer's sent them all
+  volatile LONG Taken;   // lines the consumer took
+  LONG Dropped;          // lines ColorStart() would have given up on
+  LONGLONG Times[1];     // [2*lines] wait and send (ns)
+} BENCH_Shared;
+
+DTS_Color* pDTS_Color;
+
+static char ShmName[64];
+static int CpuProducer = -1, CpuConsumer = -1;
+
+/*********************************************************************/
+static LONGLONG NowNs(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (LONGLONG)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+/*********************************************************************/
+static void SleepNs(LONGLONG llNs)
+{
+  struct timespec ts;
+
+  ts.tv_sec = (time_t)(llNs / 1000000000LL);
+  ts.tv_nsec = (long)(llNs % 1000000000LL);
+
+  while (nanosleep(&ts, &ts) != 0 && errno == EINTR)
+    ;
+}
+/*********************************************************************/
+static void Pin(int Cpu)
+{
+  cpu_set_t Set;
+
+  if (Cpu < 0)
+    return;
+
+  CPU_ZERO(&Set);
+  CPU_SET(Cpu, &Set);
+
+  if (sched_setaffinity(0, sizeof(Set), &Set) != 0)
+    perror("sched_setaffinity");
+}
+/*********************************************************************/
+static BENCH_Shared* MapShared(size_t Size, bool bCreate)
+// Purpose: Map the stand-in for the DLL's file mapping, each process
+//          opens it by name the way InitShared() does
+{
+  int fd = shm_open(ShmName, bCreate ? O_CREAT | O_EXCL | O_RDWR : O_RDWR,
+                                                                   0600);
+  if (fd < 0 || (bCreate && ftruncate(fd, Size) != 0))
+  {
+    perror(ShmName);
+    exit(1);
+  }
+
+  void* p = mmap(NULL, Size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+  close(fd);
+
+  if (p == MAP_FAILED)
+  {
+    perror("mmap");
+    exit(1);
+  }
+
+  return (BENCH_Shared*)p;
+}
+/*********************************************************************/
+static bool WaitForCredit(BENCH_Shared* pB)
+// Purpose: Colorize.cpp's, with the semaphore for its event
+{
+  LONGLONG llEnd = NowNs() + (LONGLONG)CONFIG(CFG_CREDITTIMEOUT) * 1000000;
+
+  while (FiFoCredits() == 0)
+  {
+    struct timespec ts;
+
+    if (NowNs() >= llEnd)
+      return false;
+
+    // (sem_timedwait() wants CLOCK_REALTIME, a slice is close enough)
+    clock_gettime(CLOCK_REALTIME, &ts);
+    ts.tv_nsec += 10000000;
+    if (ts.tv_nsec >= 1000000000)
+    {
+      ts.tv_sec++;
+      ts.tv_nsec -= 1000000000;
+    }
+
+    (void)sem_timedwait(&pB->Credit, &ts);
+  }
+
+  return true;
+}
+/*********************************************************************/
+static void Consumer(size_t Size, long Lines, long Poll)
+// Purpose: DTS_poll - take every line there is, then wait for the next
+//          poll (or for the producer's post)
+{
+  BENCH_Shared* pB = MapShared(Size, false);
+  char Line[GLOBALSTRINGSIZ];
+  char Buf[RENDERSIZ];
+  char Cmd[GLOBALSTRINGSIZ];
+  char Target[] = "#bench";
+  FILE* pNull = fopen("/dev/null", "w");
+  LONGLONG llWritten;
+
+  pDTS_Color = &pB->Color;
+  Pin(CpuConsumer);
+
+  while (pB->Taken < Lines)
+  {
+    if (Poll == POLLWAKE)
+      while (sem_wait(&pB->Data) != 0 && errno == EINTR)
+        ;
+    else if (Poll > 0)
+      SleepNs((LONGLONG)Poll * 1000);
+
+    while (pDTS_Color->FiFoIn != pDTS_Color->FiFoOut)
+    {
+      LONGLONG llTaken = NowNs();
+
+      if (!FiFoTake(Line, &llWritten))
+      {
+        FiFoReset();
+        break;
+      }
+
+      IpcRecord(IPC_WAIT, llTaken - llWritten, 1000000000LL);
+      (void)sem_post(&pB->Credit);
+
+      // PrintString() and Sendtcl()
+      char* tString = RenderText(Line, strlen(Line), false, Buf, DTSP_TCL,
+                                                                   false);
+      FrameCommand(Cmd, tString, 0, Target, NULL, DTSP_TCL, false);
+      fputs(Cmd, pNull);
+
+      LONGLONG llSent = NowNs();
+      IpcRecord(IPC_SEND, llSent - llTaken, 1000000000LL);
+      IpcSent(llSent);
+
+      LONG n = pB->Taken;
+      pB->Times[2*n] = llTaken - llWritten;
+      pB->Times[2*n+1] = llSent - llTaken;
+      (void)InterlockedIncrement(&pB->Taken);
+    }
+
+    // Everything the producer didn't drop has come through
+    if (pB->Done && pB->Taken + pB->Dropped >= Lines)
+      break;
+  }
+
+  fclose(pNull);
+  _exit(0);
+}
+/*********************************************************************/
+static void MakeLine(char* pLine, int Size)
+// Purpose: Chat text with some color codes in it, Size chars
+{
+  static const char Words[] = "the quick brown \"fox\" jumps $1 over \\ ";
+
+  for (int ii = 0; ii < Size; ii++)
+  {
+    if (rand() % 40 == 0)
+      pLine[ii] = CTRL_K;
+    else if (rand() % 60 == 0)
+      pLine[ii] = CTRL_B;
+    else
+      pLine[ii] = Words[ii % (sizeof(Words)-1)];
+  }
+
+  pLine[Size] = NULLCHAR;
+}
+/*********************************************************************/
+static int CompareLL(const void* a, const void* b)
+{
+  LONGLONG x = *(const LONGLONG*)a, y = *(const LONGLONG*)b;
+
+  return x < y ? -1 : x > y;
+}
+/*********************************************************************/
+static double Percentile(LONGLONG* pSorted, long n, double Pct)
+// Return: us
+{
+  if (n == 0)
+    return 0;
+
+  long ii = (long)((double)n * Pct / 100.0 + 0.999999) - 1;
+
+  if (ii < 0)
+    ii = 0;
+  if (ii >= n)
+    ii = n-1;
+
+  return (double)pSorted[ii] / 1000.0;
+}
+/*********************************************************************/
+static void Run(long Lines, int LineSize, long Poll, int Burst, long Gap,
+                                                        int FifoLines)
+{
+  size_t Size = sizeof(BENCH_Shared) + 2 * Lines * sizeof(LONGLONG);
+
+  snprintf(ShmName, sizeof(ShmName), "/ipcbench.%d", (int)getpid());
+
+  BENCH_Shared* pB = MapShared(Size, true);
+
+  memset(pB, 0, Size);
+  sem_init(&pB->Credit, 1, 0);
+  sem_init(&pB->Data, 1, 0);
+
+  pDTS_Color = &pB->Color;
+  CONFIG(CFG_FIFOLINES) = FifoLines;
+  CONFIG(CFG_CREDITTIMEOUT) = CREDITTIMEOUT;
+  pDTS_Color->CodePage = CP_ACP;
+
+  fflush(stdout);
+
+  pid_t Pid = fork();
+
+  if (Pid == 0)
+    Consumer(Size, Lines, Poll);
+
+  // The producer - ColorStart() for each line, in bursts
+  char Line[GLOBALSTRINGSIZ];
+
+  Pin(CpuProducer);
+  srand(1);
+
+  for (long nn = 0; nn < Lines; nn++)
+  {
+    MakeLine(Line, LineSize);
+
+    if (!WaitForCredit(pB))
+      pB->Dropped++;
+    else
+    {
+      FiFoPut(Line, NowNs());
+
+      if (Poll == POLLWAKE)
+        (void)sem_post(&pB->Data);
+    }
+
+    if (Gap > 0 && (nn+1) % Burst == 0)
+      SleepNs((LONGLONG)Gap * 1000);
+  }
+
+  pB->Done = 1;
+  (void)sem_post(&pB->Data);
+
+  waitpid(Pid, NULL, 0);
+
+  long n = pB->Taken;
+  LONGLONG* pWait = (LONGLONG*)malloc((n+1) * sizeof(LONGLONG));
+  LONGLONG* pSend = (LONGLONG*)malloc((n+1) * sizeof(LONGLONG));
+
+  for (long ii = 0; ii < n; ii++)
+  {
+    pWait[ii] = pB->Times[2*ii];
+    pSend[ii] = pB->Times[2*ii+1];
+  }
+
+  qsort(pWait, n, sizeof(LONGLONG), CompareLL);
+  qsort(pSend, n, sizeof(LONGLONG), CompareLL);
+
+  char Mode[16];
+
+  if (Poll == POLLWAKE)
+    strcpy(Mode, "wake");
+  else if (Poll == 0)
+    strcpy(Mode, "spin");
+  else
+    snprintf(Mode, sizeof(Mode), "%ld", Poll);
+
+  printf("%5d %7s %3d/%-6ld %7ld %5ld | %9.1f %9.1f %9.1f %9.1f %9.1f |"
+         " %7ld %7ld %7ld | %6.1f %6.1f\n",
+         LineSize, Mode, Burst, Gap, (long)IpcRate(1000000000LL),
+         (long)pB->Dropped,
+         Percentile(pWait, n, 50), Percentile(pWait, n, 90),
+         Percentile(pWait, n, 99), Percentile(pWait, n, 99.9),
+         Percentile(pWait, n, 100),
+         (long)IpcPercentile(IPC_WAIT, 50), (long)IpcPercentile(IPC_WAIT, 90),
+         (long)IpcPercentile(IPC_WAIT, 99),
+         Percentile(pSend, n, 50), Percentile(pSend, n, 99));
+  fflush(stdout);
+
+  free(pWait);
+  free(pSend);
+  sem_destroy(&pB->Credit);
+  sem_destroy(&pB->Data);
+  munmap(pB, Size);
+  shm_unlink(ShmName);
+}
+/*********************************************************************/
+static int ParseList(char* pList, long* pVals)
+// Purpose: "a,b,c" into pVals (MAXRUNVALS)
+{
+  int n = 0;
+
+  for (char* p = strtok(pList, ","); p != NULL && n < MAXRUNVALS;
+                                                   p = strtok(NULL, ","))
+    pVals[n++] = atol(p);
+
+  return n;
+}
+/*********************************************************************/
+int main(int argc, char* argv[])
+{
+  long Sizes[MAXRUNVALS] = {32, 400, 2000};
+  long Polls[MAXRUNVALS] = {POLLWAKE, 0, 1000, 10000};
+  long Bursts[MAXRUNVALS] = {1, 3}, Gaps[MAXRUNVALS] = {0, 20000};
+  int nSizes = 3, nPolls = 4, nBursts = 2;
+  long Lines = 500;
+  int FifoLines = FIFOSIZE-1;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:s:i:b:l:c:")) != -1)
+  {
+    switch (opt)
+    {
+      case 'n': Lines = atol(optarg); break;
+      case 's': nSizes = ParseList(optarg, Sizes); break;
+      case 'i': nPolls = ParseList(optarg, Polls); break;
+      case 'l': FifoLines = atoi(optarg); break;
+      case 'c':
+        if (sscanf(optarg, "%d,%d", &CpuProducer, &CpuConsumer) != 2)
+          CpuProducer = CpuConsumer = -1;
+        break;
+      case 'b':
+        nBursts = 0;
+        for (char* p = strtok(optarg, ","); p != NULL &&
+                          nBursts < MAXRUNVALS; p = strtok(NULL, ","))
+          if (sscanf(p, "%ld/%ld", &Bursts[nBursts], &Gaps[nBursts]) == 2 &&
+                                                      Bursts[nBursts] > 0)
+            nBursts++;
+        break;
+      default:
+        fprintf(stderr, "Usage: ipcbench [-n lines] [-s sizes] [-i polls] "
+                        "[-b bursts] [-l lines] [-c cpu,cpu]\n");
+        return 2;
+    }
+  }
+
+  if (Lines < 2 || FifoLines < 1 || FifoLines > FIFOSIZE-1)
+  {
+    fprintf(stderr, "need 2 lines or more, -l 1 to %d\n", FIFOSIZE-1);
+    return 2;
+  }
+
+  for (int ii = 0; ii < nSizes; ii++)
+    if (Sizes[ii] < 1 || Sizes[ii] >= (long)sizeof(((DTS_Color*)0)->FiFo[0]))
+      Sizes[ii] = 32;
+
+  printf("FiFo[%d][%d], %d in use, %ld lines a run, times in us\n",
+            FIFOSIZE, (int)sizeof(((DTS_Color*)0)->FiFo[0]), FifoLines,
+                                                                   Lines);
+  printf("%5s %7s %10s %7s %5s | %9s %9s %9s %9s %9s | %7s %7s %7s |"
+         " %6s %6s\n", "size", "poll", "burst/gap", "lines/s", "drop",
+         "wait p50", "p90", "p99", "p99.9", "max", "hist50", "hist90",
+         "hist99", "send50", "p99");
+
+  for (int ss = 0; ss < nSizes; ss++)
+    for (int bb = 0; bb < nBursts; bb++)
+      for (int pp = 0; pp < nPolls; pp++)
+        Run(Lines, (int)Sizes[ss], Polls[pp], (int)Bursts[bb], Gaps[bb],
+                                                              FifoLines);
+  return 0;
+}
+/*********************************************************************/
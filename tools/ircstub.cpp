@@ -0,0 +1,388 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// File:     ircstub.cpp
+// Author:   Scott Swift, dxzl@live.com
+//
+// A stand-in ircd for testing the DLL's direct IRC transport (IrcThread()
+// and friends in Colorize.cpp) - it registers anyone who sends NICK and
+// USER, answers PING, takes JOIN and writes each PRIVMSG to a log with the
+// time it arrived. Nothing is relayed, there's only the one client we're
+// watching (but any number can connect).
+//
+// Build (from tools/):
+//   g++ -O2 -o ircstub ircstub.cpp
+//
+// Run:
+//   ./ircstub [-a addr] [-o log] [-p secs] [-f] [port]
+//     port      to listen on (default 6667)
+//     -a addr   address to listen on (default all of them)
+//     -o log    where the arrivals go (default stdout)
+//     -p secs   PING each client this often, to see it answer
+//     -f        close a client that floods, by the classic ircd rule
+//               (FLOODLINE, FLOODBYTES and FLOODLIMIT in Colorize.h)
+//
+// Then, in XiRCON on the Windows box (or wine), point the DLL at it:
+//   DTS_irc connect <linux-host> 6667 tester
+//   DTS_irc                          (says "ready" once we sent 001)
+// and start a play from YahCoLoRiZe or mIRC (ColorConnect() does the
+// same for them) - a DDE play goes to the server while we're ready.
+// dtsreplay -c <host>:6667 replays a recording to it from Linux.
+//
+// Each PRIVMSG is logged as
+//   <ms since start> <ms since the client's last one> <nick> <target>
+//   <length> :<text>
+// and a client's totals (lines, lines/s, mean and longest gap) go to
+// stderr when it leaves.
+
+#include "../Portable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <signal.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include "../Colorize.h"
+
+#define STUBCLIENTS 16
+#define STUBNAME "ircstub"
+
+typedef struct {
+  int Sock;
+  char Nick[32];
+  bool bUser, bWelcomed;
+  char In[2*IRCLINESIZ];
+  int InLen;
+  double Connected, LastPing;
+  double Clock;      // flood check, the server's clock for this client
+  double First, Last;  // ms its first and last PRIVMSG arrived
+  double MaxGap;
+  long Lines;
+} STUB_Client;
+
+static STUB_Client Clients[STUBCLIENTS];
+static FILE* pLog = stdout;
+static double PingSecs = 0;
+static bool bFlood = false;
+static volatile sig_atomic_t bQuit = 0;
+
+/*********************************************************************/
+static double NowMs(void)
+{
+  static struct timespec Start = {0, 0};
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+
+  if (Start.tv_sec == 0 && Start.tv_nsec == 0)
+    Start = ts;
+
+  return (double)(ts.tv_sec - Start.tv_sec) * 1000.0 +
+                             (double)(ts.tv_nsec - Start.tv_nsec) / 1e6;
+}
+/*********************************************************************/
+static void Reply(STUB_Client* pC, const char* pFmt, const char* pArg)
+// Purpose: Send a line from the server, pFmt has one %s for pArg
+{
+  char Buf[IRCLINESIZ+32];
+  int Len = snprintf(Buf, IRCLINESIZ-2, pFmt, pArg);
+
+  if (Len > IRCLINESIZ-3)
+    Len = IRCLINESIZ-3;
+
+  Buf[Len++] = '\r';
+  Buf[Len++] = '\n';
+  (void)send(pC->Sock, Buf, Len, MSG_NOSIGNAL);
+}
+/*********************************************************************/
+static void Leave(STUB_Client* pC, const char* pWhy)
+{
+  double Span = pC->Last - pC->First;
+
+  fprintf(stderr, "%s left (%s): lines %ld lines/s %.1f gap mean %.1f "
+          "max %.1f ms\n", pC->Nick[0] ? pC->Nick : "?", pWhy, pC->Lines,
+          Span > 0 ? (double)(pC->Lines-1) * 1000.0 / Span : 0.0,
+          pC->Lines > 1 ? Span / (double)(pC->Lines-1) : 0.0, pC->MaxGap);
+
+  fflush(pLog);
+  close(pC->Sock);
+  pC->Sock = -1;
+}
+/*********************************************************************/
+static bool Command(STUB_Client* pC, char* pLine)
+// Purpose: Handle one line from a client
+// Return: false if it's gone
+{
+  double Now = NowMs();
+  char Arg[256];
+
+  // A prefix from a client is ignored
+  if (*pLine == ':')
+  {
+    if ((pLine = strchr(pLine, ' ')) == NULL)
+      return true;
+    while (*pLine == ' ')
+      pLine++;
+  }
+
+  if (bFlood)
+  {
+    // Each line puts the client's clock FLOODLINE ms ahead (and a
+    // second more per FLOODBYTES), too far ahead of ours and it's out
+    if (pC->Clock < Now)
+      pC->Clock = Now;
+
+    pC->Clock += FLOODLINE + 1000.0 * (double)(strlen(pLine)+2) /
+                                                            FLOODBYTES;
+    if (pC->Clock - Now > FLOODLIMIT)
+    {
+      Reply(pC, "ERROR :Closing Link: %s (Excess Flood)", pC->Nick);
+      Leave(pC, "flood");
+      return false;
+    }
+  }
+
+  if (!strncmp(pLine, "NICK ", 5))
+  {
+    if (sscanf(pLine+5, " %31s", Arg) != 1)
+      return true;
+
+    for (int ii = 0; ii < STUBCLIENTS; ii++)
+      if (Clients+ii != pC && Clients[ii].Sock >= 0 &&
+                                          !strcmp(Clients[ii].Nick, Arg))
+      {
+        Reply(pC, ":" STUBNAME " 433 * %s :Nickname is already in use",
+                                                                    Arg);
+        return true;
+      }
+
+    strcpy(pC->Nick, Arg);
+  }
+  else if (!strncmp(pLine, "USER ", 5))
+    pC->bUser = true;
+  else if (!strncmp(pLine, "PING", 4))
+    Reply(pC, ":" STUBNAME " PONG " STUBNAME "%s", pLine+4);
+  else if (!strncmp(pLine, "PONG", 4))
+    fprintf(stderr, "%s PONG after %.1f ms\n", pC->Nick,
+                                                   Now - pC->LastPing);
+  else if (!strncmp(pLine, "JOIN ", 5))
+  {
+    char Buf[300];
+
+    if (sscanf(pLine+5, " %255s", Arg) == 1)
+    {
+      snprintf(Buf, sizeof(Buf), ":%s JOIN %s", pC->Nick, Arg);
+      Reply(pC, "%s", Buf);
+    }
+  }
+  else if (!strncmp(pLine, "PRIVMSG ", 8))
+  {
+    char* pText = strstr(pLine, " :");
+
+    if (sscanf(pLine+8, " %255s", Arg) != 1 || pText == NULL)
+      return true;
+
+    pText += 2;
+
+    double Gap = pC->Lines ? Now - pC->Last : 0.0;
+
+    if (pC->Lines++ == 0)
+      pC->First = Now;
+    else if (Gap > pC->MaxGap)
+      pC->MaxGap = Gap;
+
+    pC->Last = Now;
+
+    fprintf(pLog, "%.3f %.3f %s %s %u :%s\n", Now, Gap, pC->Nick, Arg,
+                                        (UINT)strlen(pText), pText);
+  }
+  else if (!strncmp(pLine, "QUIT", 4))
+  {
+    Leave(pC, "quit");
+    return false;
+  }
+
+  if (!pC->bWelcomed && pC->bUser && pC->Nick[0])
+  {
+    pC->bWelcomed = true;
+    Reply(pC, ":" STUBNAME " 001 %s :Welcome to the stand-in ircd",
+                                                              pC->Nick);
+  }
+
+  return true;
+}
+/*********************************************************************/
+static void Receive(STUB_Client* pC)
+{
+  int Got = recv(pC->Sock, pC->In + pC->InLen,
+                                    sizeof(pC->In)-1 - pC->InLen, 0);
+  if (Got <= 0)
+  {
+    Leave(pC, "closed");
+    return;
+  }
+
+  pC->InLen += Got;
+  pC->In[pC->InLen] = NULLCHAR;
+
+  char* pLine = pC->In;
+  char* pEnd;
+
+  while ((pEnd = strchr(pLine, '\n')) != NULL)
+  {
+    *pEnd = NULLCHAR;
+    if (pEnd > pLine && pEnd[-1] == '\r')
+      pEnd[-1] = NULLCHAR;
+
+    if (!Command(pC, pLine))
+      return;
+
+    pLine = pEnd+1;
+  }
+
+  // Keep a partial line for next time (drop one that's too long)
+  pC->InLen = strlen(pLine);
+  if (pC->InLen >= (int)sizeof(pC->In)-1)
+    pC->InLen = 0;
+  memmove(pC->In, pLine, pC->InLen);
+}
+/*********************************************************************/
+static void OnSignal(int)
+{
+  bQuit = 1;
+}
+/*********************************************************************/
+int main(int argc, char* argv[])
+{
+  struct sockaddr_in Addr;
+  int Port = 6667, opt, One = 1;
+
+  memset(&Addr, 0, sizeof(Addr));
+  Addr.sin_family = AF_INET;
+  Addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+  while ((opt = getopt(argc, argv, "a:o:p:f")) != -1)
+  {
+    switch (opt)
+    {
+      case 'a':
+        if (inet_pton(AF_INET, optarg, &Addr.sin_addr) != 1)
+        {
+          fprintf(stderr, "bad address %s\n", optarg);
+          return 2;
+        }
+        break;
+      case 'o':
+        if ((pLog = fopen(optarg, "w")) == NULL)
+        {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      case 'p': PingSecs = atof(optarg); break;
+      case 'f': bFlood = true; break;
+      default:
+        fprintf(stderr, "Usage: ircstub [-a addr] [-o log] [-p secs] [-f] "
+                                                              "[port]\n");
+        return 2;
+    }
+  }
+
+  if (optind < argc)
+    Port = atoi(argv[optind]);
+
+  Addr.sin_port = htons((unsigned short)Port);
+
+  int Listen = socket(AF_INET, SOCK_STREAM, 0);
+
+  (void)setsockopt(Listen, SOL_SOCKET, SO_REUSEADDR, &One, sizeof(One));
+
+  if (Listen < 0 || bind(Listen, (sockaddr*)&Addr, sizeof(Addr)) != 0 ||
+                                                listen(Listen, 4) != 0)
+  {
+    perror("ircstub");
+    return 1;
+  }
+
+  signal(SIGINT, OnSignal);
+  signal(SIGTERM, OnSignal);
+
+  for (int ii = 0; ii < STUBCLIENTS; ii++)
+    Clients[ii].Sock = -1;
+
+  (void)NowMs();
+  fprintf(stderr, "listening on port %d\n", Port);
+
+  while (!bQuit)
+  {
+    struct pollfd Fds[STUBCLIENTS+1];
+    int Map[STUBCLIENTS+1], n = 0;
+
+    Fds[n].fd = Listen;
+    Fds[n++].events = POLLIN;
+
+    for (int ii = 0; ii < STUBCLIENTS; ii++)
+      if (Clients[ii].Sock >= 0)
+      {
+        Map[n] = ii;
+        Fds[n].fd = Clients[ii].Sock;
+        Fds[n++].events = POLLIN;
+      }
+
+    if (poll(Fds, n, 100) < 0)
+      continue;
+
+    double Now = NowMs();
+
+    if (Fds[0].revents & POLLIN)
+    {
+      int Sock = accept(Listen, NULL, NULL);
+      int ii;
+
+      for (ii = 0; ii < STUBCLIENTS && Clients[ii].Sock >= 0; ii++)
+        ;
+
+      if (Sock >= 0 && ii == STUBCLIENTS)
+        close(Sock);
+      else if (Sock >= 0)
+      {
+        memset(&Clients[ii], 0, sizeof(Clients[ii]));
+        Clients[ii].Sock = Sock;
+        Clients[ii].Connected = Clients[ii].LastPing = Now;
+      }
+    }
+
+    for (int jj = 1; jj < n; jj++)
+    {
+      STUB_Client* pC = &Clients[Map[jj]];
+
+      if (Fds[jj].revents & (POLLIN | POLLHUP | POLLERR))
+        Receive(pC);
+
+      if (pC->Sock >= 0 && pC->bWelcomed && PingSecs > 0 &&
+                                    Now - pC->LastPing >= PingSecs * 1000)
+      {
+        pC->LastPing = Now;
+        Reply(pC, "PING :%s", STUBNAME);
+      }
+    }
+
+    fflush(pLog);
+  }
+
+  for (int ii = 0; ii < STUBCLIENTS; ii++)
+    if (Clients[ii].Sock >= 0)
+      Leave(&Clients[ii], "shutdown");
+
+  close(Listen);
+
+  if (pLog != stdout)
+    fclose(pLog);
+
+  return 0;
+}
+/*********************************************************************/
@@ -0,0 +1,245 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// File:     pacetest.cpp
+// Author:   Scott Swift, dxzl@live.com
+//
+// Runs PaceStep() (Pace.cpp) against a simulated server whose lag grows
+// with the send rate. Each line costs the server Cost ms of work, a PING
+// waits behind the lines it hasn't got to, so the round-trip is Base ms
+// plus the backlog - sending faster than 1000/Cost lines a second piles
+// it up. The client PINGs every PINGEVERY ms and reports each PONG the
+// way a script's DTS_lag does, the timer ticks the way PaceTimer() and
+// OnTimer1() do (look at the lag, then send a line).
+//
+// Build and run (from tools/):
+//   g++ -O2 -o pacetest pacetest.cpp ../Pace.cpp
+//   ./pacetest
+//
+// Prints each run and exits 1 if any check fails.
+
+#include "../Portable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../Colorize.h"
+#include "../Pace.h"
+
+#define PINGEVERY 1000.0 // ms
+#define MAXSAMPLES 100000
+
+DTS_Color Shared;
+DTS_Color* pDTS_Color = &Shared;
+
+typedef struct {
+  double Interval;   // mean send interval (ms)
+  double Rate;       // lines/s
+  double LagMean;    // of the reports after the warm-up
+  double LagP95;
+  double LagMax;
+  int MinTime, MaxTime; // send interval's range over the whole run
+} SIM_Result;
+
+static int Failed = 0;
+
+/*********************************************************************/
+static int CompareD(const void* a, const void* b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+
+  return x < y ? -1 : x > y;
+}
+/*********************************************************************/
+static void Simulate(double Base, double Cost, double Cost2,
+                     double Switch, double Length, double WarmUp,
+                     int Start, SIM_Result* pRes)
+// Purpose: Play for Length ms from a send interval of Start
+// Args: Cost ms per line, Cost2 from Switch ms on (the server getting
+//       busier), reports before WarmUp ms aren't counted
+{
+  static double Lags[MAXSAMPLES];
+  double Now = 0, ServerFree = 0;
+  double PingAt = 0, PongAt = -1, NextPing = 0;
+  double Sum = 0, CountedFrom = -1;
+  long Lines = 0, LinesCounted = 0;
+  int nLags = 0;
+  LONG lLagSeen = 0;
+  int PaceTime = Start;
+
+  pRes->MinTime = pRes->MaxTime = PaceTime;
+  pDTS_Color->Lag = 0;
+  pDTS_Color->LagSamples = 0;
+
+  while (Now < Length)
+  {
+    double LineCost = Now >= Switch ? Cost2 : Cost;
+
+    // PINGs and PONGs up to this tick
+    for (;;)
+    {
+      if (PongAt < 0 && NextPing <= Now)
+      {
+        // It waits behind the lines the server has yet to do
+        PingAt = NextPing;
+        PongAt = PingAt + Base + (ServerFree > PingAt ?
+                                               ServerFree - PingAt : 0);
+      }
+      else if (PongAt >= 0 && PongAt <= Now)
+      {
+        // The script's DTS_lag
+        pDTS_Color->Lag = (LONG)(PongAt - PingAt);
+        pDTS_Color->LagSamples++;
+
+        if (PongAt >= WarmUp && nLags < MAXSAMPLES)
+          Lags[nLags++] = (double)pDTS_Color->Lag;
+
+        NextPing = PongAt + PINGEVERY;
+        PongAt = -1;
+      }
+      else
+        break;
+    }
+
+    // PaceTimer()
+    if (pDTS_Color->LagSamples != lLagSeen)
+    {
+      lLagSeen = pDTS_Color->LagSamples;
+      PaceTime = PaceStep(PaceTime, pDTS_Color->Lag);
+    }
+
+    if (PaceTime < pRes->MinTime)
+      pRes->MinTime = PaceTime;
+    if (PaceTime > pRes->MaxTime)
+      pRes->MaxTime = PaceTime;
+
+    // Send a line
+    ServerFree = (ServerFree > Now ? ServerFree : Now) + LineCost;
+    Lines++;
+
+    if (Now >= WarmUp)
+    {
+      if (CountedFrom < 0)
+        CountedFrom = Now;
+      LinesCounted++;
+    }
+
+    Now += PaceTime;
+  }
+
+  double Span = Now - CountedFrom;
+
+  pRes->Interval = LinesCounted ? Span / (double)LinesCounted : 0;
+  pRes->Rate = Span > 0 ? (double)LinesCounted * 1000.0 / Span : 0;
+
+  for (int ii = 0; ii < nLags; ii++)
+    Sum += Lags[ii];
+
+  qsort(Lags, nLags, sizeof(double), CompareD);
+
+  pRes->LagMean = nLags ? Sum / nLags : 0;
+  pRes->LagP95 = nLags ? Lags[(nLags * 95 + 99) / 100 - 1] : 0;
+  pRes->LagMax = nLags ? Lags[nLags-1] : 0;
+}
+/*********************************************************************/
+static void Show(const char* pName, SIM_Result* pRes)
+{
+  printf("  %-26s interval %7.1f (%d-%d) lines/s %5.2f lag mean %7.1f "
+         "p95 %7.1f max %7.1f\n", pName, pRes->Interval, pRes->MinTime,
+         pRes->MaxTime, pRes->Rate, pRes->LagMean, pRes->LagP95,
+                                                          pRes->LagMax);
+}
+/*********************************************************************/
+static void Check(bool bOk, const char* pWhat)
+{
+  printf("%s %s\n", bOk ? "PASS" : "FAIL", pWhat);
+
+  if (!bOk)
+    Failed++;
+}
+/*********************************************************************/
+static void Defaults(void)
+{
+  CONFIG(CFG_LAGTARGET) = LAGTARGET;
+  CONFIG(CFG_PACEMIN) = PACEMIN;
+  CONFIG(CFG_PACEMAX) = PACEMAX;
+  CONFIG(CFG_PACESTEP) = PACESTEP;
+  CONFIG(CFG_PACEBACKOFF) = PACEBACKOFF;
+}
+/*********************************************************************/
+int main(void)
+{
+  SIM_Result Res;
+  const double Base = 150, Cost = 500; // a 2 lines/s server
+  const double Minute = 60000;
+  char Name[64];
+
+  Defaults();
+
+  // The server: with no pacing, the faster we send the more lag
+  printf("Fixed interval, %.0f ms a line (no pacing):\n", Cost);
+  CONFIG(CFG_LAGTARGET) = 0;
+
+  static const int Fixed[] = {1000, 625, 550, 450, 250};
+  double LastLag = 0;
+  bool bGrows = true;
+
+  for (int ii = 0; ii < (int)(sizeof(Fixed)/sizeof(Fixed[0])); ii++)
+  {
+    Simulate(Base, Cost, Cost, 1e12, 2*Minute, Minute, Fixed[ii], &Res);
+    sprintf(Name, "send every %d ms", Fixed[ii]);
+    Show(Name, &Res);
+
+    if (Res.LagMean < LastLag || Res.MinTime != Fixed[ii] ||
+                                               Res.MaxTime != Fixed[ii])
+      bGrows = false;
+    LastLag = Res.LagMean;
+  }
+
+  Check(bGrows, "lag grows with the send rate, PaceStep() leaves the "
+                                                    "interval alone at 0");
+  Check(LastLag > 10 * LAGTARGET, "over capacity the lag runs away");
+
+  Defaults();
+
+  // Start flat out, it has to back off to about the server's rate
+  printf("Paced from %d ms, target %d ms:\n", PACEMIN, LAGTARGET);
+  Simulate(Base, Cost, Cost, 1e12, 20*Minute, 5*Minute, PACEMIN, &Res);
+  Show("2 lines/s server", &Res);
+
+  // Reports lag a round-trip behind, so it overshoots each time it
+  // finds the server's rate - but it doesn't run away
+  Check(Res.LagMean <= LAGTARGET, "mean lag under the target");
+  Check(Res.LagP95 <= 4 * LAGTARGET && Res.LagMax <= 8 * LAGTARGET,
+                                       "the overshoots stay bounded");
+  Check(Res.Rate >= 0.7 * 1000 / Cost, "at least 70% of what the server "
+                                                           "can take");
+  Check(Res.MinTime >= PACEMIN && Res.MaxTime <= PACEMAX,
+                                      "interval within its bounds");
+
+  // The server gets busier half way, we have to slow down with it (and
+  // speed up again PACESTEP ms a report, slow from a long interval)
+  Simulate(Base, 300, 1200, 10*Minute, 20*Minute, 15*Minute, PACEMIN,
+                                                                   &Res);
+  Show("300 then 1200 ms a line", &Res);
+
+  Check(Res.LagMean <= LAGTARGET && Res.Interval >= 1200,
+                                   "slowed down for a busier server");
+
+  // A fast server, nothing holds us back from PACEMIN
+  Simulate(Base, 100, 100, 1e12, 5*Minute, Minute, 2000, &Res);
+  Show("10 lines/s server", &Res);
+
+  Check(Res.Interval < PACEMIN + 1 && Res.LagMax <= Base + 100,
+                         "a fast server gets PACEMIN with no lag to speak of");
+
+  // A tight PACEMAX caps the back-off
+  CONFIG(CFG_PACEMAX) = 400;
+  Simulate(Base, Cost, Cost, 1e12, 5*Minute, Minute, PACEMIN, &Res);
+  Show("PACEMAX 400", &Res);
+
+  Check(Res.MaxTime == 400, "never slower than CFG_PACEMAX");
+
+  printf("%s\n", Failed ? "FAILED" : "all passed");
+  return Failed ? 1 : 0;
+}
+/*********************************************************************/
@@ -0,0 +1,265 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// File:     renderbench.cpp
+// Author:   Scott Swift, dxzl@live.com
+//
+// Times RenderText()'s one fused pass (Render.cpp) against the passes the
+// formatter made before it (RenderMulti() in RenderRef.cpp - strip
+// in-place, malloc and escape, PIRCH's shift right and back) on the same
+// lines, for each dialect stripped or not, and checks the two give every
+// line the same. Each line is copied into a slot first either way, the
+// way the formatter gets it. DDE is timed as PIRCH (the shifts for the
+// old passes, the one store in front of the line for RenderText()).
+//
+// Build and run (from tools/):
+//   g++ -O2 -o renderbench renderbench.cpp RenderRef.cpp ../Render.cpp
+//   ./renderbench [-n lines] [-l length] [-r runs] [-u] [file]
+//
+// With no file it makes -n (default 100000) colorized lines of about -l
+// (default 180) chars - colors, bold, quotes, backslashes and $<digit>
+// - the same every run. A file's lines are used as they are. -u renders
+// for CP_UTF8. Prints ns per line, best of -r (default 5) runs. For the
+// exhaustive check (2M random lines, text and image, every code-page)
+// see striptest. Exits 1 if any line differs.
+
+#include "../Portable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "../Colorize.h"
+#include "../Render.h"
+#include "RenderRef.h"
+
+DTS_Color Shared;
+DTS_Color* pDTS_Color = &Shared;
+
+static char** ppLines;
+static long nLines;
+static volatile DWORD dwSink; // so nothing's optimized away
+
+/*********************************************************************/
+static double NowNs(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+/*********************************************************************/
+static void MakeLines(long Count, int Length)
+// Purpose: Count chat lines of about Length chars, colorized the way
+//          YahCoLoRiZe does it
+{
+  static const char* Words[] = {
+    "hello", "the", "channel", "say", "\"hi\"", "C:\\path", "$5", "$$1",
+    "tonight", "lol", "colors", "look", "great", "anyone", "around"
+  };
+  unsigned Seed = 50;
+  char Line[GLOBALSTRINGSIZ];
+
+  ppLines = (char**)malloc(Count * sizeof(char*));
+
+  for (nLines = 0; nLines < Count; nLines++)
+  {
+    int n = 0;
+
+    while (n < Length)
+    {
+      Seed = Seed * 1103515245 + 12345;
+      unsigned r = Seed >> 16;
+
+      if (r % 3 == 0)
+        n += sprintf(Line+n, "%c%d,%d", CTRL_K, r % 16, (r >> 4) % 16);
+      else if (r % 17 == 0)
+        Line[n++] = CTRL_B;
+
+      n += sprintf(Line+n, "%s ", Words[(r >> 6) %
+                                          (sizeof(Words)/sizeof(Words[0]))]);
+    }
+
+    // EndLine()'s CTRL_K after a trailing space
+    Line[n++] = CTRL_K;
+    Line[n] = NULLCHAR;
+    ppLines[nLines] = strdup(Line);
+  }
+}
+/*********************************************************************/
+static bool ReadLines(const char* pName)
+{
+  FILE* f = fopen(pName, "rb");
+  char Line[GLOBALSTRINGSIZ];
+  long Room = 1024;
+
+  if (f == NULL)
+    return false;
+
+  ppLines = (char**)malloc(Room * sizeof(char*));
+  nLines = 0;
+
+  while (fgets(Line, sizeof(Line), f) != NULL)
+  {
+    Line[strcspn(Line, "\r\n")] = NULLCHAR;
+
+    if (nLines == Room)
+      ppLines = (char**)realloc(ppLines, (Room *= 2) * sizeof(char*));
+
+    ppLines[nLines++] = strdup(Line);
+  }
+
+  fclose(f);
+  return nLines > 0;
+}
+/*********************************************************************/
+static double TimeMulti(int Dialect, bool bStrip)
+// Return: ns a line
+{
+  static char Slot[GLOBALSTRINGSIZ+4];
+  bool bPirch = Dialect == DTSP_DDE;
+  double t0 = NowNs();
+
+  for (long ii = 0; ii < nLines; ii++)
+  {
+    strcpy(Slot, ppLines[ii]);
+
+    char* tString = RenderMulti(Slot, Dialect, bStrip, bPirch,
+                                                         Shared.CodePage);
+    dwSink += (BYTE)tString[0];
+    free(tString);
+  }
+
+  return (NowNs() - t0) / nLines;
+}
+/*********************************************************************/
+static double TimeFused(int Dialect, bool bStrip)
+{
+  static char Slot[GLOBALSTRINGSIZ+4];
+  static char Buf[RENDERSIZ];
+  double t0 = NowNs();
+
+  for (long ii = 0; ii < nLines; ii++)
+  {
+    strcpy(Slot, ppLines[ii]);
+
+    char* tString = RenderText(Slot, strlen(Slot), false, Buf, Dialect,
+                                                                 bStrip);
+    if (Dialect == DTSP_DDE)
+      tString[-1] = CTRL_K; // PIRCH's leading CTRL_K
+
+    dwSink += (BYTE)tString[0];
+  }
+
+  return (NowNs() - t0) / nLines;
+}
+/*********************************************************************/
+static long Compare(int Dialect, bool bStrip)
+// Return: lines the two render differently
+{
+  static char Slot[GLOBALSTRINGSIZ+4];
+  static char Buf[RENDERSIZ];
+  long Bad = 0;
+
+  for (long ii = 0; ii < nLines; ii++)
+  {
+    strcpy(Slot, ppLines[ii]);
+    char* pFused = RenderText(Slot, strlen(Slot), false, Buf, Dialect,
+                                                                  bStrip);
+    strcpy(Slot, ppLines[ii]);
+    char* pMulti = RenderMulti(Slot, Dialect, bStrip, false,
+                                                         Shared.CodePage);
+
+    if (pMulti == NULL || strcmp(pFused, pMulti))
+      Bad++;
+
+    free(pMulti);
+  }
+
+  return Bad;
+}
+/*********************************************************************/
+int main(int argc, char** argv)
+{
+  static const char* Names[] = {"Tcl", "DDE", "IRC"};
+  long Count = 100000;
+  int Length = 180, Runs = 5, c;
+  long Bad = 0;
+
+  Shared.CodePage = CP_ACP;
+
+  while ((c = getopt(argc, argv, "n:l:r:u")) != -1)
+  {
+    switch (c)
+    {
+      case 'n': Count = atol(optarg); break;
+      case 'l': Length = atoi(optarg); break;
+      case 'r': Runs = atoi(optarg); break;
+      case 'u': Shared.CodePage = CP_UTF8; break;
+      default:
+        fprintf(stderr, "usage: renderbench [-n lines] [-l length] "
+                                              "[-r runs] [-u] [file]\n");
+        return 2;
+    }
+  }
+
+  if (Count < 1 || Runs < 1 || Length < 1 ||
+                                  Length > GLOBALSTRINGSIZ/2 - 16)
+  {
+    fprintf(stderr, "renderbench: bad -n, -l or -r\n");
+    return 2;
+  }
+
+  if (optind < argc)
+  {
+    if (!ReadLines(argv[optind]))
+    {
+      fprintf(stderr, "renderbench: can't read %s\n", argv[optind]);
+      return 2;
+    }
+  }
+  else
+    MakeLines(Count, Length);
+
+  long Chars = 0;
+
+  for (long ii = 0; ii < nLines; ii++)
+    Chars += strlen(ppLines[ii]);
+
+  printf("%ld lines, %.0f chars a line, ns a line (best of %d):\n",
+                                    nLines, (double)Chars / nLines, Runs);
+  printf("  dialect  no strip             strip\n");
+
+  for (int Dialect = DTSP_TCL; Dialect <= DIALECT_IRC; Dialect++)
+  {
+    double Multi[2], Fused[2];
+
+    for (int s = 0; s < 2; s++)
+    {
+      Bad += Compare(Dialect, s != 0);
+
+      for (int ii = 0; ii < Runs; ii++)
+      {
+        double m = TimeMulti(Dialect, s != 0);
+        double f = TimeFused(Dialect, s != 0);
+
+        if (ii == 0 || m < Multi[s])
+          Multi[s] = m;
+        if (ii == 0 || f < Fused[s])
+          Fused[s] = f;
+      }
+    }
+
+    printf("  %-7s  %5.0f -> %-5.0f (%4.1fx)  %5.0f -> %-5.0f (%4.1fx)\n",
+           Names[Dialect], Multi[0], Fused[0], Multi[0] / Fused[0],
+                           Multi[1], Fused[1], Multi[1] / Fused[1]);
+  }
+
+  if (Bad)
+    printf("FAIL %ld renders differ\n", Bad);
+  else
+    printf("every line renders the same both ways\n");
+
+  return Bad ? 1 : 0;
+}
+/*********************************************************************/
@@ -0,0 +1,178 @@
+// Copyright 2015 Scott Swift - This program is distributed under the
+// terms of the GNU General Public License.
+
+// File:     striptest.cpp
+// Author:   Scott Swift, dxzl@live.com
+//
+// Checks RenderText() (Render.cpp) byte for byte against the scalar
+// reference in RenderRef.cpp - for every dialect, stripped or not, in
+// the ANSI and UTF-8 code-pages, for each line played as text and
+// played from a pre-formatted image (escaped for the client when it was
+// built, the way ChunkFillThread() stores it).
+//
+// Build and run (from tools/):
+//   g++ -O2 -o striptest striptest.cpp RenderRef.cpp ../Render.cpp
+//   ./striptest [lines] [seed]
+//
+// Prints the first few lines that differ and exits 1 if any do.
+
+#include "../Portable.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../Colorize.h"
+#include "../Render.h"
+#include "RenderRef.h"
+
+DTS_Color Shared;
+DTS_Color* pDTS_Color = &Shared;
+
+// Lines anyone would get wrong first
+static const char* Edges[] = {
+  "$\x02" "5",             // stripping makes a "$5" for mIRC
+  "$\x03" "4,5" "6",       // the color takes the 4,5 not the 6
+  "$\x03" "12,05" "7 ",
+  "\x03" "4,x",            // a comma with no digit is text
+  "\x03" "123",            // two digits of color, then text
+  "\x02\x03\x0f\x16\x1d\x1f", // nothing left but the codes
+  "say \"hi\" \\ $1 \x03",
+  "trailing \x03",         // EndLine()'s CTRL_K after a space
+  "caf\xc3\xa9 \x03",       // UTF-8, padded in UTF-8
+  "caf\xe9 \x03",           // ANSI, padded in ANSI
+  "\\\x02\"",
+  "$$1 $\x1f" "2 $\x03" "3,4" "5",
+  ""
+};
+
+/*********************************************************************/
+static UINT RandomLine(char* pStr)
+// Purpose: A line mostly of the chars that matter to stripping and
+//          escaping, sometimes ended the way EndLine() ends one
+{
+  static const char Mix[] = "$$$0123456789,,\"\\  abc\x02\x03\x03\x03"
+                                                  "\x0f\x16\x1d\x1f";
+  UINT length = rand() % 64;
+
+  if (rand() % 50 == 0)
+    length += rand() % 1500;
+
+  for (UINT ii = 0; ii < length; ii++)
+  {
+    int r = rand() % 20;
+
+    if (r == 0) // a UTF-8 char
+    {
+      pStr[ii++] = (char)0xc3;
+      pStr[ii] = (char)(0xa0 + rand() % 16);
+    }
+    else if (r == 1) // an ANSI one
+      pStr[ii] = (char)(0xa0 + rand() % 96);
+    else
+      pStr[ii] = Mix[rand() % (sizeof(Mix)-1)];
+  }
+
+  if (length && rand() % 4 == 0)
+  {
+    pStr[length++] = ' ';
+    pStr[length++] = CTRL_K;
+  }
+
+  pStr[length] = NULLCHAR;
+  return length;
+}
+/*********************************************************************/
+static void Show(const char* pTag, const char* pStr)
+{
+  printf("  %-6s \"", pTag);
+
+  for (; *pStr; pStr++)
+    if ((unsigned char)*pStr < 0x20 || (unsigned char)*pStr >= 0x7f)
+      printf("\\x%02x", (unsigned char)*pStr);
+    else
+      putchar(*pStr);
+
+  printf("\"\n");
+}
+/*********************************************************************/
+static long CheckLine(char* pLine, UINT length)
+// Return: how many of the ways it can be played came out wrong
+{
+  static const char* Names[] = {"tcl", "dde", "irc"};
+  static const UINT CodePages[] = {CP_ACP, CP_UTF8};
+  static long Shown = 0;
+  char Work[GLOBALSTRINGSIZ+4];
+  char Ref[RENDERSIZ];
+  char Got[RENDERSIZ];
+  long Bad = 0;
+
+  for (int cp = 0; cp < 2; cp++)
+  for (int Dialect = DTSP_TCL; Dialect <= DIALECT_IRC; Dialect++)
+  for (int s = 0; s < 2; s++)
+  for (int bImage = 0; bImage < 2; bImage++)
+  {
+    bool bStrip = s != 0;
+    UINT len = length;
+
+    Shared.CodePage = CodePages[cp];
+
+    (void)RenderRef(pLine, length, Ref, Dialect, bStrip, Shared.CodePage);
+
+    if (!bImage)
+      memcpy(Work, pLine, length+1);
+    else
+    {
+      // The image keeps a blank line as "\r\n", and the server gets
+      // the XiRCON payload unescaped
+      if (length == 0)
+        len = sprintf(Work, "\r\n");
+      else
+        len = EscapeString(pLine, length, Work,
+                             Dialect == DIALECT_IRC ? DTSP_TCL : Dialect);
+    }
+
+    char* pGot = RenderText(Work, len, bImage != 0, Got, Dialect, bStrip);
+
+    if (strcmp(pGot, Ref))
+    {
+      if (Shown++ < 10)
+      {
+        printf("%s %s%s cp %u:\n", Names[Dialect], bImage ? "image" : "text",
+                           bStrip ? " stripped" : "", Shared.CodePage);
+        Show("line", pLine);
+        Show("want", Ref);
+        Show("got", pGot);
+      }
+
+      Bad++;
+    }
+  }
+
+  return Bad;
+}
+/*********************************************************************/
+int main(int argc, char* argv[])
+{
+  long Lines = argc > 1 ? atol(argv[1]) : 200000;
+  char Line[GLOBALSTRINGSIZ+4];
+  long Bad = 0;
+  UINT ii;
+
+  srand(argc > 2 ? atoi(argv[2]) : 1);
+
+  for (ii = 0; ii < sizeof(Edges)/sizeof(Edges[0]); ii++)
+  {
+    strcpy(Line, Edges[ii]);
+    Bad += CheckLine(Line, strlen(Line));
+  }
+
+  for (long nn = 0; nn < Lines; nn++)
+  {
+    UINT length = RandomLine(Line);
+    Bad += CheckLine(Line, length);
+  }
+
+  printf("%ld lines, %ld renders differ\n",
+                        Lines + (long)(sizeof(Edges)/sizeof(Edges[0])), Bad);
+  return Bad ? 1 : 0;
+}
+/*********************************************************************/